@@ -10,12 +10,16 @@
  * @brief BS::thread_pool: a fast, lightweight, and easy-to-use C++17 thread pool library. This header file contains the main thread pool class and some additional classes and definitions. No other files are needed in order to use the thread pool itself.
  */
 
+#include <algorithm>          // std::min
+#include <atomic>             // std::atomic
 #include <chrono>             // std::chrono
 #include <condition_variable> // std::condition_variable
 #include <cstddef>            // std::size_t
+#include <array>              // std::array
 #include <cstdint>            // std::int_least16_t
 #include <exception>          // std::current_exception
 #include <functional>         // std::function
+#include <iterator>           // std::begin, std::end, std::distance
 #include <future>             // std::future, std::future_status, std::promise
 #include <memory>             // std::make_shared, std::make_unique, std::shared_ptr, std::unique_ptr
 #include <mutex>              // std::mutex, std::scoped_lock, std::unique_lock
@@ -27,6 +31,10 @@
 #include <utility>            // std::forward, std::move
 #include <vector>             // std::vector
 
+#ifdef BS_THREAD_POOL_ENABLE_TRACE
+#include "trace.hpp" // TRACE_SCOPE, TRACE_THREAD_NAME: the particle simulation's trace export
+#endif
+
 /**
  * @brief A namespace used by Barak Shoshany's projects.
  */
@@ -71,6 +79,39 @@ namespace pr {
 #else
 #define BS_THREAD_POOL_PRIORITY_INPUT
 #define BS_THREAD_POOL_PRIORITY_OUTPUT
+
+/**
+ * @brief The lanes of the task queue. Each lane is first-in, first-out; which lane a worker takes its next task from is decided by the pool's `drain_policy`. Tasks submitted without a lane go to `lane::frame`. Not available if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+ */
+enum class lane
+{
+    realtime,  // latency-critical work that must never wait behind a frame's jobs, e.g. input or audio
+    frame,     // the current frame's jobs, e.g. the physics step
+    background // work with no deadline, e.g. snapshots, statistics, spawning ahead; can be deferred by a frame deadline
+};
+
+/**
+ * @brief The number of lanes in the task queue.
+ */
+inline constexpr size_t lane_count = 3;
+
+/**
+ * @brief How the workers choose between lanes that have tasks waiting.
+ */
+enum class drain_policy
+{
+    strict,  // always the highest lane with a task: background tasks only start when no realtime or frame task is waiting
+    weighted // each lane in proportion to its weight, so a busy higher lane cannot starve a lower one
+};
+#endif
+
+#ifdef BS_THREAD_POOL_ENABLE_TRACE
+// Macro used internally to record each task a worker runs as a "pool task" event on that worker's timeline.
+#define BS_THREAD_POOL_TRACE_TASK(idx) \
+    TRACE_THREAD_NAME("worker", static_cast<int>(idx)); \
+    TRACE_SCOPE("pool task")
+#else
+#define BS_THREAD_POOL_TRACE_TASK(idx)
 #endif
 
 /**
@@ -148,6 +189,92 @@ namespace this_thread {
     inline thread_local thread_info_pool get_pool;
 } // namespace this_thread
 
+/**
+ * @brief A token that tasks check to see whether the work they belong to has been cancelled, through the `stop_source` it came from or the `multi_future` holding their futures. Plays the part of C++20's `std::stop_token` without needing C++20 or `std::jthread`. Tokens are cheap to copy; a default-constructed token is never stopped.
+ */
+class stop_token
+{
+public:
+    stop_token() = default;
+
+    /**
+     * @brief Check if stop has been requested.
+     *
+     * @return `true` if stop has been requested, `false` otherwise, including for a default-constructed token.
+     */
+    [[nodiscard]] bool stop_requested() const
+    {
+        return flag && flag->load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Check if stop can ever be requested for this token.
+     *
+     * @return `false` for a default-constructed token, `true` otherwise.
+     */
+    [[nodiscard]] bool stop_possible() const
+    {
+        return flag != nullptr;
+    }
+
+private:
+    friend class stop_source;
+    template <typename T>
+    friend class multi_future;
+
+    explicit stop_token(std::shared_ptr<const std::atomic<bool>> stop_flag) : flag(std::move(stop_flag)) {}
+
+    std::shared_ptr<const std::atomic<bool>> flag = nullptr;
+}; // class stop_token
+
+/**
+ * @brief The requesting side of a `stop_token`. Every source owns its own flag; the tokens it hands out all see the same flag and keep it alive.
+ */
+class stop_source
+{
+public:
+    /**
+     * @brief Get a token that sees stop requests made through this source.
+     *
+     * @return The token.
+     */
+    [[nodiscard]] stop_token get_token() const
+    {
+        return stop_token(flag);
+    }
+
+    /**
+     * @brief Request stop. Tasks that check a token of this source before they start are skipped; tasks that are already running only stop if they check the token themselves.
+     *
+     * @return `true` if this call requested stop, `false` if it had already been requested.
+     */
+    bool request_stop()
+    {
+        return !flag->exchange(true, std::memory_order_acq_rel);
+    }
+
+    /**
+     * @brief Check if stop has been requested.
+     *
+     * @return `true` if stop has been requested, `false` otherwise.
+     */
+    [[nodiscard]] bool stop_requested() const
+    {
+        return flag->load(std::memory_order_acquire);
+    }
+
+private:
+    std::shared_ptr<std::atomic<bool>> flag = std::make_shared<std::atomic<bool>>(false);
+}; // class stop_source
+
+/**
+ * @brief The exception a future holds when its task was skipped because its work was cancelled, via `multi_future::cancel()` or a `stop_token` passed to `submit_loop()`.
+ */
+struct task_cancelled : public std::runtime_error
+{
+    task_cancelled() : std::runtime_error("BS::task_cancelled"){};
+};
+
 /**
  * @brief A helper class to facilitate waiting for and/or getting the results of multiple futures at once.
  *
@@ -269,8 +396,253 @@ public:
         }
         return true;
     }
+
+    /**
+     * @brief Cancel the tasks behind the futures, if they came from `submit_blocks()`, `submit_loop()`, or `submit_sequence()`. Tasks that have not started yet are skipped, and their futures hold a `task_cancelled` exception; tasks that are already running finish normally, unless they check `get_stop_token()` themselves. Returns immediately; use `wait()` to wait for the running tasks.
+     *
+     * @return `true` if this call cancelled the tasks, `false` if they had already been cancelled or the futures did not come from the pool's block functions.
+     */
+    bool cancel()
+    {
+        return group && !group->stop.exchange(true, std::memory_order_acq_rel);
+    }
+
+    /**
+     * @brief Get a token that sees `cancel()`, for long tasks that want to stop part way through, or for other work that should stop along with these tasks.
+     *
+     * @return The token. Never stopped if the futures did not come from the pool's block functions.
+     */
+    [[nodiscard]] stop_token get_stop_token() const
+    {
+        if (!group)
+            return {};
+        return stop_token(std::shared_ptr<const std::atomic<bool>>(group, &group->stop));
+    }
+
+    /**
+     * @brief Wait until at least one of the futures stored in this `multi_future` is ready. Every future must be valid. For futures from `submit_blocks()`, `submit_loop()`, or `submit_sequence()`, the waiting thread is woken as each task finishes; for futures added by hand, the futures are polled at growing intervals of up to a millisecond.
+     *
+     * @return The index of the first ready future, or 0 if there are no futures.
+     */
+    size_t wait_any() const
+    {
+        if (this->empty())
+            return 0;
+        constexpr std::chrono::microseconds max_pause(1000);
+        std::chrono::microseconds pause(1);
+        while (true)
+        {
+            size_t seen = 0;
+            if (group)
+            {
+                const std::scoped_lock lock(group->mutex);
+                seen = group->done;
+            }
+            for (size_t i = 0; i < this->size(); ++i)
+            {
+                if ((*this)[i].wait_for(std::chrono::duration<double>::zero()) == std::future_status::ready)
+                    return i;
+            }
+            if (group)
+            {
+                std::unique_lock lock(group->mutex);
+                group->done_cv.wait_for(lock, pause,
+                    [this, seen]
+                    {
+                        return group->done != seen;
+                    });
+            }
+            else
+            {
+                this->front().wait_for(pause);
+            }
+            pause = std::min(pause * 2, max_pause);
+        }
+    }
+
+private:
+    friend class thread_pool;
+
+    /**
+     * @brief What the tasks of one `submit_blocks()`, `submit_loop()`, or `submit_sequence()` call share with the `multi_future` holding their futures: the flag `cancel()` sets, and a count of finished tasks that `wait_any()` sleeps on.
+     */
+    struct group_type
+    {
+        std::atomic<bool> stop = false;
+        std::mutex mutex = {};
+        std::condition_variable done_cv = {};
+        size_t done = 0;
+
+        /**
+         * @brief Called by each task of the group after its future has been made ready.
+         */
+        void finish()
+        {
+            {
+                const std::scoped_lock lock(mutex);
+                ++done;
+            }
+            done_cv.notify_all();
+        }
+    };
+
+    std::shared_ptr<group_type> group = nullptr;
 }; // class multi_future
 
+/**
+ * @brief A completion handle for the tasks of one `detach_batch()` call. Waiting on it waits for those tasks only, unlike `thread_pool::wait()`, which also waits for any unrelated work in the pool. Handles are cheap to copy and share the same batch; a default-constructed handle refers to an empty batch that is always done. The tasks do not depend on the handle, so it can be discarded at any time.
+ */
+class batch
+{
+public:
+    batch() = default;
+
+    /**
+     * @brief Check if every task in the batch has finished.
+     *
+     * @return `true` if all tasks have finished, `false` otherwise.
+     */
+    [[nodiscard]] bool done() const
+    {
+        return !state || state->remaining.load(std::memory_order_acquire) == 0;
+    }
+
+    /**
+     * @brief Get the number of tasks in the batch that have not finished yet, including those that are running.
+     *
+     * @return The number of unfinished tasks.
+     */
+    [[nodiscard]] size_t get_tasks_remaining() const
+    {
+        return state ? state->remaining.load(std::memory_order_acquire) : 0;
+    }
+
+    /**
+     * @brief Wait for every task in the batch to finish. Must not be called from a task of the same pool unless the batch is known to be done, since the batch's tasks may be queued behind the caller.
+     */
+    void wait() const
+    {
+        if (done())
+            return;
+        std::unique_lock lock(state->mutex);
+        state->done_cv.wait(lock,
+            [this]
+            {
+                return state->remaining.load(std::memory_order_acquire) == 0;
+            });
+    }
+
+    /**
+     * @brief Wait for every task in the batch to finish, but stop waiting after the specified duration has passed.
+     *
+     * @tparam R An arithmetic type representing the number of ticks to wait.
+     * @tparam P An `std::ratio` representing the length of each tick in seconds.
+     * @param duration The amount of time to wait.
+     * @return `true` if all tasks finished, `false` if the duration expired first.
+     */
+    template <typename R, typename P>
+    bool wait_for(const std::chrono::duration<R, P>& duration) const
+    {
+        return wait_until(std::chrono::steady_clock::now() + duration);
+    }
+
+    /**
+     * @brief Wait for every task in the batch to finish, but stop waiting after the specified time point has been reached.
+     *
+     * @tparam C The type of the clock used to measure time.
+     * @tparam D An `std::chrono::duration` type used to indicate the time point.
+     * @param timeout_time The time point at which to stop waiting.
+     * @return `true` if all tasks finished, `false` if the time point was reached first.
+     */
+    template <typename C, typename D>
+    bool wait_until(const std::chrono::time_point<C, D>& timeout_time) const
+    {
+        if (done())
+            return true;
+        std::unique_lock lock(state->mutex);
+        return state->done_cv.wait_until(lock, timeout_time,
+            [this]
+            {
+                return state->remaining.load(std::memory_order_acquire) == 0;
+            });
+    }
+
+private:
+    friend class thread_pool;
+
+    /**
+     * @brief The state the tasks and the handles share. Until its last task finishes, the state keeps itself alive through `self`, so that the tasks only need to carry a plain pointer to it: a task that wraps a pointer-sized closure then still fits inside `std::function` without a heap allocation.
+     */
+    struct state_type
+    {
+        std::atomic<size_t> remaining = 0;
+        std::mutex mutex = {};
+        std::condition_variable done_cv = {};
+        std::shared_ptr<state_type> self = nullptr;
+        stop_token token = {};
+
+        /**
+         * @brief Called by each task of the batch when it finishes. The last one wakes the waiters and releases the batch's own reference to the state.
+         */
+        void finish()
+        {
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return;
+            std::shared_ptr<state_type> keep;
+            {
+                const std::scoped_lock lock(mutex);
+                keep = std::move(self);
+            }
+            done_cv.notify_all();
+        }
+    };
+
+    /**
+     * @brief A batch task: runs the user's task unless the batch's token has been stopped, then counts it as finished either way. The token lives in the shared state rather than in every task, to keep the task pointer-sized.
+     *
+     * @tparam F The type of the user's task.
+     */
+    template <typename F>
+    struct task_type
+    {
+        F task;
+        state_type* state;
+
+        void operator()()
+        {
+            if (!state->token.stop_requested())
+                task();
+            state->finish();
+        }
+    };
+
+    /**
+     * @brief Get a state for a new batch. States are recycled per thread once their last task has finished and every handle to them is gone, so a thread that submits a steady stream of batches stops allocating after the first few.
+     *
+     * @return A state that nothing else refers to.
+     */
+    [[nodiscard]] static std::shared_ptr<state_type> acquire_state()
+    {
+        constexpr size_t max_cached = 8;
+        thread_local std::vector<std::shared_ptr<state_type>> cache;
+        for (const std::shared_ptr<state_type>& cached : cache)
+        {
+            if (cached.use_count() == 1)
+            {
+                // Pairs with the release of the last other reference, by a task or a handle.
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return cached;
+            }
+        }
+        std::shared_ptr<state_type> fresh = std::make_shared<state_type>();
+        if (cache.size() < max_cached)
+            cache.push_back(fresh);
+        return fresh;
+    }
+
+    std::shared_ptr<state_type> state = nullptr;
+}; // class batch
+
 /**
  * @brief A fast, lightweight, and easy-to-use C++17 thread pool class.
  */
@@ -433,8 +805,12 @@ public:
     void purge()
     {
         const std::scoped_lock tasks_lock(tasks_mutex);
+#ifdef BS_THREAD_POOL_ENABLE_PRIORITY
         while (!tasks.empty())
             tasks.pop();
+#else
+        tasks.clear();
+#endif
     }
 
     /**
@@ -454,6 +830,224 @@ public:
         task_available_cv.notify_one();
     }
 
+    /**
+     * @brief Submit many functions with no arguments and no return value into the task queue at once, with the specified priority. All of them are queued under a single lock of the queue and the threads are woken with a single notification, instead of one lock and one notification per task as with `detach_task()`. The tasks are moved out of the range.
+     *
+     * @tparam I The type of the iterators. Dereferencing one must give a function with no arguments and no return value.
+     * @param first An iterator to the first task.
+     * @param last An iterator past the last task.
+     * @param priority The priority of the tasks. Should be between -32,768 and 32,767 (a signed 16-bit integer). The default is 0. Only enabled if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     * @return A `batch` handle that waits for these tasks only.
+     */
+    template <typename I>
+    batch detach_batch(I first, I last BS_THREAD_POOL_PRIORITY_INPUT)
+    {
+        return enqueue_batch(first, last, {} BS_THREAD_POOL_PRIORITY_OUTPUT);
+    }
+
+    /**
+     * @brief Submit every function in a range into the task queue at once, with the specified priority. Equivalent to `detach_batch(std::begin(range), std::end(range))`.
+     *
+     * @tparam R The type of the range.
+     * @param range The tasks. They are moved out of the range.
+     * @param priority The priority of the tasks. Should be between -32,768 and 32,767 (a signed 16-bit integer). The default is 0. Only enabled if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     * @return A `batch` handle that waits for these tasks only.
+     */
+    template <typename R>
+    batch detach_batch(R&& range BS_THREAD_POOL_PRIORITY_INPUT)
+    {
+        return detach_batch(std::begin(range), std::end(range) BS_THREAD_POOL_PRIORITY_OUTPUT);
+    }
+
+    /**
+     * @brief Submit a function with no arguments and no return value into the task queue, with the specified priority, to be skipped if stop is requested through the given token before it starts. Otherwise the same as `detach_task()`.
+     *
+     * @tparam F The type of the function.
+     * @param task The function to push.
+     * @param token The token to check right before the task would run.
+     * @param priority The priority of the task. Should be between -32,768 and 32,767 (a signed 16-bit integer). The default is 0. Only enabled if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     */
+    template <typename F>
+    void detach_task(F&& task, const stop_token& token BS_THREAD_POOL_PRIORITY_INPUT)
+    {
+        detach_task(stoppable_task(std::forward<F>(task), token) BS_THREAD_POOL_PRIORITY_OUTPUT);
+    }
+
+    /**
+     * @brief Submit many functions into the task queue at once, with the specified priority, each to be skipped if stop is requested through the given token before it starts. Skipped tasks still count as finished in the batch, so waiting on a cancelled batch only waits for the tasks that were already running. Otherwise the same as `detach_batch()`.
+     *
+     * @tparam I The type of the iterators. Dereferencing one must give a function with no arguments and no return value.
+     * @param first An iterator to the first task.
+     * @param last An iterator past the last task.
+     * @param token The token to check right before each task would run.
+     * @param priority The priority of the tasks. Should be between -32,768 and 32,767 (a signed 16-bit integer). The default is 0. Only enabled if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     * @return A `batch` handle that waits for these tasks only.
+     */
+    template <typename I>
+    batch detach_batch(I first, I last, const stop_token& token BS_THREAD_POOL_PRIORITY_INPUT)
+    {
+        return enqueue_batch(first, last, token BS_THREAD_POOL_PRIORITY_OUTPUT);
+    }
+
+#ifndef BS_THREAD_POOL_ENABLE_PRIORITY
+    /**
+     * @brief Submit a function with no arguments and no return value into the given lane of the task queue. Otherwise the same as `detach_task()`, which submits into `lane::frame`. Not available if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     *
+     * @tparam F The type of the function.
+     * @param target The lane to queue the task in.
+     * @param task The function to push.
+     */
+    template <typename F>
+    void detach_task(const lane target, F&& task)
+    {
+        {
+            const std::scoped_lock tasks_lock(tasks_mutex);
+            tasks.emplace(std::forward<F>(task), target);
+        }
+        task_available_cv.notify_one();
+    }
+
+    /**
+     * @brief Submit many functions into the given lane of the task queue at once. Otherwise the same as `detach_batch()`, which submits into `lane::frame`. Not available if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     *
+     * @tparam I The type of the iterators. Dereferencing one must give a function with no arguments and no return value.
+     * @param target The lane to queue the tasks in.
+     * @param first An iterator to the first task.
+     * @param last An iterator past the last task.
+     * @return A `batch` handle that waits for these tasks only.
+     */
+    template <typename I>
+    batch detach_batch(const lane target, I first, I last)
+    {
+        return enqueue_batch(first, last, {}, target);
+    }
+
+    /**
+     * @brief Submit every function in a range into the given lane of the task queue at once. Equivalent to `detach_batch(target, std::begin(range), std::end(range))`. Not available if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     *
+     * @tparam R The type of the range.
+     * @param target The lane to queue the tasks in.
+     * @param range The tasks. They are moved out of the range.
+     * @return A `batch` handle that waits for these tasks only.
+     */
+    template <typename R>
+    batch detach_batch(const lane target, R&& range)
+    {
+        return enqueue_batch(std::begin(range), std::end(range), {}, target);
+    }
+
+    /**
+     * @brief Submit a function into the given lane of the task queue, to be skipped if stop is requested through the given token before it starts. Not available if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     *
+     * @tparam F The type of the function.
+     * @param target The lane to queue the task in.
+     * @param task The function to push.
+     * @param token The token to check right before the task would run.
+     */
+    template <typename F>
+    void detach_task(const lane target, F&& task, const stop_token& token)
+    {
+        detach_task(target, stoppable_task(std::forward<F>(task), token));
+    }
+
+    /**
+     * @brief Submit many functions into the given lane of the task queue at once, each to be skipped if stop is requested through the given token before it starts. Skipped tasks still count as finished in the batch. Not available if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     *
+     * @tparam I The type of the iterators. Dereferencing one must give a function with no arguments and no return value.
+     * @param target The lane to queue the tasks in.
+     * @param first An iterator to the first task.
+     * @param last An iterator past the last task.
+     * @param token The token to check right before each task would run.
+     * @return A `batch` handle that waits for these tasks only.
+     */
+    template <typename I>
+    batch detach_batch(const lane target, I first, I last, const stop_token& token)
+    {
+        return enqueue_batch(first, last, token, target);
+    }
+
+    /**
+     * @brief Submit a function with no arguments into the given lane of the task queue, and get a future for its result. Otherwise the same as `submit_task()`, which submits into `lane::frame`. Not available if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     *
+     * @tparam F The type of the function.
+     * @tparam R The return type of the function (can be `void`).
+     * @param target The lane to queue the task in.
+     * @param task The function to submit.
+     * @return A future to be used later to wait for the function to finish executing and/or obtain its returned value if it has one.
+     */
+    template <typename F, typename R = std::invoke_result_t<std::decay_t<F>>>
+    [[nodiscard]] std::future<R> submit_task(const lane target, F&& task)
+    {
+        const std::shared_ptr<std::promise<R>> task_promise = std::make_shared<std::promise<R>>();
+        detach_task(target, promise_task<R>(std::forward<F>(task), task_promise));
+        return task_promise->get_future();
+    }
+
+    /**
+     * @brief Get the number of tasks waiting in one lane of the queue. Not available if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     *
+     * @param target The lane.
+     * @return The number of queued tasks in that lane.
+     */
+    [[nodiscard]] size_t get_tasks_queued(const lane target) const
+    {
+        const std::scoped_lock tasks_lock(tasks_mutex);
+        return tasks.size(target);
+    }
+
+    /**
+     * @brief Set how the workers choose between lanes. The default is `drain_policy::strict`. Not available if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     *
+     * @param policy The policy.
+     */
+    void set_drain_policy(const drain_policy policy)
+    {
+        const std::scoped_lock tasks_lock(tasks_mutex);
+        tasks.policy = policy;
+    }
+
+    /**
+     * @brief Set the weights of the lanes under `drain_policy::weighted`: while several lanes have tasks waiting, each gets a share of the workers' picks in proportion to its weight. The default is 8 : 4 : 1. A weight of 0 only lets a lane run when the others are empty. Not available if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     *
+     * @param realtime The weight of `lane::realtime`.
+     * @param frame The weight of `lane::frame`.
+     * @param background The weight of `lane::background`.
+     */
+    void set_lane_weights(const unsigned int realtime, const unsigned int frame, const unsigned int background)
+    {
+        const std::scoped_lock tasks_lock(tasks_mutex);
+        tasks.weights = {realtime, frame, background};
+    }
+
+    /**
+     * @brief Enter frame-deadline mode: from now on a worker only starts a background task if at least `background_reserve` is left until `deadline`, the time the next frame needs the workers. Background tasks are not preempted once they start, so the reserve should be about as long as the longest one; background work then fills the idle end of each frame instead of delaying the next. Call it again for every frame. While background tasks are deferred they do not count as queued for `wait()`, as if the pool were paused. Not available if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     *
+     * @param deadline When the next frame starts.
+     * @param background_reserve How long a background task may take.
+     */
+    void set_frame_deadline(const std::chrono::steady_clock::time_point deadline, const std::chrono::steady_clock::duration background_reserve)
+    {
+        {
+            const std::scoped_lock tasks_lock(tasks_mutex);
+            tasks.deadline = deadline;
+            tasks.background_reserve = background_reserve;
+        }
+        task_available_cv.notify_all();
+    }
+
+    /**
+     * @brief Leave frame-deadline mode: background tasks start whenever the drain policy picks them. Not available if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     */
+    void clear_frame_deadline()
+    {
+        {
+            const std::scoped_lock tasks_lock(tasks_mutex);
+            tasks.deadline.reset();
+        }
+        task_available_cv.notify_all();
+    }
+#endif
+
     /**
      * @brief Parallelize a loop by automatically splitting it into blocks and submitting each block separately to the queue, with the specified priority. The block function takes two arguments, the start and end of the block, so that it is only called only once per block, but it is up to the user make sure the block function correctly deals with all the indices in each block. Does not return a `multi_future`, so the user must use `wait()` or some other method to ensure that the loop finishes executing, otherwise bad things will happen.
      *
@@ -480,6 +1074,34 @@ public:
         }
     }
 
+    /**
+     * @brief Parallelize a loop by automatically splitting it into blocks and submitting each block separately to the queue, with the specified priority, checking the given token before each block. Blocks that have not started when stop is requested are skipped; a block that is running finishes, unless `block` checks the token itself. Otherwise the same as `detach_blocks()`.
+     *
+     * @tparam T The type of the indices. Should be a signed or unsigned integer.
+     * @tparam F The type of the function to loop through.
+     * @param first_index The first index in the loop.
+     * @param index_after_last The index after the last index in the loop.
+     * @param block A function that will be called once per block that is not skipped. Should take exactly two arguments: the first index in the block and the index after the last index in the block.
+     * @param num_blocks The maximum number of blocks to split the loop into. 0 means the number of blocks will be equal to the number of threads in the pool. More blocks make a stop take effect sooner.
+     * @param token The token to check right before each block would run.
+     * @param priority The priority of the tasks. Should be between -32,768 and 32,767 (a signed 16-bit integer). The default is 0. Only enabled if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     */
+    template <typename T, typename F>
+    void detach_blocks(const T first_index, const T index_after_last, F&& block, const size_t num_blocks, const stop_token& token BS_THREAD_POOL_PRIORITY_INPUT)
+    {
+        if (index_after_last > first_index)
+        {
+            const blocks blks(first_index, index_after_last, num_blocks ? num_blocks : thread_count);
+            for (size_t blk = 0; blk < blks.get_num_blocks(); ++blk)
+                detach_task(
+                    [block = std::forward<F>(block), start = blks.start(blk), end = blks.end(blk), token]
+                    {
+                        if (!token.stop_requested())
+                            block(start, end);
+                    } BS_THREAD_POOL_PRIORITY_OUTPUT);
+        }
+    }
+
     /**
      * @brief Parallelize a loop by automatically splitting it into blocks and submitting each block separately to the queue, with the specified priority. The loop function takes one argument, the loop index, so that it is called many times per block. Does not return a `multi_future`, so the user must use `wait()` or some other method to ensure that the loop finishes executing, otherwise bad things will happen.
      *
@@ -594,32 +1216,7 @@ public:
     [[nodiscard]] std::future<R> submit_task(F&& task BS_THREAD_POOL_PRIORITY_INPUT)
     {
         const std::shared_ptr<std::promise<R>> task_promise = std::make_shared<std::promise<R>>();
-        detach_task(
-            [task = std::forward<F>(task), task_promise]
-            {
-                try
-                {
-                    if constexpr (std::is_void_v<R>)
-                    {
-                        task();
-                        task_promise->set_value();
-                    }
-                    else
-                    {
-                        task_promise->set_value(task());
-                    }
-                }
-                catch (...)
-                {
-                    try
-                    {
-                        task_promise->set_exception(std::current_exception());
-                    }
-                    catch (...)
-                    {
-                    }
-                }
-            } BS_THREAD_POOL_PRIORITY_OUTPUT);
+        detach_task(promise_task<R>(std::forward<F>(task), task_promise) BS_THREAD_POOL_PRIORITY_OUTPUT);
         return task_promise->get_future();
     }
 
@@ -634,7 +1231,7 @@ public:
      * @param block A function that will be called once per block. Should take exactly two arguments: the first index in the block and the index after the last index in the block. `block(start, end)` should typically involve a loop of the form `for (T i = start; i < end; ++i)`.
      * @param num_blocks The maximum number of blocks to split the loop into. The default is 0, which means the number of blocks will be equal to the number of threads in the pool.
      * @param priority The priority of the tasks. Should be between -32,768 and 32,767 (a signed 16-bit integer). The default is 0. Only enabled if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
-     * @return A `multi_future` that can be used to wait for all the blocks to finish. If the block function returns a value, the `multi_future` can also be used to obtain the values returned by each block.
+     * @return A `multi_future` that can be used to wait for all the blocks to finish, or to cancel the blocks that have not started. If the block function returns a value, the `multi_future` can also be used to obtain the values returned by each block.
      */
     template <typename T, typename F, typename R = std::invoke_result_t<std::decay_t<F>, T, T>>
     [[nodiscard]] multi_future<R> submit_blocks(const T first_index, const T index_after_last, F&& block, const size_t num_blocks = 0 BS_THREAD_POOL_PRIORITY_INPUT)
@@ -644,12 +1241,14 @@ public:
             const blocks blks(first_index, index_after_last, num_blocks ? num_blocks : thread_count);
             multi_future<R> future;
             future.reserve(blks.get_num_blocks());
+            future.group = std::make_shared<typename multi_future<R>::group_type>();
             for (size_t blk = 0; blk < blks.get_num_blocks(); ++blk)
-                future.push_back(submit_task(
+                future.push_back(submit_in_group<R>(
                     [block = std::forward<F>(block), start = blks.start(blk), end = blks.end(blk)]
                     {
                         return block(start, end);
-                    } BS_THREAD_POOL_PRIORITY_OUTPUT));
+                    },
+                    future.group, {} BS_THREAD_POOL_PRIORITY_OUTPUT));
             return future;
         }
         return {};
@@ -669,19 +1268,40 @@ public:
      */
     template <typename T, typename F>
     [[nodiscard]] multi_future<void> submit_loop(const T first_index, const T index_after_last, F&& loop, const size_t num_blocks = 0 BS_THREAD_POOL_PRIORITY_INPUT)
+    {
+        return submit_loop(first_index, index_after_last, std::forward<F>(loop), num_blocks, stop_token() BS_THREAD_POOL_PRIORITY_OUTPUT);
+    }
+
+    /**
+     * @brief Parallelize a loop by automatically splitting it into blocks and submitting each block separately to the queue, with the specified priority, checking the given token, as well as the returned `multi_future`'s `cancel()`, before each block. Blocks that have not started when stop is requested are skipped, and their futures hold a `task_cancelled` exception. Otherwise the same as `submit_loop()`.
+     *
+     * @tparam T The type of the indices. Should be a signed or unsigned integer.
+     * @tparam F The type of the function to loop through.
+     * @param first_index The first index in the loop.
+     * @param index_after_last The index after the last index in the loop.
+     * @param loop The function to loop through. Will be called once per index, many times per block. Should take exactly one argument: the loop index. It cannot have a return value.
+     * @param num_blocks The maximum number of blocks to split the loop into. 0 means the number of blocks will be equal to the number of threads in the pool. More blocks make a stop take effect sooner.
+     * @param token The token to check right before each block would run.
+     * @param priority The priority of the tasks. Should be between -32,768 and 32,767 (a signed 16-bit integer). The default is 0. Only enabled if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     * @return A `multi_future` that can be used to wait for all the blocks to finish, or to cancel them.
+     */
+    template <typename T, typename F>
+    [[nodiscard]] multi_future<void> submit_loop(const T first_index, const T index_after_last, F&& loop, const size_t num_blocks, const stop_token& token BS_THREAD_POOL_PRIORITY_INPUT)
     {
         if (index_after_last > first_index)
         {
             const blocks blks(first_index, index_after_last, num_blocks ? num_blocks : thread_count);
             multi_future<void> future;
             future.reserve(blks.get_num_blocks());
+            future.group = std::make_shared<multi_future<void>::group_type>();
             for (size_t blk = 0; blk < blks.get_num_blocks(); ++blk)
-                future.push_back(submit_task(
+                future.push_back(submit_in_group<void>(
                     [loop = std::forward<F>(loop), start = blks.start(blk), end = blks.end(blk)]
                     {
                         for (T i = start; i < end; ++i)
                             loop(i);
-                    } BS_THREAD_POOL_PRIORITY_OUTPUT));
+                    },
+                    future.group, token BS_THREAD_POOL_PRIORITY_OUTPUT));
             return future;
         }
         return {};
@@ -697,7 +1317,7 @@ public:
      * @param index_after_last The index after the last index in the sequence. The sequence will iterate from `first_index` to `(index_after_last - 1)` inclusive. In other words, it will be equivalent to `for (T i = first_index; i < index_after_last; ++i)`. Note that if `index_after_last <= first_index`, no tasks will be submitted, and an empty `multi_future` will be returned.
      * @param sequence The function used to define the sequence. Will be called once per index. Should take exactly one argument, the index.
      * @param priority The priority of the tasks. Should be between -32,768 and 32,767 (a signed 16-bit integer). The default is 0. Only enabled if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
-     * @return A `multi_future` that can be used to wait for all the tasks to finish. If the sequence function returns a value, the `multi_future` can also be used to obtain the values returned by each task.
+     * @return A `multi_future` that can be used to wait for all the tasks to finish, or to cancel the tasks that have not started. If the sequence function returns a value, the `multi_future` can also be used to obtain the values returned by each task.
      */
     template <typename T, typename F, typename R = std::invoke_result_t<std::decay_t<F>, T>>
     [[nodiscard]] multi_future<R> submit_sequence(const T first_index, const T index_after_last, F&& sequence BS_THREAD_POOL_PRIORITY_INPUT)
@@ -706,12 +1326,14 @@ public:
         {
             multi_future<R> future;
             future.reserve(static_cast<size_t>(index_after_last - first_index));
+            future.group = std::make_shared<typename multi_future<R>::group_type>();
             for (T i = first_index; i < index_after_last; ++i)
-                future.push_back(submit_task(
+                future.push_back(submit_in_group<R>(
                     [sequence = std::forward<F>(sequence), i]
                     {
                         return sequence(i);
-                    } BS_THREAD_POOL_PRIORITY_OUTPUT));
+                    },
+                    future.group, {} BS_THREAD_POOL_PRIORITY_OUTPUT));
             return future;
         }
         return {};
@@ -883,6 +1505,135 @@ private:
         return 1;
     }
 
+    /**
+     * @brief Queue a range of tasks as one batch: every task is wrapped to count itself as finished in the batch, all of them are pushed under a single lock of the queue, and the workers are woken once. Used by `detach_batch()`.
+     *
+     * @tparam I The type of the iterators.
+     * @tparam W The type of the arguments selecting where in the queue the tasks go: a priority, a lane, or nothing.
+     * @param first An iterator to the first task.
+     * @param last An iterator past the last task.
+     * @param token Tasks that start after stop has been requested through this token are skipped.
+     * @param where Passed on to the queue's `emplace()` with every task.
+     * @return A `batch` handle that waits for these tasks only.
+     */
+    template <typename I, typename... W>
+    batch enqueue_batch(I first, I last, stop_token token, const W... where)
+    {
+        using F = std::decay_t<decltype(*first)>;
+        const size_t count = static_cast<size_t>(std::distance(first, last));
+        batch handle;
+        if (count == 0)
+            return handle;
+        handle.state = batch::acquire_state();
+        handle.state->remaining.store(count, std::memory_order_relaxed);
+        handle.state->self = handle.state;
+        handle.state->token = std::move(token);
+        batch::state_type* const state = handle.state.get();
+        {
+            const std::scoped_lock tasks_lock(tasks_mutex);
+#ifndef BS_THREAD_POOL_ENABLE_PRIORITY
+            tasks.reserve(count, where...);
+#endif
+            for (; first != last; ++first)
+                tasks.emplace(batch::task_type<F>{std::move(*first), state}, where...);
+        }
+        if (count == 1)
+            task_available_cv.notify_one();
+        else
+            task_available_cv.notify_all();
+        return handle;
+    }
+
+    /**
+     * @brief Wrap a task so that it fulfils a promise with its result or exception. Used by `submit_task()`.
+     *
+     * @tparam R The return type of the task (can be `void`).
+     * @tparam F The type of the task.
+     * @param task The task.
+     * @param task_promise The promise to fulfil.
+     * @return The wrapped task.
+     */
+    template <typename R, typename F>
+    [[nodiscard]] static auto promise_task(F&& task, std::shared_ptr<std::promise<R>> task_promise)
+    {
+        return [task = std::forward<F>(task), task_promise = std::move(task_promise)]
+        {
+            try
+            {
+                if constexpr (std::is_void_v<R>)
+                {
+                    task();
+                    task_promise->set_value();
+                }
+                else
+                {
+                    task_promise->set_value(task());
+                }
+            }
+            catch (...)
+            {
+                try
+                {
+                    task_promise->set_exception(std::current_exception());
+                }
+                catch (...)
+                {
+                }
+            }
+        };
+    }
+
+    /**
+     * @brief Wrap a task so that it is skipped if stop has been requested through a token by the time it would run. Used by the `detach_task()` overloads that take a token.
+     *
+     * @tparam F The type of the task.
+     * @param task The task.
+     * @param token The token.
+     * @return The wrapped task.
+     */
+    template <typename F>
+    [[nodiscard]] static auto stoppable_task(F&& task, stop_token token)
+    {
+        return [task = std::forward<F>(task), token = std::move(token)]() mutable
+        {
+            if (!token.stop_requested())
+                task();
+        };
+    }
+
+    /**
+     * @brief Submit a task of a `multi_future` group: the task is skipped, leaving a `task_cancelled` exception in its future, if the group was cancelled or stop was requested through `token` by the time it would run, and it counts itself as finished in the group once its future is ready. Used by `submit_blocks()`, `submit_loop()`, and `submit_sequence()`.
+     *
+     * @tparam R The return type of the task (can be `void`).
+     * @tparam F The type of the task.
+     * @tparam G The type of the group.
+     * @param task The task.
+     * @param group The group.
+     * @param token A further token to check, or a default-constructed one.
+     * @param priority The priority of the task. Only enabled if `BS_THREAD_POOL_ENABLE_PRIORITY` is defined.
+     * @return A future for the task's result.
+     */
+    template <typename R, typename F, typename G>
+    [[nodiscard]] std::future<R> submit_in_group(F&& task, const std::shared_ptr<G>& group, stop_token token BS_THREAD_POOL_PRIORITY_INPUT)
+    {
+        const std::shared_ptr<std::promise<R>> task_promise = std::make_shared<std::promise<R>>();
+        detach_task(
+            [task = promise_task<R>(
+                 [task = std::forward<F>(task), group = group.get(), token = std::move(token)]
+                 {
+                     if (group->stop.load(std::memory_order_acquire) || token.stop_requested())
+                         throw task_cancelled();
+                     return task();
+                 },
+                 task_promise),
+                group]
+            {
+                task();
+                group->finish();
+            } BS_THREAD_POOL_PRIORITY_OUTPUT);
+        return task_promise->get_future();
+    }
+
     /**
      * @brief A worker function to be assigned to each thread in the pool. Waits until it is notified by `detach_task()` that a task is available, and then retrieves the task from the queue and executes it. Once the task finishes, the worker notifies `wait()` in case it is waiting.
      *
@@ -914,11 +1665,11 @@ private:
                 const std::function<void()> task = std::move(std::remove_const_t<pr_task&>(tasks.top()).task);
                 tasks.pop();
 #else
-                const std::function<void()> task = std::move(tasks.front());
-                tasks.pop();
+                const std::function<void()> task = tasks.take();
 #endif
                 ++tasks_running;
                 tasks_lock.unlock();
+                BS_THREAD_POOL_TRACE_TASK(idx);
                 task();
             }
             tasks_lock.lock();
@@ -931,6 +1682,182 @@ private:
     // Private classes
     // ===============
 
+    /**
+     * @brief A first-in, first-out queue of tasks in a ring buffer. The buffer doubles when full and never shrinks, so once it has grown to the largest number of queued tasks, pushing and popping no longer allocate. Replaces `std::queue`, whose `std::deque` frees and allocates a node every few tasks.
+     */
+    class [[nodiscard]] task_ring
+    {
+    public:
+        [[nodiscard]] bool empty() const
+        {
+            return count == 0;
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return count;
+        }
+
+        template <typename F>
+        void emplace(F&& task)
+        {
+            if (count == slots.size())
+                grow();
+            slots[(head + count) % slots.size()] = std::forward<F>(task);
+            ++count;
+        }
+
+        [[nodiscard]] std::function<void()>& front()
+        {
+            return slots[head];
+        }
+
+        /**
+         * @brief Grow the buffer, if needed, so that `capacity` tasks fit without growing again. Lets `detach_batch()` grow at most once per batch.
+         */
+        void reserve(const size_t capacity)
+        {
+            while (slots.size() < capacity)
+                grow();
+        }
+
+        void pop()
+        {
+            slots[head] = nullptr;
+            head = (head + 1) % slots.size();
+            --count;
+        }
+
+    private:
+        void grow()
+        {
+            std::vector<std::function<void()>> larger(slots.empty() ? 64 : slots.size() * 2);
+            for (size_t i = 0; i < count; ++i)
+                larger[i] = std::move(slots[(head + i) % slots.size()]);
+            slots.swap(larger);
+            head = 0;
+        }
+
+        std::vector<std::function<void()>> slots = {};
+        size_t head = 0;
+        size_t count = 0;
+    };
+
+#ifndef BS_THREAD_POOL_ENABLE_PRIORITY
+    /**
+     * @brief The task queue: one `task_ring` per lane, drained according to `policy`, with background tasks held back in frame-deadline mode. All access is under `tasks_mutex`, the same lock the workers sleep on, so a lane costs no more to push to or pop from than the single queue did.
+     */
+    class [[nodiscard]] lane_queue
+    {
+    public:
+        /**
+         * @brief Check whether no task may start now. Background tasks deferred by the frame deadline are not counted.
+         *
+         * @return `true` if there is nothing a worker may take.
+         */
+        [[nodiscard]] bool empty() const
+        {
+            if (!lanes[0].empty() || !lanes[1].empty())
+                return false;
+            return lanes[2].empty() || background_deferred();
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return lanes[0].size() + lanes[1].size() + lanes[2].size();
+        }
+
+        [[nodiscard]] size_t size(const lane target) const
+        {
+            return lanes[static_cast<size_t>(target)].size();
+        }
+
+        template <typename F>
+        void emplace(F&& task, const lane target = lane::frame)
+        {
+            lanes[static_cast<size_t>(target)].emplace(std::forward<F>(task));
+        }
+
+        /**
+         * @brief Make room for `additional` more tasks in one lane.
+         */
+        void reserve(const size_t additional, const lane target = lane::frame)
+        {
+            task_ring& ring = lanes[static_cast<size_t>(target)];
+            ring.reserve(ring.size() + additional);
+        }
+
+        /**
+         * @brief Remove and return the next task according to the drain policy. Only call it if `empty()` is `false`.
+         *
+         * @return The task.
+         */
+        [[nodiscard]] std::function<void()> take()
+        {
+            task_ring& ring = lanes[next_lane()];
+            std::function<void()> task = std::move(ring.front());
+            ring.pop();
+            return task;
+        }
+
+        void clear()
+        {
+            for (task_ring& ring : lanes)
+            {
+                while (!ring.empty())
+                    ring.pop();
+            }
+        }
+
+        drain_policy policy = drain_policy::strict;
+        std::array<unsigned int, lane_count> weights = {8, 4, 1};
+        std::optional<std::chrono::steady_clock::time_point> deadline = std::nullopt;
+        std::chrono::steady_clock::duration background_reserve = {};
+
+    private:
+        [[nodiscard]] bool background_deferred() const
+        {
+            return deadline && std::chrono::steady_clock::now() + background_reserve > *deadline;
+        }
+
+        /**
+         * @brief Choose the lane to take from. Under `drain_policy::weighted` this is a smooth weighted round robin: every lane with a task earns its weight in credit, the richest is picked and pays the total, so over any run of picks each lane gets its share, evenly spread out.
+         *
+         * @return The index of the lane.
+         */
+        [[nodiscard]] size_t next_lane()
+        {
+            std::array<bool, lane_count> ready = {};
+            for (size_t i = 0; i < lane_count; ++i)
+                ready[i] = !lanes[i].empty();
+            // `empty()` already admitted the background lane if it is the only one left
+            if (ready[2] && (ready[0] || ready[1]) && background_deferred())
+                ready[2] = false;
+            if (policy == drain_policy::strict)
+                return ready[0] ? 0 : (ready[1] ? 1 : 2);
+            long long total = 0;
+            size_t best = lane_count;
+            for (size_t i = 0; i < lane_count; ++i)
+            {
+                if (!ready[i])
+                {
+                    credits[i] = 0;
+                    continue;
+                }
+                credits[i] += weights[i];
+                total += weights[i];
+                if (best == lane_count || credits[i] > credits[best])
+                    best = i;
+            }
+            credits[best] -= total;
+            return best;
+        }
+
+        std::array<task_ring, lane_count> lanes = {};
+        std::array<long long, lane_count> credits = {};
+    };
+#endif
+
     /**
      * @brief A helper class to divide a range into blocks. Used by `detach_blocks()`, `submit_blocks()`, `detach_loop()`, and `submit_loop()`.
      *
@@ -1104,7 +2031,7 @@ private:
 #ifdef BS_THREAD_POOL_ENABLE_PRIORITY
     std::priority_queue<pr_task> tasks = {};
 #else
-    std::queue<std::function<void()>> tasks = {};
+    lane_queue tasks = {};
 #endif
 
     /**
@@ -0,0 +1,100 @@
+#include "allocations.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+    std::atomic<std::uint64_t> allocationCount{ 0 };
+    std::atomic<std::uint64_t> allocationBytes{ 0 };
+}
+
+AllocationTotals CurrentAllocationTotals() {
+    return { allocationCount.load(std::memory_order_relaxed), allocationBytes.load(std::memory_order_relaxed) };
+}
+
+void CountAllocation(std::size_t bytes) {
+#ifdef PARTICLE_PROFILER
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(bytes, std::memory_order_relaxed);
+#else
+    (void)bytes;
+#endif
+}
+
+bool AllocationCountingEnabled() {
+#ifdef PARTICLE_PROFILER
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef PARTICLE_PROFILER
+// Replacements for the global allocation functions. Every form is replaced, so each block is always
+// released by the function matching the one that allocated it.
+namespace {
+    void* CountedAllocate(std::size_t bytes) {
+        CountAllocation(bytes);
+        return std::malloc(bytes ? bytes : 1);
+    }
+
+    void* CountedAllocateAligned(std::size_t bytes, std::size_t alignment) {
+        CountAllocation(bytes);
+        bytes = bytes ? bytes : 1;
+#ifdef _WIN32
+        return _aligned_malloc(bytes, alignment);
+#else
+        void* memory = nullptr;
+        return posix_memalign(&memory, alignment < sizeof(void*) ? sizeof(void*) : alignment, bytes) == 0 ? memory : nullptr;
+#endif
+    }
+
+    void FreeAligned(void* memory) {
+#ifdef _WIN32
+        _aligned_free(memory);
+#else
+        std::free(memory);
+#endif
+    }
+}
+
+void* operator new(std::size_t bytes) {
+    if (void* memory = CountedAllocate(bytes))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t bytes) {
+    return ::operator new(bytes);
+}
+
+void* operator new(std::size_t bytes, const std::nothrow_t&) noexcept {
+    return CountedAllocate(bytes);
+}
+
+void* operator new[](std::size_t bytes, const std::nothrow_t&) noexcept {
+    return CountedAllocate(bytes);
+}
+
+void* operator new(std::size_t bytes, std::align_val_t alignment) {
+    if (void* memory = CountedAllocateAligned(bytes, static_cast<std::size_t>(alignment)))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t bytes, std::align_val_t alignment) {
+    return ::operator new(bytes, alignment);
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { FreeAligned(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { FreeAligned(memory); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { FreeAligned(memory); }
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept { FreeAligned(memory); }
+#endif
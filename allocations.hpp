@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Process-wide heap allocation counters. With PARTICLE_PROFILER defined the global operator new is
+// replaced by one that counts every call (one relaxed atomic add each); code that allocates through
+// malloc directly, like ImGui, can report itself with CountAllocation(). Without the profiler nothing
+// is counted and AllocationCountingEnabled() is false.
+struct AllocationTotals {
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+};
+
+AllocationTotals CurrentAllocationTotals();
+void CountAllocation(std::size_t bytes);
+bool AllocationCountingEnabled();
@@ -0,0 +1,64 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+namespace {
+    std::atomic<std::uint64_t> currentFrame{ 1 };
+
+    std::size_t AlignUp(std::size_t value, std::size_t alignment) {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+}
+
+void* FrameArena::Allocate(std::size_t bytes, std::size_t alignment) {
+    alignment = std::max(alignment, alignof(std::max_align_t));
+    if (!blocks.empty()) {
+        const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(blocks.back().memory.get());
+        const std::size_t start = AlignUp(base + offset, alignment) - base;
+        if (start + bytes <= blocks.back().size) {
+            offset = start + bytes;
+            return blocks.back().memory.get() + start;
+        }
+        usedBefore += offset;
+    }
+    // doubling keeps the number of blocks in one frame logarithmic
+    const std::size_t size = std::max({ std::size_t(FRAME_ARENA_BLOCK_SIZE), bytes + alignment, blocks.empty() ? 0 : blocks.back().size * 2 });
+    blocks.push_back({ std::unique_ptr<std::byte[]>(new std::byte[size]), size });
+    const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(blocks.back().memory.get());
+    const std::size_t start = AlignUp(base, alignment) - base;
+    offset = start + bytes;
+    return blocks.back().memory.get() + start;
+}
+
+std::size_t FrameArena::Capacity() const {
+    std::size_t capacity = 0;
+    for (const Block& block : blocks)
+        capacity += block.size;
+    return capacity;
+}
+
+void FrameArena::Rewind() {
+    if (blocks.size() > 1) {
+        // the last frame needed several blocks: replace them with one that fits it
+        const std::size_t size = Capacity();
+        blocks.clear();
+        blocks.push_back({ std::unique_ptr<std::byte[]>(new std::byte[size]), size });
+    }
+    offset = 0;
+    usedBefore = 0;
+}
+
+FrameArena& ThreadFrameArena() {
+    thread_local FrameArena arena;
+    const std::uint64_t frame = currentFrame.load(std::memory_order_relaxed);
+    if (arena.frame != frame) {
+        arena.Rewind();
+        arena.frame = frame;
+    }
+    return arena;
+}
+
+void NextFrame() {
+    currentFrame.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define FRAME_ARENA_BLOCK_SIZE (64 * 1024) // Size of the first block of every thread's frame arena
+
+// Bump allocator for data that dies before the next frame (or headless step): job lists, task
+// closures, sort and partition scratch. Each thread has its own (ThreadFrameArena()), so allocating
+// never takes a lock or touches another core's cache lines.
+//
+// NextFrame() starts a new frame for every arena at once; each one rewinds the next time its thread
+// allocates. If a frame outgrew the first block, the blocks are replaced by a single one large enough
+// for the whole frame, so a steady workload stops calling malloc after its first few frames. Memory is
+// never returned before the thread exits; objects are never destroyed by the arena.
+class FrameArena {
+public:
+    FrameArena() = default;
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void* Allocate(std::size_t bytes, std::size_t alignment);
+
+    template <typename T, typename... Args>
+    T* New(Args&&... args) {
+        return ::new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    std::size_t Capacity() const;
+    std::size_t Used() const { return usedBefore + offset; }
+
+private:
+    friend FrameArena& ThreadFrameArena();
+
+    struct Block {
+        std::unique_ptr<std::byte[]> memory;
+        std::size_t size = 0;
+    };
+
+    void Rewind();
+
+    std::vector<Block> blocks;
+    std::size_t offset = 0;     // into blocks.back()
+    std::size_t usedBefore = 0; // bytes handed out from the earlier blocks this frame
+    std::uint64_t frame = 0;
+};
+
+// The calling thread's arena, rewound first if a new frame has started since it last allocated.
+FrameArena& ThreadFrameArena();
+// Ends the current frame: nothing allocated from any frame arena may be used after this. Call it at
+// the start of every frame and headless step, while the pool is idle.
+void NextFrame();
+
+// Standard allocator over the arena of the thread that created it; deallocation is a no-op.
+template <typename T>
+class FrameAllocator {
+public:
+    using value_type = T;
+
+    FrameAllocator() : arena(&ThreadFrameArena()) {}
+    template <typename U>
+    FrameAllocator(const FrameAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(std::size_t count) { return static_cast<T*>(arena->Allocate(count * sizeof(T), alignof(T))); }
+    void deallocate(T*, std::size_t) {}
+
+    template <typename U>
+    bool operator==(const FrameAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const FrameAllocator<U>& other) const { return arena != other.arena; }
+
+private:
+    template <typename U>
+    friend class FrameAllocator;
+    FrameArena* arena;
+};
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+// pool.detach_task() for a closure of any size without a heap allocation: the closure is moved into
+// the calling thread's frame arena and the pool only receives a pointer to it, which std::function
+// stores inline. The closure is destroyed after it runs. The task must finish within the frame.
+template <typename F>
+void DetachFrameTask(BS::thread_pool& pool, F&& task) {
+    using Task = std::decay_t<F>;
+    Task* stored = ThreadFrameArena().New<Task>(std::forward<F>(task));
+    pool.detach_task(
+        [stored]
+        {
+            (*stored)();
+            stored->~Task();
+        });
+}
+
+// DetachFrameTask() for `count` tasks at once: `make(i)` builds task i, for i in [0, count), and all of
+// them are queued with pool.detach_batch(), under one lock of the pool and with one wake-up. The returned
+// handle waits for these tasks only.
+template <typename Make>
+BS::batch DetachFrameBatch(BS::thread_pool& pool, std::size_t count, Make&& make) {
+    using Task = std::decay_t<std::invoke_result_t<Make&, std::size_t>>;
+    struct Runner {
+        Task* stored;
+        void operator()() const {
+            (*stored)();
+            stored->~Task();
+        }
+    };
+    FrameVector<Runner> runners;
+    runners.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+        runners.push_back(Runner{ ThreadFrameArena().New<Task>(make(i)) });
+    return pool.detach_batch(runners.begin(), runners.end());
+}
+
+// pool.detach_blocks() through DetachFrameBatch: `block(start, end)` runs once per block, with the
+// range split into `blockCount` near-equal blocks (the thread count if 0). The one shared copy of
+// `block` is never destroyed, so it should only capture references and plain values.
+template <typename T, typename F>
+BS::batch DetachFrameBlocks(BS::thread_pool& pool, T first, T last, F&& block, std::size_t blockCount = 0) {
+    if (last <= first)
+        return {};
+    using Block = std::decay_t<F>;
+    const Block* shared = ThreadFrameArena().New<Block>(std::forward<F>(block));
+    const std::size_t count = static_cast<std::size_t>(last - first);
+    const std::size_t blocks = std::min(count, blockCount ? blockCount : static_cast<std::size_t>(pool.get_thread_count()));
+    return DetachFrameBatch(pool, blocks, [shared, first, count, blocks](std::size_t b) {
+        const T start = first + static_cast<T>(count * b / blocks);
+        const T end = first + static_cast<T>(count * (b + 1) / blocks);
+        return [shared, start, end] { (*shared)(start, end); };
+    });
+}
@@ -0,0 +1,851 @@
+// Self-contained benchmark suite for the simulation step. Each case is timed in samples of enough
+// iterations to last --min-time seconds; the median sample is reported. Results can be written as
+// JSON (--json) in the same shape as Google Benchmark output and compared with bench/compare.py.
+// On Linux, cache misses per iteration are read from the perf counters when the kernel allows it.
+#include "simulation.hpp"
+#include "allocations.hpp"
+#include "arena.hpp"
+#include "camera.hpp"
+#include "compact.hpp"
+#include "density.hpp"
+#include "event_driven.hpp"
+#include "fast_forward.hpp"
+#include "log.hpp"
+#include "spatial_sort.hpp"
+#include "spawn.hpp"
+#include "wall_scan.hpp"
+#include "BS_thread_pool.hpp"
+#include "BS_thread_pool_utils.hpp"
+
+#ifdef PARTICLE_BENCH_IMGUI
+#include <imgui.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    struct Benchmark {
+        std::string name;
+        double itemsPerIteration = 0; // particles, tasks, ... processed per call of `run`; 0 to skip items/s
+        std::function<void()> setup;
+        std::function<void()> run;
+    };
+
+    struct Result {
+        std::string name;
+        std::uint64_t iterations = 0;
+        double medianNs = 0;
+        double minNs = 0;
+        double itemsPerSecond = 0;
+        double cacheMisses = -1;   // last-level cache misses per iteration, -1 without perf counters
+        double l1dMisses = -1;     // L1 data cache read misses per iteration
+        double dtlbMisses = -1;    // data TLB read misses per iteration
+        double allocations = -1;   // heap allocations per iteration, -1 without PARTICLE_PROFILER
+    };
+
+    // Hardware cache-miss counters for this process and every thread it starts afterwards, so they have
+    // to be opened before the pools. Unavailable (Available() false) off Linux, in most containers and
+    // with kernel.perf_event_paranoid > 2.
+    class CacheCounters {
+    public:
+        CacheCounters() {
+#ifdef __linux__
+            cacheMisses = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+            l1dMisses = Open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+            dtlbMisses = Open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#endif
+        }
+        ~CacheCounters() {
+#ifdef __linux__
+            for (int fd : { cacheMisses, l1dMisses, dtlbMisses }) {
+                if (fd >= 0)
+                    close(fd);
+            }
+#endif
+        }
+        CacheCounters(const CacheCounters&) = delete;
+        CacheCounters& operator=(const CacheCounters&) = delete;
+
+        bool Available() const { return cacheMisses >= 0; }
+        std::uint64_t CacheMisses() const { return Read(cacheMisses); }
+        std::uint64_t L1dMisses() const { return Read(l1dMisses); }
+        std::uint64_t DtlbMisses() const { return Read(dtlbMisses); }
+
+    private:
+        int cacheMisses = -1;
+        int l1dMisses = -1;
+        int dtlbMisses = -1;
+
+#ifdef __linux__
+        static int Open(std::uint32_t type, std::uint64_t config) {
+            perf_event_attr attr = {};
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+
+        static std::uint64_t Read(int fd) {
+            std::uint64_t value = 0;
+#ifdef __linux__
+            if (fd >= 0 && read(fd, &value, sizeof(value)) != static_cast<ssize_t>(sizeof(value)))
+                value = 0;
+#endif
+            return value;
+        }
+    };
+
+    struct BenchOptions {
+        std::string filter;
+        std::string jsonPath;
+        double minTime = 0.2;
+        int repetitions = 5;
+        int threads = 0;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    double SecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    Result RunBenchmark(const Benchmark& benchmark, const BenchOptions& options, const CacheCounters& counters) {
+        if (benchmark.setup)
+            benchmark.setup();
+        // every iteration is a frame: its arena scratch is released before the next one
+        auto run = [&benchmark] {
+            NextFrame();
+            benchmark.run();
+        };
+
+        // Grow the iteration count until one sample lasts at least a tenth of --min-time.
+        std::uint64_t iterations = 1;
+        for (;;) {
+            Clock::time_point start = Clock::now();
+            for (std::uint64_t i = 0; i < iterations; ++i)
+                run();
+            double elapsed = SecondsSince(start);
+            if (elapsed >= options.minTime / 10 || iterations >= (1ull << 30))
+                break;
+            double scale = elapsed > 0 ? (options.minTime / 10) / elapsed : 10;
+            iterations = static_cast<std::uint64_t>(iterations * std::clamp(scale * 1.2, 1.5, 10.0));
+        }
+        iterations = std::max<std::uint64_t>(1, iterations * 10 / std::max(1, options.repetitions));
+
+        std::vector<double> samples;
+        samples.reserve(options.repetitions);
+        const AllocationTotals allocationsBefore = CurrentAllocationTotals();
+        const std::uint64_t cacheMissesBefore = counters.CacheMisses();
+        const std::uint64_t l1dMissesBefore = counters.L1dMisses();
+        const std::uint64_t dtlbMissesBefore = counters.DtlbMisses();
+        for (int repetition = 0; repetition < options.repetitions; ++repetition) {
+            Clock::time_point start = Clock::now();
+            for (std::uint64_t i = 0; i < iterations; ++i)
+                run();
+            samples.push_back(SecondsSince(start) * 1e9 / iterations);
+        }
+        const double measuredIterations = static_cast<double>(iterations) * options.repetitions;
+        const double cacheMisses = static_cast<double>(counters.CacheMisses() - cacheMissesBefore) / measuredIterations;
+        const double l1dMisses = static_cast<double>(counters.L1dMisses() - l1dMissesBefore) / measuredIterations;
+        const double dtlbMisses = static_cast<double>(counters.DtlbMisses() - dtlbMissesBefore) / measuredIterations;
+        const double allocations = static_cast<double>(CurrentAllocationTotals().allocations - allocationsBefore.allocations) / measuredIterations;
+        std::sort(samples.begin(), samples.end());
+
+        Result result;
+        result.name = benchmark.name;
+        result.iterations = iterations;
+        result.medianNs = samples[samples.size() / 2];
+        result.minNs = samples.front();
+        if (benchmark.itemsPerIteration > 0)
+            result.itemsPerSecond = benchmark.itemsPerIteration * 1e9 / result.medianNs;
+        if (counters.Available()) {
+            result.cacheMisses = cacheMisses;
+            result.l1dMisses = l1dMisses;
+            result.dtlbMisses = dtlbMisses;
+        }
+        if (AllocationCountingEnabled())
+            result.allocations = allocations;
+        return result;
+    }
+
+    // The same spread the GUI produces with a full 0-359 degree fan from the canvas centre.
+    void FillParticles(Simulation& sim, int count, float speed) {
+        ClearParticles(sim);
+        AddParticlesBetweenAngles(sim.particles, sim.bounds, 640, 360, speed, 0.0f, 359.999f, count);
+    }
+
+    // Stationary particles spread uniformly over the world, for the rendering benchmarks.
+    void FillRandomParticles(Simulation& sim, int count) {
+        std::mt19937 rng(42);
+        ClearParticles(sim);
+        for (int i = 0; i < count; ++i) {
+            sim.particles.push_back({ Vec2(static_cast<float>(rng() % static_cast<std::uint32_t>(sim.bounds.width)),
+                                           static_cast<float>(rng() % static_cast<std::uint32_t>(sim.bounds.height))),
+                                      Vec2(0.0f, 0.0f) });
+        }
+    }
+
+    // Moving particles at random positions and in random directions, in the order they were generated.
+    void FillShuffledParticles(Simulation& sim, int count, float speed = 200.0f) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        ClearParticles(sim);
+        for (int i = 0; i < count; ++i) {
+            float angle = unit(rng) * 2.0f * static_cast<float>(M_PI);
+            sim.particles.push_back({ Vec2(unit(rng) * (sim.bounds.width - 1.0f), unit(rng) * (sim.bounds.height - 1.0f)),
+                                      Vec2(speed * std::cos(angle), speed * std::sin(angle)) });
+        }
+    }
+
+    void FillWalls(Simulation& sim, int count) {
+        std::mt19937 rng(42);
+        sim.wall.clear();
+        for (int i = 0; i < count; ++i)
+            sim.wall.push_back(MakeWall(sim.bounds, rng() % 1280, rng() % 720, rng() % 1280, rng() % 720));
+    }
+
+    // Short walls scattered over the world, `length` units long: dense like a maze rather than a web of
+    // walls spanning the whole world, so a particle meets a few per step, not hundreds.
+    void FillShortWalls(Simulation& sim, int count, int length) {
+        std::mt19937 rng(42);
+        sim.wall.clear();
+        const std::uint32_t width = static_cast<std::uint32_t>(sim.bounds.width) - length;
+        const std::uint32_t height = static_cast<std::uint32_t>(sim.bounds.height) - length;
+        for (int i = 0; i < count; ++i) {
+            const int x = static_cast<int>(rng() % width);
+            const int y = static_cast<int>(rng() % height);
+            sim.wall.push_back(MakeWall(sim.bounds, x, y, x + static_cast<int>(rng() % length), y + static_cast<int>(rng() % length)));
+        }
+    }
+
+    void AddStepBenchmarks(std::vector<Benchmark>& benchmarks, BS::thread_pool& pool, BS::thread_pool& singlePool) {
+        auto sim = std::make_shared<Simulation>();
+        const float dt = 1.0f / 60.0f;
+
+        // Integration and bounds only, with one worker and with the full pool. The crossover between the
+        // two is what THREADING_THRESHOLD approximates.
+        for (BS::thread_pool* stepPool : { &singlePool, &pool }) {
+            for (int count : { 1000, 5000, 20000, 100000, 1000000 }) {
+                benchmarks.push_back({ "step/no_walls/threads:" + std::to_string(stepPool->get_thread_count()) + "/particles:" + std::to_string(count),
+                                       static_cast<double>(count),
+                                       [sim, count] { FillParticles(*sim, count, 200.0f); sim->wall.clear(); },
+                                       [sim, stepPool, dt] { StepSimulation(*sim, dt, *stepPool); } });
+            }
+        }
+
+        // Each specialized kernel against the general one on the same scene.
+        for (int walls : { 0, 4, 64 }) {
+            const int count = 20000;
+            const StepKernel specialized = walls == 0 ? StepKernel::NoWalls : walls <= FIXED_WALLS_MAX ? StepKernel::FixedWalls : StepKernel::WallScan;
+            for (StepKernel kernel : { specialized, StepKernel::General }) {
+                benchmarks.push_back({ std::string("step/kernel:") + StepKernelName(kernel) + "/walls:" + std::to_string(walls) + "/particles:" + std::to_string(count),
+                                       static_cast<double>(count),
+                                       [sim, count, walls] { FillParticles(*sim, count, 200.0f); FillWalls(*sim, walls); },
+                                       [sim, &pool, dt, kernel] { DetachParticleJobs(*sim, dt, pool, kernel).wait(); } });
+            }
+        }
+
+        // Stationary particles sleep after the first step, so the cost should follow the moving share.
+        for (int stationaryPercent : { 0, 50, 90, 99 }) {
+            const int count = 100000;
+            benchmarks.push_back({ "step/stationary:" + std::to_string(stationaryPercent) + "/particles:" + std::to_string(count),
+                                   static_cast<double>(count),
+                                   [sim, count, stationaryPercent] {
+                                       const int stationary = count / 100 * stationaryPercent;
+                                       FillRandomParticles(*sim, stationary);
+                                       AddParticlesBetweenAngles(sim->particles, sim->bounds, 640, 360, 200.0f, 0.0f, 359.999f, count - stationary);
+                                       sim->wall.clear();
+                                   },
+                                   [sim, &pool, dt] { StepSimulation(*sim, dt, pool); } });
+        }
+
+        // Wall collision cost grows linearly with the wall count for every particle.
+        for (int walls : { 1, 8, 64, 256 }) {
+            const int count = 20000;
+            benchmarks.push_back({ "step/walls:" + std::to_string(walls) + "/particles:" + std::to_string(count),
+                                   static_cast<double>(count),
+                                   [sim, count, walls] { FillParticles(*sim, count, 200.0f); FillWalls(*sim, walls); },
+                                   [sim, &pool, dt] { StepSimulation(*sim, dt, pool); } });
+        }
+    }
+
+    // The same scenes in generation order and sorted by cell. Automatic sorting is off so the order
+    // stays as set up; run with perf counters available to see the cache-miss difference.
+    void AddLocalityBenchmarks(std::vector<Benchmark>& benchmarks, BS::thread_pool& pool) {
+        auto sim = std::make_shared<Simulation>();
+        auto density = std::make_shared<DensityBuffer>();
+        const float dt = 1.0f / 60.0f;
+        for (bool sorted : { false, true }) {
+            const char* order = sorted ? "sorted" : "shuffled";
+            const int count = 200000;
+            const int walls = 64;
+            benchmarks.push_back({ std::string("locality/step/order:") + order + "/walls:" + std::to_string(walls) + "/particles:" + std::to_string(count),
+                                   static_cast<double>(count),
+                                   [sim, &pool, count, walls, sorted] {
+                                       sim->sortInterval = 0;
+                                       FillShuffledParticles(*sim, count);
+                                       FillWalls(*sim, walls);
+                                       if (sorted)
+                                           SortParticlesByCell(sim->particles, 0, sim->particles.size(), sim->bounds, pool);
+                                   },
+                                   [sim, &pool, dt] { StepSimulation(*sim, dt, pool); } });
+        }
+        for (bool sorted : { false, true }) {
+            const char* order = sorted ? "sorted" : "shuffled";
+            const int count = 4000000;
+            benchmarks.push_back({ std::string("locality/density/order:") + order + "/particles:" + std::to_string(count),
+                                   static_cast<double>(count),
+                                   [sim, &pool, count, sorted] {
+                                       FillShuffledParticles(*sim, count);
+                                       sim->wall.clear();
+                                       if (sorted)
+                                           SortParticlesByCell(sim->particles, 0, sim->particles.size(), sim->bounds, pool);
+                                   },
+                                   [sim, density, &pool] {
+                                       const Viewport viewport = { Vec2(0.0f, 0.0f), Vec2(1280.0f, 720.0f) };
+                                       density->Build(sim->particles, FitWorld(sim->bounds, viewport), viewport, pool);
+                                   } });
+        }
+
+        // What a re-sort costs when it triggers, and the check that runs every SPATIAL_SORT_INTERVAL steps.
+        const int count = 1000000;
+        benchmarks.push_back({ "locality/sort/particles:" + std::to_string(count), static_cast<double>(count),
+                               [sim, count] { FillShuffledParticles(*sim, count); },
+                               [sim, &pool] { SortParticlesByCell(sim->particles, 0, sim->particles.size(), sim->bounds, pool); } });
+        benchmarks.push_back({ "locality/measure/particles:" + std::to_string(count), 0,
+                               [sim, count] { FillShuffledParticles(*sim, count); },
+                               [sim] {
+                                   if (MeasureDisorder(sim->particles, 0, sim->particles.size(), sim->bounds) < 0.0f)
+                                       std::abort();
+                               } });
+    }
+
+    // No walls, so the step is a stream over the particle array: float storage against compact storage
+    // with each codec.
+    void AddCompactBenchmarks(std::vector<Benchmark>& benchmarks, BS::thread_pool& pool) {
+        auto sim = std::make_shared<Simulation>();
+        auto compact = std::make_shared<std::unique_ptr<CompactParticles>>();
+        const float dt = 1.0f / 60.0f;
+        for (int count : { 1000000, 10000000 }) {
+            benchmarks.push_back({ "compact/step/storage:float/particles:" + std::to_string(count), static_cast<double>(count),
+                                   [sim, compact, count] {
+                                       compact->reset();
+                                       sim->sortInterval = 0;
+                                       FillShuffledParticles(*sim, count);
+                                       sim->wall.clear();
+                                   },
+                                   [sim, &pool, dt] { StepSimulation(*sim, dt, pool); } });
+            for (CompactCodec codec : { CompactCodec::Scalar, CompactCodec::Simd }) {
+                if (codec == CompactCodec::Simd && BestCompactCodec() != CompactCodec::Simd)
+                    continue;
+                benchmarks.push_back({ std::string("compact/step/storage:compact/codec:") + CompactCodecName(codec) + "/particles:" + std::to_string(count),
+                                       static_cast<double>(count),
+                                       [sim, compact, count, codec] {
+                                           FillShuffledParticles(*sim, count);
+                                           sim->wall.clear();
+                                           *compact = std::make_unique<CompactParticles>(sim->bounds, codec);
+                                           (*compact)->Append(sim->particles.data(), sim->particles.size());
+                                           ClearParticles(*sim);
+                                           sim->particles.shrink_to_fit();
+                                       },
+                                       [sim, compact, &pool, dt] { (*compact)->Step(*sim, dt, pool); } });
+            }
+        }
+    }
+
+    const char* PageSizeName(PageSize pageSize) {
+        return pageSize == PageSize::Huge ? "huge" : "small";
+    }
+
+    // Growing the particle store from empty: std::vector reallocates and copies on every doubling,
+    // PagedVector commits in place, optionally pre-faulting the pages on the pool first. Then the
+    // step over 4 KB against 2 MB pages, where dTLB misses show the difference.
+    void AddPageBenchmarks(std::vector<Benchmark>& benchmarks, BS::thread_pool& pool) {
+        const int count = 10000000;
+        const Particle particle = { Vec2(1.0f, 1.0f), Vec2(1.0f, 0.5f) };
+        benchmarks.push_back({ "pages/append/std_vector/particles:" + std::to_string(count), static_cast<double>(count), nullptr,
+                               [count, particle] {
+                                   std::vector<Particle> particles;
+                                   for (int i = 0; i < count; ++i)
+                                       particles.push_back(particle);
+                               } });
+        for (PageSize pageSize : { PageSize::Small, PageSize::Huge }) {
+            for (bool prefault : { false, true }) {
+                benchmarks.push_back({ std::string("pages/append/paged:") + PageSizeName(pageSize) + (prefault ? "/prefault" : "") + "/particles:" + std::to_string(count),
+                                       static_cast<double>(count), nullptr,
+                                       [count, particle, pageSize, prefault, &pool] {
+                                           ParticleBuffer particles(pageSize);
+                                           if (prefault)
+                                               particles.reserve(count, &pool);
+                                           for (int i = 0; i < count; ++i)
+                                               particles.push_back(particle);
+                                       } });
+            }
+        }
+
+        auto sim = std::make_shared<Simulation>();
+        const float dt = 1.0f / 60.0f;
+        for (PageSize pageSize : { PageSize::Small, PageSize::Huge }) {
+            benchmarks.push_back({ std::string("pages/step/paged:") + PageSizeName(pageSize) + "/particles:" + std::to_string(count), static_cast<double>(count),
+                                   [sim, count, pageSize] {
+                                       sim->particles = ParticleBuffer(pageSize);
+                                       sim->sortInterval = 0;
+                                       FillShuffledParticles(*sim, count);
+                                       sim->wall.clear();
+                                   },
+                                   [sim, &pool, dt] { StepSimulation(*sim, dt, pool); } });
+        }
+    }
+
+    // A sparse, slow scene (a few walls, particles crossing a few units per step) advanced by fixed
+    // steps and by EventDrivenParticles, whose cost follows the bounces instead of the particle count.
+    void AddEventBenchmarks(std::vector<Benchmark>& benchmarks, BS::thread_pool& pool) {
+        auto sim = std::make_shared<Simulation>();
+        auto events = std::make_shared<std::unique_ptr<EventDrivenParticles>>();
+        const float dt = 1.0f / 60.0f;
+        const int count = 1000000;
+        for (float speed : { 10.0f, 200.0f }) {
+            const std::string scene = "speed:" + std::to_string(static_cast<int>(speed)) + "/walls:4/particles:" + std::to_string(count);
+            benchmarks.push_back({ "events/integrator:step/" + scene, static_cast<double>(count),
+                                   [sim, events, count, speed] {
+                                       events->reset();
+                                       sim->sortInterval = 0;
+                                       FillShuffledParticles(*sim, count, speed);
+                                       FillWalls(*sim, 4);
+                                   },
+                                   [sim, &pool, dt] { StepSimulation(*sim, dt, pool); } });
+            benchmarks.push_back({ "events/integrator:events/" + scene, static_cast<double>(count),
+                                   [sim, events, count, speed, &pool, dt] {
+                                       FillShuffledParticles(*sim, count, speed);
+                                       FillWalls(*sim, 4);
+                                       *events = std::make_unique<EventDrivenParticles>(sim->bounds, dt);
+                                       (*events)->Append(sim->particles.data(), sim->particles.size());
+                                       ClearParticles(*sim);
+                                       // plans every particle against the walls
+                                       (*events)->Step(*sim, dt, pool);
+                                   },
+                                   [sim, events, &pool, dt] { (*events)->Step(*sim, dt, pool); } });
+        }
+    }
+
+    // One second of simulated time: 60 fixed steps against FastForward with each kernel. With walls,
+    // the particles whose path may meet one are followed bounce by bounce.
+    void AddFastForwardBenchmarks(std::vector<Benchmark>& benchmarks, BS::thread_pool& pool) {
+        auto sim = std::make_shared<Simulation>();
+        const float dt = 1.0f / 60.0f;
+        const int count = 1000000;
+        for (int walls : { 0, 4 }) {
+            const std::string scene = "/walls:" + std::to_string(walls) + "/particles:" + std::to_string(count);
+            auto fill = [sim, count, walls] {
+                sim->sortInterval = 0;
+                FillShuffledParticles(*sim, count);
+                FillWalls(*sim, walls);
+            };
+            benchmarks.push_back({ "fastforward/steps:60" + scene, static_cast<double>(count), fill,
+                                   [sim, &pool, dt] {
+                                       for (int i = 0; i < 60; ++i)
+                                           StepSimulation(*sim, dt, pool);
+                                   } });
+            for (FastForwardKernel kernel : { FastForwardKernel::Scalar, FastForwardKernel::Simd }) {
+                if (kernel == FastForwardKernel::Simd && BestFastForwardKernel() != FastForwardKernel::Simd)
+                    continue;
+                benchmarks.push_back({ std::string("fastforward/kernel:") + FastForwardKernelName(kernel) + "/seconds:1" + scene,
+                                       static_cast<double>(count), fill,
+                                       [sim, &pool, kernel] { FastForward(*sim, 1.0, pool, kernel); } });
+            }
+        }
+    }
+
+    // Few particles against many walls: the particle jobs leave all but one worker idle, so the wall
+    // list is split instead. Also the bare scan of one path over the walls with each kernel.
+    void AddWallBenchmarks(std::vector<Benchmark>& benchmarks, BS::thread_pool& pool) {
+        auto sim = std::make_shared<Simulation>();
+        const float dt = 1.0f / 60.0f;
+        const int count = 10;
+        // WallScan against WallSplit across wall counts, to place WALL_SPLIT_MIN_WALLS
+        for (int sweepWalls : { 4096, 16384, 65536 }) {
+            const std::string sweepScene = "/walls:" + std::to_string(sweepWalls) + "/particles:" + std::to_string(count);
+            for (StepKernel kernel : { StepKernel::WallScan, StepKernel::WallSplit }) {
+                benchmarks.push_back({ std::string("walls/kernel:") + StepKernelName(kernel) + sweepScene, static_cast<double>(count),
+                                       [sim, count, sweepWalls] { FillShuffledParticles(*sim, count); FillShortWalls(*sim, sweepWalls, 8); },
+                                       [sim, &pool, dt, kernel] { DetachParticleJobs(*sim, dt, pool, kernel).wait(); } });
+            }
+        }
+        const int walls = 100000;
+        const std::string scene = "/walls:" + std::to_string(walls) + "/particles:" + std::to_string(count);
+        for (StepKernel kernel : { StepKernel::General, StepKernel::WallScan, StepKernel::WallSplit }) {
+            benchmarks.push_back({ std::string("walls/kernel:") + StepKernelName(kernel) + scene, static_cast<double>(count),
+                                   [sim, count, walls] { FillShuffledParticles(*sim, count); FillShortWalls(*sim, walls, 8); },
+                                   [sim, &pool, dt, kernel] { DetachParticleJobs(*sim, dt, pool, kernel).wait(); } });
+        }
+
+        auto table = std::make_shared<WallTable>();
+        auto paths = std::make_shared<std::vector<WallScanPath>>();
+        for (WallScanKernel kernel : { WallScanKernel::Scalar, WallScanKernel::Avx2, WallScanKernel::Avx512 }) {
+            if (kernel > BestWallScanKernel())
+                continue;
+            benchmarks.push_back({ std::string("walls/scan:") + WallScanKernelName(kernel) + scene, static_cast<double>(count) * walls,
+                                   [sim, table, paths, count, walls, dt] {
+                                       FillShuffledParticles(*sim, count);
+                                       FillShortWalls(*sim, walls, 8);
+                                       ResizeWallTable(*table, sim->wall.size());
+                                       FillWallTable(*table, sim->wall.data(), 0, sim->wall.size());
+                                       paths->clear();
+                                       for (const Particle& particle : sim->particles) {
+                                           const Vec2 next(particle.position.x + particle.velocity.x * dt, particle.position.y + particle.velocity.y * dt);
+                                           paths->push_back(MakeWallScanPath(particle.position, next));
+                                       }
+                                   },
+                                   [table, paths, kernel] {
+                                       // every hit, as if no collision changed the path
+                                       std::size_t hits = 0;
+                                       for (const WallScanPath& path : *paths) {
+                                           for (std::size_t w = 0; (w = FirstWallHit(*table, path, w, table->count, kernel)) < table->count; ++w)
+                                               ++hits;
+                                       }
+                                       if (hits > table->count * paths->size())
+                                           std::abort();
+                                   } });
+        }
+    }
+
+    void AddPartitionBenchmarks(std::vector<Benchmark>& benchmarks, BS::thread_pool& pool) {
+        for (int count : { 1000, 100000, 10000000 }) {
+            benchmarks.push_back({ "getJobList/particles:" + std::to_string(count), 0, nullptr,
+                                   [count, &pool] {
+                                       std::vector<std::pair<int,int>> jobList = getJobList(count, static_cast<int>(pool.get_thread_count()));
+                                       if (jobList.empty())
+                                           std::abort();
+                                   } });
+            benchmarks.push_back({ "FrameJobList/particles:" + std::to_string(count), 0, nullptr,
+                                   [count, &pool] {
+                                       FrameVector<std::pair<int,int>> jobList = FrameJobList(count, static_cast<int>(pool.get_thread_count()));
+                                       if (jobList.empty())
+                                           std::abort();
+                                   } });
+        }
+    }
+
+    void AddPoolBenchmarks(std::vector<Benchmark>& benchmarks, BS::thread_pool& pool) {
+        // One frame's worth of fork/join with empty jobs: the fixed cost every step pays.
+        for (int tasks : { 1, static_cast<int>(pool.get_thread_count()), 64 }) {
+            benchmarks.push_back({ "pool/fork_join/tasks:" + std::to_string(tasks), static_cast<double>(tasks), nullptr,
+                                   [tasks, &pool] {
+                                       for (int i = 0; i < tasks; ++i)
+                                           pool.detach_task([] {});
+                                       pool.wait();
+                                   } });
+        }
+        // Enqueueing one job list, one task at a time vs. as one batch, then waiting for just those
+        // tasks; items/s is tasks through the queue.
+        struct EmptyTask {
+            void operator()() const {}
+        };
+        for (int tasks : { 1, 10, 100, 1000, 10000 }) {
+            benchmarks.push_back({ "pool/enqueue/detach_task/tasks:" + std::to_string(tasks), static_cast<double>(tasks), nullptr,
+                                   [tasks, &pool] {
+                                       for (int i = 0; i < tasks; ++i)
+                                           pool.detach_task(EmptyTask{});
+                                       pool.wait();
+                                   } });
+            auto batch = std::make_shared<std::vector<EmptyTask>>(static_cast<std::size_t>(tasks));
+            benchmarks.push_back({ "pool/enqueue/detach_batch/tasks:" + std::to_string(tasks), static_cast<double>(tasks), nullptr,
+                                   [batch, &pool] { pool.detach_batch(*batch).wait(); } });
+        }
+    }
+
+    // A large GUI spawn applied in one go, against the asynchronous SpawnJob cancelled as soon as its
+    // first block has landed: the second bounds how long "Reset" waits for a spawn in progress.
+    void AddSpawnBenchmarks(std::vector<Benchmark>& benchmarks, BS::thread_pool& pool) {
+        auto sim = std::make_shared<Simulation>();
+        auto job = std::make_shared<SpawnJob>();
+        SimEvent spawn;
+        spawn.type = SimEvent::Type::AddAngles;
+        spawn.sx = 640;
+        spawn.sy = 360;
+        spawn.startSpeed = 200.0f;
+        spawn.endAngle = 359.999f;
+        for (int count : { 4000000, 50000000 }) {
+            spawn.count = count;
+            benchmarks.push_back({ "spawn/apply/particles:" + std::to_string(count), static_cast<double>(count), nullptr,
+                                   [sim, spawn, &pool] {
+                                       ClearParticles(*sim);
+                                       ApplyEvent(*sim, spawn, &pool);
+                                   } });
+            benchmarks.push_back({ "spawn/cancel/particles:" + std::to_string(count), 0.0, nullptr,
+                                   [sim, job, spawn, &pool] {
+                                       ClearParticles(*sim);
+                                       job->Start(*sim, spawn, pool);
+                                       while (job->Progress() == 0.0f)
+                                           std::this_thread::yield();
+                                       job->Cancel();
+                                   } });
+        }
+    }
+
+    // One message per call from every worker at once, as a physics job would log: the asynchronous
+    // log (records copied to the worker's ring, then formatted and written by LogFlush(), so the rings
+    // never fill and nothing is dropped) against BS::synced_stream (formatted under its lock on the
+    // calling thread). Both write to /dev/null and include the formatting; items/s is calls.
+    void AddLogBenchmarks(std::vector<Benchmark>& benchmarks, BS::thread_pool& pool) {
+        constexpr int calls = 256;
+        const std::size_t workers = pool.get_thread_count();
+        const std::string suffix = "/calls:" + std::to_string(calls) + "/threads:" + std::to_string(workers);
+        auto logJob = [] {
+            for (int i = 0; i < calls; ++i)
+                LOG_INFO("physics job [%d, %d) done in %.3f ms", i, i + 1000, 0.25);
+        };
+        benchmarks.push_back({ "log/async" + suffix, static_cast<double>(calls * workers), [] { LogStart("/dev/null"); },
+                               [logJob, workers, &pool] {
+                                   std::vector<decltype(logJob)> jobs(workers, logJob);
+                                   pool.detach_batch(jobs.begin(), jobs.end()).wait();
+                                   LogFlush();
+                               } });
+        auto stream = std::make_shared<std::ofstream>("/dev/null");
+        auto synced = std::make_shared<BS::synced_stream>(*stream);
+        auto streamJob = [stream, synced] {
+            for (int i = 0; i < calls; ++i)
+                synced->println("physics job [", i, ", ", i + 1000, ") done in ", 0.25, " ms");
+        };
+        benchmarks.push_back({ "log/synced_stream" + suffix, static_cast<double>(calls * workers), nullptr,
+                               [streamJob, workers, &pool] {
+                                   std::vector<decltype(streamJob)> jobs(workers, streamJob);
+                                   pool.detach_batch(jobs.begin(), jobs.end()).wait();
+                               } });
+    }
+
+    // Density image of the whole default world, the GUI's render path above DENSITY_THRESHOLD particles.
+    void AddDensityBenchmarks(std::vector<Benchmark>& benchmarks, BS::thread_pool& pool) {
+        auto sim = std::make_shared<Simulation>();
+        auto density = std::make_shared<DensityBuffer>();
+        for (int count : { 100000, 1000000, 4000000 }) {
+            benchmarks.push_back({ "density/particles:" + std::to_string(count), static_cast<double>(count),
+                                   [sim, count] { FillRandomParticles(*sim, count); },
+                                   [sim, density, &pool] {
+                                       const Viewport viewport = { Vec2(0.0f, 0.0f), Vec2(1280.0f, 720.0f) };
+                                       density->Build(sim->particles, FitWorld(sim->bounds, viewport), viewport, pool);
+                                   } });
+        }
+    }
+
+#ifdef PARTICLE_BENCH_IMGUI
+    // The GUI's draw task: one AddRectFilled per particle into a window draw list.
+    void AddDrawBenchmarks(std::vector<Benchmark>& benchmarks) {
+        auto sim = std::make_shared<Simulation>();
+        auto drawList = std::make_shared<std::unique_ptr<ImDrawList>>();
+        for (int count : { 10000, 100000, 1000000 }) {
+            benchmarks.push_back({ "draw/rects/particles:" + std::to_string(count), static_cast<double>(count),
+                                   [sim, drawList, count] {
+                                       FillParticles(*sim, count, 200.0f);
+                                       *drawList = std::make_unique<ImDrawList>(ImGui::GetDrawListSharedData());
+                                   },
+                                   [sim, drawList] {
+                                       ImDrawList* list = drawList->get();
+#if IMGUI_VERSION_NUM >= 18000
+                                       list->_ResetForNewFrame();
+#else
+                                       list->Clear();
+#endif
+                                       list->PushClipRectFullScreen();
+                                       for (const auto& particle : sim->particles) {
+                                           list->AddRectFilled(
+                                               ImVec2(particle.position.x - 1.5f, particle.position.y - 1.5f),
+                                               ImVec2(particle.position.x + 1.5f, particle.position.y + 1.5f),
+                                               IM_COL32(255, 255, 255, 255)
+                                           );
+                                       }
+                                   } });
+        }
+
+        // A 100k x 100k world at 1:1 zoom: only the particles inside the 1280x720 view produce vertices.
+        for (int count : { 1000000 }) {
+            benchmarks.push_back({ "draw/rects_culled/world:100000/particles:" + std::to_string(count), static_cast<double>(count),
+                                   [sim, drawList, count] {
+                                       sim->bounds = { 100000.0f, 100000.0f };
+                                       FillRandomParticles(*sim, count);
+                                       *drawList = std::make_unique<ImDrawList>(ImGui::GetDrawListSharedData());
+                                   },
+                                   [sim, drawList] {
+                                       const Viewport viewport = { Vec2(0.0f, 0.0f), Vec2(1280.0f, 720.0f) };
+                                       const Camera camera = { Vec2(50000.0f, 50000.0f), 1.0f };
+                                       ImDrawList* list = drawList->get();
+#if IMGUI_VERSION_NUM >= 18000
+                                       list->_ResetForNewFrame();
+#else
+                                       list->Clear();
+#endif
+                                       list->PushClipRectFullScreen();
+                                       VisibleRegion visible = VisibleWorldRegion(camera, viewport, 2.0f);
+                                       for (const auto& particle : sim->particles) {
+                                           if (!visible.Contains(particle.position))
+                                               continue;
+                                           Vec2 screen = WorldToScreen(camera, viewport, particle.position);
+                                           list->AddRectFilled(ImVec2(screen.x - 1.5f, screen.y - 1.5f), ImVec2(screen.x + 1.5f, screen.y + 1.5f),
+                                                               IM_COL32(255, 255, 255, 255));
+                                       }
+                                   } });
+        }
+    }
+#endif
+
+    std::string JsonEscape(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    bool WriteJson(const std::string& path, const std::vector<Result>& results, const BenchOptions& options, unsigned threads) {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+        std::time_t now = std::time(nullptr);
+        char date[32];
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+        out << std::setprecision(6) << std::fixed;
+        out << "{\n  \"context\": {\n"
+            << "    \"date\": \"" << date << "\",\n"
+            << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+            << "    \"pool_threads\": " << threads << ",\n"
+            << "    \"repetitions\": " << options.repetitions << ",\n"
+            << "    \"min_time\": " << options.minTime << "\n"
+            << "  },\n  \"benchmarks\": [\n";
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            const Result& result = results[i];
+            out << "    {\"name\": \"" << JsonEscape(result.name) << "\", \"iterations\": " << result.iterations
+                << ", \"real_time\": " << result.medianNs << ", \"min_time\": " << result.minNs << ", \"time_unit\": \"ns\"";
+            if (result.itemsPerSecond > 0)
+                out << ", \"items_per_second\": " << result.itemsPerSecond;
+            if (result.cacheMisses >= 0)
+                out << ", \"cache_misses\": " << result.cacheMisses << ", \"l1d_misses\": " << result.l1dMisses << ", \"dtlb_misses\": " << result.dtlbMisses;
+            if (result.allocations >= 0)
+                out << ", \"allocations\": " << result.allocations;
+            out << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        return static_cast<bool>(out);
+    }
+
+    bool ParseBenchOptions(int argc, char** argv, BenchOptions& options) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (i + 1 >= argc)
+                return false;
+            if (arg == "--filter")
+                options.filter = argv[++i];
+            else if (arg == "--json")
+                options.jsonPath = argv[++i];
+            else if (arg == "--min-time")
+                options.minTime = std::atof(argv[++i]);
+            else if (arg == "--repetitions")
+                options.repetitions = std::max(1, std::atoi(argv[++i]));
+            else if (arg == "--threads")
+                options.threads = std::atoi(argv[++i]);
+            else
+                return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!ParseBenchOptions(argc, argv, options)) {
+        std::cerr << "usage: particle_bench [--filter <substring>] [--json <file>] [--min-time <seconds>] [--repetitions <n>] [--threads <n>]\n";
+        return 1;
+    }
+
+    CacheCounters counters;
+    if (!counters.Available())
+        std::cerr << "perf counters unavailable, cache and dTLB misses are not reported" << std::endl;
+
+    // Same sizing as the GUI: every hardware thread but one (or 3 on single and dual-core systems).
+    unsigned hardwareThreads = std::thread::hardware_concurrency();
+    unsigned threads = options.threads > 0 ? options.threads : (hardwareThreads > 2 ? hardwareThreads - 1 : 3);
+    BS::thread_pool pool(threads);
+    BS::thread_pool singlePool(1);
+
+#ifdef PARTICLE_BENCH_IMGUI
+    ImGui::CreateContext();
+#endif
+
+    std::vector<Benchmark> benchmarks;
+    AddStepBenchmarks(benchmarks, pool, singlePool);
+    AddLocalityBenchmarks(benchmarks, pool);
+    AddCompactBenchmarks(benchmarks, pool);
+    AddPageBenchmarks(benchmarks, pool);
+    AddEventBenchmarks(benchmarks, pool);
+    AddFastForwardBenchmarks(benchmarks, pool);
+    AddWallBenchmarks(benchmarks, pool);
+    AddPartitionBenchmarks(benchmarks, pool);
+    AddPoolBenchmarks(benchmarks, pool);
+    AddSpawnBenchmarks(benchmarks, pool);
+    AddLogBenchmarks(benchmarks, pool);
+    AddDensityBenchmarks(benchmarks, pool);
+#ifdef PARTICLE_BENCH_IMGUI
+    AddDrawBenchmarks(benchmarks);
+#endif
+
+    std::vector<Result> results;
+    std::cout << std::left << std::setw(56) << "benchmark" << std::right << std::setw(14) << "time/iter" << std::setw(14) << "iterations" << std::setw(16) << "items/s";
+    if (counters.Available())
+        std::cout << std::setw(16) << "LLC miss/iter" << std::setw(16) << "L1D miss/iter" << std::setw(16) << "dTLB miss/iter";
+    if (AllocationCountingEnabled())
+        std::cout << std::setw(16) << "allocs/iter";
+    std::cout << "\n";
+    for (const Benchmark& benchmark : benchmarks) {
+        if (!options.filter.empty() && benchmark.name.find(options.filter) == std::string::npos)
+            continue;
+        Result result = RunBenchmark(benchmark, options, counters);
+        std::cout << std::left << std::setw(56) << result.name << std::right << std::fixed << std::setprecision(0)
+                  << std::setw(11) << result.medianNs << " ns" << std::setw(14) << result.iterations;
+        if (result.itemsPerSecond > 0)
+            std::cout << std::setw(16) << std::setprecision(3) << std::scientific << result.itemsPerSecond << std::defaultfloat;
+        else if (result.cacheMisses >= 0 || result.allocations >= 0)
+            std::cout << std::setw(16) << "";
+        if (result.cacheMisses >= 0)
+            std::cout << std::fixed << std::setprecision(0) << std::setw(16) << result.cacheMisses << std::setw(16) << result.l1dMisses << std::setw(16) << result.dtlbMisses << std::defaultfloat;
+        if (result.allocations >= 0)
+            std::cout << std::fixed << std::setprecision(2) << std::setw(16) << result.allocations << std::defaultfloat;
+        std::cout << std::endl;
+        results.push_back(result);
+    }
+
+#ifdef PARTICLE_BENCH_IMGUI
+    ImGui::DestroyContext();
+#endif
+
+    if (!options.jsonPath.empty() && !WriteJson(options.jsonPath, results, options, threads)) {
+        std::cerr << "failed writing " << options.jsonPath << std::endl;
+        return 1;
+    }
+    return 0;
+}
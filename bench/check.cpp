@@ -0,0 +1,328 @@
+// particle_check: the fast paths that claim to give exactly the results of a reference path, checked
+// bit for bit on random scenes. Exits with status 1 on the first mismatch; run by ctest.
+
+#include "simulation.hpp"
+#include "compact.hpp"
+#include "fast_forward.hpp"
+#include "wall_scan.hpp"
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+    void Check(bool ok, const std::string& what) {
+        if (!ok) {
+            std::cerr << "MISMATCH: " << what << std::endl;
+            ++failures;
+        }
+    }
+
+    // Raw mt19937 output rather than std::uniform_*_distribution, whose results differ between standard libraries.
+    float RandomUnit(std::mt19937& rng) {
+        return static_cast<float>(rng() / 4294967296.0);
+    }
+
+    // `count` particles anywhere in the world, fast enough to cross several short walls per step.
+    void RandomParticles(Simulation& sim, int count, std::mt19937& rng) {
+        ClearParticles(sim);
+        for (int i = 0; i < count; ++i) {
+            const float angle = RandomUnit(rng) * 2.0f * static_cast<float>(M_PI);
+            const float speed = 50.0f + RandomUnit(rng) * 1500.0f;
+            sim.particles.push_back({ Vec2(RandomUnit(rng) * (sim.bounds.width - 1.0f), RandomUnit(rng) * (sim.bounds.height - 1.0f)),
+                                      Vec2(speed * std::cos(angle), speed * std::sin(angle)) });
+        }
+    }
+
+    // Mostly short walls, as in a maze, with some spanning the world; a few are vertical or horizontal.
+    Walls RandomWall(const Simulation& sim, std::mt19937& rng) {
+        const int width = static_cast<int>(sim.bounds.width), height = static_cast<int>(sim.bounds.height);
+        const int x = static_cast<int>(rng() % static_cast<std::uint32_t>(width));
+        const int y = static_cast<int>(rng() % static_cast<std::uint32_t>(height));
+        const int reach = rng() % 8 == 0 ? width : 40;
+        int ex = std::clamp(x + static_cast<int>(rng() % (2 * reach + 1)) - reach, 0, width - 1);
+        int ey = std::clamp(y + static_cast<int>(rng() % (2 * reach + 1)) - reach, 0, height - 1);
+        if (rng() % 10 == 0)
+            ex = x;
+        else if (rng() % 10 == 0)
+            ey = y;
+        return MakeWall(sim.bounds, x, y, ex, ey);
+    }
+
+    // Steps with one kernel; between steps walls are added, removed and moved, so the kernels that
+    // cache the walls have to notice.
+    std::uint64_t RunKernel(StepKernel kernel, int particles, int walls, std::uint32_t seed, BS::thread_pool& pool) {
+        std::mt19937 rng(seed);
+        Simulation sim;
+        RandomParticles(sim, particles, rng);
+        for (int i = 0; i < walls; ++i)
+            sim.wall.push_back(RandomWall(sim, rng));
+        const float dt = 1.0f / 60.0f;
+        for (int step = 0; step < 30; ++step) {
+            if (step % 10 == 9 && !sim.wall.empty()) {
+                sim.wall[rng() % sim.wall.size()] = RandomWall(sim, rng);
+                if (sim.wall.size() > 1)
+                    sim.wall.pop_back();
+                sim.wall.push_back(RandomWall(sim, rng));
+            }
+            NextFrame();
+            DetachParticleJobs(sim, dt, pool, kernel).wait();
+            ++sim.step;
+        }
+        return HashSimulation(sim);
+    }
+
+    // Every step kernel against General, the plain loop over sim.wall.
+    void CheckStepKernels(BS::thread_pool& pool) {
+        struct Scene {
+            int particles;
+            int walls;
+        };
+        for (const Scene scene : { Scene{ 3000, 1 }, Scene{ 3000, 7 }, Scene{ 20000, 5 }, Scene{ 3000, 16 }, Scene{ 20000, 300 },
+                                   Scene{ 1000, 5000 } }) {
+            for (std::uint32_t seed : { 1u, 2u, 3u }) {
+                const std::uint64_t reference = RunKernel(StepKernel::General, scene.particles, scene.walls, seed, pool);
+                std::vector<StepKernel> kernels = { StepKernel::WallScan, StepKernel::WallSplit };
+                if (scene.walls <= FIXED_WALLS_MAX)
+                    kernels.push_back(StepKernel::FixedWalls);
+                for (StepKernel kernel : kernels) {
+                    Check(RunKernel(kernel, scene.particles, scene.walls, seed, pool) == reference,
+                          std::string("step kernel ") + StepKernelName(kernel) + " against general, " + std::to_string(scene.particles) +
+                              " particles, " + std::to_string(scene.walls) + " walls, seed " + std::to_string(seed));
+                }
+            }
+        }
+    }
+
+    // Every scan width against doIntersect() on each wall, from several starting walls.
+    void CheckWallScan() {
+        std::mt19937 rng(7);
+        Simulation sim;
+        RandomParticles(sim, 2000, rng);
+        for (int i = 0; i < 1000; ++i)
+            sim.wall.push_back(RandomWall(sim, rng));
+        WallTable table;
+        ResizeWallTable(table, sim.wall.size());
+        FillWallTable(table, sim.wall.data(), 0, sim.wall.size());
+        const float dt = 1.0f / 60.0f;
+        for (WallScanKernel kernel : { WallScanKernel::Scalar, WallScanKernel::Avx2, WallScanKernel::Avx512 }) {
+            if (kernel > BestWallScanKernel())
+                continue;
+            for (const Particle& particle : sim.particles) {
+                const Vec2 next(particle.position.x + particle.velocity.x * dt, particle.position.y + particle.velocity.y * dt);
+                const WallScanPath path = MakeWallScanPath(particle.position, next);
+                for (std::size_t first : { std::size_t{ 0 }, std::size_t{ 3 }, std::size_t{ 517 } }) {
+                    std::size_t expected = first;
+                    while (expected < sim.wall.size() && !doIntersect(particle.position, next, sim.wall[expected].p1, sim.wall[expected].p2))
+                        ++expected;
+                    if (FirstWallHit(table, path, first, sim.wall.size(), kernel) != expected) {
+                        Check(false, std::string("wall scan ") + WallScanKernelName(kernel) + " against doIntersect()");
+                        return;
+                    }
+                }
+            }
+        }
+    }
+
+    float FloatFromBits(std::uint32_t bits) {
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    bool SameBits(const ParticleBuffer& a, const ParticleBuffer& b) {
+        return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(Particle)) == 0;
+    }
+
+    // Values the codecs round, clamp or special-case: every half float and the midpoints and neighbours
+    // between them, half-float overflow, subnormals, infinities, NaN, and a stride-7 sweep over the float
+    // bit patterns. Positions are also taken far outside the world, past the fixed-point range.
+    std::vector<float> CodecValues() {
+        std::vector<float> values;
+        for (std::uint32_t half = 0; half < 0x7c00; ++half) {
+            // the float with the same value as the half (exponent rebiased, mantissa widened)
+            const float exact = half < 0x400 ? std::ldexp(static_cast<float>(half), -24)
+                                             : std::ldexp(1.0f + static_cast<float>(half & 0x3ff) / 1024.0f, static_cast<int>(half >> 10) - 15);
+            const float next = half + 1 < 0x400 ? std::ldexp(static_cast<float>(half + 1), -24)
+                                                : std::ldexp(1.0f + static_cast<float>((half + 1) & 0x3ff) / 1024.0f, static_cast<int>((half + 1) >> 10) - 15);
+            for (float value : { exact, (exact + next) * 0.5f, std::nextafter(exact, 0.0f), std::nextafter(exact, 1e30f) }) {
+                values.push_back(value);
+                values.push_back(-value);
+            }
+        }
+        for (std::uint64_t bits = 0; bits <= 0xffffffffull; bits += 7 * 4099)
+            values.push_back(FloatFromBits(static_cast<std::uint32_t>(bits)));
+        for (float value : { 65504.0f, 65520.0f, 65536.0f, 1e6f, 1e30f, std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN(),
+                             std::numeric_limits<float>::denorm_min(), 2147483520.0f, 2147483648.0f, 4e9f })
+        {
+            values.push_back(value);
+            values.push_back(-value);
+        }
+        return values;
+    }
+
+    // The SIMD codec against the scalar one: the encoded bits, the decoded particles, and a step with and
+    // without walls (the SIMD codec integrates wall-free steps in registers). Counts that are not a
+    // multiple of 8 run the scalar tail inside the SIMD codec.
+    void CheckCompactCodecs(BS::thread_pool& pool) {
+        if (BestCompactCodec() != CompactCodec::Simd) {
+            std::cout << "compact codec check skipped: the CPU has no AVX2 + F16C" << std::endl;
+            return;
+        }
+        const std::vector<float> values = CodecValues();
+        std::mt19937 rng(11);
+        for (WorldBounds world : { WorldBounds{}, WorldBounds{ 100000.0f, 100000.0f }, WorldBounds{ 3.0f, 5.0f } }) {
+            // positions from the sweep scaled into and around the world; velocities straight from it
+            std::vector<Particle> particles(values.size());
+            for (std::size_t i = 0; i < values.size(); ++i) {
+                const float position = values[i] * world.width / 1024.0f;
+                particles[i] = { Vec2(position, values[(i * 7 + 3) % values.size()]), Vec2(values[i], values[(i * 13 + 5) % values.size()]) };
+            }
+            for (std::size_t count : { std::size_t{ 1 }, std::size_t{ 7 }, std::size_t{ 8 }, std::size_t{ 9 }, std::size_t{ 31 }, values.size() }) {
+                CompactParticles scalar(world, CompactCodec::Scalar), simd(world, CompactCodec::Simd);
+                scalar.Append(particles.data(), count);
+                simd.Append(particles.data(), count);
+                const std::string scene = ", " + std::to_string(count) + " particles in " + std::to_string(static_cast<int>(world.width)) + "x" +
+                                          std::to_string(static_cast<int>(world.height));
+                Check(simd.SameBits(scalar), "compact encode simd against scalar" + scene);
+                ParticleBuffer decodedScalar, decodedSimd;
+                scalar.Decode(decodedScalar, pool);
+                simd.Decode(decodedSimd, pool);
+                Check(SameBits(decodedSimd, decodedScalar), "compact decode simd against scalar" + scene);
+            }
+
+            // stepping needs finite particles inside the world, moving at speeds a scene has
+            Simulation sim;
+            sim.bounds = world;
+            std::vector<Particle> inside(4099);
+            for (Particle& particle : inside) {
+                particle = { Vec2(RandomUnit(rng) * (world.width - 1.0f), RandomUnit(rng) * (world.height - 1.0f)),
+                             Vec2((RandomUnit(rng) - 0.5f) * 4000.0f, (RandomUnit(rng) - 0.5f) * 4000.0f) };
+            }
+            for (int walls : { 0, 3 }) {
+                sim.wall.clear();
+                for (int i = 0; i < walls; ++i)
+                    sim.wall.push_back(RandomWall(sim, rng));
+                CompactParticles scalar(world, CompactCodec::Scalar), simd(world, CompactCodec::Simd);
+                scalar.Append(inside.data(), inside.size());
+                simd.Append(inside.data(), inside.size());
+                for (int step = 0; step < 20; ++step) {
+                    scalar.Step(sim, 1.0f / 60.0f, pool);
+                    simd.Step(sim, 1.0f / 60.0f, pool);
+                }
+                Check(simd.SameBits(scalar), "compact step simd against scalar, " + std::to_string(walls) + " walls in " +
+                                                 std::to_string(static_cast<int>(world.width)) + "x" + std::to_string(static_cast<int>(world.height)));
+            }
+        }
+    }
+
+    // Same bits, except that NaN positions only have to both be NaN (see BestFastForwardKernel()).
+    bool SameFold(const Particle* a, const Particle* b, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i) {
+            for (int field = 0; field < 4; ++field) {
+                const float x = (&a[i].position.x)[field], y = (&b[i].position.x)[field];
+                if (std::memcmp(&x, &y, sizeof(x)) != 0 && !(field < 2 && std::isnan(x) && std::isnan(y)))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // Particles whose unfolded path ends on a lap boundary (a multiple of the world size) or a few ulps
+    // either side of it, after up to many laps in either direction, plus particles outside the world and
+    // arbitrary bit patterns.
+    std::vector<Particle> FoldParticlesToCheck(const WorldBounds& world, std::mt19937& rng) {
+        std::vector<Particle> particles;
+        const double seconds = 1.0;
+        for (int lap = -40; lap <= 40; ++lap) {
+            for (int i = 0; i < 16; ++i) {
+                const float x = RandomUnit(rng) * world.width;
+                const float y = RandomUnit(rng) * world.height;
+                const float vx = static_cast<float>((lap * static_cast<double>(world.width) - x) / seconds);
+                const float vy = static_cast<float>((lap * static_cast<double>(world.height) - y) / seconds);
+                Particle particle{ Vec2(x, y), Vec2(vx, vy) };
+                for (int ulps = 0; ulps < 4; ++ulps) {
+                    particles.push_back(particle);
+                    particle.position.x = std::nextafter(particle.position.x, i % 2 ? 1e30f : -1e30f);
+                    particle.velocity.y = std::nextafter(particle.velocity.y, i % 4 < 2 ? 1e30f : -1e30f);
+                }
+            }
+        }
+        for (int i = 0; i < 2000; ++i) {
+            // outside the world, as far as the fixed-point range of compact storage
+            const float scale = std::ldexp(1.0f, static_cast<int>(rng() % 31));
+            particles.push_back({ Vec2((RandomUnit(rng) - 0.5f) * scale * world.width, (RandomUnit(rng) - 0.5f) * scale * world.height),
+                                  Vec2((RandomUnit(rng) - 0.5f) * 1e5f, (RandomUnit(rng) - 0.5f) * 1e5f) });
+        }
+        for (int i = 0; i < 2000; ++i) {
+            particles.push_back({ Vec2(FloatFromBits(rng()), FloatFromBits(rng())), Vec2(FloatFromBits(rng()), FloatFromBits(rng())) });
+        }
+        for (float edge : { 0.0f, -0.0f, world.width, std::nextafter(world.width, 0.0f), std::nextafter(world.width, 1e30f) })
+            particles.push_back({ Vec2(edge, edge), Vec2(edge, -edge) });
+        return particles;
+    }
+
+    // The SIMD fold against the scalar one, directly and through FastForward() on an open scene, where
+    // every particle inside the world is folded.
+    void CheckFastForwardFold(BS::thread_pool& pool) {
+        if (BestFastForwardKernel() != FastForwardKernel::Simd) {
+            std::cout << "fast-forward fold check skipped: the CPU has no AVX2" << std::endl;
+            return;
+        }
+        std::mt19937 rng(5);
+        for (WorldBounds world : { WorldBounds{}, WorldBounds{ 100000.0f, 100000.0f }, WorldBounds{ 3.0f, 5.0f } }) {
+            const std::vector<Particle> particles = FoldParticlesToCheck(world, rng);
+            const std::string in = " in " + std::to_string(static_cast<int>(world.width)) + "x" + std::to_string(static_cast<int>(world.height));
+            for (double seconds : { 1.0, 1.0 / 60.0, 3600.0, 1e-7 }) {
+                // an odd count leaves a particle for the scalar tail of the SIMD kernel
+                for (std::size_t count : { particles.size(), particles.size() - 1 }) {
+                    std::vector<Particle> scalar(particles.begin(), particles.begin() + static_cast<std::ptrdiff_t>(count));
+                    std::vector<Particle> simd = scalar;
+                    FoldParticles(scalar.data(), count, seconds, world, FastForwardKernel::Scalar);
+                    FoldParticles(simd.data(), count, seconds, world, FastForwardKernel::Simd);
+                    Check(SameFold(scalar.data(), simd.data(), count),
+                          "fast-forward fold simd against scalar, " + std::to_string(seconds) + " s" + in);
+                }
+            }
+
+            Simulation scalar;
+            scalar.bounds = world;
+            for (const Particle& particle : particles) {
+                const Vec2 p = particle.position;
+                if (p.x >= 0.0f && p.x <= world.width && p.y >= 0.0f && p.y <= world.height && std::isfinite(particle.velocity.x) &&
+                    std::isfinite(particle.velocity.y))
+                    scalar.particles.push_back(particle);
+            }
+            Simulation simd = scalar;
+            const FastForwardStats stats = FastForward(scalar, 1.0, pool, FastForwardKernel::Scalar);
+            FastForward(simd, 1.0, pool, FastForwardKernel::Simd);
+            Check(stats.followed == 0, "fast-forward followed particles in an open scene" + in);
+            Check(SameBits(simd.particles, scalar.particles), "fast-forward simd against scalar" + in);
+        }
+    }
+}
+
+int main() {
+    // WallSplit needs more than one worker
+    BS::thread_pool pool(3);
+    CheckStepKernels(pool);
+    CheckWallScan();
+    CheckCompactCodecs(pool);
+    CheckFastForwardFold(pool);
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+}
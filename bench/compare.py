@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Compare two particle_bench (or Google Benchmark) JSON result files.
+
+    python3 bench/compare.py baseline.json candidate.json [--threshold 5]
+
+Prints the per-benchmark change in time per iteration and exits with status 1
+if any benchmark present in both files got slower by more than the threshold
+(in percent), so it can gate a change on throughput.
+"""
+
+import argparse
+import json
+import sys
+
+UNIT_NS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    results = {}
+    for bench in data.get("benchmarks", []):
+        # Google Benchmark also emits aggregate rows; keep plain runs and medians only.
+        if bench.get("aggregate_name") not in (None, "median"):
+            continue
+        name = bench.get("run_name", bench["name"])
+        results[name] = bench["real_time"] * UNIT_NS[bench.get("time_unit", "ns")]
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline")
+    parser.add_argument("candidate")
+    parser.add_argument("--threshold", type=float, default=5.0, help="allowed slowdown in percent (default 5)")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    candidate = load(args.candidate)
+
+    regressions = []
+    width = max([len(name) for name in baseline] + [len("benchmark")])
+    print(f"{'benchmark':<{width}} {'baseline':>14} {'candidate':>14} {'change':>9}")
+    for name, base_ns in baseline.items():
+        if name not in candidate:
+            print(f"{name:<{width}} {base_ns:>11.0f} ns {'missing':>14}")
+            continue
+        cand_ns = candidate[name]
+        change = (cand_ns - base_ns) / base_ns * 100.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions.append(name)
+        elif change < -args.threshold:
+            flag = "  improved"
+        print(f"{name:<{width}} {base_ns:>11.0f} ns {cand_ns:>11.0f} ns {change:>+8.1f}%{flag}")
+    for name in candidate:
+        if name not in baseline:
+            print(f"{name:<{width}} {'new':>14} {candidate[name]:>11.0f} ns")
+
+    if regressions:
+        print(f"\n{len(regressions)} benchmark(s) slower by more than {args.threshold:g}%", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,35 @@
+#include "camera.hpp"
+
+#include <algorithm>
+
+Camera FitWorld(const WorldBounds& world, const Viewport& viewport) {
+    Camera camera;
+    camera.center = Vec2(world.width * 0.5f, world.height * 0.5f);
+    camera.zoom = std::min(viewport.size.x / world.width, viewport.size.y / world.height);
+    return camera;
+}
+
+Vec2 ScreenToWorld(const Camera& camera, const Viewport& viewport, Vec2 point) {
+    return Vec2(camera.center.x + (point.x - viewport.min.x - viewport.size.x * 0.5f) / camera.zoom,
+                camera.center.y + (point.y - viewport.min.y - viewport.size.y * 0.5f) / camera.zoom);
+}
+
+VisibleRegion VisibleWorldRegion(const Camera& camera, const Viewport& viewport, float marginPixels) {
+    Vec2 topLeft = ScreenToWorld(camera, viewport, Vec2(viewport.min.x - marginPixels, viewport.min.y - marginPixels));
+    Vec2 bottomRight = ScreenToWorld(camera, viewport, Vec2(viewport.min.x + viewport.size.x + marginPixels,
+                                                             viewport.min.y + viewport.size.y + marginPixels));
+    return { topLeft.x, topLeft.y, bottomRight.x, bottomRight.y };
+}
+
+void ZoomAt(Camera& camera, const Viewport& viewport, Vec2 screenPoint, float factor) {
+    Vec2 anchor = ScreenToWorld(camera, viewport, screenPoint);
+    camera.zoom = std::clamp(camera.zoom * factor, 1e-5f, 64.0f);
+    // move the centre so `anchor` maps back onto `screenPoint`
+    camera.center.x = anchor.x - (screenPoint.x - viewport.min.x - viewport.size.x * 0.5f) / camera.zoom;
+    camera.center.y = anchor.y - (screenPoint.y - viewport.min.y - viewport.size.y * 0.5f) / camera.zoom;
+}
+
+void Pan(Camera& camera, Vec2 screenDelta) {
+    camera.center.x -= screenDelta.x / camera.zoom;
+    camera.center.y -= screenDelta.y / camera.zoom;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "simulation.hpp"
+
+// Maps simulation space onto the screen rectangle the canvas is drawn in, so the world can be larger
+// (or smaller) than the window. Both spaces have y growing downwards.
+struct Viewport {
+    Vec2 min;  // top-left corner on screen
+    Vec2 size; // in pixels
+};
+
+struct Camera {
+    Vec2 center;       // world point shown at the middle of the viewport
+    float zoom = 1.0f; // screen pixels per world unit
+};
+
+// World-space rectangle; particles outside it are not drawn.
+struct VisibleRegion {
+    float minX, minY, maxX, maxY;
+
+    bool Contains(Vec2 point) const { return point.x >= minX && point.x <= maxX && point.y >= minY && point.y <= maxY; }
+};
+
+// Centres the world and zooms until all of it fits. A 1280x720 world in a 1280x720 viewport maps 1:1.
+Camera FitWorld(const WorldBounds& world, const Viewport& viewport);
+
+inline Vec2 WorldToScreen(const Camera& camera, const Viewport& viewport, Vec2 point) {
+    return Vec2(viewport.min.x + viewport.size.x * 0.5f + (point.x - camera.center.x) * camera.zoom,
+                viewport.min.y + viewport.size.y * 0.5f + (point.y - camera.center.y) * camera.zoom);
+}
+
+Vec2 ScreenToWorld(const Camera& camera, const Viewport& viewport, Vec2 point);
+
+// The part of the world inside the viewport, grown by `marginPixels` so shapes straddling the edge still get drawn.
+VisibleRegion VisibleWorldRegion(const Camera& camera, const Viewport& viewport, float marginPixels);
+
+// Multiplies the zoom by `factor`, keeping the world point under `screenPoint` in place (mouse-wheel zoom).
+void ZoomAt(Camera& camera, const Viewport& viewport, Vec2 screenPoint, float factor);
+// Moves the view by a screen-space drag delta.
+void Pan(Camera& camera, Vec2 screenDelta);
@@ -0,0 +1,136 @@
+# Two-stage profile-guided build of particle_headless, and its speedup over a plain Release build.
+#
+#   cmake [-DBUILD_DIR=<dir>] [-DSTEPS=<n>] [-DREPETITIONS=<n>] [-DTHREADS=<n>] [-DSCENARIOS="a.ini;b.ini"] -P cmake/pgo.cmake
+#
+# or `cmake --build <build> --target pgo`. Stages:
+#   1. <BUILD_DIR>/plain:   Release, no LTO or PGO (the baseline)
+#   2. <BUILD_DIR>/pgo:     instrumented with PARTICLE_PGO=GENERATE, then every scenario is run once to train
+#   3. <BUILD_DIR>/pgo:     reconfigured with PARTICLE_PGO=USE and LTO on all targets and rebuilt in place
+#                           (GCC names profiles after the object paths, so both stages share one directory)
+#   4. both binaries run every scenario REPETITIONS times, alternating; the fastest run of each counts.
+# The final state hashes must match, otherwise the optimized build changed the results.
+
+if(NOT SOURCE_DIR)
+    get_filename_component(SOURCE_DIR "${CMAKE_CURRENT_LIST_DIR}/.." ABSOLUTE)
+endif()
+if(NOT BUILD_DIR)
+    set(BUILD_DIR "${SOURCE_DIR}/build-pgo")
+endif()
+if(NOT SCENARIOS)
+    file(GLOB SCENARIOS "${SOURCE_DIR}/scenarios/*.ini")
+endif()
+if(NOT STEPS)
+    set(STEPS 120) # per scenario; the full scenarios take minutes with few cores
+endif()
+if(NOT REPETITIONS)
+    set(REPETITIONS 3)
+endif()
+set(PROFILE_DIR "${BUILD_DIR}/profiles")
+
+function(build_headless dir)
+    list(JOIN ARGN " " options)
+    message(STATUS "Building ${dir} ${options}")
+    execute_process(
+        COMMAND ${CMAKE_COMMAND} -S ${SOURCE_DIR} -B ${dir} -DCMAKE_BUILD_TYPE=Release -DPARTICLE_GUI=OFF ${ARGN}
+        RESULT_VARIABLE result OUTPUT_QUIET)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "configuring ${dir} failed")
+    endif()
+    execute_process(
+        COMMAND ${CMAKE_COMMAND} --build ${dir} --target particle_headless --parallel
+        RESULT_VARIABLE result OUTPUT_QUIET)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "building ${dir} failed")
+    endif()
+endfunction()
+
+# Runs one scenario and sets <prefix>_ms and <prefix>_hash in the caller.
+function(run_headless binary scenario prefix)
+    set(arguments --scenario ${scenario} --steps ${STEPS})
+    if(THREADS)
+        list(APPEND arguments --threads ${THREADS})
+    endif()
+    execute_process(COMMAND ${binary} ${arguments} RESULT_VARIABLE result OUTPUT_VARIABLE output)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${binary} failed on ${scenario}")
+    endif()
+    string(REGEX MATCH "elapsed ms: ([0-9]+)" unused "${output}")
+    set(${prefix}_ms ${CMAKE_MATCH_1} PARENT_SCOPE)
+    string(REGEX MATCH "hash: ([0-9a-f]+)" unused "${output}")
+    set(${prefix}_hash ${CMAKE_MATCH_1} PARENT_SCOPE)
+endfunction()
+
+# "1.234" from a ratio given in thousandths
+function(format_ratio permille out)
+    math(EXPR whole "${permille} / 1000")
+    math(EXPR fraction "${permille} % 1000")
+    string(LENGTH "${fraction}" length)
+    while(length LESS 3)
+        set(fraction "0${fraction}")
+        string(LENGTH "${fraction}" length)
+    endwhile()
+    set(${out} "${whole}.${fraction}" PARENT_SCOPE)
+endfunction()
+
+set(PLAIN "${BUILD_DIR}/plain/build/particle_headless")
+set(OPTIMIZED "${BUILD_DIR}/pgo/build/particle_headless")
+
+build_headless(${BUILD_DIR}/plain -DPARTICLE_PGO=OFF -DPARTICLE_LTO_TARGETS= -DPARTICLE_NATIVE_TARGETS=)
+
+file(REMOVE_RECURSE ${PROFILE_DIR})
+build_headless(${BUILD_DIR}/pgo -DPARTICLE_PGO=GENERATE -DPARTICLE_PGO_DIR=${PROFILE_DIR} -DPARTICLE_LTO_TARGETS= -DPARTICLE_NATIVE_TARGETS=)
+foreach(scenario IN LISTS SCENARIOS)
+    message(STATUS "Training on ${scenario}")
+    run_headless(${OPTIMIZED} ${scenario} train)
+endforeach()
+
+# Clang writes raw profiles that have to be merged first
+file(GLOB raw_profiles "${PROFILE_DIR}/*.profraw")
+if(raw_profiles)
+    find_program(LLVM_PROFDATA NAMES llvm-profdata REQUIRED)
+    execute_process(COMMAND ${LLVM_PROFDATA} merge -o ${PROFILE_DIR}/default.profdata ${raw_profiles} RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "llvm-profdata merge failed")
+    endif()
+endif()
+
+build_headless(${BUILD_DIR}/pgo -DPARTICLE_PGO=USE -DPARTICLE_PGO_DIR=${PROFILE_DIR} -DPARTICLE_LTO_TARGETS=all)
+
+set(report "")
+set(plain_total 0)
+set(optimized_total 0)
+foreach(scenario IN LISTS SCENARIOS)
+    set(plain_best "")
+    set(optimized_best "")
+    foreach(repetition RANGE 1 ${REPETITIONS})
+        run_headless(${PLAIN} ${scenario} plain)
+        run_headless(${OPTIMIZED} ${scenario} optimized)
+        if(NOT plain_hash STREQUAL optimized_hash)
+            message(FATAL_ERROR "${scenario}: hash ${optimized_hash} of the PGO build differs from ${plain_hash}")
+        endif()
+        if(plain_best STREQUAL "" OR plain_ms LESS plain_best)
+            set(plain_best ${plain_ms})
+        endif()
+        if(optimized_best STREQUAL "" OR optimized_ms LESS optimized_best)
+            set(optimized_best ${optimized_ms})
+        endif()
+    endforeach()
+    math(EXPR plain_total "${plain_total} + ${plain_best}")
+    math(EXPR optimized_total "${optimized_total} + ${optimized_best}")
+    if(optimized_best GREATER 0)
+        math(EXPR permille "${plain_best} * 1000 / ${optimized_best}")
+        format_ratio(${permille} speedup)
+    else()
+        set(speedup "-")
+    endif()
+    get_filename_component(name ${scenario} NAME)
+    string(APPEND report "  ${name}: plain ${plain_best} ms, pgo+lto ${optimized_best} ms, speedup ${speedup}x\n")
+endforeach()
+
+if(optimized_total GREATER 0)
+    math(EXPR permille "${plain_total} * 1000 / ${optimized_total}")
+    format_ratio(${permille} speedup)
+else()
+    set(speedup "-")
+endif()
+message("PGO+LTO vs. plain Release, ${STEPS} steps per scenario, best of ${REPETITIONS}:\n${report}  total: plain ${plain_total} ms, pgo+lto ${optimized_total} ms, speedup ${speedup}x")
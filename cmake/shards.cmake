@@ -0,0 +1,78 @@
+# Weak scaling of sharded headless runs: the world and the particle count grow with the shard count,
+# so every shard has the same amount of work, and the time should stay flat while there are cores.
+#
+#   cmake -DHEADLESS=<particle_headless> [-DSHARDS="1;2;4"] [-DPARTICLES_PER_SHARD=<n>] [-DSTEPS=<n>]
+#         [-DTHREADS_PER_SHARD=<n>] [-DTRANSPORT=shm|socket] [-DWORK_DIR=<dir>] -P cmake/shards.cmake
+#
+# or `cmake --build <build> --target shards`. For each shard count a streams scenario of
+# PARTICLES_PER_SHARD x count particles in a (1280 x count) x 720 world is generated and run once in a
+# single process and once sharded; the state hashes must match. Efficiency is the one-shard time over
+# the n-shard time.
+
+if(NOT HEADLESS)
+    message(FATAL_ERROR "pass -DHEADLESS=<path to particle_headless>")
+endif()
+if(NOT SHARDS)
+    set(SHARDS 1 2 4)
+endif()
+if(NOT PARTICLES_PER_SHARD)
+    set(PARTICLES_PER_SHARD 250000)
+endif()
+if(NOT STEPS)
+    set(STEPS 120)
+endif()
+if(NOT THREADS_PER_SHARD)
+    set(THREADS_PER_SHARD 1)
+endif()
+if(NOT TRANSPORT)
+    set(TRANSPORT shm)
+endif()
+if(NOT WORK_DIR)
+    get_filename_component(WORK_DIR "${HEADLESS}" DIRECTORY)
+endif()
+
+# Runs particle_headless and sets <prefix>_ms and <prefix>_hash in the caller.
+function(run_headless prefix)
+    execute_process(COMMAND ${HEADLESS} --headless ${ARGN} RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_VARIABLE errors)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "particle_headless ${ARGN} failed:\n${errors}")
+    endif()
+    string(REGEX MATCH "elapsed ms: ([0-9]+)" unused "${output}")
+    set(${prefix}_ms ${CMAKE_MATCH_1} PARENT_SCOPE)
+    string(REGEX MATCH "hash: ([0-9a-f]+)" unused "${output}")
+    set(${prefix}_hash ${CMAKE_MATCH_1} PARENT_SCOPE)
+    string(REGEX MATCH "migrated: ([0-9]+)" unused "${output}")
+    set(${prefix}_migrated ${CMAKE_MATCH_1} PARENT_SCOPE)
+endfunction()
+
+set(report "")
+set(baseline "")
+foreach(shards IN LISTS SHARDS)
+    math(EXPR particles "${PARTICLES_PER_SHARD} * ${shards}")
+    math(EXPR width "1280 * ${shards}")
+    set(scenario "${WORK_DIR}/weak-scaling-${shards}.ini")
+    execute_process(COMMAND ${HEADLESS} --generate streams --out ${scenario} --particles ${particles} --steps ${STEPS} --world ${width}x720
+                    RESULT_VARIABLE result OUTPUT_QUIET)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "generating ${scenario} failed")
+    endif()
+
+    message(STATUS "${shards} shard(s), ${particles} particles")
+    run_headless(single --scenario ${scenario} --steps ${STEPS} --threads ${THREADS_PER_SHARD})
+    run_headless(sharded --scenario ${scenario} --steps ${STEPS} --threads ${THREADS_PER_SHARD} --shards ${shards} --shard-transport ${TRANSPORT})
+    if(NOT single_hash STREQUAL sharded_hash)
+        message(FATAL_ERROR "${shards} shards: hash ${sharded_hash} differs from the single-process ${single_hash}")
+    endif()
+    if(baseline STREQUAL "")
+        set(baseline ${sharded_ms})
+    endif()
+    if(sharded_ms GREATER 0)
+        math(EXPR efficiency "${baseline} * 100 / ${sharded_ms}")
+    else()
+        set(efficiency "-")
+    endif()
+    string(APPEND report "  ${shards} shard(s), ${particles} particles: single process ${single_ms} ms, sharded ${sharded_ms} ms, "
+                         "migrated ${sharded_migrated}, efficiency ${efficiency}%\n")
+endforeach()
+
+message("Weak scaling, ${PARTICLES_PER_SHARD} particles and ${THREADS_PER_SHARD} thread(s) per shard, ${STEPS} steps, ${TRANSPORT}:\n${report}")
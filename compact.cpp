@@ -0,0 +1,372 @@
+#include "compact.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+// compiled for AVX2 + F16C regardless of -march; only called after checking the CPU
+#define COMPACT_SIMD 1
+#define COMPACT_SIMD_TARGET __attribute__((target("avx2,f16c")))
+#elif defined(__AVX2__)
+#define COMPACT_SIMD 1
+#define COMPACT_SIMD_TARGET
+#endif
+#endif
+
+namespace {
+    constexpr std::size_t BlockSize = 256; // particles decoded at a time; 4 KB of floats, stays in L1
+    // Largest floats that convert to int32 without overflowing
+    constexpr float FixedMin = -2147483648.0f;
+    constexpr float FixedMax = 2147483520.0f;
+
+    // Round to nearest even, overflow to infinity, NaN stays NaN: the same bits as _mm256_cvtps_ph.
+    std::uint16_t FloatToHalf(float value) {
+        std::uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const std::uint32_t sign = (bits >> 16) & 0x8000u;
+        const std::uint32_t exponent = (bits >> 23) & 0xffu;
+        std::uint32_t mantissa = bits & 0x7fffffu;
+        if (exponent == 0xffu)
+            return static_cast<std::uint16_t>(sign | 0x7c00u | (mantissa ? 0x200u | (mantissa >> 13) : 0u));
+        const int halfExponent = static_cast<int>(exponent) - 127 + 15;
+        if (halfExponent >= 31)
+            return static_cast<std::uint16_t>(sign | 0x7c00u);
+        std::uint32_t shift = 13;
+        std::uint32_t half = static_cast<std::uint32_t>(halfExponent) << 10;
+        if (halfExponent <= 0) {
+            // subnormal half: the implicit bit becomes explicit and the exponent goes to 0
+            if (halfExponent < -10)
+                return static_cast<std::uint16_t>(sign);
+            mantissa |= 0x800000u;
+            shift = static_cast<std::uint32_t>(14 - halfExponent);
+            half = 0;
+        }
+        half |= mantissa >> shift;
+        const std::uint32_t rest = mantissa & ((1u << shift) - 1);
+        const std::uint32_t halfway = 1u << (shift - 1);
+        // a carry out of the mantissa correctly bumps the exponent, up to infinity
+        if (rest > halfway || (rest == halfway && (half & 1u)))
+            ++half;
+        return static_cast<std::uint16_t>(sign | half);
+    }
+
+    float HalfToFloat(std::uint16_t half) {
+        const std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000u) << 16;
+        std::uint32_t exponent = (half >> 10) & 0x1fu;
+        std::uint32_t mantissa = half & 0x3ffu;
+        std::uint32_t bits;
+        if (exponent == 0x1fu) {
+            // infinity, or a NaN made quiet like the hardware does
+            bits = sign | 0x7f800000u | (mantissa ? 0x400000u | (mantissa << 13) : 0u);
+        } else if (exponent != 0) {
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        } else if (mantissa == 0) {
+            bits = sign;
+        } else {
+            // subnormal half, normal float
+            exponent = 113;
+            while (!(mantissa & 0x400u)) {
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+        }
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // Same result as _mm256_max_ps(_mm256_min_ps(v, FixedMax), FixedMin) followed by _mm256_cvtps_epi32.
+    std::int32_t ToFixed(float value, float toFixed) {
+        float scaled = value * toFixed;
+        scaled = scaled < FixedMax ? scaled : FixedMax;
+        scaled = scaled > FixedMin ? scaled : FixedMin;
+        return static_cast<std::int32_t>(std::nearbyint(scaled));
+    }
+
+    void DecodeScalar(const std::int32_t* x, const std::int32_t* y, const std::uint16_t* vx, const std::uint16_t* vy,
+                      std::size_t count, float fromFixed, Particle* out) {
+        for (std::size_t i = 0; i < count; ++i) {
+            out[i].position = Vec2(static_cast<float>(x[i]) * fromFixed, static_cast<float>(y[i]) * fromFixed);
+            out[i].velocity = Vec2(HalfToFloat(vx[i]), HalfToFloat(vy[i]));
+        }
+    }
+
+    void EncodeScalar(const Particle* in, std::size_t count, float toFixed,
+                      std::int32_t* x, std::int32_t* y, std::uint16_t* vx, std::uint16_t* vy) {
+        for (std::size_t i = 0; i < count; ++i) {
+            x[i] = ToFixed(in[i].position.x, toFixed);
+            y[i] = ToFixed(in[i].position.y, toFixed);
+            vx[i] = FloatToHalf(in[i].velocity.x);
+            vy[i] = FloatToHalf(in[i].velocity.y);
+        }
+    }
+
+#ifdef COMPACT_SIMD
+    // Eight particles per iteration: convert the four component arrays, then transpose them into
+    // x, y, vx, vy records (Particle) in registers.
+    COMPACT_SIMD_TARGET
+    void DecodeSimd(const std::int32_t* x, const std::int32_t* y, const std::uint16_t* vx, const std::uint16_t* vy,
+                    std::size_t count, float fromFixed, Particle* out) {
+        const __m256 scale = _mm256_set1_ps(fromFixed);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 px = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i))), scale);
+            __m256 py = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + i))), scale);
+            __m256 pvx = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(vx + i)));
+            __m256 pvy = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(vy + i)));
+
+            __m256 xy01 = _mm256_unpacklo_ps(px, py);   // x0 y0 x1 y1 | x4 y4 x5 y5
+            __m256 xy23 = _mm256_unpackhi_ps(px, py);   // x2 y2 x3 y3 | x6 y6 x7 y7
+            __m256 v01 = _mm256_unpacklo_ps(pvx, pvy);  // vx0 vy0 vx1 vy1 | vx4 vy4 vx5 vy5
+            __m256 v23 = _mm256_unpackhi_ps(pvx, pvy);
+            __m256 p04 = _mm256_shuffle_ps(xy01, v01, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 p15 = _mm256_shuffle_ps(xy01, v01, _MM_SHUFFLE(3, 2, 3, 2));
+            __m256 p26 = _mm256_shuffle_ps(xy23, v23, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 p37 = _mm256_shuffle_ps(xy23, v23, _MM_SHUFFLE(3, 2, 3, 2));
+
+            float* record = reinterpret_cast<float*>(out + i);
+            _mm256_storeu_ps(record + 0, _mm256_permute2f128_ps(p04, p15, 0x20));
+            _mm256_storeu_ps(record + 8, _mm256_permute2f128_ps(p26, p37, 0x20));
+            _mm256_storeu_ps(record + 16, _mm256_permute2f128_ps(p04, p15, 0x31));
+            _mm256_storeu_ps(record + 24, _mm256_permute2f128_ps(p26, p37, 0x31));
+        }
+        DecodeScalar(x + i, y + i, vx + i, vy + i, count - i, fromFixed, out + i);
+    }
+
+    COMPACT_SIMD_TARGET
+    void EncodeSimd(const Particle* in, std::size_t count, float toFixed,
+                    std::int32_t* x, std::int32_t* y, std::uint16_t* vx, std::uint16_t* vy) {
+        const __m256 scale = _mm256_set1_ps(toFixed);
+        const __m256 fixedMin = _mm256_set1_ps(FixedMin);
+        const __m256 fixedMax = _mm256_set1_ps(FixedMax);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            const float* record = reinterpret_cast<const float*>(in + i);
+            __m256 p01 = _mm256_loadu_ps(record + 0);
+            __m256 p23 = _mm256_loadu_ps(record + 8);
+            __m256 p45 = _mm256_loadu_ps(record + 16);
+            __m256 p67 = _mm256_loadu_ps(record + 24);
+            __m256 p04 = _mm256_permute2f128_ps(p01, p45, 0x20);
+            __m256 p15 = _mm256_permute2f128_ps(p01, p45, 0x31);
+            __m256 p26 = _mm256_permute2f128_ps(p23, p67, 0x20);
+            __m256 p37 = _mm256_permute2f128_ps(p23, p67, 0x31);
+
+            __m256 xy01 = _mm256_unpacklo_ps(p04, p15); // x0 x1 y0 y1 | x4 x5 y4 y5
+            __m256 v01 = _mm256_unpackhi_ps(p04, p15);  // vx0 vx1 vy0 vy1 | ...
+            __m256 xy23 = _mm256_unpacklo_ps(p26, p37);
+            __m256 v23 = _mm256_unpackhi_ps(p26, p37);
+            __m256 px = _mm256_shuffle_ps(xy01, xy23, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 py = _mm256_shuffle_ps(xy01, xy23, _MM_SHUFFLE(3, 2, 3, 2));
+            __m256 pvx = _mm256_shuffle_ps(v01, v23, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 pvy = _mm256_shuffle_ps(v01, v23, _MM_SHUFFLE(3, 2, 3, 2));
+
+            px = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(px, scale), fixedMax), fixedMin);
+            py = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(py, scale), fixedMax), fixedMin);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(x + i), _mm256_cvtps_epi32(px));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + i), _mm256_cvtps_epi32(py));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(vx + i), _mm256_cvtps_ph(pvx, _MM_FROUND_TO_NEAREST_INT));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(vy + i), _mm256_cvtps_ph(pvy, _MM_FROUND_TO_NEAREST_INT));
+        }
+        EncodeScalar(in + i, count - i, toFixed, x + i, y + i, vx + i, vy + i);
+    }
+
+    // The no-wall step without leaving the component layout: decode, integrate and encode eight particles
+    // in registers. Lanes that leave the world go through AdjustParticlePosition like in StepParticles,
+    // so the result is bit-for-bit the one of the block path. Returns how many particles it stepped (a
+    // multiple of 8); the caller does the rest.
+    COMPACT_SIMD_TARGET
+    std::size_t StepNoWallsSimd(std::int32_t* x, std::int32_t* y, std::uint16_t* vx, std::uint16_t* vy, std::size_t count,
+                                float dt, WorldBounds bounds, float toFixed, float fromFixed) {
+        const __m256 fromScale = _mm256_set1_ps(fromFixed);
+        const __m256 toScale = _mm256_set1_ps(toFixed);
+        const __m256 fixedMin = _mm256_set1_ps(FixedMin);
+        const __m256 fixedMax = _mm256_set1_ps(FixedMax);
+        const __m256 step = _mm256_set1_ps(dt);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 width = _mm256_set1_ps(bounds.width);
+        const __m256 height = _mm256_set1_ps(bounds.height);
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 px = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i))), fromScale);
+            __m256 py = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + i))), fromScale);
+            __m256 pvx = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(vx + i)));
+            __m256 pvy = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(vy + i)));
+            px = _mm256_add_ps(px, _mm256_mul_ps(pvx, step));
+            py = _mm256_add_ps(py, _mm256_mul_ps(pvy, step));
+
+            __m256 outside = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(px, zero, _CMP_LE_OQ), _mm256_cmp_ps(px, width, _CMP_GT_OQ)),
+                                          _mm256_or_ps(_mm256_cmp_ps(py, zero, _CMP_LE_OQ), _mm256_cmp_ps(py, height, _CMP_GT_OQ)));
+            if (int lanes = _mm256_movemask_ps(outside)) {
+                alignas(32) float lx[8], ly[8], lvx[8], lvy[8];
+                _mm256_store_ps(lx, px);
+                _mm256_store_ps(ly, py);
+                _mm256_store_ps(lvx, pvx);
+                _mm256_store_ps(lvy, pvy);
+                for (int lane = 0; lane < 8; ++lane) {
+                    if (!(lanes & (1 << lane)))
+                        continue;
+                    Particle particle = { Vec2(lx[lane], ly[lane]), Vec2(lvx[lane], lvy[lane]) };
+                    AdjustParticlePosition(particle, bounds.width, bounds.height);
+                    lx[lane] = particle.position.x;
+                    ly[lane] = particle.position.y;
+                    lvx[lane] = particle.velocity.x;
+                    lvy[lane] = particle.velocity.y;
+                }
+                px = _mm256_load_ps(lx);
+                py = _mm256_load_ps(ly);
+                pvx = _mm256_load_ps(lvx);
+                pvy = _mm256_load_ps(lvy);
+            }
+
+            px = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(px, toScale), fixedMax), fixedMin);
+            py = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(py, toScale), fixedMax), fixedMin);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(x + i), _mm256_cvtps_epi32(px));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + i), _mm256_cvtps_epi32(py));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(vx + i), _mm256_cvtps_ph(pvx, _MM_FROUND_TO_NEAREST_INT));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(vy + i), _mm256_cvtps_ph(pvy, _MM_FROUND_TO_NEAREST_INT));
+        }
+        return i;
+    }
+#endif
+}
+
+CompactCodec BestCompactCodec() {
+#if defined(COMPACT_SIMD) && (defined(__GNUC__) || defined(__clang__))
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+    return supported ? CompactCodec::Simd : CompactCodec::Scalar;
+#elif defined(COMPACT_SIMD)
+    return CompactCodec::Simd;
+#else
+    return CompactCodec::Scalar;
+#endif
+}
+
+const char* CompactCodecName(CompactCodec codec) {
+    return codec == CompactCodec::Simd ? "simd" : "scalar";
+}
+
+CompactParticles::CompactParticles(const WorldBounds& world, CompactCodec codec) : codec(codec) {
+#ifndef COMPACT_SIMD
+    this->codec = CompactCodec::Scalar;
+#endif
+    // Whole bits needed for the largest coordinate, plus one spare for positions just past the edge
+    // before they bounce. The rest of the 31 value bits hold the fraction.
+    const float extent = std::max(world.width, world.height);
+    int integerBits = 1;
+    while (integerBits < 30 && static_cast<float>(1 << integerBits) <= extent)
+        ++integerBits;
+    fractionBits = std::max(0, 30 - integerBits);
+    toFixed = std::ldexp(1.0f, fractionBits);
+    fromFixed = std::ldexp(1.0f, -fractionBits);
+}
+
+void CompactParticles::Append(const Particle* particles, std::size_t count) {
+    const std::size_t first = Size();
+    x.resize(first + count);
+    y.resize(first + count);
+    vx.resize(first + count);
+    vy.resize(first + count);
+    EncodeBlock(first, count, particles);
+}
+
+void CompactParticles::Clear() {
+    x.clear();
+    y.clear();
+    vx.clear();
+    vy.clear();
+}
+
+void CompactParticles::DecodeBlock(std::size_t first, std::size_t count, Particle* out) const {
+#ifdef COMPACT_SIMD
+    if (codec == CompactCodec::Simd) {
+        DecodeSimd(x.data() + first, y.data() + first, vx.data() + first, vy.data() + first, count, fromFixed, out);
+        return;
+    }
+#endif
+    DecodeScalar(x.data() + first, y.data() + first, vx.data() + first, vy.data() + first, count, fromFixed, out);
+}
+
+void CompactParticles::EncodeBlock(std::size_t first, std::size_t count, const Particle* in) {
+#ifdef COMPACT_SIMD
+    if (codec == CompactCodec::Simd) {
+        EncodeSimd(in, count, toFixed, x.data() + first, y.data() + first, vx.data() + first, vy.data() + first);
+        return;
+    }
+#endif
+    EncodeScalar(in, count, toFixed, x.data() + first, y.data() + first, vx.data() + first, vy.data() + first);
+}
+
+void CompactParticles::Decode(ParticleBuffer& out, BS::thread_pool& pool) const {
+    out.resize(Size());
+    if (out.empty())
+        return;
+    DetachFrameBlocks<std::size_t>(pool, 0, Size(), [this, &out](std::size_t begin, std::size_t end) {
+        DecodeBlock(begin, end - begin, out.data() + begin);
+    }).wait();
+}
+
+void CompactParticles::Step(const Simulation& sim, float dt, BS::thread_pool& pool) {
+    TRACE_SCOPE("compact step");
+    FrameVector<std::pair<int,int>> jobList = FrameJobList(static_cast<int>(Size()), static_cast<int>(pool.get_thread_count()));
+    DetachFrameBatch(pool, jobList.size(),
+        [this, &sim, dt, &jobList](std::size_t i)
+        {
+            return [this, &sim, dt, job = jobList[i]]
+            {
+                PROFILE_WORKER_ZONE();
+                TRACE_SCOPE_INDEX("compact chunk", job.first);
+                std::array<Particle, BlockSize> block;
+                std::size_t begin = static_cast<std::size_t>(job.first);
+                const std::size_t end = static_cast<std::size_t>(job.second) + 1;
+#ifdef COMPACT_SIMD
+                if (codec == CompactCodec::Simd && sim.wall.empty())
+                    begin += StepNoWallsSimd(x.data() + begin, y.data() + begin, vx.data() + begin, vy.data() + begin, end - begin,
+                                             dt, sim.bounds, toFixed, fromFixed);
+#endif
+                for (std::size_t first = begin; first < end; first += BlockSize) {
+                    const std::size_t count = std::min(BlockSize, end - first);
+                    DecodeBlock(first, count, block.data());
+                    StepParticleBlock(block.data(), count, sim, dt);
+                    EncodeBlock(first, count, block.data());
+                }
+            };
+        }).wait();
+}
+
+bool CompactParticles::SameBits(const CompactParticles& other) const {
+    return fractionBits == other.fractionBits && x == other.x && y == other.y && vx == other.vx && vy == other.vy;
+}
+
+CompactAccuracy MeasureCompactAccuracy(const ParticleBuffer& reference, const ParticleBuffer& compact, float divergence) {
+    CompactAccuracy accuracy;
+    const std::size_t count = std::min(reference.size(), compact.size());
+    if (count == 0)
+        return accuracy;
+    double positionSum = 0;
+    double velocitySum = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        const Particle& expected = reference[i];
+        const Particle& actual = compact[i];
+        double distance = std::hypot(static_cast<double>(expected.position.x) - actual.position.x,
+                                     static_cast<double>(expected.position.y) - actual.position.y);
+        positionSum += distance;
+        accuracy.maxPositionError = std::max(accuracy.maxPositionError, distance);
+        if (distance > divergence)
+            ++accuracy.diverged;
+        double speed = std::hypot(static_cast<double>(expected.velocity.x), static_cast<double>(expected.velocity.y));
+        if (speed > 0) {
+            velocitySum += std::hypot(static_cast<double>(expected.velocity.x) - actual.velocity.x,
+                                      static_cast<double>(expected.velocity.y) - actual.velocity.y) / speed;
+        }
+    }
+    accuracy.meanPositionError = positionSum / count;
+    accuracy.meanVelocityError = velocitySum / count;
+    return accuracy;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "simulation.hpp"
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compact particle storage for scenes large enough that the step is bound by memory bandwidth:
+// 12 bytes per particle instead of 16, stored as separate arrays.
+//   - positions: 32-bit fixed point with as many fraction bits as the world size leaves (19 for the
+//     default 1280x720 world, 13 for 100000x100000), finer than a float near the far edge of the world
+//   - velocities: IEEE half floats, about 3 significant digits. Wall bounces only rotate the velocity,
+//     so the relative error stays the same whatever the speed of a batch.
+// The step decodes a block of particles into floats, runs the regular step kernel on it and encodes
+// it back, so the physics is the float path's; only the stored state is rounded. Without walls the SIMD
+// codec integrates in registers between decoding and encoding, with the same result.
+// Once walls are involved the rounding decides which side of a wall a particle hits, and the runs diverge:
+// over its 600 steps, fan ends with 26% of its particles more than a unit from the float run (up to 751).
+// Use it for open scenes, or where statistics matter more than individual trajectories.
+enum class CompactCodec {
+    Scalar, // portable bit manipulation
+    Simd    // AVX2 + F16C, 8 particles per instruction; picked when the CPU supports it
+};
+
+// The fastest codec the running CPU supports. Both produce the same bits.
+CompactCodec BestCompactCodec();
+const char* CompactCodecName(CompactCodec codec);
+
+class CompactParticles {
+public:
+    explicit CompactParticles(const WorldBounds& world, CompactCodec codec = BestCompactCodec());
+
+    void Append(const Particle* particles, std::size_t count);
+    void Clear();
+    std::size_t Size() const { return x.size(); }
+    int FractionBits() const { return fractionBits; }
+
+    // Decodes every particle into `out`, in the order they were appended. Waits for the pool.
+    void Decode(ParticleBuffer& out, BS::thread_pool& pool) const;
+    // One step of `dt` against sim's walls and bounds (sim.particles is not touched). Waits for the pool.
+    void Step(const Simulation& sim, float dt, BS::thread_pool& pool);
+    // Whether both hold the same encoded particles, bit for bit; checks one codec against the other.
+    bool SameBits(const CompactParticles& other) const;
+
+private:
+    void DecodeBlock(std::size_t first, std::size_t count, Particle* out) const;
+    void EncodeBlock(std::size_t first, std::size_t count, const Particle* in);
+
+    CompactCodec codec;
+    int fractionBits = 0;
+    float toFixed = 1.0f;
+    float fromFixed = 1.0f;
+    std::vector<std::int32_t> x;
+    std::vector<std::int32_t> y;
+    std::vector<std::uint16_t> vx; // half floats
+    std::vector<std::uint16_t> vy;
+};
+
+// How far a compact run ended from the float run of the same events. Particles are matched by index,
+// so both runs must keep their particles in append order (Simulation::sleeping off, sortInterval 0).
+struct CompactAccuracy {
+    double meanPositionError = 0; // world units
+    double maxPositionError = 0;
+    double meanVelocityError = 0; // relative to the float speed
+    std::size_t diverged = 0;     // particles more than `divergence` world units away
+};
+
+CompactAccuracy MeasureCompactAccuracy(const ParticleBuffer& reference, const ParticleBuffer& compact, float divergence = 1.0f);
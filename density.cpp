@@ -0,0 +1,81 @@
+#include "density.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+    // Counts at or above this show as full white; below it brightness grows with log(count), so a lone
+    // particle is still visible next to a dense cluster.
+    constexpr std::uint32_t SaturationCount = 64;
+
+    std::uint32_t Grey(std::uint32_t value) {
+        return (255u << 24) | (value << 16) | (value << 8) | value;
+    }
+
+    const std::array<std::uint32_t, SaturationCount + 1>& ColorTable() {
+        static const std::array<std::uint32_t, SaturationCount + 1> table = [] {
+            std::array<std::uint32_t, SaturationCount + 1> colors = {};
+            colors[0] = 0; // fully transparent, the window background shows through
+            for (std::uint32_t count = 1; count <= SaturationCount; ++count) {
+                float level = std::log2(1.0f + count) / std::log2(1.0f + SaturationCount);
+                colors[count] = Grey(static_cast<std::uint32_t>(64 + 191 * level));
+            }
+            return colors;
+        }();
+        return table;
+    }
+}
+
+void DensityBuffer::Build(const ParticleBuffer& particles, const Camera& camera, const Viewport& viewport, BS::thread_pool& pool) {
+    TRACE_SCOPE("density");
+    width = std::max(1, static_cast<int>(viewport.size.x));
+    height = std::max(1, static_cast<int>(viewport.size.y));
+    const std::size_t pixelCount = static_cast<std::size_t>(width) * height;
+    const std::size_t jobs = std::max<std::size_t>(1, pool.get_thread_count());
+    partials.resize(jobs);
+    counts.resize(pixelCount);
+    pixels.resize(pixelCount);
+
+    // Same mapping as WorldToScreen, relative to the viewport corner, with the constants folded.
+    const float offsetX = viewport.size.x * 0.5f - camera.center.x * camera.zoom;
+    const float offsetY = viewport.size.y * 0.5f - camera.center.y * camera.zoom;
+    const float zoom = camera.zoom;
+    const std::size_t total = particles.size();
+    DetachFrameBatch(pool, jobs, [this, &particles, jobs, total, pixelCount, offsetX, offsetY, zoom](std::size_t job) {
+        return [this, &particles, job, jobs, total, pixelCount, offsetX, offsetY, zoom] {
+            TRACE_SCOPE_INDEX("density bin", static_cast<std::int64_t>(job));
+            std::vector<std::uint32_t>& partial = partials[job];
+            partial.assign(pixelCount, 0);
+            const float maxX = static_cast<float>(width);
+            const float maxY = static_cast<float>(height);
+            for (std::size_t i = total * job / jobs, end = total * (job + 1) / jobs; i < end; ++i) {
+                float x = particles[i].position.x * zoom + offsetX;
+                float y = particles[i].position.y * zoom + offsetY;
+                // also rejects NaN
+                if (!(x >= 0.0f && x < maxX && y >= 0.0f && y < maxY))
+                    continue;
+                ++partial[static_cast<std::size_t>(y) * width + static_cast<std::size_t>(x)];
+            }
+        };
+    }).wait();
+
+    // Reduce and colour in bands of rows; each band only touches its own slice of every buffer.
+    const std::array<std::uint32_t, SaturationCount + 1>& colors = ColorTable();
+    DetachFrameBlocks<std::size_t>(pool, 0, static_cast<std::size_t>(height),
+        [this, &colors](std::size_t firstRow, std::size_t endRow)
+        {
+            TRACE_SCOPE("density reduce");
+            const std::size_t first = firstRow * width;
+            const std::size_t end = endRow * width;
+            std::copy(partials[0].begin() + first, partials[0].begin() + end, counts.begin() + first);
+            for (std::size_t job = 1; job < partials.size(); ++job) {
+                const std::vector<std::uint32_t>& partial = partials[job];
+                for (std::size_t p = first; p < end; ++p)
+                    counts[p] += partial[p];
+            }
+            for (std::size_t p = first; p < end; ++p)
+                pixels[p] = colors[std::min(counts[p], SaturationCount)];
+        }).wait();
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "camera.hpp"
+#include "simulation.hpp"
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+
+#include <cstdint>
+#include <vector>
+
+#define DENSITY_THRESHOLD 250000 // Particle count above which the GUI's "Auto" render mode draws the density image instead of rects
+
+// Per-pixel particle counts over a viewport, for scenes where drawing one rect per particle costs more
+// than the frame. Building it is O(particles / threads + pixels) and the result is drawn as a single
+// textured quad, so render cost no longer depends on the particle count.
+//
+// Each job bins its share of the particles into a private full-viewport count buffer (no atomics, no
+// sharing); the buffers are then summed row-band by row-band in parallel and mapped to RGBA8.
+class DensityBuffer {
+public:
+    // Counts the particles in view and refreshes Pixels(). Waits for the pool.
+    void Build(const ParticleBuffer& particles, const Camera& camera, const Viewport& viewport, BS::thread_pool& pool);
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    // Row-major, top row first; one byte each of R, G, B, A, i.e. GL_RGBA / GL_UNSIGNED_BYTE.
+    const std::vector<std::uint32_t>& Pixels() const { return pixels; }
+    const std::vector<std::uint32_t>& Counts() const { return counts; }
+
+private:
+    int width = 0;
+    int height = 0;
+    std::vector<std::vector<std::uint32_t>> partials; // one count buffer per job
+    std::vector<std::uint32_t> counts;
+    std::vector<std::uint32_t> pixels;
+};
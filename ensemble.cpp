@@ -0,0 +1,89 @@
+#include "ensemble.hpp"
+
+#include <cmath>
+
+std::vector<EnsembleMember> EnsembleGrid(const std::vector<SweepAxis>& axes) {
+    std::vector<EnsembleMember> members(1);
+    for (const SweepAxis& axis : axes) {
+        std::vector<EnsembleMember> expanded;
+        expanded.reserve(members.size() * axis.values.size());
+        for (const EnsembleMember& member : members) {
+            for (float value : axis.values) {
+                EnsembleMember next = member;
+                switch (axis.parameter) {
+                    case SweepParameter::Speed: next.speedScale = value; break;
+                    case SweepParameter::Angle: next.angleOffset = value; break;
+                    case SweepParameter::Count: next.countScale = value; break;
+                }
+                expanded.push_back(next);
+            }
+        }
+        members.swap(expanded);
+    }
+    return members;
+}
+
+EventLog ApplySweep(const EventLog& log, const EnsembleMember& member) {
+    EventLog swept = log;
+    for (SimEvent& event : swept.events) {
+        if (event.type != SimEvent::Type::AddPoints && event.type != SimEvent::Type::AddAngles && event.type != SimEvent::Type::AddVelocities)
+            continue;
+        // unchanged bits for the identity member, so it reproduces the plain run
+        if (member.speedScale != 1.0f) {
+            event.startSpeed *= member.speedScale;
+            event.endSpeed *= member.speedScale;
+        }
+        if (member.angleOffset != 0.0f) {
+            event.startAngle += member.angleOffset;
+            event.endAngle += member.angleOffset;
+        }
+        if (member.countScale != 1.0f)
+            event.count = static_cast<int>(std::lround(event.count * static_cast<double>(member.countScale)));
+    }
+    return swept;
+}
+
+namespace {
+    void RunMember(const EventLog& log, std::uint64_t steps, float dt, EnsembleMember& member) {
+        const EventLog swept = ApplySweep(log, member);
+        Simulation sim;
+        sim.bounds = swept.world;
+        ReplayCursor replay(swept);
+        while (sim.step < steps) {
+            replay.ApplyDue(sim);
+            StepParticleBlock(sim.particles.data(), sim.particles.size(), sim, dt);
+            member.particleSteps += sim.particles.size();
+            ++sim.step;
+        }
+
+        member.particles = sim.particles.size();
+        member.hash = HashSimulation(sim);
+        if (sim.particles.empty())
+            return;
+        double sumX = 0.0, sumY = 0.0, sumSpeed = 0.0;
+        for (const Particle& particle : sim.particles) {
+            sumX += particle.position.x;
+            sumY += particle.position.y;
+            sumSpeed += std::sqrt(static_cast<double>(particle.velocity.x) * particle.velocity.x + static_cast<double>(particle.velocity.y) * particle.velocity.y);
+        }
+        const double count = static_cast<double>(sim.particles.size());
+        member.meanX = sumX / count;
+        member.meanY = sumY / count;
+        member.meanSpeed = sumSpeed / count;
+        double squares = 0.0;
+        for (const Particle& particle : sim.particles) {
+            const double dx = particle.position.x - member.meanX;
+            const double dy = particle.position.y - member.meanY;
+            squares += dx * dx + dy * dy;
+        }
+        member.spread = std::sqrt(squares / count);
+    }
+}
+
+void RunEnsemble(const EventLog& log, std::uint64_t steps, float dt, std::vector<EnsembleMember>& members, BS::thread_pool& pool) {
+    // one task per member; the queue hands the next member to whichever worker finishes first
+    pool.detach_sequence<std::size_t>(0, members.size(), [&log, steps, dt, &members](std::size_t index) {
+        RunMember(log, steps, dt, members[index]);
+    });
+    pool.wait();
+}
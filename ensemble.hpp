@@ -0,0 +1,39 @@
+#pragma once
+
+#include "replay.hpp"
+#include "run_options.hpp"
+#include "simulation.hpp"
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+
+#include <cstdint>
+#include <vector>
+
+// Parameter sweeps: the same scenario run many times with the batch-add values changed, every run a
+// small independent simulation. Each member is one pool task stepped on a single worker
+// (StepParticleBlock over all of its particles), so the pool runs as many members at once as it has
+// workers and a member never waits for another. Members differ only in their spawns, so a member with
+// the identity parameters ends in the same state (and hash) as a plain run of the scenario.
+struct EnsembleMember {
+    // Applied to every spawn event of the scenario
+    float speedScale = 1.0f;  // multiplies the speeds of all three panels
+    float angleOffset = 0.0f; // degrees added to every angle
+    float countScale = 1.0f;  // multiplies the particle counts (rounded)
+
+    // Results
+    std::uint64_t particles = 0;
+    std::uint64_t particleSteps = 0; // particles stepped, summed over the steps
+    std::uint64_t hash = 0;          // HashSimulation of the final state
+    double meanX = 0.0;
+    double meanY = 0.0;
+    double meanSpeed = 0.0;
+    double spread = 0.0; // root mean square distance from the mean position
+};
+
+// Every combination of the axes' values, the first axis varying slowest. No axes: one identity member.
+std::vector<EnsembleMember> EnsembleGrid(const std::vector<SweepAxis>& axes);
+
+// `log` with the member's parameters applied to its spawn events.
+EventLog ApplySweep(const EventLog& log, const EnsembleMember& member);
+
+// Runs every member for `steps` steps of `dt` and fills in its results. Waits for the pool.
+void RunEnsemble(const EventLog& log, std::uint64_t steps, float dt, std::vector<EnsembleMember>& members, BS::thread_pool& pool);
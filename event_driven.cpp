@@ -0,0 +1,225 @@
+#include "event_driven.hpp"
+#include "arena.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+EventDrivenParticles::EventDrivenParticles(const WorldBounds& world, double bucketWidth)
+    : world(world), bucketWidth(bucketWidth), buckets(EVENT_QUEUE_BUCKETS) {}
+
+std::uint64_t EventDrivenParticles::Day(double time) const {
+    return static_cast<std::uint64_t>(time / bucketWidth);
+}
+
+void EventDrivenParticles::Plan(Flight& flight, const WorldBounds& world, const std::vector<Walls>& walls) {
+    const double x = flight.origin.x;
+    const double y = flight.origin.y;
+    const double vx = flight.velocity.x;
+    const double vy = flight.velocity.y;
+    double best = std::numeric_limits<double>::infinity();
+    std::int32_t hit = NoHit;
+    auto consider = [&best, &hit](double time, std::int32_t what) {
+        // already past a side (spawned outside the world): bounce straight away
+        time = std::max(time, 0.0);
+        if (time < best) {
+            best = time;
+            hit = what;
+        }
+    };
+
+    if (vx < 0.0)
+        consider(x / -vx, HitLeft);
+    else if (vx > 0.0)
+        consider((world.width - x) / vx, HitRight);
+    if (vy < 0.0)
+        consider(y / -vy, HitTop);
+    else if (vy > 0.0)
+        consider((world.height - y) / vy, HitBottom);
+
+    // Path origin + velocity * s against each segment p1 + (p2 - p1) * u.
+    for (std::size_t w = 0; w < walls.size(); ++w) {
+        if (static_cast<std::int32_t>(w) == flight.lastWall)
+            continue;
+        const double ex = static_cast<double>(walls[w].p2.x) - walls[w].p1.x;
+        const double ey = static_cast<double>(walls[w].p2.y) - walls[w].p1.y;
+        const double denominator = vx * ey - vy * ex;
+        if (denominator == 0.0)
+            continue;
+        const double ax = walls[w].p1.x - x;
+        const double ay = walls[w].p1.y - y;
+        const double s = (ax * ey - ay * ex) / denominator;
+        const double u = (ax * vy - ay * vx) / denominator;
+        if (s > 0.0 && u >= 0.0 && u <= 1.0 && s < best) {
+            best = s;
+            hit = static_cast<std::int32_t>(w);
+        }
+    }
+    flight.next = flight.start + best;
+    flight.hit = hit;
+}
+
+void EventDrivenParticles::Bounce(Flight& flight, const WorldBounds& world, const std::vector<Walls>& walls) {
+    const double elapsed = flight.next - flight.start;
+    Vec2 position(static_cast<float>(flight.origin.x + flight.velocity.x * elapsed),
+                  static_cast<float>(flight.origin.y + flight.velocity.y * elapsed));
+    flight.lastWall = NoHit;
+    switch (flight.hit) {
+        case HitLeft:
+            position.x = 0.0f;
+            flight.velocity.x = -flight.velocity.x;
+            break;
+        case HitRight:
+            position.x = world.width;
+            flight.velocity.x = -flight.velocity.x;
+            break;
+        case HitTop:
+            position.y = 0.0f;
+            flight.velocity.y = -flight.velocity.y;
+            break;
+        case HitBottom:
+            position.y = world.height;
+            flight.velocity.y = -flight.velocity.y;
+            break;
+        default: {
+            // same reflection as the fixed step's wall collision
+            const Walls& wallSegment = walls[static_cast<std::size_t>(flight.hit)];
+            Vec2 normal(wallSegment.p2.y - wallSegment.p1.y, wallSegment.p1.x - wallSegment.p2.x);
+            const float length = std::sqrt(normal.x * normal.x + normal.y * normal.y);
+            normal = Vec2(normal.x / length, normal.y / length);
+            const float dotProduct = 2.0f * (flight.velocity.x * normal.x + flight.velocity.y * normal.y);
+            flight.velocity.x -= dotProduct * normal.x;
+            flight.velocity.y -= dotProduct * normal.y;
+            flight.lastWall = flight.hit;
+            break;
+        }
+    }
+    flight.origin = position;
+    flight.start = flight.next;
+    Plan(flight, world, walls);
+}
+
+void EventDrivenParticles::Enqueue(std::uint32_t index) {
+    const Flight& flight = particles[index];
+    if (std::isinf(flight.next))
+        return;
+    // a particle that ran out of bounces last step is still due: keep it in a bucket the next step scans
+    buckets[std::max(Day(flight.next), Day(now)) % EVENT_QUEUE_BUCKETS].push_back(index);
+}
+
+void EventDrivenParticles::Append(const Particle* added, std::size_t count) {
+    particles.reserve(particles.size() + count);
+    for (std::size_t i = 0; i < count; ++i) {
+        Flight flight;
+        flight.origin = added[i].position;
+        flight.velocity = added[i].velocity;
+        flight.start = now;
+        Plan(flight, world, walls);
+        particles.push_back(flight);
+        Enqueue(static_cast<std::uint32_t>(particles.size() - 1));
+    }
+}
+
+void EventDrivenParticles::Clear() {
+    particles.clear();
+    for (std::vector<std::uint32_t>& bucket : buckets)
+        bucket.clear();
+}
+
+void EventDrivenParticles::Replan(BS::thread_pool& pool) {
+    const double time = now;
+    DetachFrameBlocks<std::size_t>(pool, 0, particles.size(), [this, time](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            Flight& flight = particles[i];
+            const double elapsed = time - flight.start;
+            flight.origin = Vec2(static_cast<float>(flight.origin.x + flight.velocity.x * elapsed),
+                                 static_cast<float>(flight.origin.y + flight.velocity.y * elapsed));
+            flight.start = time;
+            flight.lastWall = NoHit;
+            Plan(flight, world, walls);
+        }
+    }).wait();
+    for (std::vector<std::uint32_t>& bucket : buckets)
+        bucket.clear();
+    for (std::size_t i = 0; i < particles.size(); ++i)
+        Enqueue(static_cast<std::uint32_t>(i));
+}
+
+void EventDrivenParticles::Step(const Simulation& sim, float dt, BS::thread_pool& pool) {
+    TRACE_SCOPE("event step");
+    if (sim.bounds.width != world.width || sim.bounds.height != world.height || sim.wall.size() != walls.size() ||
+        (!walls.empty() && std::memcmp(sim.wall.data(), walls.data(), walls.size() * sizeof(Walls)) != 0)) {
+        world = sim.bounds;
+        walls = sim.wall;
+        Replan(pool);
+    }
+
+    const double end = now + dt;
+    // Take everything due by `end` out of the buckets the step passes through; a bucket also holds
+    // particles a whole number of years later, which stay.
+    const std::uint64_t firstDay = Day(now);
+    const std::uint64_t days = std::min<std::uint64_t>(Day(end) - firstDay + 1, EVENT_QUEUE_BUCKETS);
+    due.clear();
+    for (std::uint64_t day = firstDay; day < firstDay + days; ++day) {
+        std::vector<std::uint32_t>& bucket = buckets[day % EVENT_QUEUE_BUCKETS];
+        std::size_t kept = 0;
+        for (std::uint32_t index : bucket) {
+            if (particles[index].next <= end)
+                due.push_back(index);
+            else
+                bucket[kept++] = index;
+        }
+        bucket.resize(kept);
+    }
+
+    std::atomic<std::uint64_t> events{ 0 };
+    const std::size_t blocks = std::clamp<std::size_t>(due.size() / 256, 1, pool.get_thread_count());
+    DetachFrameBlocks<std::size_t>(pool, 0, due.size(), [this, end, &events](std::size_t begin, std::size_t last) {
+        std::uint64_t handled = 0;
+        for (std::size_t i = begin; i < last; ++i) {
+            Flight& flight = particles[due[i]];
+            for (int bounces = 0; flight.next <= end && bounces < EVENT_MAX_BOUNCES_PER_STEP; ++bounces) {
+                Bounce(flight, world, walls);
+                ++handled;
+            }
+        }
+        events.fetch_add(handled, std::memory_order_relaxed);
+    }, blocks).wait();
+
+    now = end;
+    for (std::uint32_t index : due)
+        Enqueue(index);
+    lastEvents = events.load(std::memory_order_relaxed);
+    totalEvents += lastEvents;
+}
+
+void EventDrivenParticles::Evaluate(ParticleBuffer& out, BS::thread_pool& pool) const {
+    out.resize(particles.size());
+    const double time = now;
+    Particle* target = out.data();
+    DetachFrameBlocks<std::size_t>(pool, 0, particles.size(), [this, time, target](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            const Flight& flight = particles[i];
+            const double elapsed = time - flight.start;
+            target[i].position = Vec2(static_cast<float>(flight.origin.x + flight.velocity.x * elapsed),
+                                      static_cast<float>(flight.origin.y + flight.velocity.y * elapsed));
+            target[i].velocity = flight.velocity;
+        }
+    }).wait();
+}
+
+Particle EventDrivenParticles::Advance(const Particle& particle, double seconds, const WorldBounds& world, const std::vector<Walls>& walls) {
+    Flight flight;
+    flight.origin = particle.position;
+    flight.velocity = particle.velocity;
+    Plan(flight, world, walls);
+    // the cap only matters for a particle wedged where it keeps hitting without moving on
+    for (int bounces = 0; flight.next <= seconds && bounces < (1 << 24); ++bounces)
+        Bounce(flight, world, walls);
+    const double elapsed = seconds - flight.start;
+    return { Vec2(static_cast<float>(flight.origin.x + flight.velocity.x * elapsed), static_cast<float>(flight.origin.y + flight.velocity.y * elapsed)),
+             flight.velocity };
+}
@@ -0,0 +1,201 @@
+#include "fast_forward.hpp"
+#include "arena.hpp"
+#include "event_driven.hpp"
+#include "trace.hpp"
+#include "wall_grid.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+// compiled for AVX2 regardless of -march; only called after checking the CPU
+#define FAST_FORWARD_SIMD 1
+#define FAST_FORWARD_SIMD_TARGET __attribute__((target("avx2")))
+#elif defined(__AVX2__)
+#define FAST_FORWARD_SIMD 1
+#define FAST_FORWARD_SIMD_TARGET
+#endif
+#endif
+
+namespace {
+    constexpr std::size_t GroupSize = 8;  // particles classified together; a group without walls near goes to the kernel whole
+    constexpr float WallMargin = 0.01f;   // grows the region a path covers before the wall lookup, for rounding
+
+    // Position along one axis of the unfolded coordinate `u`, in [0, size]; flips the velocity on odd laps.
+    // The SIMD kernel does the same operations in the same order.
+    double Fold(double u, double size, float& velocity) {
+        const double period = 2.0 * size;
+        const double m = u - std::floor(u / period) * period;
+        double x = m;
+        if (m > size) {
+            x = period - m;
+            velocity = -velocity;
+        }
+        return std::min(std::max(x, 0.0), size);
+    }
+
+    double FoldPosition(double u, double size) {
+        float ignored = 0.0f;
+        return Fold(u, size, ignored);
+    }
+
+    void FoldScalar(Particle& particle, double seconds, const WorldBounds& world) {
+        const double x = Fold(particle.position.x + static_cast<double>(particle.velocity.x) * seconds, world.width, particle.velocity.x);
+        const double y = Fold(particle.position.y + static_cast<double>(particle.velocity.y) * seconds, world.height, particle.velocity.y);
+        particle.position = Vec2(static_cast<float>(x), static_cast<float>(y));
+    }
+
+    // The part of [0, size] a particle covers along one axis while its unfolded coordinate goes from
+    // `from` to `to`: between the two folded ends if no side is passed, out to the side if one is, all of
+    // it if both are.
+    void CoveredRange(double from, double to, double size, float& low, float& high) {
+        const double a = std::min(from, to);
+        const double b = std::max(from, to);
+        const double firstLap = std::floor(a / size);
+        const double lastLap = std::floor(b / size);
+        double lo = std::min(FoldPosition(a, size), FoldPosition(b, size));
+        double hi = std::max(FoldPosition(a, size), FoldPosition(b, size));
+        if (lastLap == firstLap + 1) {
+            // the side at lastLap * size: 0 on even laps, size on odd ones
+            if (std::fmod(lastLap, 2.0) == 0.0)
+                lo = 0.0;
+            else
+                hi = size;
+        } else if (lastLap > firstLap + 1) {
+            lo = 0.0;
+            hi = size;
+        }
+        low = static_cast<float>(lo) - WallMargin;
+        high = static_cast<float>(hi) + WallMargin;
+    }
+
+    // Whether the fold is not enough for this particle.
+    bool NeedsFollowing(const Particle& particle, double seconds, const WorldBounds& world, const WallGrid& grid) {
+        const Vec2 p = particle.position;
+        // the event-driven physics bounces a particle outside the world straight back; the fold would wrap it in
+        if (p.x < 0.0f || p.x > world.width || p.y < 0.0f || p.y > world.height)
+            return true;
+        if (grid.Empty())
+            return false;
+        Vec2 min, max;
+        CoveredRange(p.x, p.x + static_cast<double>(particle.velocity.x) * seconds, world.width, min.x, max.x);
+        CoveredRange(p.y, p.y + static_cast<double>(particle.velocity.y) * seconds, world.height, min.y, max.y);
+        return grid.AnyWallNear(min, max);
+    }
+
+#ifdef FAST_FORWARD_SIMD
+    // FoldScalar on particles[0, count), two particles per 256-bit register as doubles.
+    FAST_FORWARD_SIMD_TARGET
+    void FoldSimd(Particle* particles, std::size_t count, double seconds, const WorldBounds& world) {
+        // px0 py0 vx0 vy0 px1 py1 vx1 vy1 <-> px0 py0 px1 py1 vx0 vy0 vx1 vy1; the shuffle is its own inverse
+        const __m256i split = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+        const __m256d time = _mm256_set1_pd(seconds);
+        const __m256d size = _mm256_setr_pd(world.width, world.height, world.width, world.height);
+        const __m256d period = _mm256_mul_pd(_mm256_set1_pd(2.0), size);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        const __m256i lowHalves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+        std::size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            float* lane = &particles[i].position.x;
+            const __m256 grouped = _mm256_permutevar8x32_ps(_mm256_loadu_ps(lane), split);
+            const __m256d position = _mm256_cvtps_pd(_mm256_castps256_ps128(grouped));
+            const __m256d velocity = _mm256_cvtps_pd(_mm256_extractf128_ps(grouped, 1));
+            const __m256d u = _mm256_add_pd(position, _mm256_mul_pd(velocity, time));
+            const __m256d m = _mm256_sub_pd(u, _mm256_mul_pd(_mm256_floor_pd(_mm256_div_pd(u, period)), period));
+            const __m256d odd = _mm256_cmp_pd(m, size, _CMP_GT_OQ);
+            __m256d folded = _mm256_blendv_pd(m, _mm256_sub_pd(period, m), odd);
+            // operands in this order return `folded` when it is NaN (or equal), like std::max and std::min in Fold()
+            folded = _mm256_min_pd(size, _mm256_max_pd(zero, folded));
+            // the sign flipped on the float velocity itself, as Fold() does; a round trip through double
+            // would quiet a signaling NaN
+            const __m128 oddLanes = _mm256_castps256_ps128(_mm256_permutevar8x32_ps(_mm256_castpd_ps(odd), lowHalves));
+            const __m128 flipped = _mm_xor_ps(_mm256_extractf128_ps(grouped, 1), _mm_and_ps(oddLanes, sign));
+            const __m256 packed = _mm256_set_m128(flipped, _mm256_cvtpd_ps(folded));
+            _mm256_storeu_ps(lane, _mm256_permutevar8x32_ps(packed, split));
+        }
+        for (; i < count; ++i)
+            FoldScalar(particles[i], seconds, world);
+    }
+#endif
+
+    void FoldBlock(Particle* particles, std::size_t count, double seconds, const WorldBounds& world, FastForwardKernel kernel) {
+#ifdef FAST_FORWARD_SIMD
+        if (kernel == FastForwardKernel::Simd) {
+            FoldSimd(particles, count, seconds, world);
+            return;
+        }
+#else
+        (void)kernel;
+#endif
+        for (std::size_t i = 0; i < count; ++i)
+            FoldScalar(particles[i], seconds, world);
+    }
+}
+
+void FoldParticles(Particle* particles, std::size_t count, double seconds, const WorldBounds& world, FastForwardKernel kernel) {
+    FoldBlock(particles, count, seconds, world, kernel);
+}
+
+FastForwardKernel BestFastForwardKernel() {
+#if defined(FAST_FORWARD_SIMD) && (defined(__GNUC__) || defined(__clang__))
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported ? FastForwardKernel::Simd : FastForwardKernel::Scalar;
+#elif defined(FAST_FORWARD_SIMD)
+    return FastForwardKernel::Simd;
+#else
+    return FastForwardKernel::Scalar;
+#endif
+}
+
+const char* FastForwardKernelName(FastForwardKernel kernel) {
+    return kernel == FastForwardKernel::Simd ? "simd" : "scalar";
+}
+
+FastForwardStats FastForward(Simulation& sim, double seconds, BS::thread_pool& pool, FastForwardKernel kernel) {
+    TRACE_SCOPE("fast-forward");
+    FastForwardStats stats;
+    const std::size_t first = sim.sleepingCount;
+    const std::size_t last = sim.particles.size();
+    if (first >= last || seconds <= 0.0)
+        return stats;
+
+    const WallGrid grid(sim.wall, sim.bounds);
+    const std::vector<Walls>& walls = sim.wall;
+    const WorldBounds world = sim.bounds;
+    Particle* particles = sim.particles.data();
+    std::atomic<std::size_t> followed{ 0 };
+    const std::size_t groups = (last - first + GroupSize - 1) / GroupSize;
+    DetachFrameBlocks<std::size_t>(pool, 0, groups, [&, first, last, seconds, world, particles](std::size_t begin, std::size_t end) {
+        std::size_t count = 0;
+        for (std::size_t group = begin; group < end; ++group) {
+            Particle* start = particles + first + group * GroupSize;
+            const std::size_t size = std::min(GroupSize, last - first - group * GroupSize);
+            bool near[GroupSize] = {};
+            bool any = false;
+            for (std::size_t i = 0; i < size; ++i)
+                any |= near[i] = NeedsFollowing(start[i], seconds, world, grid);
+            if (!any) {
+                FoldBlock(start, size, seconds, world, kernel);
+                continue;
+            }
+            for (std::size_t i = 0; i < size; ++i) {
+                if (near[i]) {
+                    start[i] = EventDrivenParticles::Advance(start[i], seconds, world, walls);
+                    ++count;
+                } else {
+                    FoldScalar(start[i], seconds, world);
+                }
+            }
+        }
+        followed.fetch_add(count, std::memory_order_relaxed);
+    }).wait();
+
+    stats.followed = followed.load(std::memory_order_relaxed);
+    stats.closedForm = last - first - stats.followed;
+    return stats;
+}
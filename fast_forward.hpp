@@ -0,0 +1,38 @@
+#pragma once
+
+#include "simulation.hpp"
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+
+#include <cstddef>
+
+// Skipping ahead in time without stepping. Between walls a particle's motion has a closed form: the
+// box bounces fold the straight line p + v * t back into [0, width] x [0, height], period 2 * width
+// along x and 2 * height along y, with the velocity component flipped on the odd laps. Particles
+// whose path over the skipped time may reach a wall (a WallGrid lookup of the region the path can
+// cover) are followed bounce by bounce instead with EventDrivenParticles::Advance.
+//
+// The physics is the event-driven integrator's, continuous motion with exact bounces, not the fixed
+// step's (see event_driven.hpp): fast-forwarding an event-driven run matches stepping it on, up to
+// float rounding at bounce points, while a stepped run ends up close but not identical.
+enum class FastForwardKernel {
+    Scalar, // one particle at a time, in double
+    Simd    // AVX2, two particles per instruction; picked when the CPU supports it
+};
+
+// The fastest kernel the running CPU supports. Both produce the same bits, except that when a position
+// and its velocity are both NaN either NaN may end up in the position (the compiler orders the add).
+FastForwardKernel BestFastForwardKernel();
+const char* FastForwardKernelName(FastForwardKernel kernel);
+
+struct FastForwardStats {
+    std::size_t closedForm = 0; // particles moved by the fold
+    std::size_t followed = 0;   // particles whose path may meet a wall (or that started outside the world)
+};
+
+// Moves the active particles of sim `seconds` ahead against its walls and bounds, in parallel, keeping
+// their order. Sleeping particles stay where they are, and sim.step does not change. Waits for the pool.
+FastForwardStats FastForward(Simulation& sim, double seconds, BS::thread_pool& pool, FastForwardKernel kernel = BestFastForwardKernel());
+
+// The fold alone: moves particles[0, count) `seconds` ahead as if there were no walls, on the calling
+// thread. FastForward() uses it for particles inside the world with no wall in reach.
+void FoldParticles(Particle* particles, std::size_t count, double seconds, const WorldBounds& world, FastForwardKernel kernel);
@@ -0,0 +1,345 @@
+#include "headless.hpp"
+#include "allocations.hpp"
+#include "arena.hpp"
+#include "compact.hpp"
+#include "ensemble.hpp"
+#include "event_driven.hpp"
+#include "fast_forward.hpp"
+#include "replay.hpp"
+#include "scenario.hpp"
+#include "shard.hpp"
+#include "state_export.hpp"
+#include "trace.hpp"
+#include "BS_thread_pool_utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    // Heap allocations made by the steps from `from` on, once spawning is over and buffers have grown.
+    struct SteadyAllocations {
+        std::uint64_t from = 0;
+        AllocationTotals start;
+        AllocationTotals end;
+    };
+
+    // Replays `log` into `sim` for `steps` steps and returns the elapsed milliseconds. With an open
+    // exporter every step is published.
+    std::int64_t RunFloat(const EventLog& log, std::uint64_t steps, float dt, BS::thread_pool& pool, Simulation& sim, SteadyAllocations& steady, StateExporter& exporter) {
+        ReplayCursor replay(log);
+        BS::timer timer;
+        timer.start();
+        while (sim.step < steps) {
+            if (sim.step == steady.from)
+                steady.start = CurrentAllocationTotals();
+            replay.ApplyDue(sim, &pool);
+            StepSimulation(sim, dt, pool);
+            if (exporter.IsOpen())
+                exporter.Publish(sim, pool);
+        }
+        steady.end = CurrentAllocationTotals();
+        timer.stop();
+        return timer.ms();
+    }
+
+    // RunFloat in real time, one step per dt, under a synthetic background load: before every step the
+    // load is topped up to two busy tasks of `backgroundMs` per worker, queued as `lanes` says. With a
+    // background lane every frame also sets the pool's frame deadline to the start of the next frame,
+    // with the task length as the reserve. Returns the milliseconds of every step.
+    std::vector<double> RunUnderBackgroundLoad(const EventLog& log, std::uint64_t steps, float dt, BS::thread_pool& pool, Simulation& sim, double backgroundMs, PoolLanes lanes) {
+        using Clock = std::chrono::steady_clock;
+        const Clock::duration taskLength = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(backgroundMs));
+        const Clock::duration frameLength = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(dt));
+        const BS::lane loadLane = lanes == PoolLanes::Fifo ? BS::lane::frame : BS::lane::background;
+        const std::size_t queued = 2 * pool.get_thread_count();
+        pool.set_drain_policy(lanes == PoolLanes::Weighted ? BS::drain_policy::weighted : BS::drain_policy::strict);
+
+        ReplayCursor replay(log);
+        std::vector<double> stepMs;
+        stepMs.reserve(steps);
+        Clock::time_point frameStart = Clock::now();
+        while (sim.step < steps) {
+            const Clock::time_point nextFrame = frameStart + frameLength;
+            if (lanes != PoolLanes::Fifo)
+                pool.set_frame_deadline(nextFrame, taskLength);
+            // between steps the frame lane holds nothing but load
+            for (std::size_t i = pool.get_tasks_queued(loadLane); i < queued; ++i) {
+                pool.detach_task(loadLane, [taskLength] {
+                    const Clock::time_point end = Clock::now() + taskLength;
+                    while (Clock::now() < end) {
+                    }
+                });
+            }
+            const Clock::time_point start = Clock::now();
+            replay.ApplyDue(sim, &pool);
+            StepSimulation(sim, dt, pool);
+            stepMs.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+            std::this_thread::sleep_until(nextFrame);
+            frameStart = Clock::now();
+        }
+        pool.clear_frame_deadline();
+        pool.set_drain_policy(BS::drain_policy::strict);
+        pool.purge();
+        pool.wait();
+        return stepMs;
+    }
+
+    double Percentile(std::vector<double> values, double fraction) {
+        if (values.empty())
+            return 0.0;
+        const std::size_t index = std::min(values.size() - 1, static_cast<std::size_t>(fraction * static_cast<double>(values.size())));
+        std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(index), values.end());
+        return values[index];
+    }
+
+    // Same as RunFloat with the particles kept in `store` (CompactParticles or EventDrivenParticles)
+    // between steps. Spawned particles arrive in sim.particles and are moved over before the step; at
+    // the end `readBack` puts the store's state into sim.particles.
+    template <typename Store, typename ReadBack>
+    std::int64_t RunStore(const EventLog& log, std::uint64_t steps, float dt, BS::thread_pool& pool, Simulation& sim, Store& store, ReadBack readBack, SteadyAllocations& steady) {
+        ReplayCursor replay(log);
+        BS::timer timer;
+        timer.start();
+        while (sim.step < steps) {
+            if (sim.step == steady.from)
+                steady.start = CurrentAllocationTotals();
+            NextFrame();
+            while (const SimEvent* event = replay.NextDue(sim.step)) {
+                if (event->type == SimEvent::Type::Reset)
+                    store.Clear();
+                ApplyEvent(sim, *event);
+            }
+            if (!sim.particles.empty()) {
+                store.Append(sim.particles.data(), sim.particles.size());
+                ClearParticles(sim);
+            }
+            {
+                TRACE_SCOPE("step");
+                store.Step(sim, dt, pool);
+            }
+            ++sim.step;
+        }
+        steady.end = CurrentAllocationTotals();
+        readBack(sim.particles);
+        timer.stop();
+        return timer.ms();
+    }
+
+    void PrintHash(const char* label, const Simulation& sim) {
+        std::cout << label << std::hex << std::setw(16) << std::setfill('0') << HashSimulation(sim) << std::dec << std::setfill(' ') << "\n";
+    }
+}
+
+int RunHeadless(const RunOptions& options, BS::thread_pool& pool) {
+    EventLog log;
+    std::uint64_t steps = 0;
+    std::string error;
+    if (!LoadRunEvents(options, log, steps, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    float dt = options.fixedDt > 0.0f ? options.fixedDt : log.dt;
+    if (options.steps > 0)
+        steps = options.steps;
+    else if (steps == 0)
+        steps = ReplayCursor(log).LastStep() + 1;
+
+    if (!options.sweeps.empty()) {
+        std::vector<EnsembleMember> members = EnsembleGrid(options.sweeps);
+        BS::timer timer;
+        timer.start();
+        RunEnsemble(log, steps, dt, members, pool);
+        timer.stop();
+        std::uint64_t particleSteps = 0;
+        std::cout << "steps: " << steps << "\n"
+                  << "threads: " << pool.get_thread_count() << "\n"
+                  << "members: " << members.size() << "\n"
+                  << "member  speed  angle  count  particles     mean x     mean y  mean speed     spread  hash\n";
+        for (std::size_t i = 0; i < members.size(); ++i) {
+            const EnsembleMember& member = members[i];
+            std::cout << std::setw(6) << i << std::fixed << std::setprecision(2) << std::setw(7) << member.speedScale << std::setw(7)
+                      << member.angleOffset << std::setw(7) << member.countScale << std::setw(11) << member.particles
+                      << std::setprecision(1) << std::setw(11) << member.meanX << std::setw(11) << member.meanY << std::setw(12)
+                      << member.meanSpeed << std::setw(11) << member.spread << "  " << std::hex << std::setw(16) << std::setfill('0')
+                      << member.hash << std::dec << std::setfill(' ') << "\n";
+            particleSteps += member.particleSteps;
+        }
+        std::cout.unsetf(std::ios::floatfield);
+        const double seconds = std::max<double>(timer.ms(), 1.0) / 1000.0;
+        std::cout << "particle-steps: " << particleSteps << "\n"
+                  << "particle-steps/s: " << static_cast<std::uint64_t>(static_cast<double>(particleSteps) / seconds) << "\n"
+                  << "elapsed ms: " << timer.ms() << "\n"
+                  << std::flush;
+        return 0;
+    }
+
+    if (options.shards > 0) {
+        const unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+        const int threads = options.threads > 0 ? options.threads : std::max(1, static_cast<int>(hardwareThreads) / options.shards);
+        ShardedRun run;
+        BS::timer timer;
+        timer.start();
+        if (!RunSharded(log, steps, dt, options.shards, threads, options.shardTransport, run, error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        timer.stop();
+        std::uint64_t migrated = 0;
+        std::cout << "steps: " << run.sim.step << "\n"
+                  << "shards: " << options.shards << " (" << ShardTransportName(options.shardTransport) << ")\n"
+                  << "threads per shard: " << threads << "\n"
+                  << "particles: " << run.sim.particles.size() << "\n"
+                  << "walls: " << run.sim.wall.size() << "\n";
+        for (std::size_t shard = 0; shard < run.shards.size(); ++shard) {
+            const ShardReport& report = run.shards[shard];
+            std::cout << "shard " << shard << ": particles " << report.particles << ", migrated out " << report.migratedOut
+                      << ", elapsed ms " << report.elapsedMs << "\n";
+            migrated += report.migratedOut;
+        }
+        std::cout << "migrated: " << migrated << "\n"
+                  << "elapsed ms: " << timer.ms() << "\n";
+        PrintHash("hash: ", run.sim);
+        std::cout << std::flush;
+        return 0;
+    }
+
+    StateExporter exporter;
+    if (!options.exportName.empty() && !exporter.Open(options.exportName, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    Simulation sim;
+    sim.bounds = log.world;
+    if (options.storage == ParticleStorage::Compare || options.integrator == Integrator::Compare) {
+        // keep both runs in append order so particles can be matched by index
+        sim.sleeping = false;
+        sim.sortInterval = 0;
+    }
+    // the second half of the run, or the steps after the last event if that is later
+    SteadyAllocations steady;
+    steady.from = std::max(ReplayCursor(log).LastStep() + 2, steps / 2);
+    std::int64_t floatMs = 0;
+    std::vector<double> loadedStepMs;
+    if (options.backgroundMs > 0.0) {
+        BS::timer timer;
+        timer.start();
+        loadedStepMs = RunUnderBackgroundLoad(log, steps, dt, pool, sim, options.backgroundMs, options.lanes);
+        timer.stop();
+        floatMs = timer.ms();
+    } else if (options.storage != ParticleStorage::Compact && options.integrator != Integrator::Events) {
+        floatMs = RunFloat(log, steps, dt, pool, sim, steady, exporter);
+    }
+
+    Simulation compactSim;
+    compactSim.bounds = log.world;
+    CompactParticles compact(compactSim.bounds);
+    std::int64_t compactMs = 0;
+    SteadyAllocations compactSteady;
+    compactSteady.from = steady.from;
+    if (options.storage != ParticleStorage::Float) {
+        compactMs = RunStore(log, steps, dt, pool, compactSim, compact,
+                             [&compact, &pool](ParticleBuffer& out) { compact.Decode(out, pool); }, compactSteady);
+    }
+
+    Simulation eventSim;
+    eventSim.bounds = log.world;
+    EventDrivenParticles events(eventSim.bounds, dt);
+    std::int64_t eventMs = 0;
+    SteadyAllocations eventSteady;
+    eventSteady.from = steady.from;
+    if (options.integrator != Integrator::Step) {
+        eventMs = RunStore(log, steps, dt, pool, eventSim, events,
+                           [&events, &pool](ParticleBuffer& out) { events.Evaluate(out, pool); }, eventSteady);
+    }
+
+    // only with float storage and a single integrator (checked by ParseRunOptions)
+    Simulation& forwarded = options.integrator == Integrator::Events ? eventSim : sim;
+    FastForwardStats skipped;
+    std::int64_t fastForwardMs = 0;
+    if (options.fastForward > 0.0) {
+        NextFrame();
+        BS::timer timer;
+        timer.start();
+        skipped = FastForward(forwarded, options.fastForward, pool);
+        timer.stop();
+        fastForwardMs = timer.ms();
+    }
+    TraceShutdown();
+
+    const Simulation& result = options.storage == ParticleStorage::Compact ? compactSim : options.integrator == Integrator::Events ? eventSim : sim;
+    std::cout << "steps: " << result.step << "\n"
+              << "threads: " << pool.get_thread_count() << "\n"
+              << "particles: " << result.particles.size() << "\n"
+              << "walls: " << result.wall.size() << "\n";
+    if (options.storage != ParticleStorage::Float) {
+        std::cout << "compact codec: " << CompactCodecName(BestCompactCodec()) << "\n"
+                  << "compact fraction bits: " << compact.FractionBits() << "\n";
+    }
+    if (options.integrator != Integrator::Step)
+        std::cout << "bounces: " << events.EventCount() << "\n";
+    if (options.fastForward > 0.0) {
+        std::cout << "fast-forward seconds: " << options.fastForward << "\n"
+                  << "fast-forward kernel: " << FastForwardKernelName(BestFastForwardKernel()) << "\n"
+                  << "fast-forward closed form: " << skipped.closedForm << ", followed: " << skipped.followed << "\n"
+                  << "fast-forward ms: " << fastForwardMs << "\n";
+    }
+    if (options.integrator == Integrator::Events) {
+        std::cout << "elapsed ms: " << eventMs << "\n";
+        PrintHash("hash: ", eventSim);
+    } else if (options.integrator == Integrator::Compare) {
+        CompactAccuracy difference = MeasureCompactAccuracy(sim.particles, eventSim.particles);
+        std::cout << "step elapsed ms: " << floatMs << "\n"
+                  << "events elapsed ms: " << eventMs << "\n";
+        PrintHash("step hash: ", sim);
+        PrintHash("events hash: ", eventSim);
+        std::cout << "position difference mean: " << difference.meanPositionError << "\n"
+                  << "position difference max: " << difference.maxPositionError << "\n"
+                  << "velocity difference mean (relative): " << difference.meanVelocityError << "\n"
+                  << "diverged (> 1 unit): " << difference.diverged << " of " << sim.particles.size() << "\n";
+    } else {
+        switch (options.storage) {
+            case ParticleStorage::Float:
+                std::cout << "elapsed ms: " << floatMs << "\n";
+                PrintHash("hash: ", sim);
+                break;
+            case ParticleStorage::Compact:
+                std::cout << "elapsed ms: " << compactMs << "\n";
+                PrintHash("hash: ", compactSim);
+                break;
+            case ParticleStorage::Compare: {
+                CompactAccuracy accuracy = MeasureCompactAccuracy(sim.particles, compactSim.particles);
+                std::cout << "float elapsed ms: " << floatMs << "\n"
+                          << "compact elapsed ms: " << compactMs << "\n";
+                PrintHash("float hash: ", sim);
+                PrintHash("compact hash: ", compactSim);
+                std::cout << "position error mean: " << accuracy.meanPositionError << "\n"
+                          << "position error max: " << accuracy.maxPositionError << "\n"
+                          << "velocity error mean (relative): " << accuracy.meanVelocityError << "\n"
+                          << "diverged (> 1 unit): " << accuracy.diverged << " of " << sim.particles.size() << "\n";
+                break;
+            }
+        }
+    }
+    if (options.backgroundMs > 0.0) {
+        static const char* const laneNames[] = { "fifo", "strict", "weighted" };
+        std::cout << "background: " << options.backgroundMs << " ms tasks, " << laneNames[static_cast<int>(options.lanes)] << " lanes\n"
+                  << std::fixed << std::setprecision(3)
+                  << "step ms p50: " << Percentile(loadedStepMs, 0.50) << "\n"
+                  << "step ms p99: " << Percentile(loadedStepMs, 0.99) << "\n"
+                  << "step ms max: " << Percentile(loadedStepMs, 1.0) << "\n";
+        std::cout.unsetf(std::ios::floatfield);
+    }
+    if (AllocationCountingEnabled() && steady.from < steps && options.backgroundMs <= 0.0) {
+        const SteadyAllocations& counted = options.storage == ParticleStorage::Compact ? compactSteady : options.integrator == Integrator::Events ? eventSteady : steady;
+        std::cout << "steady-state allocations: " << counted.end.allocations - counted.start.allocations
+                  << " in " << steps - counted.from << " steps\n";
+    }
+    std::cout << std::flush;
+    return 0;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "run_options.hpp"
+#include "simulation.hpp"
+
+// Run the simulation without a window at a fixed timestep, replaying `options.replayPath` or
+// `options.scenarioPath` if given.
+// Prints the final step, counts, elapsed time and the state hash so two runs can be compared.
+int RunHeadless(const RunOptions& options, BS::thread_pool& pool);
@@ -0,0 +1,34 @@
+// particle_headless: the --headless and --generate modes of the GUI executable without GLFW, OpenGL
+// or ImGui, for servers and for benchmarking the core on its own.
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+#include "headless.hpp"
+#include "run_options.hpp"
+#include "scenario.hpp"
+#include "trace.hpp"
+#include "log.hpp"
+
+#include <iostream>
+#include <string>
+#include <thread>
+
+int main(int argc, char** argv) {
+    TraceInitFromEnvironment();
+    TRACE_THREAD_NAME("main", -1);
+    LogInitFromEnvironment();
+
+    RunOptions options;
+    // always headless, with or without --headless, so the headless-only checks of ParseRunOptions apply
+    options.headless = true;
+    std::string error;
+    if (!ParseRunOptions(argc, argv, options, error)) {
+        std::cerr << error << "\n" << RunOptionsUsage();
+        return -1;
+    }
+    if (!options.generateKind.empty())
+        return WriteGeneratedScenario(options);
+
+    // Same default as the GUI: every hardware thread but one (which the GUI keeps for rendering)
+    unsigned int hardwareThreads = std::thread::hardware_concurrency() > 2 ? std::thread::hardware_concurrency() : 4;
+    BS::thread_pool pool(options.threads > 0 ? static_cast<unsigned int>(options.threads) : hardwareThreads - 1);
+    return RunHeadless(options, pool);
+}
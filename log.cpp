@@ -0,0 +1,219 @@
+#include "log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+std::atomic<bool> logEnabled{false};
+
+namespace {
+    static_assert((LOG_RING_RECORDS & (LOG_RING_RECORDS - 1)) == 0, "LOG_RING_RECORDS must be a power of two");
+
+    // One per thread that ever logged, owned by the registry so its records survive the thread. The
+    // thread only moves `head` and the writer only `tail`, so neither ever waits for the other.
+    struct LogRing {
+        alignas(64) std::atomic<std::uint64_t> head{0}; // next record the thread writes
+        std::uint64_t tailSeen = 0;                     // the thread's last look at `tail`
+        alignas(64) std::atomic<std::uint64_t> tail{0}; // next record the writer reads
+        std::atomic<std::uint64_t> dropped{0};
+        std::uint64_t droppedReported = 0;              // writer only
+        int tid = 0;
+        LogRecord records[LOG_RING_RECORDS];
+    };
+
+    struct PendingRecord {
+        LogRecord record;
+        int tid;
+    };
+
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<LogRing>> registry;
+    const std::chrono::steady_clock::time_point logEpoch = std::chrono::steady_clock::now();
+
+    std::mutex drainMutex; // one Drain() at a time, so output stays in order
+    std::vector<PendingRecord> pending; // guarded by drainMutex
+    std::FILE* output = nullptr;
+    std::thread writer;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    bool stopping = false; // guarded by wakeMutex
+
+    LogRing& LocalRing() {
+        thread_local LogRing* ring = nullptr;
+        if (!ring) {
+            std::scoped_lock lock(registryMutex);
+            registry.push_back(std::make_unique<LogRing>());
+            ring = registry.back().get();
+            ring->tid = static_cast<int>(registry.size());
+        }
+        return *ring;
+    }
+
+    const char* LevelName(LogLevel level) {
+        switch (level) {
+            case LogLevel::Debug: return "debug";
+            case LogLevel::Info: return "info";
+            case LogLevel::Warn: return "warn";
+            case LogLevel::Error: return "error";
+        }
+        return "?";
+    }
+
+    const char* BaseName(const char* path) {
+        const char* name = path;
+        for (const char* at = path; *at; ++at) {
+            if (*at == '/' || *at == '\\')
+                name = at + 1;
+        }
+        return name;
+    }
+
+    // Moves every published record out of the rings and writes them in time order.
+    void Drain() {
+        std::scoped_lock drainLock(drainMutex);
+        pending.clear();
+        {
+            std::scoped_lock lock(registryMutex);
+            for (const std::unique_ptr<LogRing>& ring : registry) {
+                const std::uint64_t head = ring->head.load(std::memory_order_acquire);
+                std::uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+                for (; tail != head; ++tail)
+                    pending.push_back({ ring->records[tail & (LOG_RING_RECORDS - 1)], ring->tid });
+                ring->tail.store(tail, std::memory_order_release);
+
+                const std::uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+                if (dropped != ring->droppedReported) {
+                    std::fprintf(output, "log: thread %d dropped %llu records, its ring was full\n", ring->tid,
+                                 static_cast<unsigned long long>(dropped - ring->droppedReported));
+                    ring->droppedReported = dropped;
+                }
+            }
+        }
+        std::stable_sort(pending.begin(), pending.end(), [](const PendingRecord& a, const PendingRecord& b) {
+            return a.record.timeNs < b.record.timeNs;
+        });
+
+        char message[512];
+        for (const PendingRecord& entry : pending) {
+            const LogRecord& record = entry.record;
+            record.print(message, sizeof(message), record.site->format, record.arguments);
+            std::fprintf(output, "%12.3f ms %-5s [%d] %s:%d: %s\n", record.timeNs / 1e6, LevelName(record.site->level), entry.tid,
+                         BaseName(record.site->file), record.site->line, message);
+        }
+        if (!pending.empty())
+            std::fflush(output);
+    }
+
+    void WriterLoop() {
+        std::unique_lock lock(wakeMutex);
+        while (!stopping) {
+            wake.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_MS));
+            lock.unlock();
+            Drain();
+            lock.lock();
+        }
+    }
+}
+
+std::int64_t LogNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - logEpoch).count();
+}
+
+LogRecord* LogClaim() {
+    LogRing& ring = LocalRing();
+    const std::uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tailSeen == LOG_RING_RECORDS) {
+        ring.tailSeen = ring.tail.load(std::memory_order_acquire);
+        if (head - ring.tailSeen == LOG_RING_RECORDS) {
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+    }
+    return &ring.records[head & (LOG_RING_RECORDS - 1)];
+}
+
+void LogPublish() {
+    LogRing& ring = LocalRing();
+    const std::uint64_t head = ring.head.load(std::memory_order_relaxed) + 1;
+    ring.head.store(head, std::memory_order_release);
+    // half a ring since the writer last ran: wake it early rather than drop records
+    if (head - ring.tailSeen == LOG_RING_RECORDS / 2) {
+        ring.tailSeen = ring.tail.load(std::memory_order_acquire);
+        if (head - ring.tailSeen >= LOG_RING_RECORDS / 2)
+            wake.notify_one();
+    }
+}
+
+std::uint64_t LogDropped() {
+    std::scoped_lock lock(registryMutex);
+    std::uint64_t dropped = 0;
+    for (const std::unique_ptr<LogRing>& ring : registry)
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    return dropped;
+}
+
+void LogFlush() {
+    if (!logEnabled.load(std::memory_order_relaxed))
+        return;
+    Drain();
+}
+
+bool LogStart(const char* path) {
+    if (logEnabled.load(std::memory_order_relaxed))
+        return true;
+    output = std::strcmp(path, "-") == 0 ? stderr : std::fopen(path, "w");
+    if (!output)
+        return false;
+    stopping = false;
+    writer = std::thread(WriterLoop);
+    logEnabled.store(true, std::memory_order_relaxed);
+    static const bool shutdownAtExit = std::atexit(LogShutdown) == 0;
+    (void)shutdownAtExit;
+    return true;
+}
+
+void LogInitFromEnvironment() {
+    const char* path = std::getenv("PARTICLE_LOG");
+    if (!path || !*path)
+        return;
+    if (!LogStart(path)) {
+        std::cerr << "cannot write log to " << path << std::endl;
+        return;
+    }
+}
+
+bool LogSuspend() {
+    if (!logEnabled.exchange(false))
+        return false;
+    {
+        std::scoped_lock lock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+    // calls that saw logEnabled before it was cleared may still be publishing; this catches all but those
+    Drain();
+    return true;
+}
+
+void LogResume() {
+    if (!output || logEnabled.load(std::memory_order_relaxed))
+        return;
+    stopping = false;
+    writer = std::thread(WriterLoop);
+    logEnabled.store(true, std::memory_order_relaxed);
+}
+
+void LogShutdown() {
+    if (!LogSuspend())
+        return;
+    if (output != stderr)
+        std::fclose(output);
+    output = nullptr;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+
+// Asynchronous logging that is cheap enough to call from every physics job. Set PARTICLE_LOG=<file>
+// ("-" for stderr) and call LogInitFromEnvironment() at startup. A LOG_* call copies its format site
+// and raw arguments into the calling thread's ring buffer, without a lock, an allocation or any
+// formatting, and returns; a writer thread drains the rings every LOG_FLUSH_MS (sooner when one is
+// half full), formats the records with snprintf and writes them in time order. When a ring is full
+// the record is dropped and counted, so logging never makes a worker wait. Without PARTICLE_LOG every
+// macro costs one relaxed load and a branch that is never taken; levels below PARTICLE_LOG_LEVEL
+// compile to nothing (configure with -DPARTICLE_LOG_LEVEL=debug|info|warn|error|off).
+//
+// Formats are printf formats and are checked like printf's. Arguments must be trivially copyable
+// (numbers, pointers) and together fit LOG_ARGUMENT_BYTES; strings must be literals (or otherwise
+// outlive the log), as only the pointer is stored.
+
+#define LOG_RING_RECORDS 4096 // Records per thread ring (64 bytes each), a power of two
+#define LOG_ARGUMENT_BYTES 40 // Argument bytes per record
+#define LOG_FLUSH_MS 10       // Longest time a record waits in a ring
+
+#define PARTICLE_LOG_DEBUG 0
+#define PARTICLE_LOG_INFO 1
+#define PARTICLE_LOG_WARN 2
+#define PARTICLE_LOG_ERROR 3
+#define PARTICLE_LOG_OFF 4
+#ifndef PARTICLE_LOG_LEVEL
+#define PARTICLE_LOG_LEVEL PARTICLE_LOG_INFO
+#endif
+
+enum class LogLevel : std::uint8_t { Debug, Info, Warn, Error };
+
+// One per LOG_* call site.
+struct LogSite {
+    LogLevel level;
+    const char* format;
+    const char* file;
+    int line;
+};
+
+// One buffered call. The writer formats it with `print`, which knows the argument types.
+struct LogRecord {
+    const LogSite* site;
+    int (*print)(char* out, std::size_t size, const char* format, const unsigned char* arguments);
+    std::int64_t timeNs;
+    unsigned char arguments[LOG_ARGUMENT_BYTES];
+};
+static_assert(sizeof(LogRecord) == 64, "a record fills one cache line");
+
+extern std::atomic<bool> logEnabled;
+
+void LogInitFromEnvironment();
+// Starts the writer on `path` ("-" for stderr); LogShutdown() runs at exit. Returns false if the file
+// cannot be opened.
+bool LogStart(const char* path);
+// Writes what is buffered and stops the writer; later LOG_* calls are ignored.
+void LogShutdown();
+// For fork(): a child gets no writer thread and may get registryMutex or the output FILE locked by a
+// thread that does not exist there. LogSuspend() writes what is buffered, stops the writer and turns
+// logging off, so children forked after it never log; it returns whether logging was on. LogResume()
+// restarts the writer on the same output, in the parent.
+bool LogSuspend();
+void LogResume();
+// Writes what is buffered now, on the calling thread, instead of waiting for the writer.
+void LogFlush();
+// Records dropped so far because a ring was full.
+std::uint64_t LogDropped();
+std::int64_t LogNowNs();
+
+// The next free record of the calling thread's ring, or nullptr (counted as dropped) if it is full.
+// LogPublish() hands it to the writer.
+LogRecord* LogClaim();
+void LogPublish();
+
+template <typename T>
+T LogRead(const unsigned char*& arguments) {
+    T value;
+    std::memcpy(&value, arguments, sizeof(T));
+    arguments += sizeof(T);
+    return value;
+}
+
+// The format was checked at the call site (see LOG_AT).
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+#endif
+template <typename... Args>
+int LogPrint(char* out, std::size_t size, const char* format, const unsigned char* arguments) {
+    // braced, so the arguments are read in order
+    const std::tuple<Args...> values{ LogRead<Args>(arguments)... };
+    return std::apply([&](auto... value) { return std::snprintf(out, size, format, value...); }, values);
+}
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+template <typename... Args>
+void LogWrite(const LogSite& site, Args... args) {
+    static_assert((std::is_trivially_copyable_v<Args> && ...), "log arguments are copied as bytes");
+    static_assert((sizeof(Args) + ... + 0) <= LOG_ARGUMENT_BYTES, "log arguments exceed LOG_ARGUMENT_BYTES");
+    LogRecord* record = LogClaim();
+    if (!record)
+        return;
+    record->site = &site;
+    record->print = &LogPrint<Args...>;
+    record->timeNs = LogNowNs();
+    unsigned char* at = record->arguments;
+    ((std::memcpy(at, &args, sizeof(Args)), at += sizeof(Args)), ...);
+    LogPublish();
+}
+
+// The printf call is never made; it only has the compiler check the format against the arguments.
+#define LOG_AT(level, format, ...)                                                             \
+    do {                                                                                       \
+        if (logEnabled.load(std::memory_order_relaxed)) {                                      \
+            static constexpr LogSite logSite = { level, format, __FILE__, __LINE__ };          \
+            LogWrite(logSite __VA_OPT__(, ) __VA_ARGS__);                                      \
+        }                                                                                      \
+        if (false)                                                                             \
+            std::printf(format __VA_OPT__(, ) __VA_ARGS__);                                    \
+    } while (0)
+
+#if PARTICLE_LOG_LEVEL <= PARTICLE_LOG_DEBUG
+#define LOG_DEBUG(format, ...) LOG_AT(LogLevel::Debug, format __VA_OPT__(, ) __VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) ((void)0)
+#endif
+#if PARTICLE_LOG_LEVEL <= PARTICLE_LOG_INFO
+#define LOG_INFO(format, ...) LOG_AT(LogLevel::Info, format __VA_OPT__(, ) __VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) ((void)0)
+#endif
+#if PARTICLE_LOG_LEVEL <= PARTICLE_LOG_WARN
+#define LOG_WARN(format, ...) LOG_AT(LogLevel::Warn, format __VA_OPT__(, ) __VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) ((void)0)
+#endif
+#if PARTICLE_LOG_LEVEL <= PARTICLE_LOG_ERROR
+#define LOG_ERROR(format, ...) LOG_AT(LogLevel::Error, format __VA_OPT__(, ) __VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) ((void)0)
+#endif
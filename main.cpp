@@ -4,7 +4,26 @@
 #include <imgui_impl_opengl3.h>
 #include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
 #include "BS_thread_pool_utils.hpp"
+#include "simulation.hpp"
+#include "camera.hpp"
+#include "density.hpp"
+#include "event_driven.hpp"
+#include "replay.hpp"
+#include "scenario.hpp"
+#include "spawn.hpp"
+#include "state_export.hpp"
+#include "run_options.hpp"
+#include "headless.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+#include "log.hpp"
+#include "arena.hpp"
+#ifdef PARTICLE_PROFILER
+#include "allocations.hpp"
+#include "profiler_panel.hpp"
+#endif
 
+#include <deque>
 #include <iostream>
 #include <string>
 #include <sstream>
@@ -15,239 +34,218 @@
 #include <ctime>
 #include <iomanip>
 
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
-
 // default thread count is 4 (single and dual-core systems may be assigned with 4 threads)
 int threadpool_size = std::thread::hardware_concurrency() > 2 ? std::thread::hardware_concurrency() : 4; 
 #define THREADPOOL_SIZE threadpool_size - 1 // save one thread for rendering
-#define THREADING_THRESHOLD 5000 // Obtained from testing, point on which single-threaded performance starts to drop in FPS
-
-struct Particle {
-    ImVec2 position;
-    ImVec2 velocity;
-    // Angle is computed upon addition of particle, and translated to horizontal and vertical velocity (ImVec2).
-};
 
-const int numParticles = 0;
-std::vector<Particle> particles;
+Simulation sim;
 BS::thread_pool pool(THREADPOOL_SIZE);
 
-struct Walls {
-    ImVec2 p1;
-    ImVec2 p2;
-};
-std::vector<Walls> wall;
-const int numWalls = 0;
-
-void AdjustParticlePosition(Particle& particle) {
-    float slope = particle.velocity.y / particle.velocity.x;
-
-    if (particle.position.x < 0) {
-        particle.position.x = 0;
-        particle.position.y = slope * particle.position.x + particle.position.y;
-        particle.velocity.x *= -1;
-    } else if (particle.position.x >= 1280) {
-        particle.position.x = 1279;
-        particle.position.y = slope * (particle.position.x - 1279) + particle.position.y;
-        particle.velocity.x *= -1;
-    }
+// The "Particle Simulation" window; the camera maps the world into it.
+const Viewport canvasViewport = { Vec2(0.0f, 0.0f), Vec2(1280.0f, 720.0f) };
+Camera camera;
 
-    if (particle.position.y < 0) {
-        particle.position.y = 0;
-        particle.position.x = particle.position.y / slope + particle.position.x;
-        particle.velocity.y *= -1;
-    } else if (particle.position.y >= 720) {
-        particle.position.y = 719;
-        particle.position.x = (particle.position.y - 719) / slope + particle.position.x;
-        particle.velocity.y *= -1;
-    }
+ImVec2 ToScreen(Vec2 worldPoint) {
+    Vec2 screen = WorldToScreen(camera, canvasViewport, worldPoint);
+    return ImVec2(screen.x, screen.y);
 }
 
-float calculateSlope(ImVec2 p1, ImVec2 p2) {
-    if (p2.x - p1.x == 0.0f)
-        // if vertical line
-        return std::numeric_limits<float>::infinity();
-    return (p2.y - p1.y) / (p2.x - p1.x);
+// Panel-space (y up) slider coordinates to the screen.
+ImVec2 PanelToScreen(int x, int y) {
+    return ToScreen(Vec2(static_cast<float>(x), sim.bounds.height - static_cast<float>(y)));
 }
 
-bool doIntersect(ImVec2 p1, ImVec2 q1, ImVec2 p2, ImVec2 q2) {
-    // Calculate slopes of the line and particle trajectory.
-    float slope1 = calculateSlope(p1, q1);
-    float slope2 = calculateSlope(p2, q2);
+// Auto draws rects up to DENSITY_THRESHOLD particles and the density image above it.
+enum RenderMode { RenderAuto, RenderRects, RenderDensity };
+int renderMode = RenderAuto;
+DensityBuffer density;
+GLuint densityTexture = 0;
+int densityTextureWidth = 0;
+int densityTextureHeight = 0;
+
+// With "Event-driven" ticked the particles live in eventParticles and sim.particles holds their
+// positions at the current time, evaluated for drawing; spawned particles are appended after them.
+bool eventDriven = false;
+EventDrivenParticles eventParticles(WorldBounds{});
+
+// With --export every completed step is published for other processes (see state_export.hpp).
+StateExporter stateExporter;
+
+// Spawns of ASYNC_SPAWN_MIN_PARTICLES or more are filled in on the pool across frames (see spawn.hpp);
+// spawns requested meanwhile wait in spawnQueue. Reset cancels both.
+SpawnJob spawnJob;
+std::deque<SimEvent> spawnQueue;
+
+bool UseDensityRendering() {
+    return renderMode == RenderDensity || (renderMode == RenderAuto && sim.particles.size() > DENSITY_THRESHOLD);
+}
 
-    // Check for vertical lines
-    if (std::isinf(slope1) && std::isinf(slope2)) {
-        // Both line and particle trajectory are vertical and never intersect
-        return false;
+// Bins the particles into the density buffer and draws it as one textured quad over the canvas.
+void DrawDensity(ImDrawList* drawList) {
+    PROFILE_ZONE(ProfileZone::DrawList);
+    TRACE_SCOPE("draw density");
+    density.Build(sim.particles, camera, canvasViewport, pool);
+
+    if (densityTexture == 0) {
+        glGenTextures(1, &densityTexture);
+        glBindTexture(GL_TEXTURE_2D, densityTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     }
-
-    // Calculate y-intercepts (b) for each line
-    float b1 = p1.y - slope1 * p1.x;
-    float b2 = p2.y - slope2 * p2.x;
-
-    // Calculate intersection point
-    float intersectionX;
-    float intersectionY;
-
-    if (std::isinf(slope1)) {
-        // Line is vertical
-        intersectionX = p1.x;
-        intersectionY = slope2 * intersectionX + b2;
-    } else if (std::isinf(slope2)) {
-        // Particle trajectory is vertical
-        intersectionX = p2.x;
-        intersectionY = slope1 * intersectionX + b1;
+    glBindTexture(GL_TEXTURE_2D, densityTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if (density.Width() != densityTextureWidth || density.Height() != densityTextureHeight) {
+        densityTextureWidth = density.Width();
+        densityTextureHeight = density.Height();
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, densityTextureWidth, densityTextureHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, density.Pixels().data());
     } else {
-        // Neither line nor particle is vertical
-        intersectionX = (b2 - b1) / (slope1 - slope2);
-        intersectionY = slope1 * intersectionX + b1;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, densityTextureWidth, densityTextureHeight, GL_RGBA, GL_UNSIGNED_BYTE, density.Pixels().data());
     }
 
-    // Check if the intersection point lies on both line and particle trajectory
-    if (!std::isnan(intersectionX) && !std::isnan(intersectionY) &&
-        (intersectionX >= std::min(p1.x, q1.x) && intersectionX <= std::max(p1.x, q1.x)) &&
-        (intersectionY >= std::min(p1.y, q1.y) && intersectionY <= std::max(p1.y, q1.y)) &&
-        (intersectionX >= std::min(p2.x, q2.x) && intersectionX <= std::max(p2.x, q2.x)) &&
-        (intersectionY >= std::min(p2.y, q2.y) && intersectionY <= std::max(p2.y, q2.y))) {
-        return true;
-    }
-    return false;
+    drawList->AddImage(
+        (ImTextureID)(intptr_t)densityTexture,
+        ImVec2(canvasViewport.min.x, canvasViewport.min.y),
+        ImVec2(canvasViewport.min.x + canvasViewport.size.x, canvasViewport.min.y + canvasViewport.size.y)
+    );
 }
 
-ImVec2 particleIntersectWall(Particle particle, ImVec2 wallStart, ImVec2 wallEnd) {
-    // Calculate the intersection point of the particle's trajectory with the wall
-    float t_intersection = (wallStart.x * (particle.position.y - wallEnd.y) + wallEnd.x * (wallStart.y - particle.position.y) +
-                            particle.position.x * (wallEnd.y - wallStart.y)) /
-                           (particle.velocity.x * (wallStart.y - wallEnd.y) + particle.velocity.y * (wallEnd.x - wallStart.x));
-
-    // Calculate the intersection point
-    return ImVec2{particle.position.x + t_intersection * particle.velocity.x, particle.position.y + t_intersection * particle.velocity.y};
+// Starts the step on the pool and returns its jobs; the event-driven step finishes before returning.
+BS::batch DetachPhysics(float dt) {
+    if (!eventDriven)
+        return DetachParticleJobs(sim, dt, pool);
+    if (sim.particles.size() > eventParticles.Size())
+        eventParticles.Append(sim.particles.data() + eventParticles.Size(), sim.particles.size() - eventParticles.Size());
+    eventParticles.Step(sim, dt, pool);
+    eventParticles.Evaluate(sim.particles, pool);
+    return {};
 }
 
-std::vector<std::pair<int,int>> getJobList() {
-    int particlesSize = static_cast<int>(particles.size());
-    std::vector<std::pair<int,int>> jobList;
-
-    int threadJobChunk = particlesSize / THREADPOOL_SIZE;
-    int i = 0;
-    int j = 0;
-    if(threadJobChunk < THREADING_THRESHOLD){
-        while(particlesSize != 0){
-            if(particlesSize - THREADING_THRESHOLD > 0){
-                j += THREADING_THRESHOLD - 1;
-                jobList.push_back(std::pair(i,j));
-                particlesSize -= THREADING_THRESHOLD;
-                i =+ j + 1;
-                ++j;
-            }else{
-                j += particlesSize - 1;
-                jobList.push_back(std::pair(i,j));
-                particlesSize = 0;
-            }
-        }
-    } else{
-        int jobRemainder = particlesSize % THREADPOOL_SIZE;
-        while(particlesSize != 0){
-            if(particlesSize - threadJobChunk > 0){
-                j += threadJobChunk - 1;
-                if(jobRemainder > 0){
-                    ++j;
-                    --jobRemainder;
-                    --particlesSize;
-                }
-                jobList.push_back(std::pair(i,j));
-                particlesSize -= threadJobChunk;
-                i = j + 1;
-                ++j;
-            }else{
-                j += particlesSize - 1;
-                jobList.push_back(std::pair(i,j));
-                particlesSize = 0;
-            }
+void UpdateParticles(float dt, ImDrawList* drawList) {
+    if (UseDensityRendering()) {
+        // binning uses the whole pool, so it runs after the step instead of alongside it
+        {
+            PROFILE_ZONE(ProfileZone::Physics);
+            TRACE_SCOPE("physics");
+            DetachPhysics(dt).wait();
         }
+        ++sim.step;
+        if (stateExporter.IsOpen())
+            stateExporter.Publish(sim, pool);
+        DrawDensity(drawList);
+        return;
     }
-    return jobList;
-}
-
-
-void UpdateParticles(ImGuiIO& io, ImDrawList* drawList) {
-    float frameRate = io.Framerate;
-    std::vector<std::pair<int,int>> jobList = getJobList();
-
-    for (auto& job : jobList){
-        pool.detach_task( // Assign to threadpool
-            [&frameRate, &job]
-            {
-                for (int i = job.first; i <= job.second; i++) {
-                    // Check for collision with the walls
-                    for (const auto& wallSegment : wall) {
-                        ImVec2 wallP1 = wallSegment.p1;
-                        ImVec2 wallP2 = wallSegment.p2;
-
-                        // calculate projected position of particle on next frame (assuming no collision with wall)
-                        ImVec2 nextPosition = ImVec2(
-                            particles[i].position.x + particles[i].velocity.x / frameRate,
-                            particles[i].position.y + particles[i].velocity.y / frameRate
-                        );
-
-                        if (doIntersect(particles[i].position, nextPosition, wallP1, wallP2)) {
-                            ImVec2 intersectPoint = particleIntersectWall(particles[i], wallP1, wallP2);
-                            // Collision occurred, update position and reflect velocity
-                            particles[i].position.x = intersectPoint.x;
-                            particles[i].position.y = intersectPoint.y;
-
-                            // Calculate the reflection vector based on the wall's normal
-                            ImVec2 wallVector = ImVec2(wallP2.y - wallP1.y, wallP1.x - wallP2.x); // Perpendicular to the wall
-                            float length = std::sqrt(wallVector.x * wallVector.x + wallVector.y * wallVector.y);
-                            wallVector = ImVec2(wallVector.x / length, wallVector.y / length);
-
-                            // Reflect the velocity vector
-                            float dotProduct = 2.0f * (particles[i].velocity.x * wallVector.x + particles[i].velocity.y * wallVector.y);
-                            particles[i].velocity.x -= dotProduct * wallVector.x;
-                            particles[i].velocity.y -= dotProduct * wallVector.y;
-
-                            // Move the particle slightly away from the collision point
-                            particles[i].position.x += wallVector.x * 0.1f;
-                            particles[i].position.y += wallVector.y * 0.1f;
-                        }
-                    }
-
-                    // Update particle's position based on its velocity
-                    particles[i].position.x += particles[i].velocity.x / frameRate;
-                    particles[i].position.y += particles[i].velocity.y / frameRate;
-
-                    // Bounce off the walls
-                    if (particles[i].position.x <= 0 || particles[i].position.x > 1280 ||
-                        particles[i].position.y <= 0 || particles[i].position.y > 720) {
-                        AdjustParticlePosition(particles[i]);
-                    }
-                }
-                // std::cout << "fin " << job.first << " " << job.second << std::endl;
-            }
-                
-        );
-    }
-    pool.detach_task(
-        [&drawList]{
-            for (const auto& particle : particles) {
 
+    PROFILE_ZONE(ProfileZone::Physics);
+    TRACE_SCOPE("physics");
+    const BS::batch physics = DetachPhysics(dt);
+    const BS::batch draw = DetachFrameBatch(pool, 1, [&drawList](std::size_t) {
+        return [&drawList]{
+            PROFILE_TASK_ZONE(ProfileZone::DrawList);
+            TRACE_SCOPE("draw list");
+            // particles outside the view generate no vertices at all
+            VisibleRegion visible = VisibleWorldRegion(camera, canvasViewport, 2.0f);
+            for (const auto& particle : sim.particles) {
+                if (!visible.Contains(particle.position))
+                    continue;
+                ImVec2 screen = ToScreen(particle.position);
                 drawList->AddRectFilled(
-                    ImVec2(particle.position.x - 1.5f, particle.position.y - 1.5f),
-                    ImVec2(particle.position.x + 1.5f, particle.position.y + 1.5f),
+                    ImVec2(screen.x - 1.5f, screen.y - 1.5f),
+                    ImVec2(screen.x + 1.5f, screen.y + 1.5f),
                     IM_COL32(255, 255, 255, 255)
                 );
             }
-        }
-    );
-    pool.wait();
+        };
+    });
+    physics.wait();
+    draw.wait();
+    ++sim.step;
+    if (stateExporter.IsOpen())
+        stateExporter.Publish(sim, pool);
 }
 
 
 
 
-int main() {
+int main(int argc, char** argv) {
+    // PARTICLE_TRACE=<file> records a Chrome/Perfetto timeline of the main loop and pool workers.
+    TraceInitFromEnvironment();
+    TRACE_THREAD_NAME("main", -1);
+    // PARTICLE_LOG=<file> (or - for stderr) writes the LOG_* messages, see log.hpp.
+    LogInitFromEnvironment();
+
+    RunOptions options;
+    std::string error;
+    if (!ParseRunOptions(argc, argv, options, error)) {
+        std::cerr << error << "\n" << RunOptionsUsage();
+        return -1;
+    }
+    if (options.threads > 0)
+        pool.reset(options.threads);
+    if (!options.generateKind.empty())
+        return WriteGeneratedScenario(options);
+    if (options.headless)
+        return RunHeadless(options, pool);
+
+    // Record/replay runs use a fixed timestep so the same events land on the same physics state.
+    EventLog replayLog;
+    std::uint64_t scenarioSteps = 0;
+    if (!LoadRunEvents(options, replayLog, scenarioSteps, error)) {
+        std::cerr << error << std::endl;
+        return -1;
+    }
+    ReplayCursor replay(replayLog);
+    if (!options.exportName.empty() && !stateExporter.Open(options.exportName, error)) {
+        std::cerr << error << std::endl;
+        return -1;
+    }
+    float fixedDt = options.fixedDt;
+    if (fixedDt <= 0.0f && (!options.replayPath.empty() || !options.scenarioPath.empty()))
+        fixedDt = replayLog.dt;
+    else if (fixedDt <= 0.0f && !options.recordPath.empty())
+        fixedDt = EventLog{}.dt;
+    sim.bounds = replayLog.world;
+    camera = FitWorld(sim.bounds, canvasViewport);
+    EventLog recordLog;
+    recordLog.dt = fixedDt;
+    recordLog.world = sim.bounds;
+    // Events are recorded at the step they take effect, so an asynchronous spawn is recorded when it completes.
+    auto recordEvent = [&](SimEvent event) {
+        event.step = sim.step;
+        if (!options.recordPath.empty())
+            recordLog.events.push_back(event);
+    };
+    auto spawnNow = [&](const SimEvent& event) {
+        if (event.count >= ASYNC_SPAWN_MIN_PARTICLES) {
+            spawnJob.Start(sim, event, pool);
+            return;
+        }
+        ApplyEvent(sim, event, &pool);
+        recordEvent(event);
+    };
+    // Replayed events apply at their exact step: a replayed spawn first completes the spawn in progress.
+    auto applyEvent = [&](const SimEvent& event, bool replayed) {
+        if (IsSpawnEvent(event) && !replayed) {
+            if (spawnJob.Active() || !spawnQueue.empty())
+                spawnQueue.push_back(event);
+            else
+                spawnNow(event);
+            return;
+        }
+        if (event.type == SimEvent::Type::Reset) {
+            spawnJob.Cancel();
+            spawnQueue.clear();
+            eventParticles.Clear();
+        } else if (IsSpawnEvent(event) && spawnJob.Active()) {
+            spawnJob.Wait();
+            spawnJob.Finish(sim);
+            recordEvent(spawnJob.Event());
+        }
+        ApplyEvent(sim, event, &pool);
+        recordEvent(event);
+    };
+    // Button presses are applied after the UI is built, so spawning shows up as its own profiler zone.
+    std::vector<SimEvent> pendingEvents;
+
     // Initialize GLFW
     if (!glfwInit()) {
         return -1;
@@ -269,6 +267,15 @@ int main() {
 
     // Initialize ImGui
     IMGUI_CHECKVERSION();
+#ifdef PARTICLE_PROFILER
+    // ImGui allocates with malloc, which the counting operator new does not see
+    ImGui::SetAllocatorFunctions(
+        [](std::size_t bytes, void*) -> void* {
+            CountAllocation(bytes);
+            return std::malloc(bytes);
+        },
+        [](void* memory, void*) { std::free(memory); });
+#endif
     ImGui::CreateContext();
     ImGuiIO& io = ImGui::GetIO();
     (void)io;
@@ -276,8 +283,10 @@ int main() {
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 330");
 
+#ifndef PARTICLE_PROFILER
     double lastDisplayTime = glfwGetTime();
     double currentFramerate = io.Framerate;
+#endif
 
     static int sx = 0;
     static int sy = 0;
@@ -288,18 +297,31 @@ int main() {
     static float startAngle = 0.0f;
     static float endAngle = 0.0f;
     static int numAddParticles = 1;
+    // slider ranges, in panel space
+    const int maxX = static_cast<int>(sim.bounds.width) - 1;
+    const int maxY = static_cast<int>(sim.bounds.height) - 1;
     std::cout << "Threadpool size: " << THREADPOOL_SIZE << std::endl;
 
     // Main loop
     while (!glfwWindowShouldClose(window)) {
+        NextFrame();
+        PROFILE_BEGIN_FRAME(pool.get_thread_count());
+        TRACE_BEGIN("frame");
+        TRACE_BEGIN("poll events");
         glfwPollEvents();
+        TRACE_END();
 
         // ImGui new frame
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
         // ImGui::ShowDemoWindow();
+        PROFILE_ZONE_BEGIN(ProfileZone::UiBuild);
+        TRACE_BEGIN("ui build");
 
+#ifdef PARTICLE_PROFILER
+        DrawProfilerPanel(frameProfiler, io.Framerate);
+#else
         double currentTime = glfwGetTime();
 
         ImGui::SetNextWindowSize(ImVec2(100, 20));
@@ -318,6 +340,7 @@ int main() {
         
         ImGui::End();
         ImGui::PopStyleVar(2);
+#endif
 
 
         ImGui::SetNextWindowSize(ImVec2(1280, 720));
@@ -327,11 +350,19 @@ int main() {
         ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0f, 0.0f));
         ImGui::Begin("Particle Simulation", nullptr, ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize);
 
+        // wheel zooms around the cursor, right-drag pans
+        if (ImGui::IsWindowHovered()) {
+            if (io.MouseWheel != 0.0f)
+                ZoomAt(camera, canvasViewport, Vec2(io.MousePos.x, io.MousePos.y), std::pow(1.2f, io.MouseWheel));
+            if (ImGui::IsMouseDragging(ImGuiMouseButton_Right))
+                Pan(camera, Vec2(io.MouseDelta.x, io.MouseDelta.y));
+        }
+
         ImDrawList* drawList = ImGui::GetWindowDrawList();
-        for (const auto& walls : wall) {
+        for (const auto& walls : sim.wall) {
             drawList->AddLine(
-                walls.p1,
-                walls.p2,
+                ToScreen(walls.p1),
+                ToScreen(walls.p2),
                 IM_COL32(0, 0, 255, 255),
                 2.0f // Line thickness
             );
@@ -345,58 +376,51 @@ int main() {
 
         ImGui::Begin("[Start-End Point] Batch Adding");
         
-        ImGui::Text("Particle Count: %d", particles.size());
+        ImGui::Text("Particle Count: %d", sim.particles.size());
+        if (spawnJob.Active()) {
+            ImGui::SameLine();
+            ImGui::Text("(spawning %d: %.0f%%)", spawnJob.Event().count, spawnJob.Progress() * 100.0f);
+        }
 
-        ImGui::SliderInt("[Start Point] - x", &sx, 0, 1279);
-        ImGui::SliderInt("[Start Point] - y", &sy, 0, 719);
-        ImGui::SliderInt("[End Point] - x", &ex, 0, 1279);
-        ImGui::SliderInt("[End Point] - y", &ey, 0, 719);
+        ImGui::SliderInt("[Start Point] - x", &sx, 0, maxX);
+        ImGui::SliderInt("[Start Point] - y", &sy, 0, maxY);
+        ImGui::SliderInt("[End Point] - x", &ex, 0, maxX);
+        ImGui::SliderInt("[End Point] - y", &ey, 0, maxY);
         ImGui::InputFloat("[Start Velocity] pix/s", &startSpeed);
         ImGui::SliderFloat("[Start Angle] - degrees", &startAngle, 0.0f, 359.999f);
         ImGui::InputInt("Number of Particles", &numAddParticles);
         if (ImGui::Button("Add")) {
-
-            float xSpacing = static_cast<float>(ex-sx) / (numAddParticles-1);
-            float ySpacing = static_cast<float>(ey-sy) / (numAddParticles-1);
-            float xSpacingSum = 0.0f;
-            float ySpacingSum = 0.0f;
-            for (int i = 0; i < numAddParticles; i++) {
-                Particle particle;
-                particle.position = ImVec2(static_cast<float>(sx) + xSpacingSum, 719 - (static_cast<float>(sy) + ySpacingSum));
-                xSpacingSum += xSpacing;
-                ySpacingSum += ySpacing;
-                float angle = (-(startAngle)) * (static_cast<float>(M_PI) / 180.0f); //convert degrees to radians
-                particle.velocity = ImVec2(
-                    startSpeed * std::cos(angle),
-                    startSpeed * std::sin(angle)
-                );
-
-                particles.push_back(particle);
-            }
+            SimEvent event;
+            event.type = SimEvent::Type::AddPoints;
+            event.sx = sx; event.sy = sy; event.ex = ex; event.ey = ey;
+            event.startSpeed = startSpeed;
+            event.startAngle = startAngle;
+            event.count = numAddParticles;
+            pendingEvents.push_back(event);
         }
 
         ImGui::SetCursorPosX(ImGui::GetWindowWidth() - ImGui::CalcTextSize("Reset").x - ImGui::GetStyle().FramePadding.x * 2 - ImGui::GetStyle().ScrollbarSize);
         ImGui::SetCursorPosY(ImGui::CalcTextSize("Reset").y * 2);
         if (ImGui::Button("Reset")) {
-            particles.clear();
+            SimEvent event;
+            event.type = SimEvent::Type::Reset;
+            pendingEvents.push_back(event);
         }
         
-        float startXCursor = static_cast<float>(sx);
-        float startYCursor = static_cast<float>(720 - sy);
+        ImVec2 startCursor = PanelToScreen(sx, sy);
 
         drawList->AddRectFilled(
-            ImVec2(startXCursor - 3.0f, startYCursor - 3.0f),
-            ImVec2(startXCursor + 3.0f, startYCursor + 3.0f),
+            ImVec2(startCursor.x - 3.0f, startCursor.y - 3.0f),
+            ImVec2(startCursor.x + 3.0f, startCursor.y + 3.0f),
             IM_COL32(0, 255, 0, 192)
         );
 
 
-        float endXCursor = static_cast<float>(ex);
-        float endYCursor = static_cast<float>(720 - ey);
+        ImVec2 endCursor = PanelToScreen(ex, ey);
 
         drawList->AddRectFilled(
-            ImVec2(endXCursor - 3.0f, endYCursor - 3.0f),
-            ImVec2(endXCursor + 3.0f, endYCursor + 3.0f),
+            ImVec2(endCursor.x - 3.0f, endCursor.y - 3.0f),
+            ImVec2(endCursor.x + 3.0f, endCursor.y + 3.0f),
             IM_COL32(255, 0, 0, 192)
         );
 
@@ -411,33 +435,21 @@ int main() {
 
         ImGui::Begin("[Start-End Angle] Batch Adding");
 
-        ImGui::SliderInt("[Start Point] - x", &sx, 0, 1279);
-        ImGui::SliderInt("[Start Point] - y", &sy, 0, 719);
+        ImGui::SliderInt("[Start Point] - x", &sx, 0, maxX);
+        ImGui::SliderInt("[Start Point] - y", &sy, 0, maxY);
         ImGui::InputFloat("[Start Velocity] pix/s", &startSpeed);
         ImGui::SliderFloat("[Start Angle] - degrees", &startAngle, 0.0f, 359.999f);
         ImGui::SliderFloat("[End Angle] - degrees", &endAngle, 0.0f, 359.999f);
         ImGui::InputInt("Number of Particles", &numAddParticles);
         if (ImGui::Button("Add")) {
-            float angleDiff;
-            if(endAngle >= startAngle)
-                angleDiff = endAngle-startAngle;
-            else
-                angleDiff = endAngle - abs(startAngle - 360);
-
-            float angleSpacing = static_cast<float>(angleDiff / (numAddParticles));
-            float angleSpacingSum = 0.0f;
-            for (int i = 0; i < numAddParticles; i++) {
-                Particle particle;
-                particle.position = ImVec2(static_cast<float>(sx), 719 - (static_cast<float>(sy)));
-                float angle = (-(startAngle + angleSpacingSum)) * (static_cast<float>(M_PI) / 180.0f); //convert degrees to radians
-                angleSpacingSum += angleSpacing;
-                particle.velocity = ImVec2(
-                    startSpeed * std::cos(angle),
-                    startSpeed * std::sin(angle)
-                );
-
-                particles.push_back(particle);
-            }
+            SimEvent event;
+            event.type = SimEvent::Type::AddAngles;
+            event.sx = sx; event.sy = sy;
+            event.startSpeed = startSpeed;
+            event.startAngle = startAngle;
+            event.endAngle = endAngle;
+            event.count = numAddParticles;
+            pendingEvents.push_back(event);
         }
         ImGui::End();
 
@@ -446,28 +458,21 @@ int main() {
         ImGui::SetNextWindowPos(ImVec2(1281, 641));
         ImGui::Begin("[Start-End Velocity] Batch Adding");
 
-        ImGui::SliderInt("[Start Point] - x", &sx, 0, 1279);
-        ImGui::SliderInt("[Start Point] - y", &sy, 0, 719);
+        ImGui::SliderInt("[Start Point] - x", &sx, 0, maxX);
+        ImGui::SliderInt("[Start Point] - y", &sy, 0, maxY);
         ImGui::InputFloat("[Start Velocity] pix/s", &startSpeed);
         ImGui::InputFloat("[End Velocity] pix/s", &endSpeed);
         ImGui::SliderFloat("Start Angle - degrees", &startAngle, 0.0f, 359.999f);
         ImGui::InputInt("Number of Particles", &numAddParticles);
         if (ImGui::Button("Add")) {
-
-            float vSpacing = static_cast<float>(endSpeed-startSpeed) / (numAddParticles);
-            float vSpacingSum = 0.0f;
-            for (int i = 0; i < numAddParticles; i++) {
-                Particle particle;
-                particle.position = ImVec2(static_cast<float>(sx), 719 - (static_cast<float>(sy)));
-                float angle = (-(startAngle)) * (static_cast<float>(M_PI) / 180.0f); //convert degrees to radians
-                particle.velocity = ImVec2(
-                    (startSpeed+vSpacingSum) * std::cos(angle),
-                    (startSpeed+vSpacingSum) * std::sin(angle)
-                );
-                vSpacingSum += vSpacing;
-
-                particles.push_back(particle);
-            }
+            SimEvent event;
+            event.type = SimEvent::Type::AddVelocities;
+            event.sx = sx; event.sy = sy;
+            event.startSpeed = startSpeed;
+            event.endSpeed = endSpeed;
+            event.startAngle = startAngle;
+            event.count = numAddParticles;
+            pendingEvents.push_back(event);
         }
 
 
@@ -482,23 +487,43 @@ int main() {
         static int wall_y1 = 1;
         static int wall_x2 = 1;
         static int wall_y2 = 1;
-        ImGui::Text("Wall Count: %d", wall.size());
+        ImGui::Text("Wall Count: %d", sim.wall.size());
         ImGui::Text("Endpoint 1");
-        ImGui::SliderInt("X1", &wall_x1, 0, 1279);
-        ImGui::SliderInt("Y1", &wall_y1, 0, 719);
+        ImGui::SliderInt("X1", &wall_x1, 0, maxX);
+        ImGui::SliderInt("Y1", &wall_y1, 0, maxY);
         ImGui::Text("Endpoint 2");
-        ImGui::SliderInt("X2", &wall_x2, 0, 1279);
-        ImGui::SliderInt("Y2", &wall_y2, 0, 719);
+        ImGui::SliderInt("X2", &wall_x2, 0, maxX);
+        ImGui::SliderInt("Y2", &wall_y2, 0, maxY);
         if (ImGui::Button("Add Wall")) {
-            Walls newWall = { ImVec2(static_cast<float>(wall_x1), static_cast<float>(720 - wall_y1)), ImVec2(static_cast<float>(wall_x2), static_cast<float>(720 - wall_y2)) };
-            wall.push_back(newWall);
+            SimEvent event;
+            event.type = SimEvent::Type::AddWall;
+            event.sx = wall_x1; event.sy = wall_y1; event.ex = wall_x2; event.ey = wall_y2;
+            pendingEvents.push_back(event);
         }
         if (ImGui::Button("Reset Wall")) {
-            wall.clear();
+            SimEvent event;
+            event.type = SimEvent::Type::ResetWall;
+            pendingEvents.push_back(event);
+        }
+
+        ImGui::Text("World %.0f x %.0f, zoom %.4f (mouse wheel: zoom, right drag: pan)", sim.bounds.width, sim.bounds.height, camera.zoom);
+        ImGui::SameLine();
+        if (ImGui::Button("Fit World"))
+            camera = FitWorld(sim.bounds, canvasViewport);
+        ImGui::SetNextItemWidth(120);
+        ImGui::Combo("Particle Rendering", &renderMode, "Auto\0Rects\0Density\0");
+        ImGui::SameLine();
+        ImGui::Text(UseDensityRendering() ? "(density image)" : "(one rect per particle)");
+        // switching either way starts from the particles as they are now
+        if (ImGui::Checkbox("Event-driven", &eventDriven))
+            eventParticles.Clear();
+        if (eventDriven) {
+            ImGui::SameLine();
+            ImGui::Text("%llu bounces last step", static_cast<unsigned long long>(eventParticles.LastEventCount()));
         }
 
-        ImVec2 flippedWallP1 = ImVec2(static_cast<float>(wall_x1), static_cast<float>(720 - wall_y1));
-        ImVec2 flippedWallP2 = ImVec2(static_cast<float>(wall_x2), static_cast<float>(720 - wall_y2));
+        ImVec2 flippedWallP1 = PanelToScreen(wall_x1, wall_y1);
+        ImVec2 flippedWallP2 = PanelToScreen(wall_x2, wall_y2);
         //Endpoints 1
         drawList->AddRectFilled(
             ImVec2(flippedWallP1.x - 3.0f, flippedWallP1.y - 3.0f),
@@ -512,21 +537,54 @@ int main() {
             IM_COL32(0, 0, 255, 255)
         );
         ImGui::End();
-
+        PROFILE_ZONE_END(ProfileZone::UiBuild);
+        TRACE_END();
+
+        PROFILE_ZONE_BEGIN(ProfileZone::Spawn);
+        TRACE_BEGIN("spawn");
+        if (spawnJob.Finish(sim))
+            recordEvent(spawnJob.Event());
+        while (!spawnJob.Active() && !spawnQueue.empty()) {
+            spawnNow(spawnQueue.front());
+            spawnQueue.pop_front();
+        }
+        while (const SimEvent* event = replay.NextDue(sim.step))
+            applyEvent(*event, true);
+        for (const SimEvent& event : pendingEvents)
+            applyEvent(event, false);
+        pendingEvents.clear();
+        PROFILE_ZONE_END(ProfileZone::Spawn);
+        TRACE_END();
 
         // Update and render particles
-        UpdateParticles(io, drawList);
+        UpdateParticles(fixedDt > 0.0f ? fixedDt : 1.0f / io.Framerate, drawList);
 
         // ImGui rendering
+        PROFILE_ZONE_BEGIN(ProfileZone::Render);
+        TRACE_BEGIN("render");
         ImGui::Render();
         glClear(GL_COLOR_BUFFER_BIT);
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        PROFILE_ZONE_END(ProfileZone::Render);
+        TRACE_END();
 
         // Swap front and back buffers
+        PROFILE_ZONE_BEGIN(ProfileZone::Swap);
+        TRACE_BEGIN("swap");
         glfwSwapBuffers(window);
+        PROFILE_ZONE_END(ProfileZone::Swap);
+        TRACE_END();
+        PROFILE_END_FRAME(sim.particles.size());
+        TRACE_END();
     }
 
+    if (!options.recordPath.empty() && !SaveEventLog(options.recordPath, recordLog, error))
+        std::cerr << error << std::endl;
+    TraceShutdown();
+
     // Cleanup
+    if (densityTexture != 0)
+        glDeleteTextures(1, &densityTexture);
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
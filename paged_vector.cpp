@@ -0,0 +1,157 @@
+#include "paged_vector.hpp"
+#include "arena.hpp"
+
+#include <cstdint>
+#include <new>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    std::size_t RoundUp(std::size_t value, std::size_t multiple) {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    std::size_t SmallPageSize() {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwPageSize;
+#else
+        static const std::size_t size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        return size;
+#endif
+    }
+
+    // Reserves `bytes` of address space aligned to HUGE_PAGE_SIZE, or returns nullptr.
+    std::byte* ReserveAddressSpace(std::size_t bytes) {
+#ifdef _WIN32
+        // VirtualAlloc reservations are 64 KB aligned; large pages need privileges and are not used
+        return static_cast<std::byte*>(VirtualAlloc(nullptr, bytes, MEM_RESERVE, PAGE_NOACCESS));
+#else
+        const std::size_t padded = bytes + HUGE_PAGE_SIZE;
+        void* mapping = mmap(nullptr, padded, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapping == MAP_FAILED)
+            return nullptr;
+        // trim the unaligned head and the tail of the padding
+        const std::uintptr_t start = reinterpret_cast<std::uintptr_t>(mapping);
+        const std::uintptr_t aligned = RoundUp(start, HUGE_PAGE_SIZE);
+        if (aligned > start)
+            munmap(mapping, aligned - start);
+        const std::size_t tail = padded - (aligned - start) - bytes;
+        if (tail > 0)
+            munmap(reinterpret_cast<void*>(aligned + bytes), tail);
+        return reinterpret_cast<std::byte*>(aligned);
+#endif
+    }
+
+    void ReleaseAddressSpace(std::byte* base, std::size_t bytes) {
+#ifdef _WIN32
+        (void)bytes;
+        VirtualFree(base, 0, MEM_RELEASE);
+#else
+        munmap(base, bytes);
+#endif
+    }
+
+    bool CommitPages(std::byte* address, std::size_t bytes, PageSize pageSize) {
+#ifdef _WIN32
+        (void)pageSize;
+        return VirtualAlloc(address, bytes, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+#else
+        if (mprotect(address, bytes, PROT_READ | PROT_WRITE) != 0)
+            return false;
+#ifdef MADV_HUGEPAGE
+        // only advice: without THP support the range simply keeps small pages
+        madvise(address, bytes, pageSize == PageSize::Huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+#else
+        (void)pageSize;
+#endif
+        return true;
+#endif
+    }
+
+    void DecommitPages(std::byte* address, std::size_t bytes) {
+#ifdef _WIN32
+        VirtualFree(address, bytes, MEM_DECOMMIT);
+#else
+        madvise(address, bytes, MADV_DONTNEED);
+        mprotect(address, bytes, PROT_NONE);
+#endif
+    }
+}
+
+PageReservation::~PageReservation() {
+    Release();
+}
+
+void PageReservation::Release() {
+    if (base)
+        ReleaseAddressSpace(base, reserved);
+    base = nullptr;
+    reserved = 0;
+    committed = 0;
+}
+
+void PageReservation::Reserve(std::size_t bytes) {
+    // Ask for PAGED_VECTOR_RESERVE up front; under an address space limit settle for less, down to
+    // what is needed right now.
+    std::size_t size = std::max(RoundUp(bytes, PAGED_VECTOR_CHUNK), base ? reserved * 2 : std::size_t(PAGED_VECTOR_RESERVE));
+    std::byte* reservation = nullptr;
+    while (!(reservation = ReserveAddressSpace(size))) {
+        if (size / 2 < bytes)
+            throw std::bad_alloc();
+        size = RoundUp(size / 2, PAGED_VECTOR_CHUNK);
+    }
+
+    if (base) {
+        // outgrew a reduced reservation: the one case where the data moves
+        if (!CommitPages(reservation, committed, pageSize)) {
+            ReleaseAddressSpace(reservation, size);
+            throw std::bad_alloc();
+        }
+        std::memcpy(reservation, base, committed);
+        ReleaseAddressSpace(base, reserved);
+    }
+    base = reservation;
+    reserved = size;
+}
+
+void PageReservation::Commit(std::size_t bytes, BS::thread_pool* pool) {
+    if (bytes <= committed)
+        return;
+    const std::size_t target = RoundUp(bytes, PAGED_VECTOR_CHUNK);
+    if (target > reserved)
+        Reserve(target);
+    if (!CommitPages(base + committed, target - committed, pageSize))
+        throw std::bad_alloc();
+    const std::size_t from = committed;
+    committed = target;
+    if (pool)
+        Prefault(from, target, *pool);
+}
+
+void PageReservation::Decommit(std::size_t bytes) {
+    const std::size_t keep = RoundUp(bytes, PAGED_VECTOR_CHUNK);
+    if (keep >= committed)
+        return;
+    DecommitPages(base + keep, committed - keep);
+    committed = keep;
+}
+
+void PageReservation::Prefault(std::size_t from, std::size_t to, BS::thread_pool& pool) {
+    // One write per small page faults it in; with huge pages the first write to each 2 MB faults the
+    // whole of it and the rest are plain stores. Spreading the range over the workers also puts each
+    // page on the NUMA node of a thread that steps particles, not all of them on the main thread's.
+    const std::size_t page = SmallPageSize();
+    std::byte* memory = base;
+    DetachFrameBlocks<std::size_t>(pool, from / page, to / page, [memory, page](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+            *reinterpret_cast<volatile std::byte*>(memory + i * page) = std::byte{ 0 };
+    }).wait();
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+
+#define PAGED_VECTOR_RESERVE (std::size_t(1) << 38) // Address space reserved per PagedVector (256 GiB); only committed pages use memory
+#define PAGED_VECTOR_CHUNK (std::size_t(32) << 20)  // Commit granularity, a multiple of the 2 MB huge page size
+#define HUGE_PAGE_SIZE (std::size_t(2) << 20)
+
+enum class PageSize {
+    Small, // the system default (4 KB), transparent huge pages explicitly refused
+    Huge   // transparent huge pages requested with madvise(MADV_HUGEPAGE) where the OS supports it
+};
+
+// A large virtual address range that is reserved once and committed in PAGED_VECTOR_CHUNK steps, so
+// growing never moves the data. The reservation is aligned to HUGE_PAGE_SIZE, which the kernel needs
+// before it can back the range with huge pages. Only if a commit outgrows the reservation (possible
+// when the address space is limited and the full reservation failed) is a larger one made and the
+// committed bytes copied over.
+class PageReservation {
+public:
+    PageReservation() = default;
+    explicit PageReservation(PageSize pageSize) : pageSize(pageSize) {}
+    ~PageReservation();
+    PageReservation(PageReservation&& other) noexcept { Swap(other); }
+    PageReservation& operator=(PageReservation&& other) noexcept {
+        Swap(other);
+        return *this;
+    }
+    PageReservation(const PageReservation&) = delete;
+    PageReservation& operator=(const PageReservation&) = delete;
+
+    std::byte* Data() const { return base; }
+    std::size_t Committed() const { return committed; }
+    PageSize Pages() const { return pageSize; }
+
+    // Makes [0, bytes) usable. With a pool, the newly committed pages are touched by the pool workers
+    // (waiting for them), so the page faults are taken in parallel now instead of one at a time by the
+    // first step that writes there. Throws std::bad_alloc if the memory cannot be reserved or committed.
+    void Commit(std::size_t bytes, BS::thread_pool* pool = nullptr);
+    // Returns the pages past `bytes` (rounded up to a chunk) to the OS; the reservation is kept.
+    void Decommit(std::size_t bytes);
+
+    void Swap(PageReservation& other) noexcept {
+        std::swap(base, other.base);
+        std::swap(reserved, other.reserved);
+        std::swap(committed, other.committed);
+        std::swap(pageSize, other.pageSize);
+    }
+
+private:
+    void Reserve(std::size_t bytes);
+    void Release();
+    void Prefault(std::size_t from, std::size_t to, BS::thread_pool& pool);
+
+    std::byte* base = nullptr;
+    std::size_t reserved = 0;
+    std::size_t committed = 0;
+    PageSize pageSize = PageSize::Huge;
+};
+
+// The subset of std::vector the particle store needs, over a PageReservation: growth commits pages
+// in place instead of allocating, copying and freeing, and data() stays put while it does. Elements
+// must be trivially copyable; they are copied with memcpy and never destroyed.
+template <typename T>
+class PagedVector {
+    static_assert(std::is_trivially_copyable_v<T>, "PagedVector copies elements with memcpy");
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = T&;
+    using const_reference = const T&;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    explicit PagedVector(PageSize pageSize = PageSize::Huge) : memory(pageSize) {}
+    PagedVector(std::initializer_list<T> values) { assign(values.begin(), values.end()); }
+    PagedVector(const PagedVector& other) : memory(other.memory.Pages()) { assign(other.begin(), other.end()); }
+    PagedVector& operator=(const PagedVector& other) {
+        if (this != &other)
+            assign(other.begin(), other.end());
+        return *this;
+    }
+    PagedVector(PagedVector&& other) noexcept { swap(other); }
+    PagedVector& operator=(PagedVector&& other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    T* data() { return reinterpret_cast<T*>(memory.Data()); }
+    const T* data() const { return reinterpret_cast<const T*>(memory.Data()); }
+    iterator begin() { return data(); }
+    iterator end() { return data() + count; }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + count; }
+    T& operator[](std::size_t index) { return data()[index]; }
+    const T& operator[](std::size_t index) const { return data()[index]; }
+    T& front() { return data()[0]; }
+    T& back() { return data()[count - 1]; }
+    const T& front() const { return data()[0]; }
+    const T& back() const { return data()[count - 1]; }
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    std::size_t capacity() const { return memory.Committed() / sizeof(T); }
+    PageSize pages() const { return memory.Pages(); }
+
+    // With a pool the new pages are pre-faulted on its workers (see PageReservation::Commit). Call it
+    // from outside the pool, while it is idle.
+    void reserve(std::size_t elements, BS::thread_pool* pool = nullptr) {
+        if (elements > capacity())
+            memory.Commit(elements * sizeof(T), pool);
+    }
+    void shrink_to_fit() { memory.Decommit(count * sizeof(T)); }
+    void clear() { count = 0; }
+
+    void resize(std::size_t elements) {
+        reserve(elements);
+        if (elements > count)
+            std::fill(data() + count, data() + elements, T{});
+        count = elements;
+    }
+
+    // Takes the `added` elements already written past the end, within capacity(), into the vector, e.g.
+    // after pool workers filled them in place.
+    void append_written(std::size_t added) { count += added; }
+
+    void push_back(const T& value) {
+        if (count == capacity())
+            reserve(count + 1);
+        data()[count++] = value;
+    }
+
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        push_back(T{ std::forward<Args>(args)... });
+        return back();
+    }
+
+    template <typename Iterator>
+    void assign(Iterator first, Iterator last) {
+        count = 0;
+        insert(end(), first, last);
+    }
+
+    template <typename Iterator>
+    iterator insert(const_iterator position, Iterator first, Iterator last) {
+        const std::size_t at = static_cast<std::size_t>(position - data());
+        const std::size_t added = static_cast<std::size_t>(std::distance(first, last));
+        reserve(count + added);
+        std::memmove(data() + at + added, data() + at, (count - at) * sizeof(T));
+        std::copy(first, last, data() + at);
+        count += added;
+        return data() + at;
+    }
+
+    void swap(PagedVector& other) noexcept {
+        memory.Swap(other.memory);
+        std::swap(count, other.count);
+    }
+
+private:
+    PageReservation memory;
+    std::size_t count = 0;
+};
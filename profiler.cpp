@@ -0,0 +1,105 @@
+#include "profiler.hpp"
+#include "BS_thread_pool.hpp"
+
+#include <algorithm>
+
+FrameProfiler frameProfiler;
+
+const char* ProfileZoneName(ProfileZone zone) {
+    switch (zone) {
+        case ProfileZone::UiBuild: return "UI build";
+        case ProfileZone::Spawn: return "Spawn";
+        case ProfileZone::Physics: return "Physics";
+        case ProfileZone::DrawList: return "Draw list";
+        case ProfileZone::Render: return "Render";
+        case ProfileZone::Swap: return "Swap";
+        case ProfileZone::Frame: return "Frame";
+        case ProfileZone::Count: break;
+    }
+    return "?";
+}
+
+void FrameProfiler::BeginFrame(std::size_t workerCount) {
+    current.fill(0.0);
+    workers.assign(workerCount, WorkerTiming{});
+    frameStartAllocations = CurrentAllocationTotals();
+    BeginZone(ProfileZone::Frame);
+}
+
+void FrameProfiler::EndFrame(std::size_t particleCount) {
+    EndZone(ProfileZone::Frame);
+    const AllocationTotals allocations = CurrentAllocationTotals();
+    lastAllocations.allocations = allocations.allocations - frameStartAllocations.allocations;
+    lastAllocations.bytes = allocations.bytes - frameStartAllocations.bytes;
+    allocationHistory[next] = static_cast<float>(lastAllocations.allocations);
+    for (std::size_t zone = 0; zone < ZoneCount; ++zone)
+        history[zone][next] = static_cast<float>(current[zone]);
+    particleHistory[next] = static_cast<float>(particleCount);
+    next = (next + 1) % HistoryLength;
+    ++frames;
+    lastWorkers = workers;
+}
+
+void FrameProfiler::EndZone(ProfileZone zone) {
+    std::size_t index = static_cast<std::size_t>(zone);
+    current[index] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - zoneStart[index]).count();
+}
+
+void FrameProfiler::AddWorkerPhysics(std::size_t worker, double ms) {
+    if (worker < workers.size()) {
+        workers[worker].physicsMs += ms;
+        ++workers[worker].chunks;
+    }
+}
+
+namespace {
+    template <typename Ring>
+    FrameVector<float> Unroll(const Ring& ring, std::size_t next, std::size_t frames) {
+        std::size_t count = std::min(frames, ring.size());
+        FrameVector<float> values(count);
+        for (std::size_t i = 0; i < count; ++i)
+            values[i] = ring[(next + ring.size() - count + i) % ring.size()];
+        return values;
+    }
+
+    FrameProfiler::Percentiles Summarize(FrameVector<float> values) {
+        FrameProfiler::Percentiles result;
+        if (values.empty())
+            return result;
+        std::sort(values.begin(), values.end());
+        auto at = [&values](double quantile) { return values[static_cast<std::size_t>(quantile * (values.size() - 1))]; };
+        result.p50 = at(0.50);
+        result.p95 = at(0.95);
+        result.p99 = at(0.99);
+        result.max = values.back();
+        return result;
+    }
+}
+
+FrameVector<float> FrameProfiler::History(ProfileZone zone) const {
+    return Unroll(history[static_cast<std::size_t>(zone)], next, frames);
+}
+
+FrameVector<float> FrameProfiler::ParticleHistory() const {
+    return Unroll(particleHistory, next, frames);
+}
+
+FrameVector<float> FrameProfiler::AllocationHistory() const {
+    return Unroll(allocationHistory, next, frames);
+}
+
+FrameProfiler::Percentiles FrameProfiler::ZonePercentiles(ProfileZone zone) const {
+    return Summarize(History(zone));
+}
+
+FrameProfiler::Percentiles FrameProfiler::AllocationPercentiles() const {
+    return Summarize(AllocationHistory());
+}
+
+WorkerProfileScope::WorkerProfileScope() : start(std::chrono::steady_clock::now()) {}
+
+WorkerProfileScope::~WorkerProfileScope() {
+    BS::this_thread::optional_index worker = BS::this_thread::get_index();
+    if (worker)
+        frameProfiler.AddWorkerPhysics(*worker, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+}
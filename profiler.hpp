@@ -0,0 +1,132 @@
+#pragma once
+
+#include "allocations.hpp"
+#include "arena.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Per-frame timing zones. Zones are recorded with PROFILE_ZONE on the thread running the frame,
+// PROFILE_TASK_ZONE for a zone owned by a single pool task (the main thread is waiting on the pool
+// meanwhile), and PROFILE_WORKER_ZONE inside physics jobs, accumulated per worker. All of them compile
+// to nothing unless PARTICLE_PROFILER is defined.
+enum class ProfileZone {
+    UiBuild,  // ImGui windows and widgets
+    Spawn,    // applying batch-add / wall events
+    Physics,  // UpdateParticles on the main thread: physics jobs and the draw task, until both batches are done
+    DrawList, // the particle draw task (worker time)
+    Render,   // ImGui::Render and the OpenGL backend
+    Swap,     // glfwSwapBuffers, including vsync waits
+    Frame,    // the whole main loop iteration
+    Count
+};
+
+const char* ProfileZoneName(ProfileZone zone);
+
+// Keeps the last `HistoryLength` frames of zone timings and heap allocation counts so the panel can
+// show distributions.
+class FrameProfiler {
+public:
+    static constexpr std::size_t HistoryLength = 512;
+    static constexpr std::size_t ZoneCount = static_cast<std::size_t>(ProfileZone::Count);
+
+    struct WorkerTiming {
+        double physicsMs = 0.0;
+        int chunks = 0;
+    };
+
+    struct Percentiles {
+        float p50 = 0.0f, p95 = 0.0f, p99 = 0.0f, max = 0.0f;
+    };
+
+    // Start timing a frame; the Frame zone is the time until EndFrame.
+    void BeginFrame(std::size_t workerCount);
+    // Close the frame and push it into the history, together with the particle count it stepped.
+    void EndFrame(std::size_t particleCount);
+
+    void AddZone(ProfileZone zone, double ms) { current[static_cast<std::size_t>(zone)] += ms; }
+    // For zones spanning code that cannot be wrapped in a scope, e.g. the UI windows of the main loop.
+    void BeginZone(ProfileZone zone) { zoneStart[static_cast<std::size_t>(zone)] = std::chrono::steady_clock::now(); }
+    void EndZone(ProfileZone zone);
+    // Called from pool workers; each worker only ever touches its own slot, and the main thread reads
+    // them after the physics batch is done.
+    void AddWorkerPhysics(std::size_t worker, double ms);
+
+    std::size_t FrameCount() const { return frames; }
+    // Oldest-to-newest samples of one zone, in milliseconds. Allocated in the frame arena.
+    FrameVector<float> History(ProfileZone zone) const;
+    FrameVector<float> ParticleHistory() const;
+    // Heap allocations made between BeginFrame and EndFrame, on any thread.
+    FrameVector<float> AllocationHistory() const;
+    Percentiles ZonePercentiles(ProfileZone zone) const;
+    Percentiles AllocationPercentiles() const;
+    const AllocationTotals& LastAllocations() const { return lastAllocations; }
+    const std::vector<WorkerTiming>& LastWorkers() const { return lastWorkers; }
+
+private:
+    std::array<double, ZoneCount> current = {};
+    std::array<std::chrono::steady_clock::time_point, ZoneCount> zoneStart = {};
+    std::vector<WorkerTiming> workers;
+    std::vector<WorkerTiming> lastWorkers;
+
+    std::array<std::array<float, HistoryLength>, ZoneCount> history = {};
+    std::array<float, HistoryLength> particleHistory = {};
+    std::array<float, HistoryLength> allocationHistory = {};
+    AllocationTotals frameStartAllocations;
+    AllocationTotals lastAllocations;
+    std::size_t next = 0;
+    std::size_t frames = 0;
+};
+
+extern FrameProfiler frameProfiler;
+
+// Adds the time between construction and destruction to a zone, like a BS::timer that reports itself.
+class ProfileScope {
+public:
+    explicit ProfileScope(ProfileZone zone) : zone(zone), start(std::chrono::steady_clock::now()) {}
+    ~ProfileScope() { frameProfiler.AddZone(zone, ElapsedMs()); }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    double ElapsedMs() const { return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); }
+
+    ProfileZone zone;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Scope for a physics job running on a pool worker.
+class WorkerProfileScope {
+public:
+    WorkerProfileScope();
+    ~WorkerProfileScope();
+    WorkerProfileScope(const WorkerProfileScope&) = delete;
+    WorkerProfileScope& operator=(const WorkerProfileScope&) = delete;
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef PARTICLE_PROFILER
+#define PROFILE_BEGIN_FRAME(workers) frameProfiler.BeginFrame(workers)
+#define PROFILE_END_FRAME(particles) frameProfiler.EndFrame(particles)
+#define PROFILE_ZONE_BEGIN(zone) frameProfiler.BeginZone(zone)
+#define PROFILE_ZONE_END(zone) frameProfiler.EndZone(zone)
+#define PROFILE_ZONE(zone) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(zone)
+#define PROFILE_WORKER_ZONE() WorkerProfileScope PROFILE_CONCAT(workerProfileScope, __LINE__)
+#define PROFILE_TASK_ZONE(zone) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(zone)
+#else
+#define PROFILE_BEGIN_FRAME(workers) ((void)0)
+#define PROFILE_END_FRAME(particles) ((void)0)
+#define PROFILE_ZONE_BEGIN(zone) ((void)0)
+#define PROFILE_ZONE_END(zone) ((void)0)
+#define PROFILE_ZONE(zone) ((void)0)
+#define PROFILE_WORKER_ZONE() ((void)0)
+#define PROFILE_TASK_ZONE(zone) ((void)0)
+#endif
@@ -0,0 +1,116 @@
+#include "profiler_panel.hpp"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+#include <vector>
+
+namespace {
+    // Buckets `values` into `bins` equal-width bins between 0 and `maxValue`.
+    FrameVector<float> Histogram(const FrameVector<float>& values, int bins, float maxValue) {
+        FrameVector<float> counts(bins, 0.0f);
+        if (maxValue <= 0.0f)
+            return counts;
+        for (float value : values) {
+            int bin = std::min(bins - 1, static_cast<int>(value / maxValue * bins));
+            counts[std::max(0, bin)] += 1.0f;
+        }
+        return counts;
+    }
+
+    // Particle count (x) against physics time (y) for every recorded frame. The point where the
+    // cloud bends upwards is where stepping stops scaling with the pool.
+    void DrawScalingPlot(const FrameVector<float>& particles, const FrameVector<float>& physicsMs, ImVec2 size) {
+        ImVec2 origin = ImGui::GetCursorScreenPos();
+        ImGui::Dummy(size);
+        ImDrawList* drawList = ImGui::GetWindowDrawList();
+        drawList->AddRect(origin, ImVec2(origin.x + size.x, origin.y + size.y), IM_COL32(128, 128, 128, 255));
+        if (particles.empty())
+            return;
+
+        float maxParticles = std::max(1.0f, *std::max_element(particles.begin(), particles.end()));
+        float maxMs = std::max(0.001f, *std::max_element(physicsMs.begin(), physicsMs.end()));
+        for (std::size_t i = 0; i < particles.size(); ++i) {
+            // newest frames are drawn brightest
+            int alpha = 64 + static_cast<int>(191 * i / particles.size());
+            ImVec2 point(origin.x + particles[i] / maxParticles * (size.x - 4) + 2,
+                         origin.y + size.y - physicsMs[i] / maxMs * (size.y - 4) - 2);
+            drawList->AddRectFilled(ImVec2(point.x - 1, point.y - 1), ImVec2(point.x + 1, point.y + 1), IM_COL32(255, 200, 0, alpha));
+        }
+        char label[64];
+        std::snprintf(label, sizeof(label), "%.0f particles, %.2f ms", maxParticles, maxMs);
+        drawList->AddText(ImVec2(origin.x + 4, origin.y + 2), IM_COL32(200, 200, 200, 255), label);
+    }
+}
+
+void DrawProfilerPanel(const FrameProfiler& profiler, float framerate) {
+    static int selectedZone = static_cast<int>(ProfileZone::Physics);
+
+    ImGui::SetNextWindowSize(ImVec2(420, 560), ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowPos(ImVec2(850, 10), ImGuiCond_FirstUseEver);
+    ImGui::Begin("Profiler");
+    ImGui::Text("%.3f FPS (%.2f ms)", framerate, framerate > 0.0f ? 1000.0f / framerate : 0.0f);
+
+    if (ImGui::BeginTable("zones", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+        ImGui::TableSetupColumn("zone (ms)");
+        ImGui::TableSetupColumn("p50");
+        ImGui::TableSetupColumn("p95");
+        ImGui::TableSetupColumn("p99");
+        ImGui::TableSetupColumn("max");
+        ImGui::TableHeadersRow();
+        for (int zone = 0; zone < static_cast<int>(ProfileZone::Count); ++zone) {
+            FrameProfiler::Percentiles percentiles = profiler.ZonePercentiles(static_cast<ProfileZone>(zone));
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            if (ImGui::RadioButton(ProfileZoneName(static_cast<ProfileZone>(zone)), selectedZone == zone))
+                selectedZone = zone;
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", percentiles.p50);
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", percentiles.p95);
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", percentiles.p99);
+            ImGui::TableNextColumn(); ImGui::Text("%.2f", percentiles.max);
+        }
+        ImGui::EndTable();
+    }
+
+    ProfileZone zone = static_cast<ProfileZone>(selectedZone);
+    FrameVector<float> history = profiler.History(zone);
+    FrameProfiler::Percentiles percentiles = profiler.ZonePercentiles(zone);
+    ImGui::Text("%s, last %d frames", ProfileZoneName(zone), static_cast<int>(history.size()));
+    if (!history.empty()) {
+        ImGui::PlotLines("##timeline", history.data(), static_cast<int>(history.size()), 0, nullptr, 0.0f, percentiles.max, ImVec2(-1, 50));
+        FrameVector<float> bins = Histogram(history, 40, percentiles.max);
+        char overlay[64];
+        std::snprintf(overlay, sizeof(overlay), "0 - %.2f ms", percentiles.max);
+        ImGui::PlotHistogram("##distribution", bins.data(), static_cast<int>(bins.size()), 0, overlay, 0.0f, FLT_MAX, ImVec2(-1, 60));
+    }
+
+    const std::vector<FrameProfiler::WorkerTiming>& workers = profiler.LastWorkers();
+    ImGui::Text("Physics per worker (last frame)");
+    FrameVector<float> workerMs;
+    workerMs.reserve(workers.size());
+    for (const FrameProfiler::WorkerTiming& worker : workers)
+        workerMs.push_back(static_cast<float>(worker.physicsMs));
+    if (!workerMs.empty())
+        ImGui::PlotHistogram("##workers", workerMs.data(), static_cast<int>(workerMs.size()), 0, nullptr, 0.0f, FLT_MAX, ImVec2(-1, 50));
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+        ImGui::Text("worker %d: %.3f ms in %d chunk(s)", static_cast<int>(i), workers[i].physicsMs, workers[i].chunks);
+    }
+
+    if (AllocationCountingEnabled()) {
+        // the frame arena should keep this at 0 once the scene stops growing
+        const AllocationTotals& last = profiler.LastAllocations();
+        FrameProfiler::Percentiles allocations = profiler.AllocationPercentiles();
+        ImGui::Text("Heap allocations: %llu this frame (%llu bytes), p50 %.0f, max %.0f",
+                    static_cast<unsigned long long>(last.allocations), static_cast<unsigned long long>(last.bytes), allocations.p50, allocations.max);
+        FrameVector<float> allocationHistory = profiler.AllocationHistory();
+        if (!allocationHistory.empty())
+            ImGui::PlotLines("##allocations", allocationHistory.data(), static_cast<int>(allocationHistory.size()), 0, nullptr, 0.0f, std::max(1.0f, allocations.max), ImVec2(-1, 40));
+    }
+
+    ImGui::Text("Particle count vs. physics time");
+    DrawScalingPlot(profiler.ParticleHistory(), profiler.History(ProfileZone::Physics), ImVec2(ImGui::GetWindowWidth() - 20, 140));
+
+    ImGui::End();
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "profiler.hpp"
+
+// "Profiler" window: framerate, zone percentiles over the recorded history, the distribution of the
+// selected zone, per-worker physics time of the last frame, heap allocations per frame, and particle
+// count vs. physics time.
+void DrawProfilerPanel(const FrameProfiler& profiler, float framerate);
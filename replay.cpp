@@ -0,0 +1,188 @@
+#include "replay.hpp"
+
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace {
+    const char* EventName(SimEvent::Type type) {
+        switch (type) {
+            case SimEvent::Type::AddPoints: return "points";
+            case SimEvent::Type::AddAngles: return "angles";
+            case SimEvent::Type::AddVelocities: return "velocities";
+            case SimEvent::Type::Reset: return "reset";
+            case SimEvent::Type::AddWall: return "wall";
+            case SimEvent::Type::ResetWall: return "reset_wall";
+        }
+        return "?";
+    }
+
+    bool ParseEventName(const std::string& name, SimEvent::Type& type) {
+        for (SimEvent::Type candidate : { SimEvent::Type::AddPoints, SimEvent::Type::AddAngles, SimEvent::Type::AddVelocities,
+                                          SimEvent::Type::Reset, SimEvent::Type::AddWall, SimEvent::Type::ResetWall }) {
+            if (name == EventName(candidate)) {
+                type = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+bool IsSpawnEvent(const SimEvent& event) {
+    return event.type == SimEvent::Type::AddPoints || event.type == SimEvent::Type::AddAngles || event.type == SimEvent::Type::AddVelocities;
+}
+
+void ApplyEvent(Simulation& sim, const SimEvent& event, BS::thread_pool* pool) {
+    if (pool && event.count > 0 && IsSpawnEvent(event))
+        sim.particles.reserve(sim.particles.size() + static_cast<std::size_t>(event.count), pool);
+    switch (event.type) {
+        case SimEvent::Type::AddPoints:
+            AddParticlesBetweenPoints(sim.particles, sim.bounds, event.sx, event.sy, event.ex, event.ey, event.startSpeed, event.startAngle, event.count);
+            break;
+        case SimEvent::Type::AddAngles:
+            AddParticlesBetweenAngles(sim.particles, sim.bounds, event.sx, event.sy, event.startSpeed, event.startAngle, event.endAngle, event.count);
+            break;
+        case SimEvent::Type::AddVelocities:
+            AddParticlesBetweenVelocities(sim.particles, sim.bounds, event.sx, event.sy, event.startSpeed, event.endSpeed, event.startAngle, event.count);
+            break;
+        case SimEvent::Type::Reset:
+            ClearParticles(sim);
+            break;
+        case SimEvent::Type::AddWall:
+            sim.wall.push_back(MakeWall(sim.bounds, event.sx, event.sy, event.ex, event.ey));
+            break;
+        case SimEvent::Type::ResetWall:
+            sim.wall.clear();
+            sim.wakeWallsFrom = 0;
+            break;
+    }
+}
+
+// Format:
+//   dt <seconds>
+//   world <width> <height>          (optional, default 1280 720)
+//   <step> points <sx> <sy> <ex> <ey> <speed> <angle> <count>
+//   <step> angles <sx> <sy> <speed> <startAngle> <endAngle> <count>
+//   <step> velocities <sx> <sy> <startSpeed> <endSpeed> <angle> <count>
+//   <step> wall <x1> <y1> <x2> <y2>
+//   <step> reset | reset_wall
+// Blank lines and lines starting with '#' are ignored.
+bool SaveEventLog(const std::string& path, const EventLog& log, std::string& error) {
+    std::ofstream out(path);
+    if (!out) {
+        error = "cannot open " + path + " for writing";
+        return false;
+    }
+    out.precision(std::numeric_limits<float>::max_digits10);
+    out << "# particle simulation event log\n";
+    out << "dt " << log.dt << "\n";
+    out << "world " << log.world.width << " " << log.world.height << "\n";
+    for (const SimEvent& event : log.events) {
+        out << event.step << " " << EventName(event.type);
+        switch (event.type) {
+            case SimEvent::Type::AddPoints:
+                out << " " << event.sx << " " << event.sy << " " << event.ex << " " << event.ey
+                    << " " << event.startSpeed << " " << event.startAngle << " " << event.count;
+                break;
+            case SimEvent::Type::AddAngles:
+                out << " " << event.sx << " " << event.sy << " " << event.startSpeed
+                    << " " << event.startAngle << " " << event.endAngle << " " << event.count;
+                break;
+            case SimEvent::Type::AddVelocities:
+                out << " " << event.sx << " " << event.sy << " " << event.startSpeed << " " << event.endSpeed
+                    << " " << event.startAngle << " " << event.count;
+                break;
+            case SimEvent::Type::AddWall:
+                out << " " << event.sx << " " << event.sy << " " << event.ex << " " << event.ey;
+                break;
+            case SimEvent::Type::Reset:
+            case SimEvent::Type::ResetWall:
+                break;
+        }
+        out << "\n";
+    }
+    if (!out) {
+        error = "failed writing " + path;
+        return false;
+    }
+    return true;
+}
+
+bool LoadEventLog(const std::string& path, EventLog& log, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+    log = EventLog{};
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        ++lineNumber;
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        if (line.rfind("dt ", 0) == 0) {
+            std::string key;
+            fields >> key >> log.dt;
+            if (!fields || !(log.dt > 0.0f)) {
+                error = path + ":" + std::to_string(lineNumber) + ": bad dt";
+                return false;
+            }
+        } else if (line.rfind("world ", 0) == 0) {
+            std::string key;
+            fields >> key >> log.world.width >> log.world.height;
+            if (!fields || log.world.width < 1 || log.world.height < 1) {
+                error = path + ":" + std::to_string(lineNumber) + ": bad world size";
+                return false;
+            }
+        } else {
+            SimEvent event;
+            std::string name;
+            fields >> event.step >> name;
+            if (fields && !ParseEventName(name, event.type)) {
+                error = path + ":" + std::to_string(lineNumber) + ": unknown event '" + name + "'";
+                return false;
+            }
+            switch (event.type) {
+                case SimEvent::Type::AddPoints:
+                    fields >> event.sx >> event.sy >> event.ex >> event.ey >> event.startSpeed >> event.startAngle >> event.count;
+                    break;
+                case SimEvent::Type::AddAngles:
+                    fields >> event.sx >> event.sy >> event.startSpeed >> event.startAngle >> event.endAngle >> event.count;
+                    break;
+                case SimEvent::Type::AddVelocities:
+                    fields >> event.sx >> event.sy >> event.startSpeed >> event.endSpeed >> event.startAngle >> event.count;
+                    break;
+                case SimEvent::Type::AddWall:
+                    fields >> event.sx >> event.sy >> event.ex >> event.ey;
+                    break;
+                case SimEvent::Type::Reset:
+                case SimEvent::Type::ResetWall:
+                    break;
+            }
+            if (!log.events.empty() && event.step < log.events.back().step) {
+                error = path + ":" + std::to_string(lineNumber) + ": events are not sorted by step";
+                return false;
+            }
+            log.events.push_back(event);
+        }
+        if (fields.fail()) {
+            error = path + ":" + std::to_string(lineNumber) + ": malformed line";
+            return false;
+        }
+    }
+    return true;
+}
+
+const SimEvent* ReplayCursor::NextDue(std::uint64_t step) {
+    if (next < log.events.size() && log.events[next].step <= step)
+        return &log.events[next++];
+    return nullptr;
+}
+
+void ReplayCursor::ApplyDue(Simulation& sim, BS::thread_pool* pool) {
+    while (const SimEvent* event = NextDue(sim.step))
+        ApplyEvent(sim, *event, pool);
+}
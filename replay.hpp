@@ -0,0 +1,63 @@
+#pragma once
+
+#include "simulation.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One operator action from the GUI (or a scenario), stamped with the simulation step it was applied
+// before. Parameters are stored exactly as the panels hold them so replays go through the same code.
+struct SimEvent {
+    enum class Type {
+        AddPoints,     // [Start-End Point] Batch Adding
+        AddAngles,     // [Start-End Angle] Batch Adding
+        AddVelocities, // [Start-End Velocity] Batch Adding
+        Reset,
+        AddWall,
+        ResetWall
+    };
+
+    std::uint64_t step = 0;
+    Type type = Type::Reset;
+    int sx = 0, sy = 0, ex = 0, ey = 0; // start/end point, or the two wall endpoints
+    float startSpeed = 0.0f, endSpeed = 0.0f;
+    float startAngle = 0.0f, endAngle = 0.0f;
+    int count = 0;
+};
+
+// An ordered list of events plus the fixed timestep and world size they were recorded under. Stored as
+// plain text, one event per line, with floats written with enough digits to round-trip exactly.
+struct EventLog {
+    float dt = 1.0f / 60.0f;
+    WorldBounds world;
+    std::vector<SimEvent> events;
+};
+
+// AddPoints, AddAngles or AddVelocities.
+bool IsSpawnEvent(const SimEvent& event);
+// With a pool, spawn events first grow sim.particles with the new pages pre-faulted on the workers.
+void ApplyEvent(Simulation& sim, const SimEvent& event, BS::thread_pool* pool = nullptr);
+
+bool SaveEventLog(const std::string& path, const EventLog& log, std::string& error);
+bool LoadEventLog(const std::string& path, EventLog& log, std::string& error);
+
+// Applies the events of a log as the simulation reaches their steps. Events must be sorted by step,
+// which is how they are recorded.
+class ReplayCursor {
+public:
+    explicit ReplayCursor(const EventLog& log) : log(log) {}
+
+    // Next pending event stamped with a step <= `step`, or nullptr once everything due has been consumed.
+    const SimEvent* NextDue(std::uint64_t step);
+    // Apply every pending event stamped with a step <= sim.step. Call right before stepping.
+    void ApplyDue(Simulation& sim, BS::thread_pool* pool = nullptr);
+    bool Finished() const { return next == log.events.size(); }
+    // Step of the last event in the log, i.e. the first step at which the whole log has been applied.
+    std::uint64_t LastStep() const { return log.events.empty() ? 0 : log.events.back().step; }
+
+private:
+    const EventLog& log;
+    std::size_t next = 0;
+};
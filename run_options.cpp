@@ -0,0 +1,257 @@
+#include "run_options.hpp"
+#include "state_export.hpp"
+
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+    // "speed=0.5,1,2" or "angle=0:90:4" (4 values from 0 to 90)
+    bool ParseSweep(const std::string& spec, SweepAxis& axis, std::string& error) {
+        const std::size_t equals = spec.find('=');
+        const std::string name = spec.substr(0, equals);
+        if (name == "speed") {
+            axis.parameter = SweepParameter::Speed;
+        } else if (name == "angle") {
+            axis.parameter = SweepParameter::Angle;
+        } else if (name == "count") {
+            axis.parameter = SweepParameter::Count;
+        } else {
+            error = "--sweep parameter must be speed, angle or count";
+            return false;
+        }
+        const std::string values = equals == std::string::npos ? std::string() : spec.substr(equals + 1);
+        float from = 0.0f, to = 0.0f;
+        int steps = 0;
+        char colon1 = 0, colon2 = 0;
+        std::istringstream range(values);
+        if (range >> from >> colon1 >> to >> colon2 >> steps && colon1 == ':' && colon2 == ':' && range.eof()) {
+            if (steps < 1) {
+                error = "--sweep range needs at least one value";
+                return false;
+            }
+            for (int i = 0; i < steps; ++i)
+                axis.values.push_back(steps == 1 ? from : from + (to - from) * static_cast<float>(i) / static_cast<float>(steps - 1));
+            return true;
+        }
+        std::istringstream list(values);
+        std::string item;
+        while (std::getline(list, item, ',')) {
+            char* end = nullptr;
+            const float value = std::strtof(item.c_str(), &end);
+            if (item.empty() || *end != '\0') {
+                error = "--sweep values must be <v1,v2,...> or <from:to:n>";
+                return false;
+            }
+            axis.values.push_back(value);
+        }
+        if (axis.values.empty()) {
+            error = "--sweep values must be <v1,v2,...> or <from:to:n>";
+            return false;
+        }
+        return true;
+    }
+}
+
+bool ParseRunOptions(int argc, char** argv, RunOptions& options, std::string& error) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        // every option except --headless takes a value
+        if (arg != "--headless" && i + 1 >= argc) {
+            error = "missing value for " + arg;
+            return false;
+        }
+        if (arg == "--headless") {
+            options.headless = true;
+        } else if (arg == "--record") {
+            options.recordPath = argv[++i];
+        } else if (arg == "--replay") {
+            options.replayPath = argv[++i];
+        } else if (arg == "--scenario") {
+            options.scenarioPath = argv[++i];
+        } else if (arg == "--generate") {
+            options.generateKind = argv[++i];
+        } else if (arg == "--out") {
+            options.outPath = argv[++i];
+        } else if (arg == "--particles") {
+            options.particles = std::atoi(argv[++i]);
+        } else if (arg == "--walls") {
+            options.walls = std::atoi(argv[++i]);
+        } else if (arg == "--seed") {
+            options.seed = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--dt") {
+            options.fixedDt = std::strtof(argv[++i], nullptr);
+            if (options.fixedDt <= 0.0f) {
+                error = "--dt must be positive";
+                return false;
+            }
+        } else if (arg == "--steps") {
+            options.steps = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--world") {
+            char* end = nullptr;
+            options.world.width = std::strtof(argv[++i], &end);
+            options.world.height = (end && *end == 'x') ? std::strtof(end + 1, nullptr) : 0.0f;
+            if (options.world.width < 1 || options.world.height < 1) {
+                error = "--world must be <width>x<height>, e.g. 100000x100000";
+                return false;
+            }
+        } else if (arg == "--storage") {
+            std::string storage = argv[++i];
+            if (storage == "float") {
+                options.storage = ParticleStorage::Float;
+            } else if (storage == "compact") {
+                options.storage = ParticleStorage::Compact;
+            } else if (storage == "compare") {
+                options.storage = ParticleStorage::Compare;
+            } else {
+                error = "--storage must be float, compact or compare";
+                return false;
+            }
+        } else if (arg == "--integrator") {
+            std::string integrator = argv[++i];
+            if (integrator == "step") {
+                options.integrator = Integrator::Step;
+            } else if (integrator == "events") {
+                options.integrator = Integrator::Events;
+            } else if (integrator == "compare") {
+                options.integrator = Integrator::Compare;
+            } else {
+                error = "--integrator must be step, events or compare";
+                return false;
+            }
+        } else if (arg == "--sweep") {
+            SweepAxis axis;
+            if (!ParseSweep(argv[++i], axis, error))
+                return false;
+            options.sweeps.push_back(axis);
+        } else if (arg == "--export") {
+            options.exportName = argv[++i];
+            if (options.exportName.empty() || options.exportName[0] != '/') {
+                error = "--export needs a shared memory name starting with /, e.g. " STATE_EXPORT_NAME;
+                return false;
+            }
+        } else if (arg == "--shards") {
+            options.shards = std::atoi(argv[++i]);
+            if (options.shards < 1) {
+                error = "--shards must be at least 1";
+                return false;
+            }
+        } else if (arg == "--shard-transport") {
+            std::string transport = argv[++i];
+            if (transport == "shm") {
+                options.shardTransport = ShardTransport::SharedMemory;
+            } else if (transport == "socket") {
+                options.shardTransport = ShardTransport::Socket;
+            } else {
+                error = "--shard-transport must be shm or socket";
+                return false;
+            }
+        } else if (arg == "--fast-forward") {
+            options.fastForward = std::atof(argv[++i]);
+            if (options.fastForward <= 0.0) {
+                error = "--fast-forward must be a positive number of seconds";
+                return false;
+            }
+        } else if (arg == "--background") {
+            options.backgroundMs = std::atof(argv[++i]);
+            if (options.backgroundMs <= 0.0) {
+                error = "--background must be a positive number of milliseconds";
+                return false;
+            }
+        } else if (arg == "--lanes") {
+            std::string lanes = argv[++i];
+            if (lanes == "fifo") {
+                options.lanes = PoolLanes::Fifo;
+            } else if (lanes == "strict") {
+                options.lanes = PoolLanes::Strict;
+            } else if (lanes == "weighted") {
+                options.lanes = PoolLanes::Weighted;
+            } else {
+                error = "--lanes must be fifo, strict or weighted";
+                return false;
+            }
+        } else if (arg == "--threads") {
+            options.threads = std::atoi(argv[++i]);
+            if (options.threads < 1) {
+                error = "--threads must be at least 1";
+                return false;
+            }
+        } else {
+            error = "unknown option " + arg;
+            return false;
+        }
+    }
+    if (!options.generateKind.empty() && options.outPath.empty()) {
+        error = "--generate needs --out";
+        return false;
+    }
+    if (!options.replayPath.empty() && !options.scenarioPath.empty()) {
+        error = "--replay and --scenario cannot be combined";
+        return false;
+    }
+    if (options.integrator != Integrator::Step && options.storage != ParticleStorage::Float) {
+        error = "--integrator events and compare use float storage";
+        return false;
+    }
+    if (!options.sweeps.empty() && (options.storage != ParticleStorage::Float || options.integrator != Integrator::Step ||
+                                    options.shards > 0 || !options.exportName.empty() || options.fastForward > 0.0)) {
+        error = "--sweep runs float storage and fixed steps, without --shards, --export or --fast-forward";
+        return false;
+    }
+    if (options.headless && !options.exportName.empty() &&
+        (options.storage != ParticleStorage::Float || options.integrator != Integrator::Step || options.shards > 0)) {
+        error = "headless --export publishes float storage and fixed steps only";
+        return false;
+    }
+    if (options.shards > 0 && (options.storage != ParticleStorage::Float || options.integrator != Integrator::Step || options.fastForward > 0.0)) {
+        error = "--shards runs float storage and fixed steps only";
+        return false;
+    }
+    if (options.fastForward > 0.0 && (options.storage != ParticleStorage::Float || options.integrator == Integrator::Compare)) {
+        error = "--fast-forward needs float storage and the step or events integrator";
+        return false;
+    }
+    if (options.backgroundMs > 0.0 && (options.storage != ParticleStorage::Float || options.integrator != Integrator::Step || !options.sweeps.empty() ||
+                                       options.shards > 0 || !options.exportName.empty() || options.fastForward > 0.0)) {
+        error = "--background runs float storage and fixed steps, without --sweep, --shards, --export or --fast-forward";
+        return false;
+    }
+    if (options.headless && options.generateKind.empty() && options.replayPath.empty() && options.scenarioPath.empty() && options.steps == 0) {
+        error = "a headless run needs --replay, --scenario or --steps";
+        return false;
+    }
+    return true;
+}
+
+const char* RunOptionsUsage() {
+    return "options:\n"
+           "  --record <file>   write spawn/wall events to an event log\n"
+           "  --replay <file>   re-apply an event log at its recorded steps\n"
+           "  --scenario <file> load a scenario file (see scenario.hpp for the format)\n"
+           "  --headless        run without a window (requires --replay, --scenario or --steps)\n"
+           "  --dt <seconds>    fixed timestep (default: the log's, or 1/60 when recording)\n"
+           "  --steps <n>       number of steps to run headless\n"
+           "  --threads <n>     number of physics worker threads\n"
+           "  --world <w>x<h>   world size (default: the log's or scenario's, else 1280x720)\n"
+           "  --storage <float|compact|compare>\n"
+           "                    headless particle storage; compare runs both and reports the compact error\n"
+           "                    (compact diverges from float once particles hit walls)\n"
+           "  --integrator <step|events|compare>\n"
+           "                    headless fixed steps or event-driven bounces; compare runs both and reports the difference\n"
+           "  --sweep <speed|angle|count>=<v1,v2,...|from:to:n>\n"
+           "                    headless ensemble: run the scenario once per combination of the swept values\n"
+           "                    (speed and count scale the batch adds, angle adds degrees); repeatable\n"
+           "  --export <name>   publish every frame to a POSIX shared memory object, e.g. " STATE_EXPORT_NAME "\n"
+           "                    (read it with particle_state_reader)\n"
+           "  --shards <n>      headless: split the world into n strips, each stepped by its own process\n"
+           "  --shard-transport <shm|socket>\n"
+           "                    how shards exchange particles: shared-memory rings (default) or Unix sockets\n"
+           "  --fast-forward <seconds>\n"
+           "                    after the last step, skip this far ahead in closed form (headless)\n"
+           "  --background <ms> headless: step in real time (one step per dt) while background tasks of this\n"
+           "                    length keep every worker busy between steps; reports step time percentiles\n"
+           "  --lanes <fifo|strict|weighted>\n"
+           "                    where that load is queued: the frame lane (as a single queue would) or the\n"
+           "                    background lane under a frame deadline, drained strictly or weighted (default strict)\n"
+           "  --generate <maze|clusters|streams> --out <file> [--particles n] [--walls n] [--steps n] [--seed n] [--world wxh]\n"
+           "                    write a generated stress scenario and exit\n";
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "simulation.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// How the headless runner stores particles between steps.
+enum class ParticleStorage {
+    Float,   // ParticleBuffer, the default
+    Compact, // CompactParticles (compact.hpp): fixed-point positions, half-float velocities
+    Compare  // both, one after the other, followed by an accuracy report of compact against float
+};
+
+// How the headless runner advances particles.
+enum class Integrator {
+    Step,   // fixed steps of dt, the default
+    Events, // EventDrivenParticles (event_driven.hpp): analytic bounce times in a calendar queue
+    Compare // both, one after the other, followed by a report of how far the event-driven run ended from the stepped one
+};
+
+// How the processes of a sharded headless run exchange particles (see shard.hpp).
+enum class ShardTransport {
+    SharedMemory, // lock-free single-producer/single-consumer rings in a shared anonymous mapping
+    Socket        // AF_UNIX stream socket pairs, standing in for a network link
+};
+
+// Where the headless background load (--background) is queued in the pool.
+enum class PoolLanes {
+    Fifo,    // in the frame lane with the steps' jobs, as with a single task queue
+    Strict,  // in the background lane, drained only when no frame job waits, with a frame deadline
+    Weighted // in the background lane, drained at a 1 : 4 share against frame jobs, with a frame deadline
+};
+
+// A batch-add value an ensemble run varies (see ensemble.hpp).
+enum class SweepParameter {
+    Speed, // scale of every spawn speed
+    Angle, // offset in degrees added to every spawn angle
+    Count  // scale of every spawn count
+};
+
+// One axis of the ensemble's parameter grid.
+struct SweepAxis {
+    SweepParameter parameter = SweepParameter::Speed;
+    std::vector<float> values;
+};
+
+// Command-line options shared by the GUI and the headless runner.
+struct RunOptions {
+    std::string recordPath;  // --record <file>: write every operator action to an event log
+    std::string replayPath;  // --replay <file>: re-apply a recorded event log at its steps
+    std::string scenarioPath; // --scenario <file>: load a workload file (see scenario.hpp)
+    bool headless = false;   // --headless: no window, step as fast as possible
+    float fixedDt = 0.0f;    // --dt <seconds>: fixed timestep; 0 steps by 1 / io.Framerate in the GUI
+    std::uint64_t steps = 0; // --steps <n>: headless step count; 0 runs until the last replayed event
+    int threads = 0;         // --threads <n>: physics worker count; 0 keeps the default
+    WorldBounds world = { 0.0f, 0.0f }; // --world <w>x<h>: world size; 0 keeps the log's or scenario's
+    ParticleStorage storage = ParticleStorage::Float; // --storage <float|compact|compare>: headless only
+    Integrator integrator = Integrator::Step; // --integrator <step|events|compare>: headless only
+    int shards = 0;          // --shards <n>: headless, split the world into n strips stepped by n processes (see shard.hpp)
+    ShardTransport shardTransport = ShardTransport::SharedMemory; // --shard-transport <shm|socket>
+    std::vector<SweepAxis> sweeps; // --sweep <speed|angle|count>=<v1,v2,...|from:to:n>, repeatable: headless ensemble over the grid
+    std::string exportName;  // --export <name>: publish every step to this shared memory object (see state_export.hpp)
+    double fastForward = 0.0; // --fast-forward <seconds>: headless, skip this far ahead after the last step (see fast_forward.hpp)
+    double backgroundMs = 0.0; // --background <ms>: headless, step in real time under a synthetic load of background tasks this long
+    PoolLanes lanes = PoolLanes::Strict; // --lanes <fifo|strict|weighted>: where that load is queued
+
+    // --generate <maze|clusters|streams> --out <file>: write a stress scenario and exit
+    std::string generateKind;
+    std::string outPath;
+    int particles = 0;       // --particles <n>: generator particle budget; 0 keeps the default
+    int walls = -1;          // --walls <n>: generator wall count; -1 keeps the default
+    std::uint32_t seed = 1;  // --seed <n>
+};
+
+bool ParseRunOptions(int argc, char** argv, RunOptions& options, std::string& error);
+const char* RunOptionsUsage();
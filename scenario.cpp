@@ -0,0 +1,341 @@
+#include "scenario.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <vector>
+
+namespace {
+    struct Section {
+        std::string name;
+        std::map<std::string, std::string> values;
+        int line = 0;
+    };
+
+    std::string Trim(const std::string& text) {
+        std::size_t first = text.find_first_not_of(" \t\r");
+        if (first == std::string::npos)
+            return "";
+        std::size_t last = text.find_last_not_of(" \t\r");
+        return text.substr(first, last - first + 1);
+    }
+
+    // Reads `key` as one or more whitespace-separated numbers into `out`. Missing optional keys leave `out` untouched.
+    template <typename... T>
+    bool Get(const Section& section, const std::string& key, bool required, std::string& error, T&... out) {
+        auto found = section.values.find(key);
+        if (found == section.values.end()) {
+            if (required)
+                error = "line " + std::to_string(section.line) + ": [" + section.name + "] needs '" + key + "'";
+            return !required;
+        }
+        std::istringstream fields(found->second);
+        (fields >> ... >> out);
+        if (fields.fail()) {
+            error = "line " + std::to_string(section.line) + ": bad value for '" + key + "' in [" + section.name + "]";
+            return false;
+        }
+        return true;
+    }
+
+    // Raw mt19937 output rather than std::uniform_*_distribution, whose results differ between standard libraries.
+    float RandomUnit(std::mt19937& rng) {
+        return static_cast<float>(rng() / 4294967296.0);
+    }
+
+    // Uniform in [low, high]; `low` when the range is empty.
+    int RandomInt(std::mt19937& rng, int low, int high) {
+        if (high <= low)
+            return low;
+        return low + static_cast<int>(rng() % static_cast<std::uint32_t>(high - low + 1));
+    }
+
+    void AddRandomWalls(std::vector<SimEvent>& events, const WorldBounds& world, std::uint64_t at, int count, std::uint32_t seed, float minLength, float maxLength) {
+        int maxX = static_cast<int>(world.width) - 1;
+        int maxY = static_cast<int>(world.height) - 1;
+        std::mt19937 rng(seed);
+        for (int i = 0; i < count; ++i) {
+            SimEvent event;
+            event.step = at;
+            event.type = SimEvent::Type::AddWall;
+            event.sx = RandomInt(rng, 0, maxX);
+            event.sy = RandomInt(rng, 0, maxY);
+            float length = minLength + (maxLength - minLength) * RandomUnit(rng);
+            float angle = 2.0f * static_cast<float>(M_PI) * RandomUnit(rng);
+            event.ex = std::clamp(static_cast<int>(event.sx + length * std::cos(angle)), 0, maxX);
+            event.ey = std::clamp(static_cast<int>(event.sy + length * std::sin(angle)), 0, maxY);
+            events.push_back(event);
+        }
+    }
+
+    bool SectionToEvents(const Section& section, Scenario& scenario, std::string& error) {
+        std::vector<SimEvent>& events = scenario.log.events;
+        SimEvent event;
+        if (!Get(section, "at", false, error, event.step))
+            return false;
+
+        if (section.name == "run") {
+            WorldBounds& world = scenario.log.world;
+            if (!Get(section, "steps", false, error, scenario.steps) || !Get(section, "dt", false, error, scenario.log.dt) ||
+                !Get(section, "world", false, error, world.width, world.height))
+                return false;
+            if (!(scenario.log.dt > 0.0f)) {
+                error = "line " + std::to_string(section.line) + ": dt must be positive";
+                return false;
+            }
+            if (world.width < 1 || world.height < 1) {
+                error = "line " + std::to_string(section.line) + ": world size must be at least 1 x 1";
+                return false;
+            }
+            return true;
+        } else if (section.name == "points") {
+            event.type = SimEvent::Type::AddPoints;
+            if (!Get(section, "start", true, error, event.sx, event.sy) || !Get(section, "end", true, error, event.ex, event.ey) ||
+                !Get(section, "speed", true, error, event.startSpeed) || !Get(section, "angle", false, error, event.startAngle) ||
+                !Get(section, "count", true, error, event.count))
+                return false;
+        } else if (section.name == "angles") {
+            event.type = SimEvent::Type::AddAngles;
+            if (!Get(section, "point", true, error, event.sx, event.sy) || !Get(section, "speed", true, error, event.startSpeed) ||
+                !Get(section, "start_angle", true, error, event.startAngle) || !Get(section, "end_angle", true, error, event.endAngle) ||
+                !Get(section, "count", true, error, event.count))
+                return false;
+        } else if (section.name == "velocities") {
+            event.type = SimEvent::Type::AddVelocities;
+            if (!Get(section, "point", true, error, event.sx, event.sy) || !Get(section, "start_speed", true, error, event.startSpeed) ||
+                !Get(section, "end_speed", true, error, event.endSpeed) || !Get(section, "angle", false, error, event.startAngle) ||
+                !Get(section, "count", true, error, event.count))
+                return false;
+        } else if (section.name == "wall") {
+            event.type = SimEvent::Type::AddWall;
+            if (!Get(section, "from", true, error, event.sx, event.sy) || !Get(section, "to", true, error, event.ex, event.ey))
+                return false;
+        } else if (section.name == "random_walls") {
+            int count = 0;
+            std::uint32_t seed = 1;
+            float minLength = 50.0f;
+            float maxLength = 300.0f;
+            if (!Get(section, "count", true, error, count) || !Get(section, "seed", false, error, seed) ||
+                !Get(section, "min_length", false, error, minLength) || !Get(section, "max_length", false, error, maxLength))
+                return false;
+            AddRandomWalls(events, scenario.log.world, event.step, count, seed, minLength, maxLength);
+            return true;
+        } else if (section.name == "reset") {
+            event.type = SimEvent::Type::Reset;
+        } else if (section.name == "reset_wall") {
+            event.type = SimEvent::Type::ResetWall;
+        } else {
+            error = "line " + std::to_string(section.line) + ": unknown section [" + section.name + "]";
+            return false;
+        }
+        if ((event.type == SimEvent::Type::AddPoints || event.type == SimEvent::Type::AddAngles ||
+             event.type == SimEvent::Type::AddVelocities) && event.count < 1) {
+            error = "line " + std::to_string(section.line) + ": count must be at least 1";
+            return false;
+        }
+        events.push_back(event);
+        return true;
+    }
+}
+
+bool LoadScenario(const std::string& path, Scenario& scenario, std::string& error, const WorldBounds* world) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+    scenario = Scenario{};
+    std::vector<Section> sections;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        ++lineNumber;
+        line = Trim(line.substr(0, line.find_first_of("#;")));
+        if (line.empty())
+            continue;
+        if (line.front() == '[' && line.back() == ']') {
+            sections.push_back({ Trim(line.substr(1, line.size() - 2)), {}, lineNumber });
+            continue;
+        }
+        std::size_t equals = line.find('=');
+        if (sections.empty() || equals == std::string::npos) {
+            error = path + ":" + std::to_string(lineNumber) + ": expected 'key = value' inside a [section]";
+            return false;
+        }
+        sections.back().values[Trim(line.substr(0, equals))] = Trim(line.substr(equals + 1));
+    }
+
+    // [run] first: it sets the world size that [random_walls] places walls in, unless `world` overrides it
+    const auto others = std::stable_partition(sections.begin(), sections.end(), [](const Section& section) { return section.name == "run"; });
+    for (auto section = sections.begin(); section != sections.end(); ++section) {
+        if (section == others && world)
+            scenario.log.world = *world;
+        if (!SectionToEvents(*section, scenario, error)) {
+            error = path + ": " + error;
+            return false;
+        }
+    }
+    if (others == sections.end() && world)
+        scenario.log.world = *world;
+    // Sections may be written in any order; replays need them sorted by step, in file order within a step.
+    std::stable_sort(scenario.log.events.begin(), scenario.log.events.end(),
+                     [](const SimEvent& a, const SimEvent& b) { return a.step < b.step; });
+    return true;
+}
+
+bool ParseScenarioKind(const std::string& name, ScenarioKind& kind) {
+    if (name == "maze")
+        kind = ScenarioKind::Maze;
+    else if (name == "clusters")
+        kind = ScenarioKind::Clusters;
+    else if (name == "streams")
+        kind = ScenarioKind::Streams;
+    else
+        return false;
+    return true;
+}
+
+namespace {
+    // Perfect maze over a cols x rows grid by randomized depth-first carving. Leaves (cols-1)*(rows-1)
+    // interior walls; the canvas bounds act as the outer wall.
+    void WriteMaze(std::ostream& out, const ScenarioParams& params, std::mt19937& rng) {
+        int rows = std::max(2, static_cast<int>(std::sqrt(params.walls * 9.0 / 16.0)) + 1);
+        int cols = std::max(2, params.walls / (rows - 1) + 1);
+        float cellW = params.world.width / cols;
+        float cellH = params.world.height / rows;
+
+        // right[c][r] / up[c][r]: wall on the right / upper edge of cell (c, r)
+        std::vector<char> right(cols * rows, 1), up(cols * rows, 1), visited(cols * rows, 0);
+        std::vector<int> stack = { 0 };
+        visited[0] = 1;
+        while (!stack.empty()) {
+            int cell = stack.back();
+            int c = cell % cols, r = cell / cols;
+            int options[4];
+            int optionCount = 0;
+            if (c > 0 && !visited[cell - 1]) options[optionCount++] = cell - 1;
+            if (c < cols - 1 && !visited[cell + 1]) options[optionCount++] = cell + 1;
+            if (r > 0 && !visited[cell - cols]) options[optionCount++] = cell - cols;
+            if (r < rows - 1 && !visited[cell + cols]) options[optionCount++] = cell + cols;
+            if (optionCount == 0) {
+                stack.pop_back();
+                continue;
+            }
+            int nextCell = options[rng() % optionCount];
+            if (nextCell == cell + 1) right[cell] = 0;
+            else if (nextCell == cell - 1) right[nextCell] = 0;
+            else if (nextCell == cell + cols) up[cell] = 0;
+            else up[nextCell] = 0;
+            visited[nextCell] = 1;
+            stack.push_back(nextCell);
+        }
+
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                int cell = r * cols + c;
+                int x0 = static_cast<int>(c * cellW), x1 = static_cast<int>((c + 1) * cellW);
+                int y0 = static_cast<int>(r * cellH), y1 = static_cast<int>((r + 1) * cellH);
+                if (c < cols - 1 && right[cell])
+                    out << "[wall]\nfrom = " << x1 << " " << y0 << "\nto = " << x1 << " " << y1 << "\n\n";
+                if (r < rows - 1 && up[cell])
+                    out << "[wall]\nfrom = " << x0 << " " << y1 << "\nto = " << x1 << " " << y1 << "\n\n";
+            }
+        }
+
+        // one full fan per cell until the particle budget is spent
+        int cells = cols * rows;
+        int perCell = std::max(1, params.particles / cells);
+        for (int cell = 0, remaining = params.particles; cell < cells && remaining > 0; ++cell, remaining -= perCell) {
+            out << "[angles]\npoint = " << static_cast<int>((cell % cols + 0.5f) * cellW) << " " << static_cast<int>((cell / cols + 0.5f) * cellH)
+                << "\nspeed = " << 40 + rng() % 160 << "\nstart_angle = 0\nend_angle = 359.999\ncount = " << (cell == cells - 1 ? remaining : std::min(perCell, remaining)) << "\n\n";
+        }
+    }
+
+    void WriteClusters(std::ostream& out, const ScenarioParams& params, std::mt19937& rng) {
+        const int clusters = 8;
+        int perCluster = std::max(1, params.particles / clusters);
+        // centres 100 units clear of the edges, or a quarter of the world in small worlds
+        const int width = static_cast<int>(params.world.width), height = static_cast<int>(params.world.height);
+        const int marginX = std::min(100, (width - 1) / 4), marginY = std::min(100, (height - 1) / 4);
+        for (int i = 0; i < clusters; ++i) {
+            int x = RandomInt(rng, marginX, width - 1 - marginX), y = RandomInt(rng, marginY, height - 1 - marginY);
+            // half as a slow full fan, half as a speed ramp along one heading
+            out << "[angles]\npoint = " << x << " " << y << "\nspeed = " << 5 + rng() % 30
+                << "\nstart_angle = 0\nend_angle = 359.999\ncount = " << std::max(1, perCluster - perCluster / 2) << "\n\n";
+            out << "[velocities]\npoint = " << x << " " << y << "\nstart_speed = 0\nend_speed = " << 20 + rng() % 60
+                << "\nangle = " << rng() % 360 << "\ncount = " << std::max(1, perCluster / 2) << "\n\n";
+        }
+        out << "[random_walls]\ncount = " << params.walls << "\nseed = " << rng() << "\nmin_length = 20\nmax_length = 200\n\n";
+    }
+
+    void WriteStreams(std::ostream& out, const ScenarioParams& params, std::mt19937& rng) {
+        const int streams = 4;
+        int perStream = std::max(2, params.particles / streams);
+        for (int i = 0; i < streams; ++i) {
+            const int height = static_cast<int>(params.world.height);
+            int y = height * (2 * i + 1) / (2 * streams);
+            out << "[points]\nstart = 0 " << std::max(y - 40, 0) << "\nend = 0 " << std::min(y + 40, height - 1) << "\nspeed = " << 2000 + rng() % 3000
+                << "\nangle = " << (rng() % 41 + 340) % 360 << "\ncount = " << perStream << "\n\n";
+        }
+        out << "[random_walls]\ncount = " << params.walls << "\nseed = " << rng() << "\nmin_length = 100\nmax_length = 400\n\n";
+    }
+}
+
+std::string GenerateScenario(const ScenarioParams& params) {
+    static const char* names[] = { "maze", "clusters", "streams" };
+    std::mt19937 rng(params.seed);
+    std::ostringstream out;
+    out << "# generated: " << names[static_cast<int>(params.kind)] << ", " << params.particles << " particles, "
+        << params.walls << " walls, seed " << params.seed << "\n\n";
+    out << "[run]\nsteps = " << params.steps << "\n";
+    if (params.world.width != WorldBounds{}.width || params.world.height != WorldBounds{}.height)
+        out << "world = " << params.world.width << " " << params.world.height << "\n";
+    out << "\n";
+    switch (params.kind) {
+        case ScenarioKind::Maze: WriteMaze(out, params, rng); break;
+        case ScenarioKind::Clusters: WriteClusters(out, params, rng); break;
+        case ScenarioKind::Streams: WriteStreams(out, params, rng); break;
+    }
+    return out.str();
+}
+
+int WriteGeneratedScenario(const RunOptions& options) {
+    ScenarioParams params;
+    if (!ParseScenarioKind(options.generateKind, params.kind)) {
+        std::cerr << "unknown scenario kind '" << options.generateKind << "' (expected maze, clusters or streams)" << std::endl;
+        return 1;
+    }
+    if (options.particles > 0) params.particles = options.particles;
+    if (options.walls >= 0) params.walls = options.walls;
+    if (options.steps > 0) params.steps = options.steps;
+    params.seed = options.seed;
+    if (options.world.width > 0) params.world = options.world;
+
+    std::ofstream out(options.outPath);
+    out << GenerateScenario(params);
+    if (!out) {
+        std::cerr << "failed writing " << options.outPath << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+bool LoadRunEvents(const RunOptions& options, EventLog& log, std::uint64_t& steps, std::string& error) {
+    if (!options.scenarioPath.empty()) {
+        Scenario scenario;
+        if (!LoadScenario(options.scenarioPath, scenario, error, options.world.width > 0 ? &options.world : nullptr))
+            return false;
+        log = scenario.log;
+        if (scenario.steps > 0)
+            steps = scenario.steps;
+    } else if (!options.replayPath.empty() && !LoadEventLog(options.replayPath, log, error)) {
+        return false;
+    }
+    if (options.world.width > 0)
+        log.world = options.world;
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "replay.hpp"
+#include "run_options.hpp"
+
+#include <cstdint>
+#include <string>
+
+// A parametric workload: timestep, run length and the spawn/wall actions to apply, written as a small
+// INI file. Every section becomes one or more SimEvents, so a scenario is replayed exactly like a
+// recorded session:
+//
+//   [run]           steps = 600, dt = 0.0166667, world = 1280 720
+//   [points]        at, start = x y, end = x y, speed, angle, count
+//   [angles]        at, point = x y, speed, start_angle, end_angle, count
+//   [velocities]    at, point = x y, start_speed, end_speed, angle, count
+//   [wall]          at, from = x y, to = x y
+//   [random_walls]  at, count, seed, min_length, max_length
+//   [reset], [reset_wall]   at
+//
+// `at` is the step the action is applied before (default 0). Coordinates are in panel space, like the
+// sliders, inside the world size given in [run]. Keys are separated from values by '='; '#' and ';' start comments.
+struct Scenario {
+    EventLog log;
+    std::uint64_t steps = 0; // 0: run until the last event
+};
+
+// `world`, if given, replaces the [run] world size before any section is placed in it.
+bool LoadScenario(const std::string& path, Scenario& scenario, std::string& error, const WorldBounds* world = nullptr);
+
+// Stress scenes built from the same batch-add primitives as the GUI panels.
+enum class ScenarioKind {
+    Maze,     // a perfect maze of walls with particles fanned out from cell centres
+    Clusters, // dense low-speed fans around a few points, plus random walls
+    Streams   // high-velocity lines of particles crossing random walls
+};
+
+struct ScenarioParams {
+    ScenarioKind kind = ScenarioKind::Maze;
+    int particles = 100000;
+    int walls = 64;
+    std::uint64_t steps = 600;
+    std::uint32_t seed = 1;
+    WorldBounds world;
+};
+
+bool ParseScenarioKind(const std::string& name, ScenarioKind& kind);
+std::string GenerateScenario(const ScenarioParams& params);
+
+// --generate: write a generated scenario to --out. Returns the process exit code.
+int WriteGeneratedScenario(const RunOptions& options);
+
+// The events a run should replay: from --scenario or --replay, whichever was given. `steps` is set
+// from the scenario when it defines one; --world overrides the world size of either.
+bool LoadRunEvents(const RunOptions& options, EventLog& log, std::uint64_t& steps, std::string& error);
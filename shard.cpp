@@ -0,0 +1,436 @@
+#include "shard.hpp"
+#include "arena.hpp"
+#include "log.hpp"
+#include "spawn.hpp"
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+#include "BS_thread_pool_utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <thread>
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+const char* ShardTransportName(ShardTransport transport) {
+    return transport == ShardTransport::Socket ? "socket" : "shm";
+}
+
+#ifdef _WIN32
+
+bool RunSharded(const EventLog&, std::uint64_t, float, int, int, ShardTransport, ShardedRun&, std::string& error) {
+    error = "--shards needs fork() and is not supported on Windows";
+    return false;
+}
+
+#else
+
+namespace {
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "ring cursors are shared between processes");
+
+    // Cursors on separate cache lines, so the producer and the consumer do not invalidate each other's.
+    struct alignas(64) RingCursor {
+        std::atomic<std::uint64_t> value{ 0 };
+    };
+
+    // Bytes [head, tail) are written and not read yet; both only grow, positions wrap modulo the capacity.
+    struct Ring {
+        RingCursor head; // advanced by the reader
+        RingCursor tail; // advanced by the writer
+        std::byte data[SHARD_RING_BYTES];
+    };
+
+    // One direction of the stream between two processes. Reads and writes move as many bytes as they
+    // can without blocking, possibly none.
+    class Channel {
+    public:
+        Channel() = default;
+        explicit Channel(Ring* ring) : ring(ring) {}
+        explicit Channel(int socket) : socket(socket) {}
+
+        std::size_t TryWrite(const std::byte* bytes, std::size_t size) {
+            if (ring) {
+                const std::uint64_t tail = ring->tail.value.load(std::memory_order_relaxed);
+                const std::uint64_t head = ring->head.value.load(std::memory_order_acquire);
+                const std::size_t count = std::min<std::size_t>(size, SHARD_RING_BYTES - (tail - head));
+                const std::size_t at = tail % SHARD_RING_BYTES;
+                const std::size_t first = std::min(count, SHARD_RING_BYTES - at);
+                std::memcpy(ring->data + at, bytes, first);
+                std::memcpy(ring->data, bytes + first, count - first);
+                ring->tail.value.store(tail + count, std::memory_order_release);
+                return count;
+            }
+            const ssize_t sent = send(socket, bytes, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+            return sent > 0 ? static_cast<std::size_t>(sent) : 0;
+        }
+
+        std::size_t TryRead(std::byte* bytes, std::size_t size) {
+            if (ring) {
+                const std::uint64_t head = ring->head.value.load(std::memory_order_relaxed);
+                const std::uint64_t tail = ring->tail.value.load(std::memory_order_acquire);
+                const std::size_t count = std::min<std::size_t>(size, tail - head);
+                const std::size_t at = head % SHARD_RING_BYTES;
+                const std::size_t first = std::min(count, SHARD_RING_BYTES - at);
+                std::memcpy(bytes, ring->data + at, first);
+                std::memcpy(bytes + first, ring->data, count - first);
+                ring->head.value.store(head + count, std::memory_order_release);
+                return count;
+            }
+            const ssize_t received = recv(socket, bytes, size, MSG_DONTWAIT);
+            return received > 0 ? static_cast<std::size_t>(received) : 0;
+        }
+
+    private:
+        Ring* ring = nullptr;
+        int socket = -1;
+    };
+
+    // Particles a shard sends another after a step.
+    struct BatchHeader {
+        std::uint64_t count = 0;
+        std::size_t PayloadBytes() const { return count * sizeof(Particle); }
+    };
+
+    // A shard's final state, sent to the parent after the last step; shard 0 adds the walls.
+    struct ResultHeader {
+        ShardReport report;
+        std::uint64_t walls = 0;
+        std::size_t PayloadBytes() const { return report.particles * sizeof(Particle) + walls * sizeof(Walls); }
+    };
+
+    // Reassembles one message, a Header followed by Header::PayloadBytes() of payload, from the pieces
+    // a stream delivers it in. The payload buffer keeps its capacity across messages.
+    template <typename Header>
+    class MessageReader {
+    public:
+        // True once the whole message has arrived; stops reading there, so the stream may already hold the next.
+        bool Poll(Channel& channel) {
+            for (;;) {
+                if (received < sizeof(Header)) {
+                    const std::size_t read = channel.TryRead(reinterpret_cast<std::byte*>(&header) + received, sizeof(Header) - received);
+                    if (read == 0)
+                        return false;
+                    received += read;
+                    if (received == sizeof(Header))
+                        payload.resize(header.PayloadBytes());
+                    continue;
+                }
+                const std::size_t total = sizeof(Header) + payload.size();
+                if (received == total)
+                    return true;
+                const std::size_t read = channel.TryRead(payload.data() + (received - sizeof(Header)), total - received);
+                if (read == 0)
+                    return false;
+                received += read;
+            }
+        }
+        void Reset() { received = 0; }
+
+        Header header;
+        std::vector<std::byte> payload;
+
+    private:
+        std::size_t received = 0;
+    };
+
+    // Writes all of `bytes`, calling `whileFull` whenever the stream takes nothing.
+    template <typename WhileFull>
+    void WriteAll(Channel& channel, const void* bytes, std::size_t size, WhileFull whileFull) {
+        const std::byte* next = static_cast<const std::byte*>(bytes);
+        while (size > 0) {
+            const std::size_t written = channel.TryWrite(next, size);
+            next += written;
+            size -= written;
+            if (written == 0) {
+                whileFull();
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Process `node` in [0, shards]; the parent is `shards`. Streams run from every shard to every
+    // other shard and to the parent.
+    class Network {
+    public:
+        bool Open(int shards, ShardTransport transport, std::string& error) {
+            nodes = shards + 1;
+            if (transport == ShardTransport::SharedMemory) {
+                mappedBytes = static_cast<std::size_t>(shards) * nodes * sizeof(Ring);
+                void* mapping = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+                if (mapping == MAP_FAILED) {
+                    error = "cannot map " + std::to_string(mappedBytes >> 20) + " MB of shared memory for the shard rings";
+                    return false;
+                }
+                rings = static_cast<Ring*>(mapping);
+                for (int r = 0; r < shards * nodes; ++r) {
+                    new (&rings[r].head) RingCursor();
+                    new (&rings[r].tail) RingCursor();
+                }
+            } else {
+                sockets.assign(static_cast<std::size_t>(nodes) * nodes, -1);
+                for (int a = 0; a < nodes; ++a) {
+                    for (int b = a + 1; b < nodes; ++b) {
+                        int pair[2];
+                        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+                            error = "cannot create the shard sockets";
+                            return false;
+                        }
+                        sockets[a * nodes + b] = pair[0];
+                        sockets[b * nodes + a] = pair[1];
+                    }
+                }
+            }
+            return true;
+        }
+
+        // Keeps only `node`'s socket ends open; the rings stay mapped in every process.
+        void KeepOnly(int node) {
+            for (std::size_t end = 0; end < sockets.size(); ++end) {
+                if (static_cast<int>(end) / nodes != node && sockets[end] >= 0) {
+                    close(sockets[end]);
+                    sockets[end] = -1;
+                }
+            }
+        }
+
+        Channel From(int source, int node) { return rings ? Channel(&rings[source * nodes + node]) : Channel(sockets[node * nodes + source]); }
+        Channel To(int node, int target) { return rings ? Channel(&rings[node * nodes + target]) : Channel(sockets[node * nodes + target]); }
+
+        ~Network() {
+            if (rings)
+                munmap(rings, mappedBytes);
+            for (int socket : sockets)
+                if (socket >= 0)
+                    close(socket);
+        }
+
+    private:
+        int nodes = 0;
+        Ring* rings = nullptr;
+        std::size_t mappedBytes = 0;
+        std::vector<int> sockets; // [a * nodes + b]: a's end of the pair between a and b
+    };
+
+    // Strip `shard` of `shards` is x in [StripEdge(shard), StripEdge(shard + 1)), open-ended at both
+    // sides of the world so that particles outside it still have an owner.
+    float StripEdge(int edge, int shards, const WorldBounds& world) {
+        if (edge == 0)
+            return -std::numeric_limits<float>::infinity();
+        if (edge == shards)
+            return std::numeric_limits<float>::infinity();
+        return world.width * static_cast<float>(edge) / static_cast<float>(shards);
+    }
+
+    // The shard whose strip holds x; `self` for NaN, which fits no strip.
+    int StripOwner(float x, int self, int shards, const WorldBounds& world) {
+        if (std::isnan(x))
+            return self;
+        int owner = 0;
+        while (owner + 1 < shards && StripEdge(owner + 1, shards, world) <= x)
+            ++owner;
+        return owner;
+    }
+
+    void RunShard(int shard, int shards, int threads, const EventLog& log, std::uint64_t steps, float dt, Network& network) {
+        BS::thread_pool pool(static_cast<unsigned int>(threads));
+        Simulation sim;
+        sim.bounds = log.world;
+        const float minX = StripEdge(shard, shards, sim.bounds);
+        const float maxX = StripEdge(shard + 1, shards, sim.bounds);
+
+        std::vector<Channel> in(shards), out(shards);
+        std::vector<MessageReader<BatchHeader>> readers(shards);
+        std::vector<std::vector<Particle>> outgoing(shards);
+        std::vector<Particle> moved;
+        std::vector<char> arrived(shards);
+        for (int other = 0; other < shards; ++other) {
+            if (other != shard) {
+                in[other] = network.From(other, shard);
+                out[other] = network.To(shard, other);
+            }
+        }
+        auto receive = [&] {
+            bool all = true;
+            for (int other = 0; other < shards; ++other) {
+                if (other != shard && !arrived[other])
+                    arrived[other] = readers[other].Poll(in[other]);
+                all = all && (other == shard || arrived[other]);
+            }
+            return all;
+        };
+
+        ShardReport report;
+        ReplayCursor replay(log);
+        BS::timer timer;
+        timer.start();
+        while (sim.step < steps) {
+            // every shard replays every event but keeps only the particles spawned in its own strip
+            while (const SimEvent* event = replay.NextDue(sim.step)) {
+                if (IsSpawnEvent(*event))
+                    AppendSpawn(sim.particles, SpawnPattern::Of(*event, sim.bounds), minX, maxX);
+                else
+                    ApplyEvent(sim, *event, &pool);
+            }
+
+            StepSimulation(sim, dt, pool);
+
+            moved.clear();
+            TakeParticlesOutside(sim, minX, maxX, moved);
+            for (const Particle& particle : moved) {
+                const int owner = StripOwner(particle.position.x, shard, shards, sim.bounds);
+                if (owner == shard) // NaN positions fit no strip and stay where they are
+                    sim.particles.push_back(particle);
+                else
+                    outgoing[owner].push_back(particle);
+            }
+            for (int other = 0; other < shards; ++other) {
+                if (other == shard)
+                    continue;
+                const BatchHeader header{ outgoing[other].size() };
+                WriteAll(out[other], &header, sizeof(header), receive);
+                WriteAll(out[other], outgoing[other].data(), header.PayloadBytes(), receive);
+                report.migratedOut += header.count;
+                outgoing[other].clear();
+            }
+            while (!receive())
+                std::this_thread::yield();
+            for (int other = 0; other < shards; ++other) {
+                if (other == shard)
+                    continue;
+                const Particle* arrivals = reinterpret_cast<const Particle*>(readers[other].payload.data());
+                sim.particles.insert(sim.particles.end(), arrivals, arrivals + readers[other].header.count);
+                readers[other].Reset();
+                arrived[other] = 0;
+            }
+        }
+        timer.stop();
+
+        report.particles = sim.particles.size();
+        report.elapsedMs = timer.ms();
+        ResultHeader result{ report, shard == 0 ? sim.wall.size() : 0 };
+        Channel parent = network.To(shard, shards);
+        auto wait = [] {};
+        WriteAll(parent, &result, sizeof(result), wait);
+        WriteAll(parent, sim.particles.data(), report.particles * sizeof(Particle), wait);
+        WriteAll(parent, sim.wall.data(), result.walls * sizeof(Walls), wait);
+    }
+
+    void StopChildren(const std::vector<pid_t>& children) {
+        for (pid_t child : children) {
+            if (child > 0) {
+                kill(child, SIGKILL);
+                waitpid(child, nullptr, 0);
+            }
+        }
+    }
+}
+
+bool RunSharded(const EventLog& log, std::uint64_t steps, float dt, int shards, int threadsPerShard, ShardTransport transport,
+                ShardedRun& run, std::string& error) {
+    Network network;
+    if (!network.Open(shards, transport, error))
+        return false;
+
+    // anything buffered would be written again by every child
+    std::cout << std::flush;
+    std::fflush(stdout);
+    // the log writer is stopped across the forks, so no child inherits its locks; children do not log
+    const bool logging = LogSuspend();
+    std::vector<pid_t> children(shards, -1);
+    for (int shard = 0; shard < shards; ++shard) {
+        children[shard] = fork();
+        if (children[shard] < 0) {
+            StopChildren(children);
+            if (logging)
+                LogResume();
+            error = "cannot start shard process " + std::to_string(shard);
+            return false;
+        }
+        if (children[shard] == 0) {
+            // The child has only this thread; it leaves with _exit so the parent's pool and other
+            // statics, whose threads do not exist here, are never destroyed.
+            int status = 0;
+            try {
+                network.KeepOnly(shard);
+                RunShard(shard, shards, threadsPerShard, log, steps, dt, network);
+            } catch (const std::exception& exception) {
+                std::fprintf(stderr, "shard %d: %s\n", shard, exception.what());
+                status = 1;
+            }
+            std::fflush(stderr);
+            _exit(status);
+        }
+    }
+    if (logging)
+        LogResume();
+    network.KeepOnly(shards);
+
+    std::vector<Channel> in(shards);
+    std::vector<MessageReader<ResultHeader>> readers(shards);
+    std::vector<char> done(shards), exited(shards);
+    for (int shard = 0; shard < shards; ++shard)
+        in[shard] = network.From(shard, shards);
+    int remaining = shards;
+    while (remaining > 0) {
+        bool progress = false;
+        for (int shard = 0; shard < shards; ++shard) {
+            if (done[shard])
+                continue;
+            if (readers[shard].Poll(in[shard])) {
+                done[shard] = 1;
+                --remaining;
+                progress = true;
+                continue;
+            }
+            int status = 0;
+            if (!exited[shard] && waitpid(children[shard], &status, WNOHANG) == children[shard]) {
+                exited[shard] = 1;
+                children[shard] = -1;
+                // a clean exit has written everything; read the rest on the next pass
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                    StopChildren(children);
+                    error = "shard " + std::to_string(shard) + " failed";
+                    return false;
+                }
+            } else if (exited[shard] && !readers[shard].Poll(in[shard])) {
+                StopChildren(children);
+                error = "shard " + std::to_string(shard) + " exited without sending its particles";
+                return false;
+            }
+        }
+        if (!progress)
+            std::this_thread::yield();
+    }
+    for (int shard = 0; shard < shards; ++shard)
+        if (children[shard] > 0)
+            waitpid(children[shard], nullptr, 0);
+
+    run.shards.clear();
+    ClearParticles(run.sim);
+    run.sim.bounds = log.world;
+    run.sim.step = steps;
+    for (int shard = 0; shard < shards; ++shard) {
+        const ResultHeader& result = readers[shard].header;
+        const Particle* particles = reinterpret_cast<const Particle*>(readers[shard].payload.data());
+        run.sim.particles.insert(run.sim.particles.end(), particles, particles + result.report.particles);
+        if (result.walls > 0) {
+            const Walls* walls = reinterpret_cast<const Walls*>(particles + result.report.particles);
+            run.sim.wall.assign(walls, walls + result.walls);
+        }
+        run.shards.push_back(result.report);
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "replay.hpp"
+#include "run_options.hpp"
+#include "simulation.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define SHARD_RING_BYTES (std::size_t(4) << 20) // Capacity of each shared-memory ring between two shards
+
+// Domain-decomposed headless runs: the world is split into `shards` vertical strips of equal width,
+// each owned by a child process with its own thread pool and particle store. Every process replays
+// the whole event log (walls are shared; spawned particles are kept only by the strip they start in),
+// steps its particles, and after each step sends the ones that crossed into another strip to that
+// strip's owner. Particles do not interact, so the union of the shards' particles is the state a
+// single process reaches, and HashSimulation matches it.
+//
+// Each ordered pair of processes has its own byte stream, read and written without blocking: a
+// lock-free single-producer/single-consumer ring in shared memory, or a Unix-domain socket pair, which
+// behaves like the network link between machines would. A process that cannot write because a ring is
+// full drains its own incoming streams meanwhile, so two shards sending to each other never deadlock.
+// POSIX only (fork, mmap, socketpair).
+const char* ShardTransportName(ShardTransport transport);
+
+struct ShardReport {
+    std::uint64_t particles = 0;   // owned at the end
+    std::uint64_t migratedOut = 0; // sent to other shards over the whole run
+    std::int64_t elapsedMs = 0;    // from the first step to the last, in the shard
+};
+
+struct ShardedRun {
+    Simulation sim; // every shard's particles gathered after the last step, plus the walls
+    std::vector<ShardReport> shards;
+};
+
+// Replays `log` for `steps` steps of `dt` in `shards` processes with `threadsPerShard` workers each and
+// gathers the result. Returns false and sets `error` if the processes or channels cannot be set up or
+// a shard fails. Call it from a single-threaded point (its own pool, if any, idle): it forks.
+bool RunSharded(const EventLog& log, std::uint64_t steps, float dt, int shards, int threadsPerShard, ShardTransport transport,
+                ShardedRun& run, std::string& error);
@@ -0,0 +1,649 @@
+#include "simulation.hpp"
+#include "log.hpp"
+#include "profiler.hpp"
+#include "spatial_sort.hpp"
+#include "spawn.hpp"
+#include "trace.hpp"
+#include "wall_scan.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <thread>
+
+void AdjustParticlePosition(Particle& particle, float width, float height) {
+    float slope = particle.velocity.y / particle.velocity.x;
+    float maxX = width - 1;
+    float maxY = height - 1;
+
+    if (particle.position.x < 0) {
+        particle.position.x = 0;
+        particle.position.y = slope * particle.position.x + particle.position.y;
+        particle.velocity.x *= -1;
+    } else if (particle.position.x >= width) {
+        particle.position.x = maxX;
+        particle.position.y = slope * (particle.position.x - maxX) + particle.position.y;
+        particle.velocity.x *= -1;
+    }
+
+    if (particle.position.y < 0) {
+        particle.position.y = 0;
+        particle.position.x = particle.position.y / slope + particle.position.x;
+        particle.velocity.y *= -1;
+    } else if (particle.position.y >= height) {
+        particle.position.y = maxY;
+        particle.position.x = (particle.position.y - maxY) / slope + particle.position.x;
+        particle.velocity.y *= -1;
+    }
+}
+
+float calculateSlope(Vec2 p1, Vec2 p2) {
+    if (p2.x - p1.x == 0.0f)
+        // if vertical line
+        return std::numeric_limits<float>::infinity();
+    return (p2.y - p1.y) / (p2.x - p1.x);
+}
+
+bool doIntersect(Vec2 p1, Vec2 q1, Vec2 p2, Vec2 q2) {
+    // Calculate slopes of the line and particle trajectory.
+    float slope1 = calculateSlope(p1, q1);
+    float slope2 = calculateSlope(p2, q2);
+
+    // Check for vertical lines
+    if (std::isinf(slope1) && std::isinf(slope2)) {
+        // Both line and particle trajectory are vertical and never intersect
+        return false;
+    }
+
+    // Calculate y-intercepts (b) for each line
+    float b1 = p1.y - slope1 * p1.x;
+    float b2 = p2.y - slope2 * p2.x;
+
+    // Calculate intersection point
+    float intersectionX;
+    float intersectionY;
+
+    if (std::isinf(slope1)) {
+        // Line is vertical
+        intersectionX = p1.x;
+        intersectionY = slope2 * intersectionX + b2;
+    } else if (std::isinf(slope2)) {
+        // Particle trajectory is vertical
+        intersectionX = p2.x;
+        intersectionY = slope1 * intersectionX + b1;
+    } else {
+        // Neither line nor particle is vertical
+        intersectionX = (b2 - b1) / (slope1 - slope2);
+        intersectionY = slope1 * intersectionX + b1;
+    }
+
+    // Check if the intersection point lies on both line and particle trajectory
+    if (!std::isnan(intersectionX) && !std::isnan(intersectionY) &&
+        (intersectionX >= std::min(p1.x, q1.x) && intersectionX <= std::max(p1.x, q1.x)) &&
+        (intersectionY >= std::min(p1.y, q1.y) && intersectionY <= std::max(p1.y, q1.y)) &&
+        (intersectionX >= std::min(p2.x, q2.x) && intersectionX <= std::max(p2.x, q2.x)) &&
+        (intersectionY >= std::min(p2.y, q2.y) && intersectionY <= std::max(p2.y, q2.y))) {
+        return true;
+    }
+    return false;
+}
+
+Vec2 particleIntersectWall(Particle particle, Vec2 wallStart, Vec2 wallEnd) {
+    // Calculate the intersection point of the particle's trajectory with the wall
+    float t_intersection = (wallStart.x * (particle.position.y - wallEnd.y) + wallEnd.x * (wallStart.y - particle.position.y) +
+                            particle.position.x * (wallEnd.y - wallStart.y)) /
+                           (particle.velocity.x * (wallStart.y - wallEnd.y) + particle.velocity.y * (wallEnd.x - wallStart.x));
+
+    // Calculate the intersection point
+    return Vec2{particle.position.x + t_intersection * particle.velocity.x, particle.position.y + t_intersection * particle.velocity.y};
+}
+
+namespace {
+    template <typename JobList>
+    void FillJobList(int particlesSize, int threadCount, JobList& jobList) {
+        int threadJobChunk = particlesSize / threadCount;
+        int i = 0;
+        int j = 0;
+        if(threadJobChunk < THREADING_THRESHOLD){
+            while(particlesSize != 0){
+                if(particlesSize - THREADING_THRESHOLD > 0){
+                    j += THREADING_THRESHOLD - 1;
+                    jobList.push_back(std::pair(i,j));
+                    particlesSize -= THREADING_THRESHOLD;
+                    i =+ j + 1;
+                    ++j;
+                }else{
+                    j += particlesSize - 1;
+                    jobList.push_back(std::pair(i,j));
+                    particlesSize = 0;
+                }
+            }
+        } else{
+            int jobRemainder = particlesSize % threadCount;
+            while(particlesSize != 0){
+                if(particlesSize - threadJobChunk > 0){
+                    j += threadJobChunk - 1;
+                    if(jobRemainder > 0){
+                        ++j;
+                        --jobRemainder;
+                        --particlesSize;
+                    }
+                    jobList.push_back(std::pair(i,j));
+                    particlesSize -= threadJobChunk;
+                    i = j + 1;
+                    ++j;
+                }else{
+                    j += particlesSize - 1;
+                    jobList.push_back(std::pair(i,j));
+                    particlesSize = 0;
+                }
+            }
+        }
+    }
+}
+
+std::vector<std::pair<int,int>> getJobList(int particlesSize, int threadCount) {
+    std::vector<std::pair<int,int>> jobList;
+    FillJobList(particlesSize, threadCount, jobList);
+    return jobList;
+}
+
+FrameVector<std::pair<int,int>> FrameJobList(int particlesSize, int threadCount) {
+    FrameVector<std::pair<int,int>> jobList;
+    jobList.reserve(static_cast<std::size_t>(threadCount) + 1);
+    FillJobList(particlesSize, threadCount, jobList);
+    return jobList;
+}
+
+void AddParticlesBetweenPoints(ParticleBuffer& particles, const WorldBounds& world, int sx, int sy, int ex, int ey, float speed, float angle, int count) {
+    AppendSpawn(particles, SpawnPattern::Points(world, sx, sy, ex, ey, speed, angle, count));
+}
+
+void AddParticlesBetweenAngles(ParticleBuffer& particles, const WorldBounds& world, int sx, int sy, float speed, float startAngle, float endAngle, int count) {
+    AppendSpawn(particles, SpawnPattern::Angles(world, sx, sy, speed, startAngle, endAngle, count));
+}
+
+void AddParticlesBetweenVelocities(ParticleBuffer& particles, const WorldBounds& world, int sx, int sy, float startSpeed, float endSpeed, float angle, int count) {
+    AppendSpawn(particles, SpawnPattern::Velocities(world, sx, sy, startSpeed, endSpeed, angle, count));
+}
+
+Walls MakeWall(const WorldBounds& world, int x1, int y1, int x2, int y2) {
+    return { Vec2(static_cast<float>(x1), world.height - static_cast<float>(y1)), Vec2(static_cast<float>(x2), world.height - static_cast<float>(y2)) };
+}
+
+namespace {
+    // Wall sets for the step kernels. ForEach(f) calls f(p1, p2) for every wall in index order, which
+    // is the order the original loop tested them in, so all kernels give bitwise-identical results.
+    struct NoWalls {
+        template <typename F>
+        void ForEach(F&&) const {}
+    };
+
+    // A few walls copied into the job itself: the loop has a constant trip count, gets unrolled, and
+    // the endpoints stay in registers instead of being reloaded through the vector for every particle.
+    template <std::size_t N>
+    struct FixedWalls {
+        std::array<Walls, N> walls;
+
+        template <typename F>
+        void ForEach(F&& f) const {
+            for (const Walls& wallSegment : walls)
+                f(wallSegment.p1, wallSegment.p2);
+        }
+    };
+
+    struct IndexedWalls {
+        const Walls* walls;
+        std::size_t count;
+
+        template <typename F>
+        void ForEach(F&& f) const {
+            for (std::size_t w = 0; w < count; ++w)
+                f(walls[w].p1, walls[w].p2);
+        }
+    };
+
+    // The walls as a WallTable, scanned 8 or 16 at a time for the first one the particle's path meets.
+    struct ScannedWalls {
+        const Walls* walls;
+        const WallTable* table;
+        WallScanKernel kernel;
+    };
+
+    // projected position of particle on next frame (assuming no collision with wall)
+    inline Vec2 NextPosition(const Particle& particle, float dt) {
+        return Vec2(
+            particle.position.x + particle.velocity.x * dt,
+            particle.position.y + particle.velocity.y * dt
+        );
+    }
+
+    inline void CollideWithWall(Particle& particle, Vec2 wallP1, Vec2 wallP2, float dt) {
+        Vec2 nextPosition = NextPosition(particle, dt);
+
+        if (doIntersect(particle.position, nextPosition, wallP1, wallP2)) {
+            Vec2 intersectPoint = particleIntersectWall(particle, wallP1, wallP2);
+            // Collision occurred, update position and reflect velocity
+            particle.position.x = intersectPoint.x;
+            particle.position.y = intersectPoint.y;
+
+            // Calculate the reflection vector based on the wall's normal
+            Vec2 wallVector = Vec2(wallP2.y - wallP1.y, wallP1.x - wallP2.x); // Perpendicular to the wall
+            float length = std::sqrt(wallVector.x * wallVector.x + wallVector.y * wallVector.y);
+            wallVector = Vec2(wallVector.x / length, wallVector.y / length);
+
+            // Reflect the velocity vector
+            float dotProduct = 2.0f * (particle.velocity.x * wallVector.x + particle.velocity.y * wallVector.y);
+            particle.velocity.x -= dotProduct * wallVector.x;
+            particle.velocity.y -= dotProduct * wallVector.y;
+
+            // Move the particle slightly away from the collision point
+            particle.position.x += wallVector.x * 0.1f;
+            particle.position.y += wallVector.y * 0.1f;
+        }
+    }
+
+    template <typename WallSet>
+    inline void CollideWithWalls(Particle& particle, const WallSet& walls, float dt) {
+        walls.ForEach([&particle, dt](Vec2 wallP1, Vec2 wallP2) { CollideWithWall(particle, wallP1, wallP2, dt); });
+    }
+
+    inline void MoveParticle(Particle& particle, float dt, float width, float height) {
+        // Update particle's position based on its velocity
+        particle.position.x += particle.velocity.x * dt;
+        particle.position.y += particle.velocity.y * dt;
+
+        // Bounce off the walls
+        if (particle.position.x <= 0 || particle.position.x > width ||
+            particle.position.y <= 0 || particle.position.y > height) {
+            AdjustParticlePosition(particle, width, height);
+        }
+    }
+
+    template <typename WallSet>
+    void StepParticles(Particle* particles, int first, int last, const WallSet& walls, float dt, WorldBounds bounds) {
+        // read once per job
+        const float width = bounds.width;
+        const float height = bounds.height;
+        for (int i = first; i <= last; i++) {
+            Particle particle = particles[i];
+
+            // Check for collision with the walls
+            CollideWithWalls(particle, walls, dt);
+
+            MoveParticle(particle, dt, width, height);
+            particles[i] = particle;
+        }
+    }
+
+    constexpr int WallScanGroup = 16;          // particles that take a tile of the wall table together
+    constexpr std::size_t WallScanTile = 1024; // walls per tile: 28 KB of table, which stays in L1 for the group
+
+    // Only the walls the scan reports are handed to CollideWithWall, in index order; after a collision
+    // the scan goes on behind that wall with the new path, as the loop over every wall would. The table
+    // is streamed once per group of particles rather than once per particle: each particle's walls are
+    // still visited in order, tile after tile.
+    void StepParticles(Particle* particles, int first, int last, const ScannedWalls& walls, float dt, WorldBounds bounds) {
+        const WallTable& table = *walls.table;
+        for (int start = first; start <= last; start += WallScanGroup) {
+            const int count = std::min(WallScanGroup, last + 1 - start);
+            Particle* group = particles + start;
+            WallScanPath paths[WallScanGroup];
+            for (int i = 0; i < count; ++i)
+                paths[i] = MakeWallScanPath(group[i].position, NextPosition(group[i], dt));
+            for (std::size_t tile = 0; tile < table.count; tile += WallScanTile) {
+                const std::size_t tileEnd = std::min(table.count, tile + WallScanTile);
+                for (int i = 0; i < count; ++i) {
+                    for (std::size_t w = tile; (w = FirstWallHit(table, paths[i], w, tileEnd, walls.kernel)) < tileEnd; ++w) {
+                        CollideWithWall(group[i], walls.walls[w].p1, walls.walls[w].p2, dt);
+                        paths[i] = MakeWallScanPath(group[i].position, NextPosition(group[i], dt));
+                    }
+                }
+            }
+            for (int i = 0; i < count; ++i)
+                MoveParticle(group[i], dt, bounds.width, bounds.height);
+        }
+    }
+
+    // Steps the active particles only; job ranges are relative to the first active particle. All jobs
+    // go to the pool as one batch.
+    template <typename WallSet>
+    BS::batch DetachKernelJobs(Simulation& sim, const WallSet& walls, float dt, BS::thread_pool& pool) {
+        Particle* active = sim.particles.data() + sim.sleepingCount;
+        const WorldBounds bounds = sim.bounds;
+        FrameVector<std::pair<int,int>> jobList = FrameJobList(static_cast<int>(sim.particles.size() - sim.sleepingCount), static_cast<int>(pool.get_thread_count()));
+
+        return DetachFrameBatch(pool, jobList.size(),
+            [&jobList, active, &walls, dt, bounds](std::size_t i)
+            {
+                return [active, walls, dt, bounds, job = jobList[i]]
+                {
+                    PROFILE_WORKER_ZONE();
+                    TRACE_SCOPE_INDEX("physics chunk", job.first);
+                    StepParticles(active, job.first, job.second, walls, dt, bounds);
+                    LOG_DEBUG("physics job [%d, %d) done", job.first, job.second);
+                };
+            }
+        );
+    }
+
+    // Instantiates FixedWalls<1> .. FixedWalls<N> and uses the one matching the wall count.
+    template <std::size_t N>
+    bool DetachFixedWallJobs(Simulation& sim, float dt, BS::thread_pool& pool, BS::batch& jobs) {
+        if constexpr (N == 0) {
+            return false;
+        } else {
+            if (sim.wall.size() != N)
+                return DetachFixedWallJobs<N - 1>(sim, dt, pool, jobs);
+            FixedWalls<N> walls;
+            std::copy_n(sim.wall.begin(), N, walls.walls.begin());
+            jobs = DetachKernelJobs(sim, walls, dt, pool);
+            return true;
+        }
+    }
+}
+
+namespace {
+    // The table of the walls the calling thread last stepped with WallScan or WallSplit. Rebuilding it
+    // costs more than scanning it for a few particles, so it is kept while the walls stay the same.
+    const WallTable& ScanTable(const std::vector<Walls>& walls, BS::thread_pool& pool) {
+        thread_local std::vector<Walls> source;
+        thread_local WallTable table;
+        if (table.count == walls.size() && source.size() == walls.size() &&
+            std::memcmp(source.data(), walls.data(), walls.size() * sizeof(Walls)) == 0)
+            return table;
+        source = walls;
+        ResizeWallTable(table, walls.size());
+        const std::size_t blocks = std::clamp<std::size_t>(walls.size() / THREADING_THRESHOLD, 1, pool.get_thread_count());
+        // the workers fill this thread's table, not their own
+        WallTable& filled = table;
+        DetachFrameBlocks<std::size_t>(pool, 0, walls.size(), [&filled, &walls](std::size_t begin, std::size_t end) {
+            FillWallTable(filled, walls.data(), begin, end);
+        }, blocks).wait();
+        return table;
+    }
+
+    // WallSplit: every worker owns a range of the walls and finds, for each particle, the first wall of
+    // its range the particle's path meets; the first of those over all ranges is the wall the loop over
+    // every wall would collide with first. The collisions are applied here, and the particles that had
+    // one are scanned again from behind that wall with their new path, until none has. Each round is
+    // one pass over the pool; particles rarely hit more than a wall or two per step.
+    void StepSplitWalls(Simulation& sim, float dt, BS::thread_pool& pool) {
+        TRACE_SCOPE("physics split walls");
+        Particle* active = sim.particles.data() + sim.sleepingCount;
+        const std::size_t count = sim.particles.size() - sim.sleepingCount;
+        if (count == 0)
+            return;
+        const Walls* walls = sim.wall.data();
+        const std::size_t wallCount = sim.wall.size();
+        const std::size_t blocks = std::min<std::size_t>(pool.get_thread_count(), wallCount);
+        auto blockStart = [wallCount, blocks](std::size_t block) { return wallCount * block / blocks; };
+        const WallScanKernel kernel = BestWallScanKernel();
+
+        const WallTable& table = ScanTable(sim.wall, pool);
+        FrameVector<WallScanPath> paths(count);
+        FrameVector<std::size_t> resume(count, 0); // first wall not yet tested against the current path
+        FrameVector<std::size_t> pending(count);
+        FrameVector<std::size_t> hits(blocks * count); // per block, the first wall of its range each pending particle meets
+        for (std::size_t i = 0; i < count; ++i) {
+            paths[i] = MakeWallScanPath(active[i].position, NextPosition(active[i], dt));
+            pending[i] = i;
+        }
+
+        std::size_t pendingCount = count;
+        while (pendingCount > 0) {
+            DetachFrameBatch(pool, blocks, [&table, &paths, &resume, &pending, &hits, &blockStart, wallCount, count, pendingCount, kernel](std::size_t block) {
+                return [&table, &paths, &resume, &pending, &hits, &blockStart, wallCount, count, pendingCount, kernel, block] {
+                    PROFILE_WORKER_ZONE();
+                    const std::size_t begin = blockStart(block);
+                    const std::size_t end = blockStart(block + 1);
+                    for (std::size_t k = 0; k < pendingCount; ++k)
+                        hits[block * count + k] = wallCount;
+                    // tile by tile, like the WallScan jobs; a particle is done with the range at its first hit
+                    for (std::size_t tile = begin; tile < end; tile += WallScanTile) {
+                        const std::size_t tileEnd = std::min(end, tile + WallScanTile);
+                        for (std::size_t k = 0; k < pendingCount; ++k) {
+                            const std::size_t i = pending[k];
+                            if (hits[block * count + k] != wallCount || resume[i] >= tileEnd)
+                                continue;
+                            const std::size_t w = FirstWallHit(table, paths[i], std::max(tile, resume[i]), tileEnd, kernel);
+                            if (w < tileEnd)
+                                hits[block * count + k] = w;
+                        }
+                    }
+                };
+            }).wait();
+
+            std::size_t stillPending = 0;
+            for (std::size_t k = 0; k < pendingCount; ++k) {
+                const std::size_t i = pending[k];
+                std::size_t w = wallCount;
+                for (std::size_t block = 0; block < blocks; ++block)
+                    w = std::min(w, hits[block * count + k]);
+                if (w == wallCount)
+                    continue;
+                CollideWithWall(active[i], walls[w].p1, walls[w].p2, dt);
+                paths[i] = MakeWallScanPath(active[i].position, NextPosition(active[i], dt));
+                resume[i] = w + 1;
+                pending[stillPending++] = i;
+            }
+            pendingCount = stillPending;
+        }
+
+        const float width = sim.bounds.width;
+        const float height = sim.bounds.height;
+        for (std::size_t i = 0; i < count; ++i)
+            MoveParticle(active[i], dt, width, height);
+    }
+}
+
+// A wall split does about 1.35x WallScan's work plus ~7 us of passes over the pool (walls/kernel
+// benchmarks, 4096-100,000 walls on one core), so it pays off only when the workers really run at once:
+// from 3 of them it takes about half WallScan's time at WALL_SPLIT_MIN_WALLS walls, leaving room for
+// cross-core wake-ups. Workers beyond the hardware threads add nothing.
+StepKernel SelectStepKernel(const Simulation& sim, unsigned threads) {
+    if (sim.wall.empty())
+        return StepKernel::NoWalls;
+    if (sim.wall.size() <= FIXED_WALLS_MAX)
+        return StepKernel::FixedWalls;
+    const unsigned hardwareThreads = std::thread::hardware_concurrency();
+    const unsigned parallel = hardwareThreads > 0 ? std::min(threads, hardwareThreads) : threads;
+    // fewer active particles than THREADING_THRESHOLD make a single particle job
+    if (sim.wall.size() >= WALL_SPLIT_MIN_WALLS && parallel >= WALL_SPLIT_MIN_THREADS &&
+        sim.particles.size() - sim.sleepingCount < THREADING_THRESHOLD)
+        return StepKernel::WallSplit;
+    return StepKernel::WallScan;
+}
+
+const char* StepKernelName(StepKernel kernel) {
+    switch (kernel) {
+        case StepKernel::NoWalls: return "no_walls";
+        case StepKernel::FixedWalls: return "fixed_walls";
+        case StepKernel::General: return "general";
+        case StepKernel::WallScan: return "wall_scan";
+        case StepKernel::WallSplit: return "wall_split";
+    }
+    return "?";
+}
+
+BS::batch DetachParticleJobs(Simulation& sim, float dt, BS::thread_pool& pool) {
+    return DetachParticleJobs(sim, dt, pool, SelectStepKernel(sim, static_cast<unsigned>(pool.get_thread_count())));
+}
+
+BS::batch DetachParticleJobs(Simulation& sim, float dt, BS::thread_pool& pool, StepKernel kernel) {
+    UpdateActivity(sim, pool);
+    if (sim.sortInterval > 0 && sim.step % sim.sortInterval == 0)
+        SortIfScattered(sim, pool);
+    if (kernel == StepKernel::NoWalls && sim.wall.empty())
+        return DetachKernelJobs(sim, NoWalls{}, dt, pool);
+    BS::batch jobs;
+    if (kernel == StepKernel::FixedWalls && DetachFixedWallJobs<FIXED_WALLS_MAX>(sim, dt, pool, jobs))
+        return jobs;
+    if (kernel == StepKernel::WallSplit && !sim.wall.empty() && pool.get_thread_count() > 1) {
+        StepSplitWalls(sim, dt, pool);
+        return jobs;
+    }
+    if ((kernel == StepKernel::WallScan || kernel == StepKernel::WallSplit) && !sim.wall.empty())
+        return DetachKernelJobs(sim, ScannedWalls{ sim.wall.data(), &ScanTable(sim.wall, pool), BestWallScanKernel() }, dt, pool);
+    return DetachKernelJobs(sim, IndexedWalls{ sim.wall.data(), sim.wall.size() }, dt, pool);
+}
+
+void StepParticleBlock(Particle* particles, std::size_t count, const Simulation& sim, float dt) {
+    if (count == 0)
+        return;
+    if (sim.wall.empty())
+        StepParticles(particles, 0, static_cast<int>(count) - 1, NoWalls{}, dt, sim.bounds);
+    else
+        StepParticles(particles, 0, static_cast<int>(count) - 1, IndexedWalls{ sim.wall.data(), sim.wall.size() }, dt, sim.bounds);
+}
+
+namespace {
+    // Stable partition of particles[first, last) in three parallel passes (count, scatter into a
+    // scratch buffer at prefix-summed offsets, copy back). `keepFirst(particle, index)` must be
+    // deterministic; the result does not depend on the thread count. Returns the number kept first,
+    // and leaves the range untouched if that is 0.
+    template <typename Predicate>
+    std::size_t PartitionParticles(ParticleBuffer& particles, std::size_t first, std::size_t last, Predicate keepFirst, BS::thread_pool& pool) {
+        const std::size_t count = last - first;
+        if (count == 0)
+            return 0;
+        const std::size_t blocks = std::clamp<std::size_t>(count / THREADING_THRESHOLD, 1, pool.get_thread_count());
+        auto blockStart = [first, count, blocks](std::size_t block) { return first + count * block / blocks; };
+
+        FrameVector<std::size_t> kept(blocks, 0);
+        DetachFrameBatch(pool, blocks, [&particles, &kept, &keepFirst, &blockStart](std::size_t block) {
+            return [&particles, &kept, &keepFirst, &blockStart, block] {
+                for (std::size_t i = blockStart(block), end = blockStart(block + 1); i < end; ++i)
+                    kept[block] += keepFirst(particles[i], i) ? 1 : 0;
+            };
+        }).wait();
+        std::size_t totalKept = 0;
+        for (std::size_t block = 0; block < blocks; ++block)
+            totalKept += kept[block];
+        if (totalKept == 0)
+            return 0;
+
+        FrameVector<Particle> scratch(count);
+        std::size_t keptOffset = 0;
+        DetachFrameBatch(pool, blocks, [&](std::size_t block) {
+            const std::size_t restOffset = totalKept + (blockStart(block) - first - keptOffset);
+            auto scatter = [&particles, &scratch, &keepFirst, &blockStart, block, keptOffset, restOffset] {
+                std::size_t keptAt = keptOffset;
+                std::size_t restAt = restOffset;
+                for (std::size_t i = blockStart(block), end = blockStart(block + 1); i < end; ++i)
+                    scratch[keepFirst(particles[i], i) ? keptAt++ : restAt++] = particles[i];
+            };
+            keptOffset += kept[block];
+            return scatter;
+        }).wait();
+        DetachFrameBlocks<std::size_t>(pool, 0, count, [&particles, &scratch, first](std::size_t begin, std::size_t end) {
+            std::copy(scratch.begin() + begin, scratch.begin() + end, particles.begin() + first + begin);
+        }).wait();
+        return totalKept;
+    }
+
+    // Loose test: inside the wall's bounding box grown by one unit. Enough to wake anything the wall
+    // could possibly touch; a stationary particle only collides when it lies on the wall itself.
+    bool NearWall(Vec2 position, const Walls& wallSegment) {
+        return position.x >= std::min(wallSegment.p1.x, wallSegment.p2.x) - 1.0f && position.x <= std::max(wallSegment.p1.x, wallSegment.p2.x) + 1.0f &&
+               position.y >= std::min(wallSegment.p1.y, wallSegment.p2.y) - 1.0f && position.y <= std::max(wallSegment.p1.y, wallSegment.p2.y) + 1.0f;
+    }
+
+    bool NearAnyWall(Vec2 position, const Walls* walls, std::size_t count) {
+        for (std::size_t w = 0; w < count; ++w) {
+            if (NearWall(position, walls[w]))
+                return true;
+        }
+        return false;
+    }
+
+    // A particle the step would leave bitwise unchanged: no velocity, strictly inside the bounds (so
+    // AdjustParticlePosition never runs) and clear of every wall.
+    bool CanSleep(const Particle& particle, const WorldBounds& bounds, const std::vector<Walls>& walls) {
+        return particle.velocity.x == 0.0f && particle.velocity.y == 0.0f &&
+               particle.position.x > 0.0f && particle.position.x < bounds.width &&
+               particle.position.y > 0.0f && particle.position.y < bounds.height &&
+               !NearAnyWall(particle.position, walls.data(), walls.size());
+    }
+}
+
+void UpdateActivity(Simulation& sim, BS::thread_pool& pool) {
+    if (!sim.sleeping)
+        return;
+    // Walls added since the last step wake the sleepers next to them. Woken particles stay active.
+    if (sim.wakeWallsFrom < sim.wall.size() && sim.sleepingCount > 0) {
+        const Walls* added = sim.wall.data() + sim.wakeWallsFrom;
+        const std::size_t addedCount = sim.wall.size() - sim.wakeWallsFrom;
+        sim.sleepingCount = PartitionParticles(sim.particles, 0, sim.sleepingCount,
+            [added, addedCount](const Particle& particle, std::size_t) { return !NearAnyWall(particle.position, added, addedCount); }, pool);
+    }
+    sim.wakeWallsFrom = sim.wall.size();
+
+    // Particles added since the last step that can sleep join the sleeping prefix.
+    if (sim.classifiedCount < sim.particles.size()) {
+        const std::size_t classified = sim.classifiedCount;
+        sim.sleepingCount += PartitionParticles(sim.particles, sim.sleepingCount, sim.particles.size(),
+            [&sim, classified](const Particle& particle, std::size_t index) { return index >= classified && CanSleep(particle, sim.bounds, sim.wall); }, pool);
+        sim.classifiedCount = sim.particles.size();
+    }
+}
+
+void ClearParticles(Simulation& sim) {
+    sim.particles.clear();
+    sim.sleepingCount = 0;
+    sim.classifiedCount = 0;
+}
+
+void TakeParticlesOutside(Simulation& sim, float minX, float maxX, std::vector<Particle>& moved) {
+    // sleepers never move, so they are never outside
+    std::size_t kept = sim.sleepingCount;
+    std::size_t classifiedRemoved = 0;
+    for (std::size_t i = sim.sleepingCount; i < sim.particles.size(); ++i) {
+        const Particle& particle = sim.particles[i];
+        if (particle.position.x >= minX && particle.position.x < maxX) {
+            sim.particles[kept++] = particle;
+        } else {
+            moved.push_back(particle);
+            classifiedRemoved += i < sim.classifiedCount;
+        }
+    }
+    sim.particles.resize(kept);
+    sim.classifiedCount -= classifiedRemoved;
+}
+
+void StepSimulation(Simulation& sim, float dt, BS::thread_pool& pool) {
+    TRACE_SCOPE("step");
+    NextFrame();
+    DetachParticleJobs(sim, dt, pool).wait();
+    ++sim.step;
+}
+
+namespace {
+    void HashBytes(std::uint64_t& hash, const void* data, std::size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (std::size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+    }
+}
+
+std::uint64_t HashSimulation(const Simulation& sim) {
+    // Particles are combined with a sum of per-particle hashes, so the order the activity partition
+    // leaves them in does not matter; walls are hashed in order.
+    std::uint64_t particleSum = 0;
+    for (const Particle& particle : sim.particles) {
+        std::uint64_t particleHash = 14695981039346656037ull;
+        HashBytes(particleHash, &particle, sizeof(Particle));
+        particleSum += particleHash;
+    }
+    std::uint64_t hash = 14695981039346656037ull;
+    std::uint64_t particleCount = sim.particles.size();
+    HashBytes(hash, &particleCount, sizeof(particleCount));
+    HashBytes(hash, &particleSum, sizeof(particleSum));
+    HashBytes(hash, sim.wall.data(), sim.wall.size() * sizeof(Walls));
+    return hash;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "arena.hpp"
+#include "paged_vector.hpp"
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define FIXED_WALLS_MAX 7 // Largest wall count stepped by a FixedWalls kernel, below WALL_SCAN_MIN_WALLS
+#define WALL_SCAN_MIN_WALLS 8 // Wall count from which the WallScan kernel is faster than FixedWalls and General (re-measure with the step/kernel benchmarks)
+#define WALL_SPLIT_MIN_WALLS 16384 // Wall count from which a step with fewer than THREADING_THRESHOLD active particles splits the walls across the workers (see SelectStepKernel)
+#define WALL_SPLIT_MIN_THREADS 3 // Workers on separate hardware threads a wall split needs to beat WallScan
+#define SPATIAL_SORT_INTERVAL 64 // Steps between checks of how scattered the particle order has become (see spatial_sort.hpp)
+#define THREADING_THRESHOLD 5000 // Obtained from testing, point on which single-threaded performance starts to drop in FPS (re-measure with the step/no_walls benchmarks)
+
+// Same layout as ImVec2, so the core builds without ImGui; the GUI converts when drawing.
+struct Vec2 {
+    float x = 0.0f;
+    float y = 0.0f;
+    constexpr Vec2() = default;
+    constexpr Vec2(float x, float y) : x(x), y(y) {}
+};
+
+struct Particle {
+    Vec2 position;
+    Vec2 velocity;
+    // Angle is computed upon addition of particle, and translated to horizontal and vertical velocity (Vec2).
+};
+
+// Particle storage: grows in place on (transparent) huge pages, see paged_vector.hpp.
+using ParticleBuffer = PagedVector<Particle>;
+
+struct Walls {
+    Vec2 p1;
+    Vec2 p2;
+};
+
+// Size of the simulated area. Particles bounce back into [0, width) x [0, height). Simulation space has y
+// growing downwards; the panels, event logs and scenarios give coordinates with y growing upwards
+// (panel space), which the spawn functions and MakeWall flip against the world height.
+struct WorldBounds {
+    float width = 1280.0f;
+    float height = 720.0f;
+};
+
+// Everything the physics step reads or writes. `step` counts completed calls to StepSimulation and is
+// what recorded events are stamped with.
+struct Simulation {
+    ParticleBuffer particles;
+    std::vector<Walls> wall;
+    WorldBounds bounds;
+    std::uint64_t step = 0;
+
+    // Activity: particles [0, sleepingCount) are stationary and skipped by the step; the rest are
+    // active. Maintained by UpdateActivity() at the start of every step. Particles may be appended
+    // freely; anything that removes particles must go through ClearParticles().
+    std::size_t sleepingCount = 0;
+    std::size_t classifiedCount = 0; // particles [0, classifiedCount) have been considered for sleeping
+    std::size_t wakeWallsFrom = 0;   // walls [wakeWallsFrom, wall.size()) have not woken their neighbours yet
+    bool sleeping = true;            // false keeps every particle active; with sortInterval 0 the order then never changes
+
+    // The active particles are re-sorted by cell when they have become scattered, checked on every
+    // step that is a multiple of this. 0 never sorts.
+    std::uint64_t sortInterval = SPATIAL_SORT_INTERVAL;
+};
+
+void AdjustParticlePosition(Particle& particle, float width = 1280.0f, float height = 720.0f);
+float calculateSlope(Vec2 p1, Vec2 p2);
+bool doIntersect(Vec2 p1, Vec2 q1, Vec2 p2, Vec2 q2);
+Vec2 particleIntersectWall(Particle particle, Vec2 wallStart, Vec2 wallEnd);
+std::vector<std::pair<int,int>> getJobList(int particlesSize, int threadCount);
+// getJobList() in the calling thread's frame arena, for the per-step callers.
+FrameVector<std::pair<int,int>> FrameJobList(int particlesSize, int threadCount);
+
+// Batch adding, exactly as done by the three "Batch Adding" panels. Coordinates are in panel space
+// (y grows upwards), angles in degrees, speeds in world units/s.
+void AddParticlesBetweenPoints(ParticleBuffer& particles, const WorldBounds& world, int sx, int sy, int ex, int ey, float speed, float angle, int count);
+void AddParticlesBetweenAngles(ParticleBuffer& particles, const WorldBounds& world, int sx, int sy, float speed, float startAngle, float endAngle, int count);
+void AddParticlesBetweenVelocities(ParticleBuffer& particles, const WorldBounds& world, int sx, int sy, float startSpeed, float endSpeed, float angle, int count);
+Walls MakeWall(const WorldBounds& world, int x1, int y1, int x2, int y2);
+
+// Moves newly added particles that cannot move (zero velocity, inside the bounds, clear of all walls)
+// into the sleeping prefix, and wakes sleepers next to walls added since the last call. Compaction
+// runs on the pool and waits for it. The particle order changes, the set of particles does not.
+void UpdateActivity(Simulation& sim, BS::thread_pool& pool);
+void ClearParticles(Simulation& sim);
+// Moves the active particles with x outside [minX, maxX) to the end of `moved` and closes the gaps,
+// keeping the order of the rest. Call between steps.
+void TakeParticlesOutside(Simulation& sim, float minX, float maxX, std::vector<Particle>& moved);
+
+// Step kernels, specialized at compile time on the wall set. All of them produce the same state.
+enum class StepKernel {
+    NoWalls,    // integration and bounds only
+    FixedWalls, // 1..FIXED_WALLS_MAX walls copied into each job
+    General,    // any number of walls, read from sim.wall; never selected, the reference the others are checked and benchmarked against
+    WallScan,   // many walls: each particle's path tested against 8 or 16 walls at once (see wall_scan.hpp)
+    WallSplit   // many walls, few particles: the wall list split across the workers instead of the particles
+};
+
+// The fastest kernel for the current scene on a pool of `threads` workers; chosen again every step.
+StepKernel SelectStepKernel(const Simulation& sim, unsigned threads);
+const char* StepKernelName(StepKernel kernel);
+
+// Queue one physics job per chunk of getJobList() on the pool without waiting for them, so callers can
+// overlap other work (e.g. the draw task). The caller must wait on the returned batch (or the pool) before
+// touching the particles; the batch leaves out unrelated work such as a snapshot writer.
+// WallSplit needs the results of one pass over the pool to queue the next, so it steps before returning.
+BS::batch DetachParticleJobs(Simulation& sim, float dt, BS::thread_pool& pool);
+// Same with an explicit kernel (for benchmarks); falls back to General if `kernel` cannot handle the scene.
+BS::batch DetachParticleJobs(Simulation& sim, float dt, BS::thread_pool& pool, StepKernel kernel);
+// Steps particles[0, count) in place on the calling thread, against sim's walls and bounds (sim.particles
+// is not touched). For storage formats that decode a block at a time, see compact.hpp.
+void StepParticleBlock(Particle* particles, std::size_t count, const Simulation& sim, float dt);
+// Advance the simulation by one step of `dt` seconds and wait for it to finish. Starts a new frame for
+// the frame arenas (NextFrame()) first.
+void StepSimulation(Simulation& sim, float dt, BS::thread_pool& pool);
+
+// FNV-1a hash over the raw bytes of every particle and wall, used to check that two runs ended
+// bitwise-identical. Independent of particle order.
+std::uint64_t HashSimulation(const Simulation& sim);
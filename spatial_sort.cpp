@@ -0,0 +1,123 @@
+#include "spatial_sort.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace {
+    constexpr std::uint32_t GridCells = 1u << SPATIAL_SORT_GRID_BITS;
+    constexpr int KeyBits = 2 * SPATIAL_SORT_GRID_BITS;
+    constexpr int DigitBits = 8;
+    constexpr std::size_t Digits = std::size_t(1) << DigitBits;
+    constexpr std::size_t DisorderSamples = 4096;
+
+    // Inserts a zero bit above every bit of `value` (bits 0..15).
+    std::uint32_t SpreadBits(std::uint32_t value) {
+        value &= 0x0000ffffu;
+        value = (value | (value << 8)) & 0x00ff00ffu;
+        value = (value | (value << 4)) & 0x0f0f0f0fu;
+        value = (value | (value << 2)) & 0x33333333u;
+        value = (value | (value << 1)) & 0x55555555u;
+        return value;
+    }
+
+    std::uint32_t Cell(float coordinate, float size) {
+        float cell = coordinate * (GridCells / size);
+        // also maps NaN to 0
+        if (!(cell >= 0.0f))
+            return 0;
+        return std::min(static_cast<std::uint32_t>(std::min(cell, static_cast<float>(GridCells))), GridCells - 1);
+    }
+}
+
+std::uint32_t MortonKey(Vec2 position, const WorldBounds& world) {
+    return SpreadBits(Cell(position.x, world.width)) | (SpreadBits(Cell(position.y, world.height)) << 1);
+}
+
+float MeasureDisorder(const ParticleBuffer& particles, std::size_t first, std::size_t last, const WorldBounds& world) {
+    if (last - first < 2)
+        return 0.0f;
+    const std::size_t pairs = last - first - 1;
+    const std::size_t stride = std::max<std::size_t>(1, pairs / DisorderSamples);
+    std::size_t sampled = 0;
+    std::size_t outOfOrder = 0;
+    for (std::size_t i = first; i + 1 < last; i += stride) {
+        outOfOrder += MortonKey(particles[i].position, world) > MortonKey(particles[i + 1].position, world) ? 1 : 0;
+        ++sampled;
+    }
+    return static_cast<float>(outOfOrder) / sampled;
+}
+
+void SortParticlesByCell(ParticleBuffer& particles, std::size_t first, std::size_t last, const WorldBounds& world, BS::thread_pool& pool) {
+    TRACE_SCOPE("spatial sort");
+    const std::size_t count = last - first;
+    if (count < 2)
+        return;
+    const std::size_t blocks = std::clamp<std::size_t>(count / THREADING_THRESHOLD, 1, pool.get_thread_count());
+    auto blockStart = [count, blocks](std::size_t block) { return count * block / blocks; };
+
+    // Sort (key, index) pairs, then move every particle once.
+    // scratch lives in the frame arena, which keeps the memory for the next sort
+    FrameVector<std::uint32_t> keys(count), sortedKeys(count);
+    FrameVector<std::uint32_t> order(count), sortedOrder(count);
+    DetachFrameBatch(pool, blocks, [&](std::size_t block) {
+        return [&, block] {
+            for (std::size_t i = blockStart(block), end = blockStart(block + 1); i < end; ++i) {
+                keys[i] = MortonKey(particles[first + i].position, world);
+                order[i] = static_cast<std::uint32_t>(i);
+            }
+        };
+    }).wait();
+
+    FrameVector<std::array<std::size_t, Digits>> offsets(blocks);
+    for (int shift = 0; shift < KeyBits; shift += DigitBits) {
+        DetachFrameBatch(pool, blocks, [&, shift](std::size_t block) {
+            return [&, block, shift] {
+                std::array<std::size_t, Digits>& histogram = offsets[block];
+                histogram.fill(0);
+                for (std::size_t i = blockStart(block), end = blockStart(block + 1); i < end; ++i)
+                    ++histogram[(keys[i] >> shift) & (Digits - 1)];
+            };
+        }).wait();
+
+        // Digit-major, block-minor prefix sum: each block scatters after the earlier blocks with the
+        // same digit, which keeps the pass stable and independent of the block count.
+        std::size_t offset = 0;
+        for (std::size_t digit = 0; digit < Digits; ++digit) {
+            for (std::size_t block = 0; block < blocks; ++block) {
+                std::size_t digitCount = offsets[block][digit];
+                offsets[block][digit] = offset;
+                offset += digitCount;
+            }
+        }
+
+        DetachFrameBatch(pool, blocks, [&, shift](std::size_t block) {
+            return [&, block, shift] {
+                std::array<std::size_t, Digits>& next = offsets[block];
+                for (std::size_t i = blockStart(block), end = blockStart(block + 1); i < end; ++i) {
+                    std::size_t to = next[(keys[i] >> shift) & (Digits - 1)]++;
+                    sortedKeys[to] = keys[i];
+                    sortedOrder[to] = order[i];
+                }
+            };
+        }).wait();
+        keys.swap(sortedKeys);
+        order.swap(sortedOrder);
+    }
+
+    FrameVector<Particle> sorted(count);
+    DetachFrameBlocks<std::size_t>(pool, 0, count, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i)
+            sorted[i] = particles[first + order[i]];
+    }).wait();
+    DetachFrameBlocks<std::size_t>(pool, 0, count, [&](std::size_t begin, std::size_t end) {
+        std::copy(sorted.begin() + begin, sorted.begin() + end, particles.begin() + first + begin);
+    }).wait();
+}
+
+bool SortIfScattered(Simulation& sim, BS::thread_pool& pool) {
+    if (MeasureDisorder(sim.particles, sim.sleepingCount, sim.particles.size(), sim.bounds) <= SPATIAL_SORT_THRESHOLD)
+        return false;
+    SortParticlesByCell(sim.particles, sim.sleepingCount, sim.particles.size(), sim.bounds, pool);
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "simulation.hpp"
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define SPATIAL_SORT_GRID_BITS 10       // The world is split into 2^bits x 2^bits cells for the sort key
+#define SPATIAL_SORT_THRESHOLD 0.25f    // Disorder (see MeasureDisorder) above which the particles get re-sorted; 0.5 is random order
+
+// Keeps particles that are close in the world close in memory. Particles are ordered by the Z-order
+// (Morton) index of their grid cell, so anything that walks the particle array and touches per-cell or
+// per-pixel data (density binning, draw lists, the wall lookups) does so in runs of nearby cells.
+// Particles do not interact, so their order never changes the simulated state.
+
+// Morton index of the cell `position` falls in; positions outside the world clamp to the border cells.
+std::uint32_t MortonKey(Vec2 position, const WorldBounds& world);
+
+// Share of neighbouring pairs (i, i + 1) in particles[first, last) whose keys are out of order, from a
+// sample of at most a few thousand pairs: 0 when sorted, about 0.5 when shuffled.
+float MeasureDisorder(const ParticleBuffer& particles, std::size_t first, std::size_t last, const WorldBounds& world);
+
+// Stable parallel LSD radix sort of particles[first, last) by MortonKey, 8 bits per pass. Waits for the pool.
+void SortParticlesByCell(ParticleBuffer& particles, std::size_t first, std::size_t last, const WorldBounds& world, BS::thread_pool& pool);
+
+// Sorts the active particles if MeasureDisorder is above SPATIAL_SORT_THRESHOLD. Returns whether it sorted.
+bool SortIfScattered(Simulation& sim, BS::thread_pool& pool);
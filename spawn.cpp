@@ -0,0 +1,249 @@
+#include "spawn.hpp"
+#include "log.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+SpawnPattern SpawnPattern::Points(const WorldBounds& world, int sx, int sy, int ex, int ey, float speed, float angle, int count) {
+    SpawnPattern pattern;
+    pattern.kind = Kind::Points;
+    pattern.count = count;
+    pattern.x = static_cast<float>(sx);
+    pattern.y = static_cast<float>(sy);
+    pattern.top = world.height - 1;
+    pattern.spacingX = static_cast<float>(ex-sx) / (count-1);
+    pattern.spacingY = static_cast<float>(ey-sy) / (count-1);
+    float radians = (-(angle)) * (static_cast<float>(M_PI) / 180.0f); //convert degrees to radians
+    pattern.velocity = Vec2(
+        speed * std::cos(radians),
+        speed * std::sin(radians)
+    );
+    return pattern;
+}
+
+SpawnPattern SpawnPattern::Angles(const WorldBounds& world, int sx, int sy, float speed, float startAngle, float endAngle, int count) {
+    float angleDiff;
+    if(endAngle >= startAngle)
+        angleDiff = endAngle-startAngle;
+    else
+        angleDiff = endAngle - std::abs(startAngle - 360);
+
+    SpawnPattern pattern;
+    pattern.kind = Kind::Angles;
+    pattern.count = count;
+    pattern.x = static_cast<float>(sx);
+    pattern.y = static_cast<float>(sy);
+    pattern.top = world.height - 1;
+    pattern.spacingX = static_cast<float>(angleDiff / (count));
+    pattern.speed = speed;
+    pattern.angle = startAngle;
+    return pattern;
+}
+
+SpawnPattern SpawnPattern::Velocities(const WorldBounds& world, int sx, int sy, float startSpeed, float endSpeed, float angle, int count) {
+    SpawnPattern pattern;
+    pattern.kind = Kind::Velocities;
+    pattern.count = count;
+    pattern.x = static_cast<float>(sx);
+    pattern.y = static_cast<float>(sy);
+    pattern.top = world.height - 1;
+    pattern.spacingX = static_cast<float>(endSpeed-startSpeed) / (count);
+    pattern.speed = startSpeed;
+    float radians = (-(angle)) * (static_cast<float>(M_PI) / 180.0f); //convert degrees to radians
+    pattern.velocity = Vec2(std::cos(radians), std::sin(radians));
+    return pattern;
+}
+
+SpawnPattern SpawnPattern::Of(const SimEvent& event, const WorldBounds& world) {
+    switch (event.type) {
+        case SimEvent::Type::AddPoints:
+            return Points(world, event.sx, event.sy, event.ex, event.ey, event.startSpeed, event.startAngle, event.count);
+        case SimEvent::Type::AddAngles:
+            return Angles(world, event.sx, event.sy, event.startSpeed, event.startAngle, event.endAngle, event.count);
+        case SimEvent::Type::AddVelocities:
+            return Velocities(world, event.sx, event.sy, event.startSpeed, event.endSpeed, event.startAngle, event.count);
+        default:
+            return {};
+    }
+}
+
+void SpawnPattern::Advance(Sums& sums, int particles) const {
+    for (int i = 0; i < particles; i++) {
+        sums.x += spacingX;
+        if (kind == Kind::Points)
+            sums.y += spacingY;
+    }
+}
+
+// Each loop is the body of the AddParticlesBetween*() loop it replaced, operation for operation.
+void SpawnPattern::Write(Particle* out, int particles, Sums& sums) const {
+    switch (kind) {
+        case Kind::Points:
+            for (int i = 0; i < particles; i++) {
+                Particle particle;
+                particle.position = Vec2(x + sums.x, top - (y + sums.y));
+                sums.x += spacingX;
+                sums.y += spacingY;
+                particle.velocity = velocity;
+                out[i] = particle;
+            }
+            break;
+        case Kind::Angles:
+            for (int i = 0; i < particles; i++) {
+                Particle particle;
+                particle.position = Vec2(x, top - y);
+                float radians = (-(angle + sums.x)) * (static_cast<float>(M_PI) / 180.0f);
+                sums.x += spacingX;
+                particle.velocity = Vec2(
+                    speed * std::cos(radians),
+                    speed * std::sin(radians)
+                );
+                out[i] = particle;
+            }
+            break;
+        case Kind::Velocities:
+            for (int i = 0; i < particles; i++) {
+                Particle particle;
+                particle.position = Vec2(x, top - y);
+                particle.velocity = Vec2(
+                    (speed + sums.x) * velocity.x,
+                    (speed + sums.x) * velocity.y
+                );
+                sums.x += spacingX;
+                out[i] = particle;
+            }
+            break;
+    }
+}
+
+void SpawnPattern::XRange(float& low, float& high) const {
+    low = high = x;
+    if (kind == Kind::Points && count > 1) {
+        const float end = x + spacingX * static_cast<float>(count - 1);
+        low = std::min(low, end);
+        high = std::max(high, end);
+    }
+    // the sums drift from the exact products by a few ulps per particle
+    const float margin = 1.0f + 1e-3f * (high - low);
+    low -= margin;
+    high += margin;
+}
+
+void AppendSpawn(ParticleBuffer& particles, const SpawnPattern& pattern, float minX, float maxX) {
+    if (pattern.Count() <= 0)
+        return;
+    float low, high;
+    pattern.XRange(low, high);
+    if (high < minX || low >= maxX)
+        return;
+    if (low >= minX && high < maxX) {
+        AppendSpawn(particles, pattern);
+        return;
+    }
+    std::array<Particle, 4096> block;
+    SpawnPattern::Sums sums;
+    for (int first = 0; first < pattern.Count(); first += static_cast<int>(block.size())) {
+        const int size = std::min(static_cast<int>(block.size()), pattern.Count() - first);
+        pattern.Write(block.data(), size, sums);
+        for (int i = 0; i < size; ++i) {
+            if (block[i].position.x >= minX && block[i].position.x < maxX)
+                particles.push_back(block[i]);
+        }
+    }
+}
+
+void AppendSpawn(ParticleBuffer& particles, const SpawnPattern& pattern) {
+    if (pattern.Count() <= 0)
+        return;
+    const std::size_t count = static_cast<std::size_t>(pattern.Count());
+    particles.reserve(particles.size() + count);
+    SpawnPattern::Sums sums;
+    pattern.Write(particles.end(), pattern.Count(), sums);
+    particles.append_written(count);
+}
+
+void SpawnJob::Start(Simulation& sim, const SimEvent& spawn, BS::thread_pool& threads) {
+    Cancel();
+    event = spawn;
+    pattern = SpawnPattern::Of(spawn, sim.bounds);
+    pool = &threads;
+    // committed only: the pages are faulted in by the blocks that fill them
+    sim.particles.reserve(sim.particles.size() + static_cast<std::size_t>(std::max(pattern.Count(), 0)));
+    out = sim.particles.end();
+    written.store(0, std::memory_order_relaxed);
+    stop = BS::stop_source();
+    fill.clear();
+    active = true;
+    LOG_INFO("spawning %d particles on the pool", pattern.Count());
+    auto scanner = [this] { Scan(); };
+    scan = pool->detach_batch(BS::lane::background, &scanner, &scanner + 1, stop.get_token());
+}
+
+void SpawnJob::Scan() {
+    TRACE_SCOPE("spawn scan");
+    struct Block {
+        SpawnJob* job;
+        int first;
+        int particles;
+        SpawnPattern::Sums sums;
+
+        void operator()() {
+            TRACE_SCOPE("spawn block");
+            job->pattern.Write(job->out + first, particles, sums);
+            job->written.fetch_add(static_cast<std::size_t>(particles), std::memory_order_relaxed);
+        }
+    };
+
+    std::vector<Block> blocks;
+    blocks.reserve(SPAWN_QUEUE_BLOCKS);
+    SpawnPattern::Sums sums;
+    for (int first = 0, particles = 0; first < pattern.Count(); first += particles) {
+        if (stop.stop_requested())
+            return;
+        particles = std::min(SPAWN_BLOCK_PARTICLES, pattern.Count() - first);
+        blocks.push_back({ this, first, particles, sums });
+        pattern.Advance(sums, particles);
+        if (blocks.size() == SPAWN_QUEUE_BLOCKS || first + particles == pattern.Count()) {
+            fill.push_back(pool->detach_batch(BS::lane::background, blocks.begin(), blocks.end(), stop.get_token()));
+            blocks.clear();
+        }
+    }
+}
+
+float SpawnJob::Progress() const {
+    if (!active || pattern.Count() <= 0)
+        return 1.0f;
+    return static_cast<float>(written.load(std::memory_order_relaxed)) / static_cast<float>(pattern.Count());
+}
+
+bool SpawnJob::Finish(Simulation& sim) {
+    // the scanner queues all of `fill` before it finishes
+    if (!active || !scan.done())
+        return false;
+    for (const BS::batch& blocks : fill) {
+        if (!blocks.done())
+            return false;
+    }
+    sim.particles.append_written(static_cast<std::size_t>(std::max(pattern.Count(), 0)));
+    active = false;
+    LOG_INFO("spawned %d particles, applied before step %llu", pattern.Count(), static_cast<unsigned long long>(sim.step));
+    return true;
+}
+
+void SpawnJob::Wait() const {
+    scan.wait();
+    for (const BS::batch& blocks : fill)
+        blocks.wait();
+}
+
+void SpawnJob::Cancel() {
+    if (!active)
+        return;
+    stop.request_stop();
+    Wait();
+    active = false;
+    LOG_INFO("spawn of %d particles cancelled with %zu written", pattern.Count(), written.load(std::memory_order_relaxed));
+}
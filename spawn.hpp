@@ -0,0 +1,108 @@
+#pragma once
+
+#include "replay.hpp"
+#include "simulation.hpp"
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#define ASYNC_SPAWN_MIN_PARTICLES (1 << 20) // Spawns at least this large are filled in on the pool across frames (see SpawnJob)
+#define SPAWN_BLOCK_PARTICLES (1 << 16)     // Particles per spawn task, about 1 ms of work; a cancelled spawn waits for at most one per worker
+#define SPAWN_QUEUE_BLOCKS 16               // Blocks the spawn scanner queues at a time, so that filling starts while it is still scanning
+
+// The particles of one batch-adding panel, made a range at a time. Each pattern carries running sums
+// (position offsets, angle or speed) from one particle to the next; Write() produces exactly the
+// particles AddParticlesBetween*() appends, bit for bit, from wherever Advance() has moved the sums to
+// with the same float additions. So a spawn can be filled in blocks on different threads once the
+// sums at each block's start are known.
+class SpawnPattern {
+public:
+    struct Sums {
+        float x = 0.0f; // Points: x offset; Angles: angle offset; Velocities: speed offset
+        float y = 0.0f; // Points: y offset
+    };
+
+    static SpawnPattern Points(const WorldBounds& world, int sx, int sy, int ex, int ey, float speed, float angle, int count);
+    static SpawnPattern Angles(const WorldBounds& world, int sx, int sy, float speed, float startAngle, float endAngle, int count);
+    static SpawnPattern Velocities(const WorldBounds& world, int sx, int sy, float startSpeed, float endSpeed, float angle, int count);
+    // The pattern of a spawn event (AddPoints, AddAngles or AddVelocities).
+    static SpawnPattern Of(const SimEvent& event, const WorldBounds& world);
+
+    int Count() const { return count; }
+    // A range holding every particle's x (world units), with a margin for the rounding of the running sums.
+    void XRange(float& low, float& high) const;
+    // Moves `sums` on by `particles` particles.
+    void Advance(Sums& sums, int particles) const;
+    // Writes the next `particles` particles, starting with the one `sums` is at, and moves `sums` past them.
+    void Write(Particle* out, int particles, Sums& sums) const;
+
+private:
+    enum class Kind { Points, Angles, Velocities };
+
+    Kind kind = Kind::Points;
+    int count = 0;
+    float x = 0.0f;   // start point, panel space
+    float y = 0.0f;
+    float top = 0.0f; // world y of panel y 0
+    float spacingX = 0.0f;
+    float spacingY = 0.0f;
+    float speed = 0.0f; // Angles: every particle's; Velocities: the first particle's
+    float angle = 0.0f; // Angles: the first particle's, in degrees
+    Vec2 velocity;      // Points: every particle's; Velocities: the cosine and sine of the angle
+};
+
+// Appends all of a pattern's particles, as AddParticlesBetween*() does.
+void AppendSpawn(ParticleBuffer& particles, const SpawnPattern& pattern);
+// Appends, in order, only those with x in [minX, maxX): the strip of one shard (see shard.hpp). A pattern
+// entirely outside the strip costs nothing; others are made a block at a time, so only the kept
+// particles are ever stored.
+void AppendSpawn(ParticleBuffer& particles, const SpawnPattern& pattern, float minX, float maxX);
+
+// A large spawn filled in on the pool's background lane while the GUI keeps running. The particles are
+// written straight past the end of sim.particles, into capacity reserved up front (committed, not yet
+// touched, so starting is quick), and become part of the simulation in one go when Finish() sees them
+// all written: the simulation ends up exactly as if ApplyEvent() had spawned them at that step.
+//
+// A scanner task walks the pattern's running sums to find where each block starts, checking for
+// cancellation once per block, and queues the blocks SPAWN_QUEUE_BLOCKS at a time as batches that check
+// it before each block.
+// Cancel() therefore returns after at most one block per worker (a millisecond or so), however large
+// the spawn; until then the job's particles stay outside sim.particles, so nothing has to be undone.
+class SpawnJob {
+public:
+    SpawnJob() = default;
+    ~SpawnJob() { Cancel(); }
+    SpawnJob(const SpawnJob&) = delete;
+    SpawnJob& operator=(const SpawnJob&) = delete;
+
+    // Starts spawning `event`'s particles. Until Finish() or Cancel(), nothing else may add particles
+    // to sim.particles or replace them. Call from outside the pool, between steps.
+    void Start(Simulation& sim, const SimEvent& event, BS::thread_pool& pool);
+    bool Active() const { return active; }
+    const SimEvent& Event() const { return event; }
+    // Fraction of the particles written so far.
+    float Progress() const;
+    // Once every particle is written, appends them to sim.particles, ends the job and returns true.
+    // Call between steps.
+    bool Finish(Simulation& sim);
+    // Waits until every particle is written, for Finish() to succeed. Call from outside the pool.
+    void Wait() const;
+    // Stops the job without adding anything. Blocks that have not started are skipped; this waits for
+    // the running ones.
+    void Cancel();
+
+private:
+    void Scan();
+
+    SpawnPattern pattern;
+    SimEvent event;
+    Particle* out = nullptr;
+    BS::thread_pool* pool = nullptr;
+    BS::stop_source stop;
+    BS::batch scan;
+    std::vector<BS::batch> fill; // queued by the scanner; read once it has finished
+    std::atomic<std::size_t> written = 0;
+    bool active = false;
+};
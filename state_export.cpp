@@ -0,0 +1,242 @@
+#include "state_export.hpp"
+#include "arena.hpp"
+#include "log.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    std::size_t SegmentBytes(std::uint64_t capacity) {
+        return StateExportHeader::PageBytes + STATE_EXPORT_SLOTS * 4 * capacity * sizeof(float);
+    }
+
+    const float* SlotArrays(const StateExportHeader* header, std::uint64_t capacity, std::int32_t slot) {
+        const std::byte* base = reinterpret_cast<const std::byte*>(header) + StateExportHeader::PageBytes;
+        return reinterpret_cast<const float*>(base) + static_cast<std::size_t>(slot) * 4 * capacity;
+    }
+}
+
+#ifdef _WIN32
+
+StateExporter::~StateExporter() = default;
+
+bool StateExporter::Open(const std::string&, std::string& error) {
+    error = "--export needs POSIX shared memory and is not supported on Windows";
+    return false;
+}
+
+void StateExporter::Publish(const Simulation&, BS::thread_pool&) {}
+void StateExporter::Grow(std::uint64_t) {}
+
+StateReader::~StateReader() = default;
+
+bool StateReader::Open(const std::string&, std::string& error) {
+    error = "shared memory state export is not supported on Windows";
+    return false;
+}
+
+std::uint64_t StateReader::Published() const { return 0; }
+const StateExportHeader::Slot* StateReader::Begin(std::uint64_t, StateFrame&, std::uint64_t&) { return nullptr; }
+bool StateReader::End(const StateExportHeader::Slot&, std::uint64_t) const { return false; }
+bool StateReader::Map(std::size_t) { return false; }
+
+#else
+
+StateExporter::~StateExporter() {
+    if (header)
+        munmap(header, mappedBytes);
+    if (descriptor >= 0) {
+        close(descriptor);
+        shm_unlink(name.c_str());
+    }
+}
+
+bool StateExporter::Open(const std::string& objectName, std::string& error) {
+    name = objectName;
+    // a previous run that did not exit cleanly leaves its object behind
+    shm_unlink(name.c_str());
+    descriptor = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (descriptor < 0) {
+        error = "cannot create shared memory object " + name;
+        return false;
+    }
+    const std::size_t bytes = SegmentBytes(STATE_EXPORT_MIN_CAPACITY);
+    void* mapping = MAP_FAILED;
+    if (ftruncate(descriptor, static_cast<off_t>(bytes)) == 0)
+        mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    if (mapping == MAP_FAILED) {
+        error = "cannot size shared memory object " + name;
+        return false;
+    }
+    mappedBytes = bytes;
+    header = new (mapping) StateExportHeader();
+    header->version.store(StateExportHeader::Version, std::memory_order_relaxed);
+    header->slots.store(STATE_EXPORT_SLOTS, std::memory_order_relaxed);
+    header->segmentBytes.store(bytes, std::memory_order_relaxed);
+    header->capacity.store(STATE_EXPORT_MIN_CAPACITY, std::memory_order_relaxed);
+    header->latest.store(-1, std::memory_order_relaxed);
+    // readers check the magic last
+    header->magic.store(StateExportHeader::Magic, std::memory_order_release);
+    return true;
+}
+
+void StateExporter::Grow(std::uint64_t particles) {
+    const std::uint64_t capacity = std::max(particles, 2 * header->capacity.load(std::memory_order_relaxed));
+    const std::size_t bytes = SegmentBytes(capacity);
+    // Every slot moves: mark them all as being written, so readers in the middle of one discard it.
+    header->sequence.fetch_add(1, std::memory_order_relaxed);
+    for (StateExportHeader::Slot& slot : header->slot)
+        slot.sequence.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (ftruncate(descriptor, static_cast<off_t>(bytes)) != 0)
+        throw std::bad_alloc();
+    void* mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    if (mapping == MAP_FAILED)
+        throw std::bad_alloc();
+    munmap(header, mappedBytes);
+    header = static_cast<StateExportHeader*>(mapping);
+    mappedBytes = bytes;
+
+    header->segmentBytes.store(bytes, std::memory_order_relaxed);
+    header->capacity.store(capacity, std::memory_order_relaxed);
+    header->latest.store(-1, std::memory_order_relaxed);
+    for (StateExportHeader::Slot& slot : header->slot)
+        slot.sequence.fetch_add(1, std::memory_order_release);
+    header->sequence.fetch_add(1, std::memory_order_release);
+    LOG_INFO("state export grown to %llu particles per slot", static_cast<unsigned long long>(capacity));
+}
+
+void StateExporter::Publish(const Simulation& sim, BS::thread_pool& pool) {
+    TRACE_SCOPE("export");
+    const std::size_t count = sim.particles.size();
+    if (count > header->capacity.load(std::memory_order_relaxed))
+        Grow(count);
+    const std::uint64_t capacity = header->capacity.load(std::memory_order_relaxed);
+    const std::int32_t target = (header->latest.load(std::memory_order_relaxed) + 1) % STATE_EXPORT_SLOTS;
+    StateExportHeader::Slot& slot = header->slot[target];
+
+    const std::uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    float* x = const_cast<float*>(SlotArrays(header, capacity, target));
+    float* y = x + capacity;
+    float* vx = y + capacity;
+    float* vy = vx + capacity;
+    const Particle* particles = sim.particles.data();
+    const BS::batch transpose = DetachFrameBlocks<std::size_t>(pool, 0, count, [particles, x, y, vx, vy](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            x[i] = particles[i].position.x;
+            y[i] = particles[i].position.y;
+            vx[i] = particles[i].velocity.x;
+            vy[i] = particles[i].velocity.y;
+        }
+    });
+    transpose.wait();
+
+    const std::uint64_t published = header->published.load(std::memory_order_relaxed) + 1;
+    slot.frame.store(published, std::memory_order_relaxed);
+    slot.step.store(sim.step, std::memory_order_relaxed);
+    slot.count.store(count, std::memory_order_relaxed);
+    slot.width.store(sim.bounds.width, std::memory_order_relaxed);
+    slot.height.store(sim.bounds.height, std::memory_order_relaxed);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+
+    header->latest.store(target, std::memory_order_release);
+    header->published.store(published, std::memory_order_release);
+}
+
+StateReader::~StateReader() {
+    if (header)
+        munmap(const_cast<StateExportHeader*>(header), mappedBytes);
+    if (descriptor >= 0)
+        close(descriptor);
+}
+
+bool StateReader::Open(const std::string& name, std::string& error) {
+    descriptor = shm_open(name.c_str(), O_RDONLY, 0);
+    if (descriptor < 0) {
+        error = "no shared memory object " + name + " (is the simulation running with --export?)";
+        return false;
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || !Map(static_cast<std::size_t>(info.st_size))) {
+        error = "cannot map " + name;
+        return false;
+    }
+    if (header->magic.load(std::memory_order_acquire) != StateExportHeader::Magic ||
+        header->version.load(std::memory_order_relaxed) != StateExportHeader::Version) {
+        error = name + " is not a particle state export of this version";
+        return false;
+    }
+    return true;
+}
+
+bool StateReader::Map(std::size_t bytes) {
+    if (bytes < sizeof(StateExportHeader))
+        return false;
+    void* mapping = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, descriptor, 0);
+    if (mapping == MAP_FAILED)
+        return false;
+    if (header)
+        munmap(const_cast<StateExportHeader*>(header), mappedBytes);
+    header = static_cast<const StateExportHeader*>(mapping);
+    mappedBytes = bytes;
+    return true;
+}
+
+std::uint64_t StateReader::Published() const {
+    return header->published.load(std::memory_order_acquire);
+}
+
+const StateExportHeader::Slot* StateReader::Begin(std::uint64_t afterFrame, StateFrame& frame, std::uint64_t& sequence) {
+    const std::uint64_t layout = header->sequence.load(std::memory_order_acquire);
+    if (layout & 1)
+        return nullptr;
+    const std::uint64_t bytes = header->segmentBytes.load(std::memory_order_relaxed);
+    if (bytes > mappedBytes) {
+        // grown since the last frame; the next call reads from the new mapping
+        struct stat info;
+        if (fstat(descriptor, &info) == 0)
+            Map(static_cast<std::size_t>(info.st_size));
+        return nullptr;
+    }
+    const std::uint64_t capacity = header->capacity.load(std::memory_order_relaxed);
+    const std::int32_t latest = header->latest.load(std::memory_order_acquire);
+    if (latest < 0 || latest >= STATE_EXPORT_SLOTS)
+        return nullptr;
+    const StateExportHeader::Slot& slot = header->slot[latest];
+    sequence = slot.sequence.load(std::memory_order_acquire);
+    if ((sequence & 1) || header->sequence.load(std::memory_order_relaxed) != layout)
+        return nullptr;
+
+    frame.frame = slot.frame.load(std::memory_order_relaxed);
+    if (frame.frame <= afterFrame)
+        return nullptr;
+    frame.step = slot.step.load(std::memory_order_relaxed);
+    // bounded by the capacity, so a torn read never leaves the mapping
+    frame.count = std::min(slot.count.load(std::memory_order_relaxed), capacity);
+    frame.width = slot.width.load(std::memory_order_relaxed);
+    frame.height = slot.height.load(std::memory_order_relaxed);
+    frame.x = SlotArrays(header, capacity, latest);
+    frame.y = frame.x + capacity;
+    frame.vx = frame.y + capacity;
+    frame.vy = frame.vx + capacity;
+    return &slot;
+}
+
+bool StateReader::End(const StateExportHeader::Slot& slot, std::uint64_t sequence) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.sequence.load(std::memory_order_relaxed) == sequence;
+}
+
+#endif
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "simulation.hpp"
+#include "BS_thread_pool.hpp" // BS::thread_pool from https://github.com/bshoshany/thread-pool
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define STATE_EXPORT_NAME "/particle-state" // Default POSIX shared memory object
+#define STATE_EXPORT_SLOTS 3                // Frames in the segment: the newest, the one before it, the one being written
+#define STATE_EXPORT_MIN_CAPACITY (std::uint64_t(1) << 20) // Particles per slot the segment starts with; it doubles as needed
+
+// Completed frames published to a POSIX shared memory object, so that external visualizers and
+// analytics can map the particle state read-only and use it in place, without copying it and without
+// ever making the simulation wait.
+//
+// The segment is a header page followed by STATE_EXPORT_SLOTS slots; each slot holds one frame as four
+// float arrays (x, y, vx, vy) of `capacity` entries. The writer fills the slot after the newest one,
+// which is never the newest nor (with three slots) the one before it, so a reader that has just picked
+// up the newest frame gets at least one more frame time before it can be overwritten. Every slot and
+// the header are guarded by a sequence lock: the writer makes the count odd before it changes them and
+// even after. A reader notes the count, reads, and accepts what it read only if the count is still the
+// same even value; otherwise it tries again on the new newest frame.
+//
+// When a frame outgrows the capacity the writer enlarges the object and moves the slots, inside the
+// header's sequence lock; readers see the new size and map again.
+struct StateExportHeader {
+    static constexpr std::uint64_t Magic = 0x3154415453505452ull; // "RTPSTAT1"
+    static constexpr std::uint32_t Version = 1;
+
+    struct Slot {
+        std::atomic<std::uint64_t> sequence;
+        std::atomic<std::uint64_t> frame; // 1-based publication number
+        std::atomic<std::uint64_t> step;  // sim.step after the frame's step
+        std::atomic<std::uint64_t> count; // particles in the frame
+        std::atomic<float> width;
+        std::atomic<float> height;
+    };
+
+    std::atomic<std::uint64_t> magic;
+    std::atomic<std::uint32_t> version;
+    std::atomic<std::uint32_t> slots;
+    std::atomic<std::uint64_t> sequence;     // header sequence lock, guards the fields below
+    std::atomic<std::uint64_t> segmentBytes; // size of the object
+    std::atomic<std::uint64_t> capacity;     // particles per slot; the arrays of slot s start at PageBytes + s * 4 * capacity floats
+    std::atomic<std::int32_t> latest;        // slot with the newest complete frame, -1 before the first
+    std::atomic<std::uint64_t> published;    // frames published so far
+    Slot slot[STATE_EXPORT_SLOTS];
+
+    static constexpr std::size_t PageBytes = 4096;
+};
+static_assert(sizeof(StateExportHeader) <= StateExportHeader::PageBytes, "the header fits its page");
+
+// The publishing side. Owns the shared memory object and removes it when destroyed.
+class StateExporter {
+public:
+    StateExporter() = default;
+    ~StateExporter();
+    StateExporter(const StateExporter&) = delete;
+    StateExporter& operator=(const StateExporter&) = delete;
+
+    // Creates (or replaces) the object `name`. Returns false and sets `error` if it cannot.
+    bool Open(const std::string& name, std::string& error);
+    bool IsOpen() const { return header != nullptr; }
+
+    // Writes sim's particles as the newest frame, transposed to the slot's arrays on the pool, and
+    // waits for it. Call between steps. Throws std::bad_alloc if the object cannot grow.
+    void Publish(const Simulation& sim, BS::thread_pool& pool);
+
+private:
+    void Grow(std::uint64_t particles);
+
+    std::string name;
+    int descriptor = -1;
+    StateExportHeader* header = nullptr;
+    std::size_t mappedBytes = 0;
+};
+
+// One frame as a reader sees it: pointers straight into the shared mapping.
+struct StateFrame {
+    std::uint64_t frame = 0; // publication number; gaps are frames the reader missed
+    std::uint64_t step = 0;
+    std::uint64_t count = 0;
+    float width = 0.0f;
+    float height = 0.0f;
+    const float* x = nullptr;
+    const float* y = nullptr;
+    const float* vx = nullptr;
+    const float* vy = nullptr;
+};
+
+// The reading side, for other processes: maps the object read-only.
+class StateReader {
+public:
+    enum class Result {
+        Read,    // `use` saw a whole, consistent frame
+        NoFrame, // nothing newer than `afterFrame` is ready (or the segment is being resized)
+        Torn     // the writer overwrote the frame while `use` ran; its results must be discarded
+    };
+
+    StateReader() = default;
+    ~StateReader();
+    StateReader(const StateReader&) = delete;
+    StateReader& operator=(const StateReader&) = delete;
+
+    bool Open(const std::string& name, std::string& error);
+
+    // Calls `use(frame)` on the newest frame if it is newer than frame `afterFrame` (0 takes any). The
+    // frame's arrays can change under `use`, which must tolerate any float values and only keep its
+    // results if this returns Result::Read.
+    template <typename F>
+    Result ReadLatest(std::uint64_t afterFrame, F&& use) {
+        StateFrame frame;
+        std::uint64_t sequence = 0;
+        const StateExportHeader::Slot* slot = Begin(afterFrame, frame, sequence);
+        if (!slot)
+            return Result::NoFrame;
+        use(static_cast<const StateFrame&>(frame));
+        return End(*slot, sequence) ? Result::Read : Result::Torn;
+    }
+
+    std::uint64_t Published() const;
+
+private:
+    const StateExportHeader::Slot* Begin(std::uint64_t afterFrame, StateFrame& frame, std::uint64_t& sequence);
+    bool End(const StateExportHeader::Slot& slot, std::uint64_t sequence) const;
+    bool Map(std::size_t bytes);
+
+    int descriptor = -1;
+    const StateExportHeader* header = nullptr;
+    std::size_t mappedBytes = 0;
+};
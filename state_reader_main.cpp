@@ -0,0 +1,134 @@
+// particle_state_reader: reference consumer of the shared-memory state export (state_export.hpp).
+// Maps the frames a simulation started with --export publishes and prints statistics computed in
+// place, once a second, to show how many frames an external process keeps up with.
+#include "state_export.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace {
+    struct FrameStats {
+        double meanX = 0.0;
+        double meanY = 0.0;
+        double meanSpeed = 0.0;
+        float maxSpeed = 0.0f;
+        float minX = 0.0f, minY = 0.0f, maxX = 0.0f, maxY = 0.0f;
+    };
+
+    // Straight over the shared arrays; nothing is copied out first.
+    FrameStats Measure(const StateFrame& frame) {
+        FrameStats stats;
+        if (frame.count == 0)
+            return stats;
+        double sumX = 0.0, sumY = 0.0, sumSpeed = 0.0;
+        float maxSpeed = 0.0f;
+        float minX = frame.x[0], maxX = frame.x[0], minY = frame.y[0], maxY = frame.y[0];
+        for (std::uint64_t i = 0; i < frame.count; ++i) {
+            const float x = frame.x[i];
+            const float y = frame.y[i];
+            const float speed = std::sqrt(frame.vx[i] * frame.vx[i] + frame.vy[i] * frame.vy[i]);
+            sumX += x;
+            sumY += y;
+            sumSpeed += speed;
+            maxSpeed = std::max(maxSpeed, speed);
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+        }
+        const double count = static_cast<double>(frame.count);
+        stats.meanX = sumX / count;
+        stats.meanY = sumY / count;
+        stats.meanSpeed = sumSpeed / count;
+        stats.maxSpeed = maxSpeed;
+        stats.minX = minX;
+        stats.maxX = maxX;
+        stats.minY = minY;
+        stats.maxY = maxY;
+        return stats;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string name = STATE_EXPORT_NAME;
+    double seconds = 10.0;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--name" && i + 1 < argc) {
+            name = argv[++i];
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            seconds = std::atof(argv[++i]);
+        } else {
+            std::cerr << "usage: particle_state_reader [--name <shm object, default " STATE_EXPORT_NAME ">] [--seconds <n, default 10>]\n";
+            return -1;
+        }
+    }
+
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+    StateReader reader;
+    std::string error;
+    // the simulation may still be starting up
+    while (!reader.Open(name, error)) {
+        if (Clock::now() - start > std::chrono::seconds(5)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    std::uint64_t lastFrame = 0;
+    std::uint64_t read = 0, missed = 0, torn = 0, bytes = 0;
+    Clock::time_point lastReport = Clock::now();
+    Clock::time_point lastNewFrame = lastReport;
+    FrameStats stats;
+    StateFrame seen;
+    std::cout << std::fixed << std::setprecision(1);
+    while (std::chrono::duration<double>(Clock::now() - start).count() < seconds) {
+        FrameStats current;
+        StateFrame frame;
+        const StateReader::Result result = reader.ReadLatest(lastFrame, [&current, &frame](const StateFrame& latest) {
+            frame = latest;
+            current = Measure(latest);
+        });
+        const Clock::time_point now = Clock::now();
+        if (result == StateReader::Result::Read) {
+            if (lastFrame > 0)
+                missed += frame.frame - lastFrame - 1;
+            lastFrame = frame.frame;
+            ++read;
+            bytes += frame.count * 4 * sizeof(float);
+            stats = current;
+            seen = frame;
+            lastNewFrame = now;
+        } else if (result == StateReader::Result::Torn) {
+            ++torn;
+        } else {
+            if (now - lastNewFrame > std::chrono::seconds(2) && lastFrame > 0) {
+                std::cout << "no new frames for 2 s, the simulation has stopped\n";
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+
+        const double elapsed = std::chrono::duration<double>(now - lastReport).count();
+        if (elapsed >= 1.0) {
+            std::cout << "frames " << read << " (missed " << missed << ", torn " << torn << ")"
+                      << "  step " << seen.step << "  particles " << seen.count
+                      << "  mean (" << stats.meanX << ", " << stats.meanY << ")"
+                      << "  speed mean " << stats.meanSpeed << " max " << stats.maxSpeed
+                      << "  box (" << stats.minX << ", " << stats.minY << ")-(" << stats.maxX << ", " << stats.maxY << ")"
+                      << "  " << static_cast<double>(bytes) / elapsed / 1e9 << " GB/s in place\n"
+                      << std::flush;
+            read = missed = torn = bytes = 0;
+            lastReport = now;
+        }
+    }
+    return 0;
+}
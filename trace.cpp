@@ -0,0 +1,148 @@
+#include "trace.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+std::atomic<bool> traceEnabled{false};
+
+namespace {
+    enum class Phase : char { Begin = 'B', End = 'E', Complete = 'X' };
+
+    struct TraceEvent {
+        const char* name;
+        std::int64_t startNs;
+        std::int64_t durationNs;
+        std::int64_t index;
+        Phase phase;
+    };
+
+    // One per thread that ever recorded an event. Owned by the registry so events survive the thread;
+    // the mutex is only contended while TraceShutdown() is writing.
+    struct ThreadBuffer {
+        std::mutex mutex;
+        std::vector<TraceEvent> events;
+        const char* name = nullptr;
+        int nameIndex = -1;
+        int tid = 0;
+    };
+
+    // Stop recording a thread after this many events (40 MB each) rather than exhausting memory.
+    constexpr std::size_t MaxEventsPerThread = 1u << 20;
+
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> registry;
+    std::string tracePath;
+    const std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+
+    ThreadBuffer& LocalBuffer() {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::scoped_lock lock(registryMutex);
+            registry.push_back(std::make_unique<ThreadBuffer>());
+            buffer = registry.back().get();
+            buffer->tid = static_cast<int>(registry.size());
+            buffer->events.reserve(4096);
+        }
+        return *buffer;
+    }
+
+    void Record(const TraceEvent& event) {
+        ThreadBuffer& buffer = LocalBuffer();
+        std::scoped_lock lock(buffer.mutex);
+        if (buffer.events.size() < MaxEventsPerThread)
+            buffer.events.push_back(event);
+    }
+
+    void WriteEscaped(std::ostream& out, const char* text) {
+        for (; *text; ++text) {
+            if (*text == '"' || *text == '\\')
+                out << '\\';
+            out << *text;
+        }
+    }
+}
+
+std::int64_t TraceNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceEpoch).count();
+}
+
+void TraceInitFromEnvironment() {
+    const char* path = std::getenv("PARTICLE_TRACE");
+    if (!path || !*path)
+        return;
+    tracePath = path;
+    traceEnabled.store(true, std::memory_order_relaxed);
+    std::atexit(TraceShutdown);
+}
+
+void TraceSetThreadName(const char* name, int index) {
+    ThreadBuffer& buffer = LocalBuffer();
+    std::scoped_lock lock(buffer.mutex);
+    buffer.name = name;
+    buffer.nameIndex = index;
+}
+
+void TraceBegin(const char* name) {
+    Record({ name, TraceNowNs(), 0, -1, Phase::Begin });
+}
+
+void TraceEnd() {
+    Record({ nullptr, TraceNowNs(), 0, -1, Phase::End });
+}
+
+void TraceComplete(const char* name, std::int64_t startNs, std::int64_t endNs, std::int64_t index) {
+    Record({ name, startNs, endNs - startNs, index, Phase::Complete });
+}
+
+void TraceShutdown() {
+    if (!traceEnabled.exchange(false))
+        return;
+
+    std::ofstream out(tracePath);
+    if (!out) {
+        std::cerr << "cannot write trace to " << tracePath << std::endl;
+        return;
+    }
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto separator = [&] { out << (first ? "" : ",\n"); first = false; };
+
+    std::scoped_lock registryLock(registryMutex);
+    for (const std::unique_ptr<ThreadBuffer>& buffer : registry) {
+        std::scoped_lock lock(buffer->mutex);
+        if (buffer->name) {
+            separator();
+            out << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid << ",\"name\":\"thread_name\",\"args\":{\"name\":\"";
+            WriteEscaped(out, buffer->name);
+            if (buffer->nameIndex >= 0)
+                out << " " << buffer->nameIndex;
+            out << "\"}}";
+        }
+        for (const TraceEvent& event : buffer->events) {
+            separator();
+            // ts and dur are in microseconds
+            out << "{\"ph\":\"" << static_cast<char>(event.phase) << "\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"ts\":" << event.startNs / 1000.0;
+            if (event.phase == Phase::Complete)
+                out << ",\"dur\":" << event.durationNs / 1000.0;
+            if (event.name) {
+                out << ",\"name\":\"";
+                WriteEscaped(out, event.name);
+                out << "\"";
+            }
+            if (event.index >= 0)
+                out << ",\"args\":{\"index\":" << event.index << "}";
+            out << "}";
+        }
+        buffer->events.clear();
+    }
+    out << "\n]}\n";
+    std::cout << "trace written to " << tracePath << std::endl;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Timeline export in the Chrome trace-event JSON format, which Perfetto (ui.perfetto.dev) and
+// chrome://tracing open directly. Set PARTICLE_TRACE=<file> and call TraceInitFromEnvironment() at
+// startup; events are buffered per thread and written by TraceShutdown(). When tracing is off every
+// macro below costs one relaxed load and a branch that is never taken. Define PARTICLE_NO_TRACE to
+// compile them out entirely.
+//
+// Names must be string literals (or otherwise outlive the trace): only the pointer is stored.
+
+extern std::atomic<bool> traceEnabled;
+
+void TraceInitFromEnvironment();
+void TraceShutdown();
+
+void TraceSetThreadName(const char* name, int index = -1);
+void TraceBegin(const char* name);
+void TraceEnd();
+void TraceComplete(const char* name, std::int64_t startNs, std::int64_t endNs, std::int64_t index);
+std::int64_t TraceNowNs();
+
+// A complete ("X") event spanning the lifetime of the object.
+class TraceScope {
+public:
+    explicit TraceScope(const char* name, std::int64_t index = -1)
+        : name(traceEnabled.load(std::memory_order_relaxed) ? name : nullptr), index(index), start(this->name ? TraceNowNs() : 0) {}
+    ~TraceScope() {
+        if (name)
+            TraceComplete(name, start, TraceNowNs(), index);
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    std::int64_t index;
+    std::int64_t start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifndef PARTICLE_NO_TRACE
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_SCOPE_INDEX(name, index) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, index)
+#define TRACE_BEGIN(name) do { if (traceEnabled.load(std::memory_order_relaxed)) TraceBegin(name); } while (0)
+#define TRACE_END() do { if (traceEnabled.load(std::memory_order_relaxed)) TraceEnd(); } while (0)
+#define TRACE_THREAD_NAME(name, index) do { if (traceEnabled.load(std::memory_order_relaxed)) TraceSetThreadName(name, index); } while (0)
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_SCOPE_INDEX(name, index) ((void)0)
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END() ((void)0)
+#define TRACE_THREAD_NAME(name, index) ((void)0)
+#endif
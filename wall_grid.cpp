@@ -0,0 +1,72 @@
+#include "wall_grid.hpp"
+
+#include <algorithm>
+
+namespace {
+    constexpr int GridCells = WALL_GRID_CELLS;
+    constexpr int SummedStride = WALL_GRID_CELLS + 1;
+    constexpr int ExactQueryCells = 16; // queries covering at most this many cells check the boxes themselves
+}
+
+WallGrid::WallGrid(const std::vector<Walls>& walls, const WorldBounds& world)
+    : cellWidth(world.width / GridCells), cellHeight(world.height / GridCells), cellStart(GridCells * GridCells + 1, 0),
+      summed(SummedStride * SummedStride, 0) {
+    boxes.reserve(walls.size());
+    for (const Walls& w : walls)
+        boxes.push_back({ Vec2(std::min(w.p1.x, w.p2.x), std::min(w.p1.y, w.p2.y)), Vec2(std::max(w.p1.x, w.p2.x), std::max(w.p1.y, w.p2.y)) });
+
+    // counting pass, then fill: cellWalls lists the walls of cell c at [cellStart[c], cellStart[c + 1])
+    for (const Box& box : boxes) {
+        const CellRange range = Cells(box.min, box.max);
+        for (int y = range.y0; y <= range.y1; ++y)
+            for (int x = range.x0; x <= range.x1; ++x)
+                ++cellStart[y * GridCells + x + 1];
+    }
+    for (int c = 0; c < GridCells * GridCells; ++c)
+        cellStart[c + 1] += cellStart[c];
+    cellWalls.resize(cellStart.back());
+    std::vector<std::uint32_t> fill(cellStart.begin(), cellStart.end() - 1);
+    for (std::size_t w = 0; w < boxes.size(); ++w) {
+        const CellRange range = Cells(boxes[w].min, boxes[w].max);
+        for (int y = range.y0; y <= range.y1; ++y)
+            for (int x = range.x0; x <= range.x1; ++x)
+                cellWalls[fill[y * GridCells + x]++] = static_cast<std::uint32_t>(w);
+    }
+
+    for (int y = 0; y < GridCells; ++y)
+        for (int x = 0; x < GridCells; ++x) {
+            const int c = y * GridCells + x;
+            summed[(y + 1) * SummedStride + x + 1] = cellStart[c + 1] - cellStart[c] + summed[y * SummedStride + x + 1] +
+                                                     summed[(y + 1) * SummedStride + x] - summed[y * SummedStride + x];
+        }
+}
+
+WallGrid::CellRange WallGrid::Cells(Vec2 min, Vec2 max) const {
+    auto cell = [](float value, float size) { return std::clamp(static_cast<int>(value / size), 0, GridCells - 1); };
+    return { cell(min.x, cellWidth), cell(min.y, cellHeight), cell(max.x, cellWidth), cell(max.y, cellHeight) };
+}
+
+std::uint32_t WallGrid::CountIn(const CellRange& range) const {
+    return summed[(range.y1 + 1) * SummedStride + range.x1 + 1] - summed[range.y0 * SummedStride + range.x1 + 1] -
+           summed[(range.y1 + 1) * SummedStride + range.x0] + summed[range.y0 * SummedStride + range.x0];
+}
+
+bool WallGrid::AnyWallNear(Vec2 min, Vec2 max) const {
+    if (boxes.empty())
+        return false;
+    const CellRange range = Cells(min, max);
+    if (CountIn(range) == 0)
+        return false;
+    if ((range.x1 - range.x0 + 1) * (range.y1 - range.y0 + 1) > ExactQueryCells)
+        return true;
+    for (int y = range.y0; y <= range.y1; ++y)
+        for (int x = range.x0; x <= range.x1; ++x) {
+            const int c = y * GridCells + x;
+            for (std::uint32_t i = cellStart[c]; i < cellStart[c + 1]; ++i) {
+                const Box& box = boxes[cellWalls[i]];
+                if (box.min.x <= max.x && box.max.x >= min.x && box.min.y <= max.y && box.max.y >= min.y)
+                    return true;
+            }
+        }
+    return false;
+}
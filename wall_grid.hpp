@@ -0,0 +1,41 @@
+#pragma once
+
+#include "simulation.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#define WALL_GRID_CELLS 64 // The world is split into this many x this many cells for wall lookups
+
+// Which walls are near a region: every wall's bounding box is entered in the cells of a uniform grid
+// over the world, and a summed-area table over the per-cell counts answers "is any wall in this
+// rectangle of cells" in constant time however large the rectangle is. Walls reaching outside the
+// world count in the border cells. Build it again when the walls or bounds change.
+class WallGrid {
+public:
+    WallGrid(const std::vector<Walls>& walls, const WorldBounds& world);
+
+    bool Empty() const { return boxes.empty(); }
+    // Whether a wall may touch the box [min, max]. Conservative: false only if no wall's bounding box
+    // overlaps it, and only compared box by box when the query covers a few cells.
+    bool AnyWallNear(Vec2 min, Vec2 max) const;
+
+private:
+    struct Box {
+        Vec2 min;
+        Vec2 max;
+    };
+    struct CellRange {
+        int x0, y0, x1, y1; // inclusive
+    };
+
+    CellRange Cells(Vec2 min, Vec2 max) const;
+    std::uint32_t CountIn(const CellRange& range) const;
+
+    float cellWidth;
+    float cellHeight;
+    std::vector<Box> boxes;
+    std::vector<std::uint32_t> cellStart; // WALL_GRID_CELLS^2 + 1 offsets into cellWalls
+    std::vector<std::uint32_t> cellWalls;
+    std::vector<std::uint32_t> summed;    // (WALL_GRID_CELLS + 1)^2 summed-area table of per-cell wall counts
+};
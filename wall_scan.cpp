@@ -0,0 +1,266 @@
+#include "wall_scan.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+// compiled for AVX2 / AVX-512 regardless of -march; only called after checking the CPU
+#define WALL_SCAN_AVX2 1
+#define WALL_SCAN_AVX2_TARGET __attribute__((target("avx2")))
+#define WALL_SCAN_AVX512 1
+#define WALL_SCAN_AVX512_TARGET __attribute__((target("avx512f")))
+#else
+#if defined(__AVX2__)
+#define WALL_SCAN_AVX2 1
+#define WALL_SCAN_AVX2_TARGET
+#endif
+#if defined(__AVX512F__)
+#define WALL_SCAN_AVX512 1
+#define WALL_SCAN_AVX512_TARGET
+#endif
+#endif
+#endif
+
+namespace {
+    constexpr std::size_t Padding = 16; // one vector of the widest kernel, so a scan may load past `last`
+
+    // doIntersect() on the table's wall `w`, step by step.
+    bool PathHitsWall(const WallTable& table, const WallScanPath& path, std::size_t w) {
+        const float slope1 = path.slope;
+        const float slope2 = table.slope[w];
+        if (std::isinf(slope1) && std::isinf(slope2))
+            return false;
+        const float b1 = path.intercept;
+        const float b2 = table.intercept[w];
+        float intersectionX;
+        float intersectionY;
+        if (std::isinf(slope1)) {
+            intersectionX = path.from.x;
+            intersectionY = slope2 * intersectionX + b2;
+        } else if (std::isinf(slope2)) {
+            intersectionX = table.x1[w];
+            intersectionY = slope1 * intersectionX + b1;
+        } else {
+            intersectionX = (b2 - b1) / (slope1 - slope2);
+            intersectionY = slope1 * intersectionX + b1;
+        }
+        return !std::isnan(intersectionX) && !std::isnan(intersectionY) &&
+               intersectionX >= path.minX && intersectionX <= path.maxX && intersectionY >= path.minY && intersectionY <= path.maxY &&
+               intersectionX >= table.minX[w] && intersectionX <= table.maxX[w] && intersectionY >= table.minY[w] && intersectionY <= table.maxY[w];
+    }
+
+    std::size_t FirstWallHitScalar(const WallTable& table, const WallScanPath& path, std::size_t first, std::size_t last) {
+        for (std::size_t w = first; w < last; ++w) {
+            if (PathHitsWall(table, path, w))
+                return w;
+        }
+        return last;
+    }
+
+#ifdef WALL_SCAN_AVX2
+    // PathHitsWall on 8 walls per iteration. Both branches of the path's slope are uniform across the
+    // lanes; the wall's is a blend. Ordered comparisons are false on NaN, which covers the isnan tests.
+    WALL_SCAN_AVX2_TARGET
+    std::size_t FirstWallHitAvx2(const WallTable& table, const WallScanPath& path, std::size_t first, std::size_t last) {
+        const __m256 magnitude = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        const __m256 infinity = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+        const bool pathVertical = std::isinf(path.slope);
+        const __m256 slope1 = _mm256_set1_ps(path.slope);
+        const __m256 b1 = _mm256_set1_ps(path.intercept);
+        const __m256 fromX = _mm256_set1_ps(path.from.x);
+        const __m256 pathMinX = _mm256_set1_ps(path.minX);
+        const __m256 pathMaxX = _mm256_set1_ps(path.maxX);
+        const __m256 pathMinY = _mm256_set1_ps(path.minY);
+        const __m256 pathMaxY = _mm256_set1_ps(path.maxY);
+        for (std::size_t w = first; w < last; w += 8) {
+            const __m256 slope2 = _mm256_loadu_ps(table.slope + w);
+            const __m256 b2 = _mm256_loadu_ps(table.intercept + w);
+            const __m256 wallVertical = _mm256_cmp_ps(_mm256_and_ps(slope2, magnitude), infinity, _CMP_EQ_OQ);
+            __m256 x;
+            __m256 y;
+            __m256 hit;
+            if (pathVertical) {
+                x = fromX;
+                y = _mm256_add_ps(_mm256_mul_ps(slope2, x), b2);
+                hit = _mm256_cmp_ps(_mm256_and_ps(slope2, magnitude), infinity, _CMP_NEQ_UQ);
+            } else {
+                const __m256 crossing = _mm256_div_ps(_mm256_sub_ps(b2, b1), _mm256_sub_ps(slope1, slope2));
+                x = _mm256_blendv_ps(crossing, _mm256_loadu_ps(table.x1 + w), wallVertical);
+                y = _mm256_add_ps(_mm256_mul_ps(slope1, x), b1);
+                hit = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            }
+            hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(x, pathMinX, _CMP_GE_OQ), _mm256_cmp_ps(x, pathMaxX, _CMP_LE_OQ)));
+            hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(y, pathMinY, _CMP_GE_OQ), _mm256_cmp_ps(y, pathMaxY, _CMP_LE_OQ)));
+            hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(x, _mm256_loadu_ps(table.minX + w), _CMP_GE_OQ),
+                                                   _mm256_cmp_ps(x, _mm256_loadu_ps(table.maxX + w), _CMP_LE_OQ)));
+            hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(y, _mm256_loadu_ps(table.minY + w), _CMP_GE_OQ),
+                                                   _mm256_cmp_ps(y, _mm256_loadu_ps(table.maxY + w), _CMP_LE_OQ)));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(hit));
+            if (last - w < 8)
+                mask &= (1u << (last - w)) - 1;
+            if (mask)
+                return w + static_cast<std::size_t>(std::countr_zero(mask));
+        }
+        return last;
+    }
+#endif
+
+#ifdef WALL_SCAN_AVX512
+    // The same on 16 walls per iteration, with mask registers.
+    WALL_SCAN_AVX512_TARGET
+    std::size_t FirstWallHitAvx512(const WallTable& table, const WallScanPath& path, std::size_t first, std::size_t last) {
+        const __m512 infinity = _mm512_set1_ps(std::numeric_limits<float>::infinity());
+        const bool pathVertical = std::isinf(path.slope);
+        const __m512 slope1 = _mm512_set1_ps(path.slope);
+        const __m512 b1 = _mm512_set1_ps(path.intercept);
+        const __m512 fromX = _mm512_set1_ps(path.from.x);
+        const __m512 pathMinX = _mm512_set1_ps(path.minX);
+        const __m512 pathMaxX = _mm512_set1_ps(path.maxX);
+        const __m512 pathMinY = _mm512_set1_ps(path.minY);
+        const __m512 pathMaxY = _mm512_set1_ps(path.maxY);
+        for (std::size_t w = first; w < last; w += 16) {
+            const __m512 slope2 = _mm512_loadu_ps(table.slope + w);
+            const __m512 b2 = _mm512_loadu_ps(table.intercept + w);
+            const __mmask16 wallVertical = _mm512_cmp_ps_mask(_mm512_abs_ps(slope2), infinity, _CMP_EQ_OQ);
+            __m512 x;
+            __m512 y;
+            __mmask16 hit;
+            if (pathVertical) {
+                x = fromX;
+                y = _mm512_add_ps(_mm512_mul_ps(slope2, x), b2);
+                hit = static_cast<__mmask16>(~wallVertical);
+            } else {
+                const __m512 crossing = _mm512_div_ps(_mm512_sub_ps(b2, b1), _mm512_sub_ps(slope1, slope2));
+                x = _mm512_mask_blend_ps(wallVertical, crossing, _mm512_loadu_ps(table.x1 + w));
+                y = _mm512_add_ps(_mm512_mul_ps(slope1, x), b1);
+                hit = 0xffff;
+            }
+            hit = _mm512_mask_cmp_ps_mask(hit, x, pathMinX, _CMP_GE_OQ);
+            hit = _mm512_mask_cmp_ps_mask(hit, x, pathMaxX, _CMP_LE_OQ);
+            hit = _mm512_mask_cmp_ps_mask(hit, y, pathMinY, _CMP_GE_OQ);
+            hit = _mm512_mask_cmp_ps_mask(hit, y, pathMaxY, _CMP_LE_OQ);
+            hit = _mm512_mask_cmp_ps_mask(hit, x, _mm512_loadu_ps(table.minX + w), _CMP_GE_OQ);
+            hit = _mm512_mask_cmp_ps_mask(hit, x, _mm512_loadu_ps(table.maxX + w), _CMP_LE_OQ);
+            hit = _mm512_mask_cmp_ps_mask(hit, y, _mm512_loadu_ps(table.minY + w), _CMP_GE_OQ);
+            hit = _mm512_mask_cmp_ps_mask(hit, y, _mm512_loadu_ps(table.maxY + w), _CMP_LE_OQ);
+            unsigned mask = hit;
+            if (last - w < 16)
+                mask &= (1u << (last - w)) - 1;
+            if (mask)
+                return w + static_cast<std::size_t>(std::countr_zero(mask));
+        }
+        return last;
+    }
+#endif
+}
+
+void ResizeWallTable(WallTable& table, std::size_t count) {
+    const std::size_t length = count + Padding;
+    table.storage.resize(7 * length);
+    float* next = table.storage.data();
+    auto array = [&next, length, count](float fill) {
+        float* values = next;
+        next += length;
+        std::fill(values + count, values + length, fill);
+        return values;
+    };
+    // an empty box: nothing lies in it
+    const float infinity = std::numeric_limits<float>::infinity();
+    table.slope = array(0.0f);
+    table.intercept = array(0.0f);
+    table.x1 = array(0.0f);
+    table.minX = array(infinity);
+    table.maxX = array(-infinity);
+    table.minY = array(infinity);
+    table.maxY = array(-infinity);
+    table.count = count;
+}
+
+void FillWallTable(WallTable& table, const Walls* walls, std::size_t first, std::size_t last) {
+    const float infinity = std::numeric_limits<float>::infinity();
+    float* slope = table.slope;
+    float* intercept = table.intercept;
+    float* x1 = table.x1;
+    float* minX = table.minX;
+    float* maxX = table.maxX;
+    float* minY = table.minY;
+    float* maxY = table.maxY;
+    for (std::size_t w = first; w < last; ++w) {
+        const Vec2 p2 = walls[w].p1;
+        const Vec2 q2 = walls[w].p2;
+        // calculateSlope(), without a branch so the loop vectorizes
+        const float run = q2.x - p2.x;
+        const float quotient = (q2.y - p2.y) / run;
+        const float slope2 = run == 0.0f ? infinity : quotient;
+        slope[w] = slope2;
+        intercept[w] = p2.y - slope2 * p2.x;
+        x1[w] = p2.x;
+        minX[w] = std::min(p2.x, q2.x);
+        maxX[w] = std::max(p2.x, q2.x);
+        minY[w] = std::min(p2.y, q2.y);
+        maxY[w] = std::max(p2.y, q2.y);
+    }
+}
+
+WallScanPath MakeWallScanPath(Vec2 position, Vec2 nextPosition) {
+    WallScanPath path;
+    path.from = position;
+    path.slope = calculateSlope(position, nextPosition);
+    path.intercept = position.y - path.slope * position.x;
+    path.minX = std::min(position.x, nextPosition.x);
+    path.maxX = std::max(position.x, nextPosition.x);
+    path.minY = std::min(position.y, nextPosition.y);
+    path.maxY = std::max(position.y, nextPosition.y);
+    return path;
+}
+
+WallScanKernel BestWallScanKernel() {
+#if defined(__GNUC__) || defined(__clang__)
+#ifdef WALL_SCAN_AVX512
+    static const bool avx512 = __builtin_cpu_supports("avx512f");
+    if (avx512)
+        return WallScanKernel::Avx512;
+#endif
+#ifdef WALL_SCAN_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2)
+        return WallScanKernel::Avx2;
+#endif
+    return WallScanKernel::Scalar;
+#elif defined(WALL_SCAN_AVX512)
+    return WallScanKernel::Avx512;
+#elif defined(WALL_SCAN_AVX2)
+    return WallScanKernel::Avx2;
+#else
+    return WallScanKernel::Scalar;
+#endif
+}
+
+const char* WallScanKernelName(WallScanKernel kernel) {
+    switch (kernel) {
+        case WallScanKernel::Scalar: return "scalar";
+        case WallScanKernel::Avx2: return "avx2";
+        case WallScanKernel::Avx512: return "avx512";
+    }
+    return "?";
+}
+
+std::size_t FirstWallHit(const WallTable& table, const WallScanPath& path, std::size_t first, std::size_t last, WallScanKernel kernel) {
+    switch (kernel) {
+#ifdef WALL_SCAN_AVX512
+        case WallScanKernel::Avx512:
+            return FirstWallHitAvx512(table, path, first, last);
+#endif
+#ifdef WALL_SCAN_AVX2
+        case WallScanKernel::Avx2:
+            return FirstWallHitAvx2(table, path, first, last);
+#endif
+        default:
+            return FirstWallHitScalar(table, path, first, last);
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "simulation.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// The walls as a structure of arrays, for testing one particle's path against 8 or 16 walls at once.
+// Per wall it keeps everything doIntersect() derives from the wall alone (slope, intercept, bounding
+// box), so a scan only does the path-dependent half, with the same operations in the same order: it
+// reports exactly the walls doIntersect() would, and a step built on it stays bitwise-identical to the
+// plain wall loop. wall_scan.cpp is compiled without FMA contraction to keep it that way.
+struct WallTable {
+    float* slope = nullptr;
+    float* intercept = nullptr;
+    float* x1 = nullptr; // p1.x, where a vertical wall is met
+    float* minX = nullptr;
+    float* maxX = nullptr;
+    float* minY = nullptr;
+    float* maxY = nullptr;
+    std::size_t count = 0; // walls; the arrays run on for a vector width of padding that never intersects
+
+    WallTable() = default;
+    // the arrays point into `storage`
+    WallTable(const WallTable&) = delete;
+    WallTable& operator=(const WallTable&) = delete;
+
+private:
+    friend void ResizeWallTable(WallTable& table, std::size_t count);
+    std::vector<float> storage;
+};
+
+// Sizes the arrays for `count` walls and fills the padding; the walls are filled by FillWallTable().
+void ResizeWallTable(WallTable& table, std::size_t count);
+// Fills walls [first, last) of the table; disjoint ranges can be filled on different threads.
+void FillWallTable(WallTable& table, const Walls* walls, std::size_t first, std::size_t last);
+
+// A particle's path for one step, position -> nextPosition, with what doIntersect() derives from it.
+struct WallScanPath {
+    Vec2 from;
+    float slope = 0.0f;
+    float intercept = 0.0f;
+    float minX = 0.0f;
+    float maxX = 0.0f;
+    float minY = 0.0f;
+    float maxY = 0.0f;
+};
+
+WallScanPath MakeWallScanPath(Vec2 position, Vec2 nextPosition);
+
+enum class WallScanKernel {
+    Scalar,
+    Avx2,  // 8 walls per iteration
+    Avx512 // 16 walls per iteration
+};
+
+// The widest kernel the CPU runs.
+WallScanKernel BestWallScanKernel();
+const char* WallScanKernelName(WallScanKernel kernel);
+
+// The first wall w in [first, last) for which doIntersect(position, nextPosition, p1, p2) holds, or
+// `last` if there is none.
+std::size_t FirstWallHit(const WallTable& table, const WallScanPath& path, std::size_t first, std::size_t last, WallScanKernel kernel);